@@ -0,0 +1,125 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A bump allocator. Allocating is a pointer increment; nothing is freed individually, instead
+// everything allocated from the arena goes at once, in Reset or when the arena is destroyed. Only
+// use it for types that don't need their destructors run.
+// Blocks grow geometrically, and Reset keeps the largest one, so an arena which is reset between
+// uses settles at a single block and stops touching the heap altogether.
+class Arena
+{
+public:
+    explicit Arena(size_t _initialBlockSize = 16 * 1024)
+    : mCursor(NULL)
+    , mLimit(NULL)
+    , mNextBlockSize(_initialBlockSize)
+    , mBytesAllocated(0)
+    { }
+
+    ~Arena()
+    {
+        for (size_t i = 0; i < mBlocks.size(); ++i) {
+            free(mBlocks[i].mMemory);
+        }
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // _alignment must be a power of two.
+    void* Allocate(size_t _size, size_t _alignment = sizeof(void*))
+    {
+        assert((_alignment & (_alignment - 1)) == 0);
+
+        uintptr_t aligned = (uintptr_t(mCursor) + _alignment - 1) & ~uintptr_t(_alignment - 1);
+        if (mCursor == NULL || aligned + _size > uintptr_t(mLimit)) {
+            AddBlock(_size + _alignment);
+            aligned = (uintptr_t(mCursor) + _alignment - 1) & ~uintptr_t(_alignment - 1);
+        }
+
+        mCursor = (char*) (aligned + _size);
+        mBytesAllocated += _size;
+        return (void*) aligned;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Uninitialized storage for _count T's.
+    template <typename T>
+    T* AllocateArray(size_t _count)
+    {
+        return (T*) Allocate(sizeof(T) * _count, alignof(T));
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Frees everything. The largest block is kept for reuse.
+    void Reset()
+    {
+        if (mBlocks.empty()) {
+            return;
+        }
+
+        size_t largest = 0;
+        for (size_t i = 1; i < mBlocks.size(); ++i) {
+            if (mBlocks[i].mSize > mBlocks[largest].mSize) {
+                largest = i;
+            }
+        }
+
+        for (size_t i = 0; i < mBlocks.size(); ++i) {
+            if (i != largest) {
+                free(mBlocks[i].mMemory);
+            }
+        }
+
+        mBlocks[0] = mBlocks[largest];
+        mBlocks.resize(1);
+        mCursor = mBlocks[0].mMemory;
+        mLimit = mBlocks[0].mMemory + mBlocks[0].mSize;
+        mBytesAllocated = 0;
+    }
+
+    // Bytes handed out since construction or the last Reset.
+    size_t GetBytesAllocated() const { return mBytesAllocated; }
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    // --------------------------------------------------------------------------------------------
+    void AddBlock(size_t _minSize)
+    {
+        size_t blockSize = mNextBlockSize;
+        while (blockSize < _minSize) {
+            blockSize *= 2;
+        }
+        mNextBlockSize = blockSize * 2;
+
+        Block block;
+        block.mMemory = (char*) malloc(blockSize);
+        block.mSize = blockSize;
+        assert(block.mMemory);
+        mBlocks.push_back(block);
+
+        mCursor = block.mMemory;
+        mLimit = block.mMemory + blockSize;
+    }
+
+    struct Block
+    {
+        char* mMemory;
+        size_t mSize;
+    };
+
+    std::vector<Block> mBlocks;
+    char* mCursor;
+    char* mLimit;
+    size_t mNextBlockSize;
+    size_t mBytesAllocated;
+};
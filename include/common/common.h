@@ -10,6 +10,8 @@ enum GLCCError
     GLCCError_MissingRequiredParameter,
     GLCCError_FileNotFound,
     GLCCError_InvalidSyntax,
-    GLCCError_NotImplemented
+    GLCCError_NotImplemented,
+    GLCCError_InvalidOperation,
+    GLCCError_ErrorDirective
 };
 
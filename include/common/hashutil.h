@@ -0,0 +1,398 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// FNV-1a. Very cheap for the short strings (identifiers, keywords) we hash on the lexing path.
+inline uint64_t HashBytes64(const char* _data, size_t _length, uint64_t _seed = 0)
+{
+    uint64_t hash = 14695981039346656037ULL ^ _seed;
+    for (size_t i = 0; i < _length; ++i) {
+        hash ^= (unsigned char)_data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A 128-bit digest, for content addressing. Not cryptographic.
+struct Hash128
+{
+    uint64_t mLow;
+    uint64_t mHigh;
+
+    bool operator==(const Hash128& _rhs) const { return mLow == _rhs.mLow && mHigh == _rhs.mHigh; }
+    bool operator!=(const Hash128& _rhs) const { return !(*this == _rhs); }
+};
+
+// ------------------------------------------------------------------------------------------------
+// xxHash64, fed incrementally. Four independent lanes over 32-byte stripes, so long inputs hash
+// at close to memory speed--unlike HashBytes64, which is a byte at a time and only meant for
+// short strings. The output is the same as the reference implementation's for the same seed.
+class StreamHash64
+{
+public:
+    explicit StreamHash64(uint64_t _seed = 0)
+    : mTotalLength(0)
+    , mBufferedLength(0)
+    , mSeed(_seed)
+    {
+        mLanes[0] = _seed + kPrime1 + kPrime2;
+        mLanes[1] = _seed + kPrime2;
+        mLanes[2] = _seed;
+        mLanes[3] = _seed - kPrime1;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    void Update(const void* _data, size_t _length)
+    {
+        const unsigned char* data = (const unsigned char*) _data;
+        const unsigned char* end = data + _length;
+        mTotalLength += _length;
+
+        // Top up a partial stripe first.
+        if (mBufferedLength > 0) {
+            size_t take = 32 - mBufferedLength;
+            if (take > _length) {
+                take = _length;
+            }
+            memcpy(mBuffer + mBufferedLength, data, take);
+            mBufferedLength += take;
+            data += take;
+            if (mBufferedLength < 32) {
+                return;
+            }
+            Stripe(mBuffer);
+            mBufferedLength = 0;
+        }
+
+        for (; end - data >= 32; data += 32) {
+            Stripe(data);
+        }
+
+        memcpy(mBuffer, data, end - data);
+        mBufferedLength = size_t(end - data);
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Hashes the bytes of a value. Only for plain integers; the result depends on byte order.
+    template <typename T>
+    void UpdateValue(const T& _value) { Update(&_value, sizeof(_value)); }
+
+    // --------------------------------------------------------------------------------------------
+    // Doesn't change the state, more can be fed after.
+    uint64_t Finish() const
+    {
+        uint64_t hash;
+        if (mTotalLength >= 32) {
+            hash = Rotl(mLanes[0], 1) + Rotl(mLanes[1], 7) + Rotl(mLanes[2], 12) + Rotl(mLanes[3], 18);
+            for (int i = 0; i < 4; ++i) {
+                hash ^= Round(0, mLanes[i]);
+                hash = hash * kPrime1 + kPrime4;
+            }
+        } else {
+            hash = mSeed + kPrime5;
+        }
+        hash += mTotalLength;
+
+        const unsigned char* data = mBuffer;
+        const unsigned char* end = mBuffer + mBufferedLength;
+        for (; end - data >= 8; data += 8) {
+            hash ^= Round(0, Read64(data));
+            hash = Rotl(hash, 27) * kPrime1 + kPrime4;
+        }
+        if (end - data >= 4) {
+            hash ^= uint64_t(Read32(data)) * kPrime1;
+            hash = Rotl(hash, 23) * kPrime2 + kPrime3;
+            data += 4;
+        }
+        for (; data < end; ++data) {
+            hash ^= (*data) * kPrime5;
+            hash = Rotl(hash, 11) * kPrime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static const uint64_t kPrime1 = 11400714785074694791ULL;
+    static const uint64_t kPrime2 = 14029467366897019727ULL;
+    static const uint64_t kPrime3 = 1609587929392839161ULL;
+    static const uint64_t kPrime4 = 9650029242287828579ULL;
+    static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+    static uint64_t Rotl(uint64_t _value, int _bits) { return (_value << _bits) | (_value >> (64 - _bits)); }
+    static uint64_t Round(uint64_t _lane, uint64_t _input) { return Rotl(_lane + _input * kPrime2, 31) * kPrime1; }
+
+    // Little endian, like the reference. memcpy so unaligned reads are fine everywhere.
+    static uint64_t Read64(const unsigned char* _data)
+    {
+        uint64_t value;
+        memcpy(&value, _data, sizeof(value));
+        return value;
+    }
+    static uint32_t Read32(const unsigned char* _data)
+    {
+        uint32_t value;
+        memcpy(&value, _data, sizeof(value));
+        return value;
+    }
+
+    void Stripe(const unsigned char* _data)
+    {
+        mLanes[0] = Round(mLanes[0], Read64(_data + 0));
+        mLanes[1] = Round(mLanes[1], Read64(_data + 8));
+        mLanes[2] = Round(mLanes[2], Read64(_data + 16));
+        mLanes[3] = Round(mLanes[3], Read64(_data + 24));
+    }
+
+    uint64_t mLanes[4];
+    uint64_t mTotalLength;
+    unsigned char mBuffer[32];
+    size_t mBufferedLength;
+    uint64_t mSeed;
+};
+
+// ------------------------------------------------------------------------------------------------
+// Two differently seeded StreamHash64s side by side, for a Hash128.
+class StreamHash128
+{
+public:
+    StreamHash128()
+    : mLow(0)
+    , mHigh(0x9E3779B97F4A7C15ULL)
+    { }
+
+    void Update(const void* _data, size_t _length)
+    {
+        mLow.Update(_data, _length);
+        mHigh.Update(_data, _length);
+    }
+
+    template <typename T>
+    void UpdateValue(const T& _value) { Update(&_value, sizeof(_value)); }
+
+    Hash128 Finish() const
+    {
+        Hash128 hash;
+        hash.mLow = mLow.Finish();
+        hash.mHigh = mHigh.Finish();
+        return hash;
+    }
+
+private:
+    StreamHash64 mLow;
+    StreamHash64 mHigh;
+};
+
+// ------------------------------------------------------------------------------------------------
+inline Hash128 HashBytes128(const void* _data, size_t _length)
+{
+    StreamHash128 hasher;
+    hasher.Update(_data, _length);
+    return hasher.Finish();
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// An open-addressed set of strings which can be queried with a pointer and length, so lookups
+// never have to build a std::string.
+class StringSet
+{
+public:
+    StringSet()
+    : mCount(0)
+    {
+        mSlots.resize(16, 0);
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Returns false if the string was already present.
+    bool Insert(const char* _str, size_t _length)
+    {
+        if (Contains(_str, _length)) {
+            return false;
+        }
+
+        // Keep the load factor at or below one half.
+        if ((mCount + 1) * 2 > mSlots.size()) {
+            Grow();
+        }
+
+        mEntries.push_back(std::string(_str, _length));
+        mHashes.push_back(HashBytes64(_str, _length));
+        Place(uint32_t(mEntries.size()));
+        ++mCount;
+        return true;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    bool Contains(const char* _str, size_t _length) const
+    {
+        uint64_t hash = HashBytes64(_str, _length);
+        size_t mask = mSlots.size() - 1;
+        for (size_t slot = size_t(hash) & mask; mSlots[slot] != 0; slot = (slot + 1) & mask) {
+            uint32_t index = mSlots[slot] - 1;
+            if (mHashes[index] == hash && mEntries[index].size() == _length
+             && memcmp(mEntries[index].data(), _str, _length) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t Size() const { return mCount; }
+
+    // --------------------------------------------------------------------------------------------
+    void Clear()
+    {
+        mEntries.clear();
+        mHashes.clear();
+        mSlots.assign(mSlots.size(), 0);
+        mCount = 0;
+    }
+
+private:
+    // --------------------------------------------------------------------------------------------
+    // _entry is the 1-based index of the entry to place.
+    void Place(uint32_t _entry)
+    {
+        size_t mask = mSlots.size() - 1;
+        size_t slot = size_t(mHashes[_entry - 1]) & mask;
+        while (mSlots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        mSlots[slot] = _entry;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    void Grow()
+    {
+        mSlots.assign(mSlots.size() * 2, 0);
+        for (uint32_t i = 0; i < mEntries.size(); ++i) {
+            Place(i + 1);
+        }
+    }
+
+private:
+    std::vector<std::string> mEntries;
+    std::vector<uint64_t> mHashes;
+    std::vector<uint32_t> mSlots;   // 1-based index into mEntries, 0 for empty.
+    size_t mCount;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Maps strings to small, dense integer ids and back. Ids start at 1 (0 is never handed out), and
+// are given out in the order strings are first seen, so a caller which interns a fixed list of
+// strings first knows their ids without looking them up.
+class StringInterner
+{
+public:
+    StringInterner()
+    {
+        mSlots.resize(64, 0);
+        // Id 0 is reserved.
+        mOffsets.push_back(0);
+        mLengths.push_back(0);
+        mHashes.push_back(0);
+    }
+
+    // --------------------------------------------------------------------------------------------
+    uint32_t Intern(const char* _str, size_t _length)
+    {
+        uint32_t hash = uint32_t(HashBytes64(_str, _length));
+        size_t mask = mSlots.size() - 1;
+        size_t slot = hash & mask;
+        for (; mSlots[slot] != 0; slot = (slot + 1) & mask) {
+            uint32_t id = mSlots[slot];
+            if (mHashes[id] == hash && mLengths[id] == _length
+             && memcmp(&mChars[mOffsets[id]], _str, _length) == 0) {
+                return id;
+            }
+        }
+
+        uint32_t id = uint32_t(mOffsets.size());
+        mOffsets.push_back(uint32_t(mChars.size()));
+        mLengths.push_back(uint32_t(_length));
+        mHashes.push_back(hash);
+        mChars.insert(mChars.end(), _str, _str + _length);
+
+        // Keep the load factor at or below one half.
+        if (id * 2 > mSlots.size()) {
+            Grow();
+        } else {
+            mSlots[slot] = id;
+        }
+        return id;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Returns 0 if _str has never been interned.
+    uint32_t Find(const char* _str, size_t _length) const
+    {
+        uint32_t hash = uint32_t(HashBytes64(_str, _length));
+        size_t mask = mSlots.size() - 1;
+        for (size_t slot = hash & mask; mSlots[slot] != 0; slot = (slot + 1) & mask) {
+            uint32_t id = mSlots[slot];
+            if (mHashes[id] == hash && mLengths[id] == _length
+             && memcmp(&mChars[mOffsets[id]], _str, _length) == 0) {
+                return id;
+            }
+        }
+        return 0;
+    }
+
+    // The text is not NUL terminated, and the pointer is only good until the next Intern.
+    const char* GetString(uint32_t _id) const { return mChars.data() + mOffsets[_id]; }
+    uint32_t GetLength(uint32_t _id) const { return mLengths[_id]; }
+
+    // The number of ids handed out so far; valid ids are [1, Size()].
+    size_t Size() const { return mOffsets.size() - 1; }
+
+    // --------------------------------------------------------------------------------------------
+    // Forgets every string, but keeps the memory. Ids handed out before are no longer valid.
+    void Clear()
+    {
+        mSlots.assign(mSlots.size(), 0);
+        mOffsets.resize(1);
+        mLengths.resize(1);
+        mHashes.resize(1);
+        mChars.clear();
+    }
+
+private:
+    // --------------------------------------------------------------------------------------------
+    void Grow()
+    {
+        mSlots.assign(mSlots.size() * 2, 0);
+        size_t mask = mSlots.size() - 1;
+        for (uint32_t id = 1; id < mOffsets.size(); ++id) {
+            size_t slot = mHashes[id] & mask;
+            while (mSlots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            mSlots[slot] = id;
+        }
+    }
+
+private:
+    std::vector<char> mChars;
+    std::vector<uint32_t> mOffsets;
+    std::vector<uint32_t> mLengths;
+    std::vector<uint32_t> mHashes;
+    std::vector<uint32_t> mSlots;   // Id of the string in the slot, 0 for empty.
+};
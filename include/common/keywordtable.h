@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// A keyword and the token it lexes as. Tables end with an entry whose Keyword is nullptr.
+struct KeywordEntry
+{
+    const char* Keyword;
+    const int Token;
+};
+
+// An immutable perfect hash over a fixed set of keywords. Every keyword owns exactly one slot,
+// so classifying an identifier costs one hash, one table read and one compare, no matter how
+// many keywords there are. The hash parameters are searched for once, at construction.
+class KeywordTable
+{
+public:
+    // Any number of KeywordEntry tables may be combined into one KeywordTable. A keyword which
+    // appears more than once keeps the token from its first appearance.
+    explicit KeywordTable(const KeywordEntry* _keywords);
+    KeywordTable(const KeywordEntry* const* _tables, size_t _tableCount);
+
+    // Returns true and fills in _outToken if _str (which need not be NUL terminated) is a
+    // keyword.
+    bool Find(const char* _str, size_t _length, int* _outToken) const;
+
+    size_t GetKeywordCount() const { return mKeywordCount; }
+
+private:
+    void Build(const KeywordEntry* const* _tables, size_t _tableCount);
+    bool TryBuild(uint64_t _seed, const std::vector<const KeywordEntry*>& _keywords);
+
+    struct Slot
+    {
+        const char* Keyword;    // nullptr for an unused slot.
+        uint32_t Length;
+        int Token;
+    };
+
+    uint64_t mSeed;
+    uint32_t mSlotMask;
+    uint32_t mBucketCount;
+    size_t mKeywordCount;
+    std::vector<uint32_t> mDisplacements;
+    std::vector<Slot> mSlots;
+};
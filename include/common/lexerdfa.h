@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+struct LexicalEntry;
+
+// A single deterministic automaton compiled from a complete table of LexicalEntry's. Patterns
+// use the subset of <regex> ECMAScript syntax our tables actually need: literals, escapes,
+// character classes, '.', grouping, alternation and the *, +, ?, {m,n} quantifiers.
+// Each rule matches its longest prefix, which is what the greedy ECMAScript matcher produced for
+// every pattern in our tables.
+class LexerDFA
+{
+public:
+    // A rule which matched at the scan position. Rule is the index into the LexicalEntry table.
+    struct Match
+    {
+        int Rule;
+        size_t Length;
+    };
+
+    // Rules must end with a SentinelRule.
+    explicit LexerDFA(const LexicalEntry* _rules);
+
+    // Runs the automaton once from _begin, stopping at _end or as soon as no rule can match any
+    // longer. Every rule which matched is written to _outMatches (with its longest match),
+    // ordered by rule index--which is also rule priority. Returns the number of matches.
+    // If _outExamined is given, it receives how many bytes the result depended on: every byte the
+    // automaton consumed plus the one that stopped it (reaching _end counts as one byte).
+    size_t Scan(const char* _begin, const char* _end, std::vector<Match>* _outMatches, size_t* _outExamined = nullptr) const;
+
+    size_t GetRuleCount() const { return mRuleCount; }
+    size_t GetStateCount() const { return mAccepts.size(); }
+
+private:
+    // State 0 is the dead state, state 1 is the start state.
+    enum {
+        kDeadState = 0,
+        kStartState = 1
+    };
+
+    size_t mRuleCount;
+    size_t mClassCount;
+    unsigned char mByteClass[256];
+
+    // mTransitions[state * mClassCount + mByteClass[byte]] is the next state.
+    std::vector<int> mTransitions;
+
+    // For each state, the sorted list of rules which accept in that state. Stored as a
+    // [begin, end) range into mAcceptRules.
+    struct AcceptRange
+    {
+        int Begin;
+        int End;
+    };
+    std::vector<AcceptRange> mAccepts;
+    std::vector<int> mAcceptRules;
+
+    // For each state, an EScanClass (see scan.h) of bytes which all loop back to that state, or
+    // ESC_None. Runs of those bytes are skipped with the vectorized scanners instead of stepping 
+    // the automaton once per byte--this is what makes long whitespace runs, identifiers and
+    // numbers cheap.
+    std::vector<unsigned char> mAccelerators;
+};
@@ -1,18 +1,23 @@
 #pragma once
 
-#include <regex>
-#include <set>
+#include <stdint.h>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "common/hashutil.h"
+#include "common/lexerdfa.h"
+
 
 class StateObject;
 
 typedef long long StreamOffset;
-typedef int (*CheckFunc)(const std::string& _match, const int _initialToken, StateObject* _state);
+// The match is not NUL terminated; it points directly into the buffer being lexed.
+typedef int (*CheckFunc)(const char* _match, size_t _matchLength, const int _initialToken, StateObject* _state);
 
 // A single entry in a table of lexical rules for how to parse a string into tokens. Pattern 
-// should be a <regex> conformant string specifying the rule for a single token.
-// Tokens are specified in decreasing priority.
+// should be a <regex> conformant string specifying the rule for a single token (see LexerDFA for
+// the supported subset). Tokens are specified in decreasing priority.
 struct LexicalEntry
 {
 	const char* Pattern;
@@ -37,13 +42,30 @@ extern const LexicalEntry SentinelRule;
 class StateObject
 {
 public:
-    // ReservedTypes is a list of strings with nullptr as the last element.
-    StateObject(const char** _reservedTypes);
+    StateObject();
 
-    bool IsValidType(const std::string& _identifier) const;
+    // User-defined type names (e.g. structs). Keywords and reserved types are not kept here;
+    // those are classified by the lexer's KeywordTable.
+    void AddUserType(const char* _identifier, size_t _length);
+    bool IsUserType(const char* _identifier, size_t _length) const;
 
 private:
-    std::set<std::string> mTypes;
+    StringSet mUserTypes;
+};
+
+// A lightweight token which refers back into the buffer it was lexed from instead of owning a 
+// copy of its text. Copying one never allocates, but the buffer must outlive the token.
+struct TokenRef
+{
+    // The default constructor sets parameters to REJECTTOKEN, 0, 0
+    TokenRef();
+    TokenRef(int _streamTok, StreamOffset _offset, StreamOffset _length);
+
+    bool IsEOF() const;
+
+    int mType;
+    StreamOffset mOffset;
+    StreamOffset mLength;
 };
 
 class Token 
@@ -63,6 +85,108 @@ private:
     friend std::ostream& operator<<(std::ostream& _os, const Token& _token);
 };
 
+// The compiled, immutable form of a LexicalEntry table. Compiling is the expensive part of
+// setting up a Lexer, so build a rule set once and share it: any number of Lexers on any number
+// of threads may use the same LexerRuleSet concurrently.
+class LexerRuleSet
+{
+public:
+    // Rules must end with a SentinelRule, and must outlive the rule set.
+    explicit LexerRuleSet(const LexicalEntry* _rules);
+
+    // Returns the process-wide rule set for _rules, compiling it on first use. Safe to call from
+    // any thread. Only use this for tables with static storage duration--rule sets fetched this
+    // way live until exit.
+    static const LexerRuleSet& Get(const LexicalEntry* _rules);
+
+    const LexicalEntry* GetRules() const { return mRules; }
+    const LexerDFA& GetDFA() const { return mDFA; }
+
+private:
+    LexerRuleSet(const LexerRuleSet&);
+    LexerRuleSet& operator=(const LexerRuleSet&);
+
+    const LexicalEntry* mRules;
+    LexerDFA mDFA;
+};
+
+// An edit to a buffer: mRemovedLength bytes at mOffset were replaced by mInsertedLength new
+// bytes. Offsets are in bytes.
+struct TextEdit
+{
+    TextEdit(StreamOffset _offset = 0, StreamOffset _removedLength = 0, StreamOffset _insertedLength = 0);
+
+    StreamOffset mOffset;
+    StreamOffset mRemovedLength;
+    StreamOffset mInsertedLength;
+};
+
+// What an incremental re-lex changed: the mOldCount tokens starting at index mFirst were replaced
+// by mNewCount freshly lexed ones. Every token after them is unchanged, apart from its offset.
+struct TokenSplice
+{
+    TokenSplice();
+
+    size_t mFirst;
+    size_t mOldCount;
+    size_t mNewCount;
+};
+
+// Tokens stored as a structure of arrays, so later passes can walk just the data they need.
+// Offsets and lengths refer into the buffer that was lexed, which must outlive the TokenBuffer.
+// Positions aren't stored at all; PositionOf works them out on demand.
+class TokenBuffer
+{
+public:
+    TokenBuffer();
+
+    // Empties the buffer but keeps its capacity, so a single TokenBuffer can be reused for any 
+    // number of files.
+    void Clear();
+
+    size_t Size() const { return mTypes.size(); }
+    bool IsEmpty() const { return mTypes.empty(); }
+
+    const int* GetTypes() const { return mTypes.data(); }
+    const StreamOffset* GetOffsets() const { return mOffsets.data(); }
+    const uint32_t* GetLengths() const { return mLengths.data(); }
+
+    int GetType(size_t _index) const { return mTypes[_index]; }
+    StreamOffset GetOffset(size_t _index) const { return mOffsets[_index]; }
+    uint32_t GetLength(size_t _index) const { return mLengths[_index]; }
+    TokenRef Get(size_t _index) const { return TokenRef(mTypes[_index], mOffsets[_index], mLengths[_index]); }
+
+    const char* GetBuffer() const { return mBuffer; }
+    const char* GetText(size_t _index) const { return mBuffer + mOffsets[_index]; }
+
+    // Line and column of a token (or of any byte offset in the buffer). The first call indexes
+    // the line starts of the buffer; after that each lookup is a binary search.
+    StreamPosition PositionOf(size_t _index) const { return PositionOfOffset(mOffsets[_index]); }
+    StreamPosition PositionOfOffset(StreamOffset _offset) const;
+
+    void Push(int _type, StreamOffset _offset, StreamOffset _length)
+    {
+        mTypes.push_back(_type);
+        mOffsets.push_back(_offset);
+        mLengths.push_back(uint32_t(_length));
+    }
+
+private:
+    friend class Lexer;
+
+    void Splice(size_t _first, size_t _oldCount, const TokenBuffer& _fresh, StreamOffset _shift);
+    void ApplyEdit(const TextEdit& _edit, const char* _newBuffer, size_t _newBufferLength);
+
+    std::vector<int> mTypes;
+    std::vector<StreamOffset> mOffsets;
+    std::vector<uint32_t> mLengths;
+    const char* mBuffer;
+    size_t mBufferLength;
+
+    mutable std::vector<StreamOffset> mLineStarts;
+    mutable bool mLineStartsValid;
+};
+
 class Lexer
 {
 public:
@@ -71,6 +195,16 @@ public:
 	// The StateObject is an optional state object which carries the state of the whole
 	// lex and parse result, for reentrancy. It is optional.
 	Lexer(const LexicalEntry* _rules, const char* _stringToLex, StateObject* _state);
+
+    // Zero-copy mode. The lexer never copies the input, instead it lexes _buffer in place. 
+    // _buffer need not be NUL terminated, but it must stay alive and unmodified for as long as 
+    // the lexer or any TokenRef produced from it is in use.
+    Lexer(const LexicalEntry* _rules, const char* _buffer, size_t _length, StateObject* _state);
+
+    // As above, but using an already compiled rule set, which must outlive the lexer. These do
+    // no rule compilation at all, so constructing a Lexer this way is cheap.
+    Lexer(const LexerRuleSet& _ruleSet, const char* _stringToLex, StateObject* _state);
+    Lexer(const LexerRuleSet& _ruleSet, const char* _buffer, size_t _length, StateObject* _state);
 	~Lexer();
 
 	// Peek at the next token and return.
@@ -79,26 +213,56 @@ public:
 	// Pop the next token and return.
 	Token Pop();
 
+    // As Peek and Pop, but return a TokenRef into the lexed buffer. These never allocate.
+    TokenRef PeekRef() const;
+    TokenRef PopRef();
+
+    // Lexes everything that remains (including the current lookahead) into _outTokens in one
+    // pass, replacing its contents. Tokens which were ignored are not stored. Afterwards the 
+    // lexer is at EOF. Returns false if some input couldn't be matched; the tokens before it 
+    // are still stored.
+    bool TokenizeAll(TokenBuffer* _outTokens);
+
+    // Incremental re-lexing. _tokens holds the tokens of a buffer before _edit was made to it,
+    // and this lexer must be over the buffer after the edit. Only the text from the last token
+    // boundary before the edit up to the point where the new tokens line up with the old ones
+    // again is lexed; later tokens are just shifted, so an edit costs O(edit) lexing rather than
+    // O(file). Afterwards _tokens refers to this lexer's buffer. _outSplice (which may be NULL)
+    // receives the range of tokens which changed. The lexer's Peek/Pop position is not affected.
+    // Returns false if some of the new text couldn't be matched; as with TokenizeAll, the tokens
+    // before the error are kept and the rest are dropped.
+    // Identifier classification is assumed not to have changed, so if the edit adds or removes a
+    // user type, re-lex the whole buffer instead. No rule may match across ignored text.
+    bool Relex(const TextEdit& _edit, TokenBuffer* _tokens, TokenSplice* _outSplice);
+
+    // The buffer that TokenRef offsets are relative to.
+    const char* GetBuffer() const { return mSrcBegin; }
+    const char* GetTokenText(const TokenRef& _token) const { return mSrcBegin + _token.mOffset; }
+
 private:
-    void ConstructRules(const LexicalEntry* _rules);
-    Token FindNextToken();
+    Lexer(const Lexer&);
+    Lexer& operator=(const Lexer&);
 
-    struct RuleEntry 
-    {
-        std::regex Regex;
-        const int Token;
-        CheckFunc TokenCallback;    
-    };
+    TokenRef FindNextToken();
+    int MatchToken(size_t* _outLength);
+    void AdvancePosition(const char* _from, const char* _to);
 
 private:
-    std::vector<RuleEntry> mRules;
+    // All rules are compiled into a single automaton, so finding a token is one linear scan 
+    // regardless of how many rules there are. mOwnedRuleSet is only used by the constructors
+    // which take a raw LexicalEntry table.
+    std::unique_ptr<LexerRuleSet> mOwnedRuleSet;
+    const LexerRuleSet* mRuleSet;
+    std::vector<LexerDFA::Match> mMatches;
+    // Only used when the lexer owns a copy of its input.
     std::string mStringToLex;
-    std::string::const_iterator mSrcPos;
+    const char* mSrcBegin;
+    const char* mSrcEnd;
+    const char* mSrcPos;
     StreamPosition mStreamPosition;
 	StateObject* mState;
-    Token mLookaheadToken;
-
-    std::set<std::string> mTypes;
+    TokenRef mLookaheadToken;
+    StreamPosition mLookaheadPosition;
 };
 
 // This token id indicates that the lexer should grab this token, then ignore it and move to the next
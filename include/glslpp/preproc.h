@@ -18,11 +18,99 @@ struct GLPPOptions
     // error messages. 
     bool mMaintainLineCount;
 
+    // Directories searched for #include files, in order. "name" includes look in the including
+    // file's directory first; <name> includes only look here. genPreprocessor copies the 
+    // strings, they don't need to outlive the call.
+    const char* const* mIncludePaths;
+    size_t mIncludePathCount;
+
+    // Macros defined before any input, as with -D on a compiler's command line. "NAME" defines
+    // NAME as 1, and "NAME=VALUE" or "NAME(a,b)=VALUE" as VALUE. Copied, like mIncludePaths.
+    const char* const* mDefines;
+    size_t mDefineCount;
+
+    // If set, a directory to keep preprocessed output in, keyed by a hash of the input, these
+    // options and every file it includes. Inputs seen before come straight back out of it, and
+    // aren't preprocessed at all. Shared safely by any number of processes; least recently used
+    // entries go once it's over mCacheMaxBytes (0 for the default, 256M). The streaming
+    // interface doesn't use it. Copied, like mIncludePaths.
+    const char* mCacheDirectory;
+    unsigned long long mCacheMaxBytes;
+
     inline GLPPOptions()
     : mMaintainLineCount(true)
+    , mIncludePaths(NULL)
+    , mIncludePathCount(0)
+    , mDefines(NULL)
+    , mDefineCount(0)
+    , mCacheDirectory(NULL)
+    , mCacheMaxBytes(0)
     { }
 };
 
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Preprocesses many inputs at once, on a pool of threads. Everything that doesn't change from
+// one input to the next (options, predefined macros, included files) is set up once and shared.
+struct GLPPBatch;
+
+struct GLPPBatchInput
+{
+    // The file to read. Or, if mMemBuffer is set, the name to report it as (and may be NULL).
+    const char* mFilename;
+    // '\0' terminated source to use instead of reading mFilename.
+    const char* mMemBuffer;
+};
+
+struct GLPPBatchResult
+{
+    GLCCint mErrorCode;
+    const char* mOutput;        // '\0' terminated; NULL if preprocessing failed.
+    size_t mOutputLength;
+    const char* mError;         // As getLastError would give; NULL if preprocessing succeeded.
+};
+
+// One variant for preprocessVariants: macros defined on top of the batch's GLPPOptions::mDefines,
+// in the same form.
+struct GLPPDefineSet
+{
+    const char* const* mDefines;
+    size_t mDefineCount;
+};
+
+struct GLPPVariantResult
+{
+    GLCCint mErrorCode;
+    const char* mOutput;        // '\0' terminated; NULL if preprocessing failed.
+    size_t mOutputLength;
+    const char* mError;         // As getLastError would give; NULL if preprocessing succeeded.
+
+    // The first variant whose output is identical to this one's: this one's own index, unless an
+    // earlier one came out the same, in which case mOutput is that one's too. A failed variant
+    // is only ever the same as itself.
+    size_t mSameAs;
+};
+
+// What scanFromFile and scanFromMemory found. The strings are valid until the next call on the
+// preprocessor.
+struct GLPPScanResult
+{
+    GLCCint mVersion;                   // The input's #version, or 0 if it has none.
+    const char* const* mIncludes;       // Resolved paths of every file it might include.
+    size_t mIncludeCount;
+    const char* const* mExtensions;     // Each distinct #extension, as "name : behavior".
+    size_t mExtensionCount;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Receives preprocessed output from the streaming interface (preprocessBegin and friends), in 
+// pieces, as soon as it is ready. _text is not NULL terminated, and is only valid for the 
+// duration of the call.
+typedef void (*GLPPOutputFn)(const char* _text, size_t _length, void* _userData);
+
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
@@ -33,3 +121,54 @@ extern "C" GLCCint preprocessFromFile(GLCCPreprocessor* _preproc, const char* _f
 extern "C" GLCCint preprocessFromMemory(GLCCPreprocessor* _preproc, const char* _memBuffer, 
                                         const char* _optFilename);
 extern "C" const char* getLastError(GLCCPreprocessor* _preproc);
+
+// Gets _preproc ready for another input as if it had just been made with genPreprocessor: any
+// stream in progress is abandoned, and the last output and error are gone. Unlike deleting it and
+// making another, every buffer keeps its memory. (preprocessFromFile and the rest can be called
+// again without this; it is only needed to abandon a stream, or to forget the identifiers
+// interned so far, which otherwise accumulate across inputs.)
+extern "C" GLCCint resetPreprocessor(GLCCPreprocessor* _preproc);
+
+// The output of the last preprocessFromFile or preprocessFromMemory, NULL terminated, or NULL if
+// it failed. Valid until the next call on _preproc. Streamed output only goes to the callback.
+extern "C" const char* getOutput(GLCCPreprocessor* _preproc, size_t* _optLength);
+
+// Streaming interface. Input is fed in chunks of any size, split anywhere, and output is handed to
+// _outputFn as it is produced. The input never has to be in memory all at once, and the 
+// preprocessor's own memory use doesn't grow with its size. preprocessEnd must be called to 
+// flush the last of the output, and returns the overall result. Only one stream can be in 
+// progress on a preprocessor at a time.
+extern "C" GLCCint preprocessBegin(GLCCPreprocessor* _preproc, const char* _optFilename, 
+                                   GLPPOutputFn _outputFn, void* _optUserData);
+extern "C" GLCCint preprocessFeed(GLCCPreprocessor* _preproc, const char* _chunk, size_t _chunkLength);
+extern "C" GLCCint preprocessEnd(GLCCPreprocessor* _preproc);
+
+// Batch interface. _optThreadCount of 0 uses every hardware thread. preprocessBatch fills in 
+// _outResults[i] for _inputs[i]; the strings in them are valid until the next call on _batch. It
+// returns GLCCError_Ok if every input succeeded, otherwise the error of the first that didn't.
+extern "C" GLCCint genBatch(GLPPBatch** _newBatch, const GLPPOptions* _optOptions, size_t _optThreadCount);
+extern "C" GLCCint deleteBatch(GLPPBatch** _batch);
+extern "C" GLCCint preprocessBatch(GLPPBatch* _batch, const GLPPBatchInput* _inputs, size_t _inputCount,
+                                   GLPPBatchResult* _outResults);
+
+// Variant interface. Preprocesses the one _input under each of _defineSets, on _batch's threads.
+// Phases two and three, and tokenizing, are done once for all of them; each variant only runs
+// phase four, over the same tokens. _outResults[i] is for _defineSets[i], and is valid until the
+// next call on _batch. Returns as preprocessBatch does. The disk cache isn't used.
+extern "C" GLCCint preprocessVariants(GLPPBatch* _batch, const GLPPBatchInput* _input,
+                                      const GLPPDefineSet* _defineSets, size_t _variantCount,
+                                      GLPPVariantResult* _outResults);
+
+// Dependency scanning. Finds the files an input might #include, without preprocessing it: only
+// directive lines are looked at, and macros aren't expanded. Conditionals that can't be decided
+// without them are assumed to be taken, so the includes are never fewer than preprocessing
+// would read. Fails if an #include that might be reached names its file with a macro.
+// getDepfile gives the last successful scan as a Makefile rule (which Ninja reads too) for
+// _target, which depends on the input and every include. _target is what the build makes from
+// the input--its output--never the input itself, which Make would drop as depending on itself.
+// The rule is NULL terminated, and valid until the next call on _preproc; NULL if the last run
+// wasn't a scan that succeeded, or _target is the input's own name.
+extern "C" GLCCint scanFromFile(GLCCPreprocessor* _preproc, const char* _filename, GLPPScanResult* _outResult);
+extern "C" GLCCint scanFromMemory(GLCCPreprocessor* _preproc, const char* _memBuffer, 
+                                  const char* _optFilename, GLPPScanResult* _outResult);
+extern "C" const char* getDepfile(GLCCPreprocessor* _preproc, const char* _target, size_t* _optLength);
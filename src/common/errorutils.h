@@ -0,0 +1,61 @@
+#pragma once
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "common/common.h"
+#include "stringutils.h"
+
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// Where ReportError puts the message: either a string allocated with new[], replaced every time,
+// or a buffer that keeps its capacity from one error to the next.
+inline void StoreErrorString(char** _where, const char* _fmt, va_list _args)
+{
+    // Cleanup if anythign is there already.
+    if (*_where) {
+        delete [] (*_where);
+        (*_where) = NULL;
+    }
+
+    // determine required size.
+    va_list args;
+    va_copy(args, _args);
+    int reqSize = vsnprintf(NULL, 0, _fmt, args);
+    assert(reqSize >= 0);
+    va_end(args);
+
+    // Create new place.
+    (*_where) = new char[reqSize + 1];
+    vsnprintf(*_where, reqSize + 1, _fmt, _args);
+}
+
+// ------------------------------------------------------------------------------------------------
+inline void StoreErrorString(std::vector<char>* _where, const char* _fmt, va_list _args)
+{
+    va_list args;
+    va_copy(args, _args);
+    int reqSize = vsnprintf(NULL, 0, _fmt, args);
+    assert(reqSize >= 0);
+    va_end(args);
+
+    bufferResize(_where, size_t(reqSize) + 1);
+    vsnprintf(_where->data(), reqSize + 1, _fmt, _args);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Formats an error message into _where->mErrorString (replacing whatever was there) and returns
+// _errCode, so a failing path can just return ReportError(...). This will work for any stateful 
+// object that has an mErrorString StoreErrorString accepts.
+template<typename T>
+GLCCint ReportError(GLCCint _errCode, T *_where, const char* _fmt, ...)
+{
+    va_list args;
+    va_start(args, _fmt);
+    StoreErrorString(&_where->mErrorString, _fmt, args);
+    va_end(args);
+
+    return _errCode;
+}
@@ -2,17 +2,25 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
 #	include <unistd.h>
 #endif
 
 #include "stringutils.h"
 
+#include <string>
+#include <vector>
+
 // ------------------------------------------------------------------------------------------------
-long long computeFileSize(const char* _filename)
+inline long long computeFileSize(const char* _filename)
 {
 	struct stat sb;
     if (stat(_filename, &sb) == -1) {
@@ -23,7 +31,52 @@ long long computeFileSize(const char* _filename)
 }
 
 // ------------------------------------------------------------------------------------------------
-char* fileContentsToString(const char* _filename)
+// Size and modification time, enough to tell whether a file has changed since it was last read.
+// Returns false if the file doesn't exist or isn't a regular file.
+inline bool computeFileStamp(const char* _filename, long long* _outSize, long long* _outModTime)
+{
+    struct stat sb;
+    if (stat(_filename, &sb) == -1 || (sb.st_mode & S_IFMT) != S_IFREG) {
+        return false;
+    }
+
+    (*_outSize) = (long long) sb.st_size;
+    (*_outModTime) = (long long) sb.st_mtime;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// The path that names _filename however it was spelled: absolute, with no "." or ".." parts and,
+// on POSIX, with symbolic links followed. Returns false if the file can't be found.
+inline bool computeFullPath(const char* _filename, std::string* _outPath)
+{
+#ifdef _WIN32
+    DWORD length = GetFullPathNameA(_filename, 0, NULL, NULL);
+    if (length == 0) {
+        return false;
+    }
+
+    _outPath->resize(length);
+    length = GetFullPathNameA(_filename, length, &(*_outPath)[0], NULL);
+    if (length == 0 || length >= _outPath->size()) {
+        return false;
+    }
+    _outPath->resize(length);
+    return GetFileAttributesA(_outPath->c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+    char* fullPath = realpath(_filename, NULL);
+    if (!fullPath) {
+        return false;
+    }
+
+    _outPath->assign(fullPath);
+    free(fullPath);
+    return true;
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+inline char* fileContentsToString(const char* _filename)
 {
     // NOTE: This pushes a double-NULL into the end of the file contents--so the contents aren't
     // exactly the same as in the file. This is to allow flex/bison to parse in place.
@@ -54,4 +107,179 @@ char* fileContentsToString(const char* _filename)
 	retBuffer[effectiveFileSize + 1] = '\0';
 
     return retBuffer;
-}
\ No newline at end of file
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reads the whole file into _outBuffer, reusing its capacity, and returns the number of bytes
+// read. Reads until end of file rather than trusting the size on disk, so it works on pipes and
+// the like too. Returns false if the file can't be opened.
+inline bool fileContentsToBuffer(const char* _filename, std::vector<char>* _outBuffer, size_t* _outLength)
+{
+    FILE* file = fopen(_filename, "rb");
+    if (!file) {
+        return false;
+    }
+
+    size_t length = 0;
+    for (;;) {
+        if (_outBuffer->size() - length < 4096) {
+            bufferResize(_outBuffer, length + 4096);
+        }
+
+        size_t read = fread(_outBuffer->data() + length, 1, _outBuffer->size() - length, file);
+        length += read;
+        if (read == 0) {
+            break;
+        }
+    }
+
+    bool failed = (ferror(file) != 0);
+    fclose(file);
+
+    (*_outLength) = length;
+    return !failed;
+}
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A file's contents mapped into memory, rather than read into a heap buffer. The mapping is
+// read-only, which is all the preprocessor needs--its phases write their output elsewhere.
+// Unlike fileContentsToString, the contents are NOT '\0' terminated--use GetSize. Sizes are
+// 64-bit throughout, so there is no 4G limit on 64-bit builds.
+class MappedFile
+{
+public:
+    MappedFile()
+    : mData(NULL)
+    , mSize(0)
+    , mMapped(false)
+#ifdef _WIN32
+    , mFile(INVALID_HANDLE_VALUE)
+    , mMapping(NULL)
+#endif
+    { }
+
+    ~MappedFile() { Close(); }
+
+    // --------------------------------------------------------------------------------------------
+    // Returns false if the file couldn't be opened or mapped (pipes, some special files, or a
+    // view too large for the address space). An empty file opens fine, with no data.
+    bool Open(const char* _filename)
+    {
+        Close();
+
+#ifdef _WIN32
+        mFile = CreateFileA(_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(mFile, &fileSize) || (unsigned long long) fileSize.QuadPart > size_t(-1)) {
+            Close();
+            return false;
+        }
+
+        mSize = size_t(fileSize.QuadPart);
+        if (mSize == 0) {
+            // Windows refuses to map empty files.
+            mData = Empty();
+            return true;
+        }
+
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mMapping == NULL) {
+            Close();
+            return false;
+        }
+
+        mData = (char*) MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = open(_filename, O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat sb;
+        if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || (unsigned long long) sb.st_size > size_t(-1)) {
+            close(fd);
+            return false;
+        }
+
+        mSize = size_t(sb.st_size);
+        if (mSize == 0) {
+            // mmap refuses zero-length mappings.
+            close(fd);
+            mData = Empty();
+            return true;
+        }
+
+        void* mapping = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping holds its own reference to the file.
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            mSize = 0;
+            return false;
+        }
+
+        // Everybody reading this reads it front to back, exactly once.
+        madvise(mapping, mSize, MADV_SEQUENTIAL);
+        mData = (char*) mapping;
+#endif
+        mMapped = (mData != NULL);
+        if (!mMapped) {
+            Close();
+        }
+        return mMapped;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    void Close()
+    {
+#ifdef _WIN32
+        if (mMapped) {
+            UnmapViewOfFile(mData);
+        }
+        if (mMapping != NULL) {
+            CloseHandle(mMapping);
+            mMapping = NULL;
+        }
+        if (mFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(mFile);
+            mFile = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (mMapped) {
+            munmap(mData, mSize);
+        }
+#endif
+        mData = NULL;
+        mSize = 0;
+        mMapped = false;
+    }
+
+    bool IsOpen() const { return mData != NULL; }
+    const char* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    // Where empty files point, so IsOpen still works for them.
+    static char* Empty()
+    {
+        static char sEmpty[1] = { '\0' };
+        return sEmpty;
+    }
+
+    char* mData;
+    size_t mSize;
+    bool mMapped;
+#ifdef _WIN32
+    HANDLE mFile;
+    HANDLE mMapping;
+#endif
+};
@@ -2,6 +2,9 @@
 
 #include "common/common.h"
 
+#include <string.h>
+#include <vector>
+
 inline char* stringDuplicate(const char* _inStr)
 {
     if (_inStr == NULL) {
@@ -10,7 +13,7 @@ inline char* stringDuplicate(const char* _inStr)
 
     // Determine length--doesn't include \0
     size_t strLen = 0;
-    while ((*_inStr++) != 0) {
+    while (_inStr[strLen] != 0) {
         ++strLen;
     }
 
@@ -30,3 +33,26 @@ inline char* stringDuplicate(const char* _inStr)
     return retBuffer;
 }
 
+
+// ------------------------------------------------------------------------------------------------
+// Resizes _buffer to _size elements. Its capacity never shrinks, and at least doubles whenever it
+// has to grow, so a buffer reused for inputs of varying size settles at the largest of them and
+// stops touching the heap. (resize on its own grows an empty vector to exactly what's asked.)
+template <typename T>
+inline void bufferResize(std::vector<T>* _buffer, size_t _size)
+{
+    if (_size > _buffer->capacity()) {
+        size_t capacity = _buffer->capacity() * 2;
+        _buffer->reserve(_size > capacity ? _size : capacity);
+    }
+    _buffer->resize(_size);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Copies _str, '\0' and all, into _buffer.
+inline void bufferAssignString(std::vector<char>* _buffer, const char* _str)
+{
+    size_t length = strlen(_str);
+    bufferResize(_buffer, length + 1);
+    memcpy(_buffer->data(), _str, length + 1);
+}
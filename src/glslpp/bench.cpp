@@ -0,0 +1,577 @@
+#include "glslppafx.h"
+
+#include "common/parserutil.h"
+#include "fileutils.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <windows.h>
+#   include <psapi.h>
+#   pragma comment(lib, "psapi.lib")
+#else
+#   include <dirent.h>
+#   include <sys/resource.h>
+#endif
+
+// Measures every tokenizer in the tree over the files in tests/glslpp and over generated inputs
+// from 1 KB to 100 MB. Run with --help for the options.
+
+extern const LexicalEntry* GetGlslTokens();
+size_t flexTokenizeBuffer(const char* _buffer, size_t _length, bool* _outComplete);
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Every allocation made through operator new is counted. The benchmark is single threaded, so a
+// plain counter is fine.
+static size_t gAllocationCount = 0;
+
+void* operator new(size_t _size)
+{
+    ++gAllocationCount;
+    void* retPtr = malloc(_size ? _size : 1);
+    if (!retPtr) {
+        throw std::bad_alloc();
+    }
+    return retPtr;
+}
+
+void* operator new[](size_t _size)
+{
+    return operator new(_size);
+}
+
+void* operator new(size_t _size, const std::nothrow_t&) noexcept
+{
+    ++gAllocationCount;
+    return malloc(_size ? _size : 1);
+}
+
+void* operator new[](size_t _size, const std::nothrow_t& _nothrow) noexcept
+{
+    return operator new(_size, _nothrow);
+}
+
+void operator delete(void* _ptr) noexcept { free(_ptr); }
+void operator delete[](void* _ptr) noexcept { free(_ptr); }
+void operator delete(void* _ptr, const std::nothrow_t&) noexcept { free(_ptr); }
+void operator delete[](void* _ptr, const std::nothrow_t&) noexcept { free(_ptr); }
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// Peak resident set size of the whole process, in KB. This only ever goes up, so it's the high
+// water mark of everything run so far.
+size_t PeakRSSKB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return size_t(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#   ifdef __APPLE__
+    return size_t(usage.ru_maxrss / 1024);
+#   else
+    return size_t(usage.ru_maxrss);
+#   endif
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+struct BenchInput
+{
+    std::string mName;
+    std::string mContents;
+};
+
+// ------------------------------------------------------------------------------------------------
+std::vector<std::string> ListShaderFiles(const std::string& _dir)
+{
+    std::vector<std::string> retFiles;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA((_dir + "\\*.glsl").c_str(), &findData);
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        do {
+            retFiles.push_back(_dir + "/" + findData.cFileName);
+        } while (FindNextFileA(findHandle, &findData));
+        FindClose(findHandle);
+    }
+#else
+    DIR* dir = opendir(_dir.c_str());
+    if (dir) {
+        while (struct dirent* entry = readdir(dir)) {
+            size_t nameLength = strlen(entry->d_name);
+            if (nameLength > 5 && strcmp(entry->d_name + nameLength - 5, ".glsl") == 0) {
+                retFiles.push_back(_dir + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    std::sort(retFiles.begin(), retFiles.end());
+    return retFiles;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Deterministic shader-like source which every tokenizer accepts: declarations, expressions,
+// float/int/hex constants and swizzles, but no comments or preprocessor directives since not all
+// of the tokenizers handle those.
+std::string GenerateSource(size_t _size)
+{
+    static const char* const types[] = { "float", "vec2", "vec3", "vec4", "mat4", "int", "uint", "bool" };
+    static const char* const ops[] = { " + ", " - ", " * ", " / ", " << ", " >= ", " && ", " != " };
+    static const char* const swizzles[] = { ".x", ".xy", ".rgb", ".stpq", ".w", ".zyx" };
+
+    std::string retSource;
+    retSource.reserve(_size + 256);
+
+    uint32_t seed = 0x2545f491u;
+    char line[256];
+    for (int func = 0; retSource.size() < _size; ++func) {
+        snprintf(line, sizeof(line), "vec4 shade%d(in vec4 color, in sampler2D tex%d, vec2 uv)\n{\n", func, func);
+        retSource += line;
+
+        for (int stmt = 0; stmt < 12 && retSource.size() < _size; ++stmt) {
+            seed = seed * 1664525u + 1013904223u;
+            unsigned r = seed >> 8;
+            switch (r % 4) {
+                case 0:
+                    snprintf(line, sizeof(line), "    %s value%u = color%s%s%u.%ue-3;\n",
+                             types[r % 8], r % 1000, swizzles[(r >> 3) % 6], ops[(r >> 6) % 8], r % 97, (r >> 9) % 1000);
+                    break;
+                case 1:
+                    snprintf(line, sizeof(line), "    color = texture(tex%d, uv * %u.5) + vec4(0x%XU, %uu, %u.0f, 1.0);\n",
+                             func, r % 13, r % 4096, (r >> 12) % 200, (r >> 4) % 50);
+                    break;
+                case 2:
+                    snprintf(line, sizeof(line), "    if (uv%s >= %u.25 || color.a <= 0.%u) { color%s *= %u; }\n",
+                             swizzles[r % 6], r % 8, (r >> 5) % 100, swizzles[(r >> 2) % 6], (r >> 7) % 9 + 1);
+                    break;
+                default:
+                    snprintf(line, sizeof(line), "    for (int i%u = 0; i%u < %u; ++i%u) {\n        color += vec4(i%u) * 0.125;\n    }\n",
+                             r % 10, r % 10, (r >> 4) % 64 + 1, r % 10, r % 10);
+                    break;
+            }
+            retSource += line;
+        }
+        retSource += "    return color;\n}\n\n";
+    }
+
+    return retSource;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A tokenizer under test. Run tokenizes the whole input once and returns the token count.
+struct Tokenizer
+{
+    const char* mName;
+    size_t (*Run)(const std::string& _input, bool* _outComplete);
+};
+
+// ------------------------------------------------------------------------------------------------
+size_t RunFlex(const std::string& _input, bool* _outComplete)
+{
+    return flexTokenizeBuffer(_input.data(), _input.size(), _outComplete);
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t RunLexerPop(const std::string& _input, bool* _outComplete)
+{
+    StateObject state;
+    Lexer lexer(LexerRuleSet::Get(GetGlslTokens()), _input.data(), _input.size(), &state);
+
+    size_t tokenCount = 0;
+    while (!lexer.PeekRef().IsEOF() && lexer.PeekRef().mType != REJECTTOKEN) {
+        lexer.Pop();
+        ++tokenCount;
+    }
+    (*_outComplete) = lexer.PeekRef().IsEOF();
+    return tokenCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t RunLexerPopRef(const std::string& _input, bool* _outComplete)
+{
+    StateObject state;
+    Lexer lexer(LexerRuleSet::Get(GetGlslTokens()), _input.data(), _input.size(), &state);
+
+    size_t tokenCount = 0;
+    while (!lexer.PeekRef().IsEOF() && lexer.PeekRef().mType != REJECTTOKEN) {
+        lexer.PopRef();
+        ++tokenCount;
+    }
+    (*_outComplete) = lexer.PeekRef().IsEOF();
+    return tokenCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t RunLexerTokenizeAll(const std::string& _input, bool* _outComplete)
+{
+    // Reused between runs, the way a build farm worker would.
+    static TokenBuffer tokens;
+
+    StateObject state;
+    Lexer lexer(LexerRuleSet::Get(GetGlslTokens()), _input.data(), _input.size(), &state);
+    (*_outComplete) = lexer.TokenizeAll(&tokens);
+    return tokens.Size();
+}
+
+const Tokenizer gTokenizers[] = {
+    { "flex"                , RunFlex             },
+    { "lexer-pop"           , RunLexerPop         },
+    { "lexer-popref"        , RunLexerPopRef      },
+    { "lexer-tokenizeall"   , RunLexerTokenizeAll },
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Checks Lexer::Relex against lexing from scratch. _editCount random edits are made to _source
+// one after another; after each, the tokens are brought up to date with Relex and compared with
+// TokenizeAll's over the edited text: types, offsets, lengths and positions. The edits insert
+// pieces of GLSL, so tokens merge, split and change type. Returns how many edits gave different
+// tokens.
+size_t CheckRelex(const char* _name, const std::string& _source, size_t _editCount, uint32_t _seed)
+{
+    static const char* const pieces[] = {
+        "a", "x1", "_", "float", "vec3", "if", "0", "7", "1.5", ".", "e", "e+", "3u", "0x", "F",
+        " ", "  ", "\n", "\t", "+", "-", "=", "<", "<<", ">", "&", "|", "^", "!", ";", ",",
+        "(", ")", "{", "}", "[", "]"
+    };
+    const size_t pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+    const LexerRuleSet& ruleSet = LexerRuleSet::Get(GetGlslTokens());
+
+    // The tokens refer into the text they were lexed from, so each edit is made into the other
+    // buffer, and the old one kept until Relex is done with it.
+    std::string texts[2];
+    texts[0] = _source;
+    size_t current = 0;
+
+    StateObject state;
+    TokenBuffer tokens;
+    TokenBuffer fresh;
+    {
+        Lexer lexer(ruleSet, texts[0].data(), texts[0].size(), &state);
+        lexer.TokenizeAll(&tokens);
+    }
+
+    uint32_t seed = _seed;
+    size_t failures = 0;
+    for (size_t edit = 0; edit < _editCount; ++edit) {
+        const std::string& text = texts[current];
+        std::string& edited = texts[1 - current];
+
+        seed = seed * 1664525u + 1013904223u;
+        size_t offset = text.empty() ? 0 : (seed >> 8) % (text.size() + 1);
+        seed = seed * 1664525u + 1013904223u;
+        size_t removed = std::min(size_t((seed >> 8) % 12), text.size() - offset);
+
+        // One to three pieces, or now and then a stretch of the text itself, moved.
+        std::string inserted;
+        seed = seed * 1664525u + 1013904223u;
+        if ((seed >> 8) % 8 == 0 && !text.empty()) {
+            size_t from = (seed >> 12) % text.size();
+            inserted = text.substr(from, (seed >> 4) % 40);
+        } else {
+            for (size_t i = (seed >> 8) % 3; i < 3; ++i) {
+                seed = seed * 1664525u + 1013904223u;
+                inserted += pieces[(seed >> 8) % pieceCount];
+            }
+        }
+
+        edited.assign(text, 0, offset);
+        edited += inserted;
+        edited.append(text, offset + removed, std::string::npos);
+
+        TextEdit textEdit(StreamOffset(offset), StreamOffset(removed), StreamOffset(inserted.size()));
+        TokenSplice splice;
+        Lexer relexer(ruleSet, edited.data(), edited.size(), &state);
+        bool relexComplete = relexer.Relex(textEdit, &tokens, &splice);
+
+        Lexer lexer(ruleSet, edited.data(), edited.size(), &state);
+        bool freshComplete = lexer.TokenizeAll(&fresh);
+
+        // Relex only says whether the text it lexed again matched, not text after it.
+        bool same = ((relexComplete || !freshComplete) && tokens.Size() == fresh.Size()
+                  && splice.mFirst + splice.mNewCount <= tokens.Size());
+        for (size_t i = 0; same && i < fresh.Size(); ++i) {
+            same = (tokens.GetType(i) == fresh.GetType(i) && tokens.GetOffset(i) == fresh.GetOffset(i)
+                 && tokens.GetLength(i) == fresh.GetLength(i));
+        }
+        if (same && fresh.Size() > 0) {
+            size_t i = (seed >> 8) % fresh.Size();
+            StreamPosition relexPos = tokens.PositionOf(i);
+            StreamPosition freshPos = fresh.PositionOf(i);
+            same = (relexPos.mLineNum == freshPos.mLineNum && relexPos.mColNum == freshPos.mColNum);
+        }
+
+        if (!same) {
+            if (failures == 0) {
+                fprintf(stderr, "%s: edit %zu (offset %zu, removed %zu, inserted \"%s\") relexed to %zu tokens, "
+                        "lexing from scratch gives %zu.\n", _name, edit, offset, removed, inserted.c_str(),
+                        tokens.Size(), fresh.Size());
+            }
+            ++failures;
+
+            // Start the next edit from correct tokens, so one mistake isn't counted over and over.
+            Lexer resync(ruleSet, edited.data(), edited.size(), &state);
+            resync.TokenizeAll(&tokens);
+        }
+
+        current = 1 - current;
+    }
+
+    return failures;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+struct BenchResult
+{
+    const char* mTokenizer;
+    const char* mInput;
+    size_t mBytes;
+    size_t mTokens;
+    bool mComplete;
+    size_t mIterations;
+    double mSeconds;            // Fastest single iteration.
+    double mAllocsPerToken;
+    size_t mPeakRSSKB;
+};
+
+// ------------------------------------------------------------------------------------------------
+BenchResult RunBench(const Tokenizer& _tokenizer, const BenchInput& _input, double _minSeconds)
+{
+    BenchResult retResult;
+    retResult.mTokenizer = _tokenizer.mName;
+    retResult.mInput = _input.mName.c_str();
+    retResult.mBytes = _input.mContents.size();
+    retResult.mIterations = 0;
+    retResult.mSeconds = 0;
+
+    // The first run pays for any one-time setup (compiling rule sets, growing reused buffers), so
+    // allocations are counted on the second.
+    _tokenizer.Run(_input.mContents, &retResult.mComplete);
+    size_t allocsBefore = gAllocationCount;
+    retResult.mTokens = _tokenizer.Run(_input.mContents, &retResult.mComplete);
+    size_t allocs = gAllocationCount - allocsBefore;
+    retResult.mAllocsPerToken = retResult.mTokens ? double(allocs) / double(retResult.mTokens) : 0.0;
+
+    double totalSeconds = 0;
+    while (totalSeconds < _minSeconds || retResult.mIterations == 0) {
+        bool complete = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _tokenizer.Run(_input.mContents, &complete);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        totalSeconds += seconds;
+        if (retResult.mIterations == 0 || seconds < retResult.mSeconds) {
+            retResult.mSeconds = seconds;
+        }
+        ++retResult.mIterations;
+    }
+
+    retResult.mPeakRSSKB = PeakRSSKB();
+    return retResult;
+}
+
+// ------------------------------------------------------------------------------------------------
+enum EReportFormat {
+    ERF_Text,
+    ERF_CSV,
+    ERF_JSON
+};
+
+// ------------------------------------------------------------------------------------------------
+void PrintResult(EReportFormat _format, const BenchResult& _result, bool _first)
+{
+    double megabytesPerSecond = _result.mSeconds > 0 ? double(_result.mBytes) / (1024.0 * 1024.0) / _result.mSeconds : 0.0;
+    double tokensPerSecond = _result.mSeconds > 0 ? double(_result.mTokens) / _result.mSeconds : 0.0;
+
+    switch (_format) {
+        case ERF_Text:
+            if (_first) {
+                printf("%-18s %-28s %12s %10s %4s %6s %10s %14s %9s %10s\n", "tokenizer", "input", "bytes", "tokens",
+                       "ok", "iters", "MB/s", "tokens/s", "allocs/tk", "peakRSS_KB");
+            }
+            printf("%-18s %-28s %12zu %10zu %4s %6zu %10.2f %14.0f %9.3f %10zu\n", _result.mTokenizer, _result.mInput,
+                   _result.mBytes, _result.mTokens, _result.mComplete ? "yes" : "no", _result.mIterations,
+                   megabytesPerSecond, tokensPerSecond, _result.mAllocsPerToken, _result.mPeakRSSKB);
+            break;
+
+        case ERF_CSV:
+            if (_first) {
+                printf("tokenizer,input,bytes,tokens,complete,iterations,seconds,mb_per_s,tokens_per_s,allocs_per_token,peak_rss_kb\n");
+            }
+            printf("%s,%s,%zu,%zu,%d,%zu,%.9f,%.3f,%.0f,%.6f,%zu\n", _result.mTokenizer, _result.mInput,
+                   _result.mBytes, _result.mTokens, _result.mComplete ? 1 : 0, _result.mIterations, _result.mSeconds,
+                   megabytesPerSecond, tokensPerSecond, _result.mAllocsPerToken, _result.mPeakRSSKB);
+            break;
+
+        case ERF_JSON:
+            // Input names are file paths or generated names; neither needs escaping beyond '\'.
+            printf("%s\n  {\"tokenizer\": \"%s\", \"input\": \"", _first ? "[" : ",", _result.mTokenizer);
+            for (const char* c = _result.mInput; *c; ++c) {
+                printf(*c == '\\' || *c == '"' ? "\\%c" : "%c", *c);
+            }
+            printf("\", \"bytes\": %zu, \"tokens\": %zu, \"complete\": %s, \"iterations\": %zu, \"seconds\": %.9f, "
+                   "\"mb_per_s\": %.3f, \"tokens_per_s\": %.0f, \"allocs_per_token\": %.6f, \"peak_rss_kb\": %zu}",
+                   _result.mBytes, _result.mTokens, _result.mComplete ? "true" : "false", _result.mIterations,
+                   _result.mSeconds, megabytesPerSecond, tokensPerSecond, _result.mAllocsPerToken, _result.mPeakRSSKB);
+            break;
+    }
+    fflush(stdout);
+}
+
+// ------------------------------------------------------------------------------------------------
+void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: glslpp_bench [options] [files...]\n"
+        "  --format=text|csv|json   Output format (default text).\n"
+        "  --tests=DIR              Directory of .glsl files to run (default: the repo's tests/glslpp).\n"
+        "  --no-tests               Don't run the test files.\n"
+        "  --max-size=BYTES         Largest generated input (default 104857600; 0 for none).\n"
+        "  --min-time=SECONDS       Keep repeating each run for at least this long (default 0.5).\n"
+        "  --tokenizer=NAME         Only run NAME (may be given more than once).\n"
+        "  --check-relex[=EDITS]    Instead of benchmarking, check incremental re-lexing against\n"
+        "                           lexing from scratch over EDITS random edits to each input\n"
+        "                           (default 1000). Fails if any differ.\n"
+        "Files named on the command line are run as well as the test files.\n");
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    EReportFormat format = ERF_Text;
+    std::string testDir = GLSLPP_BENCH_TEST_DIR;
+    size_t maxSize = 100 * 1024 * 1024;
+    double minSeconds = 0.5;
+    std::vector<std::string> onlyTokenizers;
+    std::vector<std::string> files;
+    size_t relexEdits = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--format=text") {
+            format = ERF_Text;
+        } else if (arg == "--format=csv") {
+            format = ERF_CSV;
+        } else if (arg == "--format=json") {
+            format = ERF_JSON;
+        } else if (arg.compare(0, 8, "--tests=") == 0) {
+            testDir = arg.substr(8);
+        } else if (arg == "--no-tests") {
+            testDir.clear();
+        } else if (arg.compare(0, 11, "--max-size=") == 0) {
+            maxSize = size_t(strtoull(arg.c_str() + 11, NULL, 10));
+        } else if (arg.compare(0, 11, "--min-time=") == 0) {
+            minSeconds = atof(arg.c_str() + 11);
+        } else if (arg.compare(0, 12, "--tokenizer=") == 0) {
+            onlyTokenizers.push_back(arg.substr(12));
+        } else if (arg == "--check-relex") {
+            relexEdits = 1000;
+        } else if (arg.compare(0, 14, "--check-relex=") == 0) {
+            relexEdits = size_t(strtoull(arg.c_str() + 14, NULL, 10));
+        } else if (arg.compare(0, 2, "--") == 0) {
+            PrintUsage();
+            return GLCCError_MissingRequiredParameter;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (!testDir.empty()) {
+        std::vector<std::string> testFiles = ListShaderFiles(testDir);
+        files.insert(files.begin(), testFiles.begin(), testFiles.end());
+    }
+
+    std::vector<BenchInput> inputs;
+    for (size_t i = 0; i < files.size(); ++i) {
+        char* contents = fileContentsToString(files[i].c_str());
+        if (!contents) {
+            fprintf(stderr, "Couldn't read '%s', skipping it.\n", files[i].c_str());
+            continue;
+        }
+
+        BenchInput input;
+        input.mName = files[i];
+        input.mContents.assign(contents, size_t(computeFileSize(files[i].c_str())));
+        delete [] contents;
+        inputs.push_back(input);
+    }
+
+    static const size_t generatedSizes[] = { 1024, 10 * 1024, 100 * 1024, 1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024 };
+    static const char* const generatedNames[] = { "generated-1KB", "generated-10KB", "generated-100KB", "generated-1MB", "generated-10MB", "generated-100MB" };
+    for (size_t i = 0; i < sizeof(generatedSizes) / sizeof(generatedSizes[0]); ++i) {
+        if (maxSize && generatedSizes[i] > maxSize) {
+            break;
+        }
+
+        BenchInput input;
+        input.mName = generatedNames[i];
+        input.mContents = GenerateSource(generatedSizes[i]);
+        inputs.push_back(input);
+    }
+
+    // Edits are made to each input as a whole, so the generated ones are kept small.
+    if (relexEdits > 0) {
+        size_t failures = 0;
+        size_t edits = 0;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i].mContents.size() <= 100 * 1024) {
+                failures += CheckRelex(inputs[i].mName.c_str(), inputs[i].mContents, relexEdits, uint32_t(i + 1));
+                edits += relexEdits;
+            }
+        }
+
+        printf("relex: %zu of %zu edits differed from lexing from scratch\n", failures, edits);
+        return (failures == 0) ? GLCCError_Ok : GLCCError_InvalidOperation;
+    }
+
+    if (format == ERF_Text) {
+        printf("scan implementation: %s\n", GetScanImplementationName());
+    }
+
+    bool first = true;
+    for (size_t t = 0; t < sizeof(gTokenizers) / sizeof(gTokenizers[0]); ++t) {
+        if (!onlyTokenizers.empty() && std::find(onlyTokenizers.begin(), onlyTokenizers.end(), gTokenizers[t].mName) == onlyTokenizers.end()) {
+            continue;
+        }
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            PrintResult(format, RunBench(gTokenizers[t], inputs[i], minSeconds), first);
+            first = false;
+        }
+    }
+
+    if (format == ERF_JSON) {
+        printf(first ? "[]\n" : "\n]\n");
+    }
+
+    return GLCCError_Ok;
+}
@@ -0,0 +1,323 @@
+#include "glslppafx.h"
+
+#include "depscan.h"
+
+#include "earlyphases.h"
+#include "errorutils.h"
+#include "fileutils.h"
+#include "includecache.h"
+#include "stringutils.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsPunctuator(const PPToken& _token, uint32_t _id)
+{
+    return _token.mType == PPT_Punctuator && _token.mId == _id;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+DependencyScanner::DependencyScanner()
+: mIncludePaths(NULL)
+, mCompiler(&mInterner)
+, mConditionalBase(0)
+, mLine(1)
+, mVersion(0)
+{
+    SeedPPInterner(&mInterner);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::Scan(const char* _filename, const char* _text, size_t _length,
+                                const std::vector<std::string>* _optIncludePaths)
+{
+    // Only directive lines are ever interned, so starting afresh each time is cheap.
+    mInterner.Clear();
+    SeedPPInterner(&mInterner);
+
+    mIncludePaths = _optIncludePaths;
+    mConditionals.clear();
+    mConditionalBase = 0;
+    mLine = 1;
+    mSeen.clear();
+    mSeen.insert(_filename);
+    mVersion = 0;
+    mIncludes.clear();
+    mExtensions.clear();
+    mErrorString.clear();
+
+    return ScanText(_filename, _text, _length, 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::ScanText(const char* _filename, const char* _text, size_t _length, size_t _depth)
+{
+    // A file's conditionals are its own. Any it leaves open are closed when it ends, and an
+    // #endif too many can't close the includer's.
+    size_t savedLine = mLine;
+    size_t savedBase = mConditionalBase;
+    mLine = 1;
+    mConditionalBase = mConditionals.size();
+
+    const char* end = _text + _length;
+    const char* line = _text;
+    while (line != end) {
+        size_t skipped = 0;
+        line = PPFindDependencyDirective(line, end, &skipped);
+        mLine += skipped;
+        if (line == end) {
+            break;
+        }
+
+        const char* eol = (const char*) memchr(line, '\n', size_t(end - line));
+        const char* lineEnd = eol ? eol : end;
+        GLCCint errCode = Directive(_filename, line, size_t(lineEnd - line), _depth);
+        if (errCode != GLCCError_Ok) {
+            return errCode;
+        }
+
+        line = eol ? eol + 1 : end;
+        ++mLine;
+    }
+
+    mConditionals.resize(mConditionalBase);
+    mConditionalBase = savedBase;
+    mLine = savedLine;
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::ScanFile(const char* _includer, const std::string& _path, size_t _depth)
+{
+    MappedFile mapped;
+    if (!mapped.Open(_path.c_str())) {
+        return IsTaken() ? Error(GLCCError_FileNotFound, _includer, "cannot open include file \"%s\"", _path.c_str())
+                         : GLCCError_Ok;
+    }
+
+    // The file above this one is still being scanned, from its own buffer. Moving the buffers
+    // around as there come to be more of them doesn't move what's in them.
+    if (mTexts.size() <= _depth) {
+        mTexts.resize(_depth + 1);
+    }
+    std::vector<char>& text = mTexts[_depth];
+    bufferResize(&text, mapped.GetSize() + 1);
+
+    bool usedContinuations = false;
+    size_t textLength = PreprocessEarlyPhases(mapped.GetData(), mapped.GetSize(), text.data(),
+                                              true, &usedContinuations, NULL);
+    mapped.Close();
+
+    return ScanText(_path.c_str(), text.data(), textLength, _depth);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::Directive(const char* _filename, const char* _text, size_t _length, size_t _depth)
+{
+    // '#', the name, and then its arguments up to the EOL PPTokenize ends the line with.
+    mTokens.clear();
+    PPTokenize(_text, _length, &mInterner, &mTokens);
+    assert(mTokens.size() >= 3 && IsPunctuator(mTokens[0], PPS_Hash));
+    const PPToken* args = mTokens.data() + 2;
+    const PPToken* argsEnd = mTokens.data() + mTokens.size() - 1;
+
+    switch (mTokens[1].mId) {
+        case PPS_If:
+        case PPS_Ifdef:
+        case PPS_Ifndef:
+        {
+            Conditional cond;
+            cond.mEnclosingLive = IsLive();
+            cond.mEnclosingTaken = IsTaken();
+            if (!cond.mEnclosingLive) {
+                cond.mBranch = EB_Skipped;
+            } else if (mTokens[1].mId == PPS_If) {
+                cond.mBranch = Evaluate(args, argsEnd);
+            } else {
+                cond.mBranch = EB_Maybe;
+            }
+            cond.mAnyTaken = (cond.mBranch == EB_Taken);
+            cond.mAllSkipped = (cond.mBranch == EB_Skipped);
+            mConditionals.push_back(cond);
+            return GLCCError_Ok;
+        }
+
+        case PPS_Elif:
+        case PPS_Else:
+        {
+            if (mConditionals.size() == mConditionalBase) {
+                return GLCCError_Ok;
+            }
+
+            Conditional& cond = mConditionals.back();
+            if (!cond.mEnclosingLive || cond.mAnyTaken) {
+                cond.mBranch = EB_Skipped;
+            } else if (mTokens[1].mId == PPS_Elif) {
+                cond.mBranch = Evaluate(args, argsEnd);
+            } else {
+                cond.mBranch = cond.mAllSkipped ? EB_Taken : EB_Maybe;
+            }
+            cond.mAnyTaken = cond.mAnyTaken || (cond.mBranch == EB_Taken);
+            cond.mAllSkipped = cond.mAllSkipped && (cond.mBranch == EB_Skipped);
+            return GLCCError_Ok;
+        }
+
+        case PPS_Endif:
+            if (mConditionals.size() > mConditionalBase) {
+                mConditionals.pop_back();
+            }
+            return GLCCError_Ok;
+
+        case PPS_Include:
+            return IsLive() ? Include(_filename, args, argsEnd, _depth) : GLCCError_Ok;
+
+        case PPS_Version:
+        {
+            // Only the input's own, which phase four insists comes before anything else.
+            long long version = 0;
+            if (_depth == 0 && mVersion == 0 && IsLive() && args != argsEnd && args->mType == PPT_Number
+             && mCompiler.EvaluateOperand(args, args + 1, &version)) {
+                mVersion = (GLCCint) version;
+            }
+            return GLCCError_Ok;
+        }
+
+        case PPS_Extension:
+            if (IsLive()) {
+                Extension(args, argsEnd);
+            }
+            return GLCCError_Ok;
+
+        default:
+            assert(!"PPFindDependencyDirective found a directive that isn't one of ours");
+            return GLCCError_Ok;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::Include(const char* _filename, const PPToken* _args, const PPToken* _argsEnd, size_t _depth)
+{
+    // "name" or <name>, put back together as phase four does it. A name made by a macro could be
+    // anything, so a scan that finds one can't say what the input depends on.
+    const PPToken* tok = _args;
+    bool isQuote = (tok != _argsEnd && tok->mType == PPT_Other && mInterner.GetString(tok->mId)[0] == '"');
+    bool isSystem = (tok != _argsEnd && IsPunctuator(*tok, PPS_LeftAngle));
+    if (!isQuote && !isSystem) {
+        if (tok != _argsEnd && tok->mType == PPT_Identifier) {
+            return Error(GLCCError_InvalidSyntax, _filename, "#include of a macro can't be scanned");
+        }
+        return IsTaken() ? Error(GLCCError_InvalidSyntax, _filename, "#include expects \"FILENAME\" or <FILENAME>")
+                         : GLCCError_Ok;
+    }
+
+    mIncludeName.clear();
+    bool closed = false;
+    for (++tok; tok != _argsEnd; ++tok) {
+        closed = isQuote ? (tok->mType == PPT_Other && mInterner.GetString(tok->mId)[0] == '"')
+                         : IsPunctuator(*tok, PPS_RightAngle);
+        if (closed) {
+            ++tok;
+            break;
+        }
+
+        if (tok->mFlags & PPTF_LeadingSpace) {
+            mIncludeName += ' ';
+        }
+        mIncludeName.append(mInterner.GetString(tok->mId), mInterner.GetLength(tok->mId));
+    }
+
+    if (!closed || tok != _argsEnd || mIncludeName.empty()) {
+        return IsTaken() ? Error(GLCCError_InvalidSyntax, _filename, "#include expects \"FILENAME\" or <FILENAME>")
+                         : GLCCError_Ok;
+    }
+
+    // A file that isn't there only matters if it's certainly needed. Each file is scanned once:
+    // everything it could include was found the first time.
+    std::string path;
+    if (!ResolveIncludePath(_filename, mIncludeName, isSystem, mIncludePaths, &path)) {
+        return IsTaken() ? Error(GLCCError_FileNotFound, _filename, "cannot find include file \"%s\"", mIncludeName.c_str())
+                         : GLCCError_Ok;
+    }
+
+    if (!mSeen.insert(path).second) {
+        return GLCCError_Ok;
+    }
+    mIncludes.push_back(path);
+
+    return ScanFile(_filename, path, _depth + 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+void DependencyScanner::Extension(const PPToken* _args, const PPToken* _argsEnd)
+{
+    // name : behavior. Anything else is for the compiler to complain about.
+    if (_argsEnd - _args != 3 || _args[0].mType != PPT_Identifier || !IsPunctuator(_args[1], PPS_Colon)
+     || _args[2].mType != PPT_Identifier) {
+        return;
+    }
+
+    std::string extension(mInterner.GetString(_args[0].mId), mInterner.GetLength(_args[0].mId));
+    extension += " : ";
+    extension.append(mInterner.GetString(_args[2].mId), mInterner.GetLength(_args[2].mId));
+    if (std::find(mExtensions.begin(), mExtensions.end(), extension) == mExtensions.end()) {
+        mExtensions.push_back(extension);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+DependencyScanner::EBranch DependencyScanner::Evaluate(const PPToken* _args, const PPToken* _argsEnd)
+{
+    // Names are left to be looked up when it runs, so only an expression that folded all the way
+    // down is known without any macros.
+    PPCondition condition;
+    const char* error = NULL;
+    if (!mCompiler.Compile(_args, _argsEnd, true, &condition, &error)
+     || condition.mOpCount != 1 || condition.mOps[0].mOp != PPCO_Constant) {
+        return EB_Maybe;
+    }
+
+    return (condition.mConstants[condition.mOps[0].mArg] != 0) ? EB_Taken : EB_Skipped;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint DependencyScanner::Error(GLCCint _errCode, const char* _filename, const char* _fmt, ...)
+{
+    char message[512];
+    va_list args;
+    va_start(args, _fmt);
+    vsnprintf(message, sizeof(message), _fmt, args);
+    va_end(args);
+
+    return ReportError(_errCode, this, "%s(%lld): error: %s\n", _filename, (long long) mLine, message);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool DependencyScanner::IsLive() const
+{
+    // The innermost conditional says it all: one inside a branch that isn't taken is skipped
+    // from the start.
+    if (mConditionals.empty()) {
+        return true;
+    }
+
+    const Conditional& cond = mConditionals.back();
+    return cond.mEnclosingLive && cond.mBranch != EB_Skipped;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool DependencyScanner::IsTaken() const
+{
+    if (mConditionals.empty()) {
+        return true;
+    }
+
+    const Conditional& cond = mConditionals.back();
+    return cond.mEnclosingTaken && cond.mBranch == EB_Taken;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common/common.h"
+#include "common/hashutil.h"
+#include "ppcondition.h"
+#include "pptokens.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Finds what a shader depends on without preprocessing it: every file it might #include, its
+// #version, and the #extension lines that might apply. Only the lines of the directives that
+// matter here are tokenized (see PPFindDependencyDirective); everything else is passed over a
+// line at a time, at the speed of memchr. Nothing is expanded and no output is made.
+//
+// Without macros, most conditionals can't be decided, and any branch which might be taken is
+// scanned. Only an #if or #elif that is constant as written (#if 0, #if 1 || X) is known to be
+// taken or not, and an #else after them. So the includes found are always at least those that
+// preprocessing would read, and can be more. An #include whose name comes from a macro can't be
+// followed, and fails the scan unless it's in a branch known not to be taken.
+class DependencyScanner
+{
+public:
+    DependencyScanner();
+
+    // Scans _text, which has already been through phases two and three (with _maintainLineCount,
+    // so errors have the right line numbers). _filename is where it came from: "name" includes
+    // look next to it. _optIncludePaths are searched as phase four would, and must last as long
+    // as the call. Forgets the last scan.
+    GLCCint Scan(const char* _filename, const char* _text, size_t _length,
+                 const std::vector<std::string>* _optIncludePaths);
+
+    // The first #version's number in the input (not its includes), or 0 if it has none.
+    GLCCint GetVersion() const { return mVersion; }
+
+    // Every file found, each once, in the order they were first included.
+    const std::vector<std::string>& GetIncludes() const { return mIncludes; }
+
+    // Every distinct #extension, as "name : behavior", in the order first seen.
+    const std::vector<std::string>& GetExtensions() const { return mExtensions; }
+
+    const char* GetErrorString() const { return mErrorString.empty() ? NULL : mErrorString.data(); }
+
+private:
+    DependencyScanner(const DependencyScanner&);
+    DependencyScanner& operator=(const DependencyScanner&);
+
+    template<typename T>
+    friend GLCCint ReportError(GLCCint _errCode, T *_where, const char* _fmt, ...);
+
+    enum EBranch {
+        EB_Taken = 0,
+        EB_Skipped,
+        EB_Maybe
+    };
+
+    // An open conditional.
+    struct Conditional
+    {
+        EBranch mBranch;        // The branch being scanned now.
+        bool mEnclosingLive;    // Whether the branch around the conditional might be taken.
+        bool mEnclosingTaken;   // Whether the branch around the conditional is taken for sure.
+        bool mAnyTaken;         // Whether an earlier branch was taken for sure.
+        bool mAllSkipped;       // Whether every earlier branch was known not to be taken.
+    };
+
+    GLCCint ScanText(const char* _filename, const char* _text, size_t _length, size_t _depth);
+    GLCCint ScanFile(const char* _includer, const std::string& _path, size_t _depth);
+    GLCCint Directive(const char* _filename, const char* _text, size_t _length, size_t _depth);
+    GLCCint Include(const char* _filename, const PPToken* _args, const PPToken* _argsEnd, size_t _depth);
+    void Extension(const PPToken* _args, const PPToken* _argsEnd);
+    EBranch Evaluate(const PPToken* _args, const PPToken* _argsEnd);
+    GLCCint Error(GLCCint _errCode, const char* _filename, const char* _fmt, ...);
+
+    // Whether the line being scanned might be preprocessed, or certainly will be.
+    bool IsLive() const;
+    bool IsTaken() const;
+
+    const std::vector<std::string>* mIncludePaths;
+
+    StringInterner mInterner;
+    PPConditionCompiler mCompiler;
+    std::vector<PPToken> mTokens;       // The directive being looked at.
+    std::vector<Conditional> mConditionals;
+    size_t mConditionalBase;            // The first of mConditionals opened in this file.
+    std::vector<std::vector<char> > mTexts;     // Each include depth's file, after phase three.
+    std::string mIncludeName;
+    size_t mLine;                       // In the file being scanned, from 1.
+
+    std::set<std::string> mSeen;        // Every file scanned, the input's name included.
+    GLCCint mVersion;
+    std::vector<std::string> mIncludes;
+    std::vector<std::string> mExtensions;
+
+    std::vector<char> mErrorString;
+};
@@ -0,0 +1,360 @@
+#include "glslppafx.h"
+
+#include "diskcache.h"
+
+#include "fileutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#ifdef _WIN32
+#	include <direct.h>
+#	include <process.h>
+#	include <sys/utime.h>
+#else
+#	include <dirent.h>
+#	include <utime.h>
+#endif
+
+namespace {
+
+// Bumped whenever the entry layout changes. Old entries then simply never match.
+const char kEntryMagic[8] = { 'G', 'L', 'P', 'P', 'C', 'A', '0', '1' };
+
+// Which version of the preprocessor's output an entry holds. It's part of every key, so bump it
+// with every change to what preprocessing outputs, however small: entries made before the change
+// are then missed rather than returned.
+//   1: The output the cache started with.
+//   2: Line continuations padded by phase four, from the line map.
+//   3: That padding put where streaming puts it, at the EOL ending the spliced line.
+const uint32_t kOutputVersion = 3;
+const char kEntryExtension[] = ".glppc";
+
+const unsigned long long kDefaultMaxBytes = 256ULL * 1024 * 1024;
+
+// On-disk layout of an entry, all native-endian. The header, then for each included file an
+// IncludeRecord followed by its path, then the output.
+struct EntryHeader
+{
+    char mMagic[8];
+    uint64_t mKeyLow;
+    uint64_t mKeyHigh;
+    uint64_t mOutputLength;
+    int32_t mVersion;
+    uint32_t mIncludeCount;
+};
+
+struct IncludeRecord
+{
+    int64_t mSize;
+    int64_t mModTime;
+    uint64_t mHashLow;
+    uint64_t mHashHigh;
+    uint32_t mPathLength;
+};
+
+struct EntryInfo
+{
+    std::string mPath;
+    unsigned long long mSize;
+    long long mModTime;
+
+    bool operator<(const EntryInfo& _rhs) const { return mModTime < _rhs.mModTime; }
+};
+
+std::atomic<unsigned> sTempCounter(0);
+
+// ------------------------------------------------------------------------------------------------
+void AppendBytes(std::vector<char>* _buffer, const void* _data, size_t _length)
+{
+    size_t offset = _buffer->size();
+    bufferResize(_buffer, offset + _length);
+    if (_length > 0) {
+        memcpy(_buffer->data() + offset, _data, _length);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether the file at _path is still what _record says it was.
+bool IsUnchanged(const std::string& _path, const IncludeRecord& _record)
+{
+    long long size = 0;
+    long long modTime = 0;
+    if (!computeFileStamp(_path.c_str(), &size, &modTime) || size != _record.mSize) {
+        return false;
+    }
+
+    if (modTime == _record.mModTime) {
+        return true;
+    }
+
+    // Touched, but maybe not changed.
+    MappedFile mapped;
+    if (!mapped.Open(_path.c_str())) {
+        return false;
+    }
+    Hash128 hash = HashBytes128(mapped.GetData(), mapped.GetSize());
+    return hash.mLow == _record.mHashLow && hash.mHigh == _record.mHashHigh;
+}
+
+// ------------------------------------------------------------------------------------------------
+void ListEntries(const std::string& _directory, std::vector<EntryInfo>* _outEntries)
+{
+    size_t extensionLength = strlen(kEntryExtension);
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE find = FindFirstFileA((_directory + "\\*").c_str(), &found);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    do {
+        size_t nameLength = strlen(found.cFileName);
+        if (nameLength <= extensionLength || strcmp(found.cFileName + nameLength - extensionLength, kEntryExtension) != 0) {
+            continue;
+        }
+
+        EntryInfo info;
+        info.mPath = _directory + "/" + found.cFileName;
+        info.mSize = ((unsigned long long) found.nFileSizeHigh << 32) | found.nFileSizeLow;
+        info.mModTime = (long long) (((unsigned long long) found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime);
+        _outEntries->push_back(info);
+    } while (FindNextFileA(find, &found));
+    FindClose(find);
+#else
+    DIR* dir = opendir(_directory.c_str());
+    if (!dir) {
+        return;
+    }
+
+    while (struct dirent* found = readdir(dir)) {
+        size_t nameLength = strlen(found->d_name);
+        if (nameLength <= extensionLength || strcmp(found->d_name + nameLength - extensionLength, kEntryExtension) != 0) {
+            continue;
+        }
+
+        EntryInfo info;
+        info.mPath = _directory + "/" + found->d_name;
+        long long size = 0;
+        if (!computeFileStamp(info.mPath.c_str(), &size, &info.mModTime)) {
+            continue;
+        }
+        info.mSize = (unsigned long long) size;
+        _outEntries->push_back(info);
+    }
+    closedir(dir);
+#endif
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+DiskCache::DiskCache(const char* _directory, unsigned long long _maxBytes)
+: mDirectory(_directory)
+, mMaxBytes(_maxBytes != 0 ? _maxBytes : kDefaultMaxBytes)
+{
+    // Fails harmlessly if it's already there. If it can't be made, every lookup just misses.
+#ifdef _WIN32
+    _mkdir(mDirectory.c_str());
+#else
+    mkdir(mDirectory.c_str(), 0777);
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+Hash128 DiskCache::ComputeKey(bool _maintainLineCount, const std::vector<std::string>& _includePaths,
+                              const IncludedFile* _predefines, const char* _filename,
+                              const char* _input, size_t _length)
+{
+    // Strings go in with their lengths, so no two different sets of them hash the same bytes.
+    StreamHash128 hasher;
+    hasher.Update(kEntryMagic, sizeof(kEntryMagic));
+    hasher.UpdateValue(kOutputVersion);
+    hasher.UpdateValue(uint8_t(_maintainLineCount));
+
+    hasher.UpdateValue(uint64_t(_includePaths.size()));
+    for (size_t i = 0; i < _includePaths.size(); ++i) {
+        hasher.UpdateValue(uint64_t(_includePaths[i].size()));
+        hasher.Update(_includePaths[i].data(), _includePaths[i].size());
+    }
+
+    // The macros as defined, rather than the options they came from.
+    Hash128 predefines = { 0, 0 };
+    if (_predefines) {
+        predefines = _predefines->mContentHash;
+    }
+    hasher.UpdateValue(predefines.mLow);
+    hasher.UpdateValue(predefines.mHigh);
+
+    // The name matters: "name" includes are looked for next to it.
+    size_t filenameLength = strlen(_filename);
+    hasher.UpdateValue(uint64_t(filenameLength));
+    hasher.Update(_filename, filenameLength);
+
+    hasher.UpdateValue(uint64_t(_length));
+    hasher.Update(_input, _length);
+    return hasher.Finish();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool DiskCache::Lookup(const Hash128& _key, std::vector<char>* _outOutput, GLCCint* _outVersion)
+{
+    std::string path = EntryPath(_key);
+    MappedFile mapped;
+    if (!mapped.Open(path.c_str())) {
+        return false;
+    }
+
+    // Anything that doesn't add up--truncated, another version's, a different key--is a miss.
+    const char* data = mapped.GetData();
+    size_t size = mapped.GetSize();
+    EntryHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.mMagic, kEntryMagic, sizeof(kEntryMagic)) != 0
+     || header.mKeyLow != _key.mLow || header.mKeyHigh != _key.mHigh) {
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    std::string includePath;
+    for (uint32_t i = 0; i < header.mIncludeCount; ++i) {
+        IncludeRecord record;
+        if (size - offset < sizeof(record)) {
+            return false;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (size - offset < record.mPathLength) {
+            return false;
+        }
+        includePath.assign(data + offset, record.mPathLength);
+        offset += record.mPathLength;
+
+        if (!IsUnchanged(includePath, record)) {
+            return false;
+        }
+    }
+
+    if (size - offset != header.mOutputLength) {
+        return false;
+    }
+
+    bufferResize(_outOutput, size_t(header.mOutputLength) + 1);
+    memcpy(_outOutput->data(), data + offset, size_t(header.mOutputLength));
+    (*_outOutput)[size_t(header.mOutputLength)] = '\0';
+    (*_outVersion) = header.mVersion;
+
+    // Recently used, as far as eviction is concerned.
+    mapped.Close();
+    utime(path.c_str(), NULL);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void DiskCache::Store(const Hash128& _key, const std::vector<std::shared_ptr<const IncludedFile> >& _includes,
+                      const char* _output, size_t _length, GLCCint _version)
+{
+    EntryHeader header;
+    memcpy(header.mMagic, kEntryMagic, sizeof(kEntryMagic));
+    header.mKeyLow = _key.mLow;
+    header.mKeyHigh = _key.mHigh;
+    header.mOutputLength = _length;
+    header.mVersion = _version;
+    header.mIncludeCount = uint32_t(_includes.size());
+
+    mEntry.clear();
+    AppendBytes(&mEntry, &header, sizeof(header));
+    for (size_t i = 0; i < _includes.size(); ++i) {
+        const IncludedFile& file = *_includes[i];
+
+        IncludeRecord record;
+        record.mSize = file.mSize;
+        record.mModTime = file.mModTime;
+        record.mHashLow = file.mContentHash.mLow;
+        record.mHashHigh = file.mContentHash.mHigh;
+        record.mPathLength = uint32_t(file.mPath.size());
+        AppendBytes(&mEntry, &record, sizeof(record));
+        AppendBytes(&mEntry, file.mPath.data(), file.mPath.size());
+    }
+    AppendBytes(&mEntry, _output, _length);
+
+    // Something that could never fit would only push everything else out.
+    if (mEntry.size() > mMaxBytes) {
+        return;
+    }
+
+    // Written somewhere private, then renamed into place, so nobody ever maps half an entry.
+    std::string path = EntryPath(_key);
+    char suffix[64];
+#ifdef _WIN32
+    sprintf(suffix, ".%d.%u.tmp", _getpid(), unsigned(sTempCounter++));
+#else
+    sprintf(suffix, ".%d.%u.tmp", int(getpid()), unsigned(sTempCounter++));
+#endif
+    std::string tempPath = path + suffix;
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    bool written = (fwrite(mEntry.data(), 1, mEntry.size(), file) == mEntry.size());
+    written = (fclose(file) == 0) && written;
+
+#ifdef _WIN32
+    bool placed = written && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    bool placed = written && rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!placed) {
+        remove(tempPath.c_str());
+        return;
+    }
+
+    // Listing the directory on every store would cost more than the cache saves. Instead the
+    // odds of trimming are scaled so that, across every process sharing the cache, it happens
+    // about every sixteenth of the limit written. The key makes a fine random number.
+    unsigned long long storesPerTrim = mMaxBytes / (16 * (unsigned long long) mEntry.size());
+    if (storesPerTrim <= 1 || (_key.mHigh % storesPerTrim) == 0) {
+        Trim();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+std::string DiskCache::EntryPath(const Hash128& _key) const
+{
+    char name[64];
+    sprintf(name, "/%016llx%016llx%s", (unsigned long long) _key.mHigh, (unsigned long long) _key.mLow, kEntryExtension);
+    return mDirectory + name;
+}
+
+// ------------------------------------------------------------------------------------------------
+void DiskCache::Trim()
+{
+    std::vector<EntryInfo> entries;
+    ListEntries(mDirectory, &entries);
+
+    unsigned long long total = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        total += entries[i].mSize;
+    }
+    if (total <= mMaxBytes) {
+        return;
+    }
+
+    // Oldest first, down to 90% of the limit so the next few stores don't have to trim again.
+    std::sort(entries.begin(), entries.end());
+    unsigned long long target = mMaxBytes - mMaxBytes / 10;
+    for (size_t i = 0; i < entries.size() && total > target; ++i) {
+        if (remove(entries[i].mPath.c_str()) == 0) {
+            total -= entries[i].mSize;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common/common.h"
+#include "common/hashutil.h"
+#include "includecache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Preprocessed output kept on disk, so a build that preprocesses the same source with the same
+// options again gets the output back without preprocessing anything.
+// An entry is keyed by a hash of everything known before preprocessing starts: the input's bytes
+// and name, and the options (include paths and predefined macros included). What it #includes
+// isn't known until the end, so the entry records each included file's path and content hash,
+// and a lookup only hits if every one of them is unchanged. A file whose size and modification
+// time are what they were isn't read again to check.
+// One file per entry, in a single directory, written under a temporary name and renamed into
+// place--so any number of processes can share a cache. Entries are read through a mapping. Hits
+// touch the entry's modification time, and once the directory is over its size limit the least
+// recently used entries are deleted.
+// Not caught: a new file appearing earlier in the include path than the one that was used.
+class DiskCache
+{
+public:
+    // _maxBytes of 0 means the default, 256M.
+    DiskCache(const char* _directory, unsigned long long _maxBytes);
+
+    // The options that change the output: _maintainLineCount and _includePaths are as in
+    // GLPPOptions, and _predefines is the predefined macros' file (see MakeIncludedFile), or NULL
+    // if there are none.
+    static Hash128 ComputeKey(bool _maintainLineCount, const std::vector<std::string>& _includePaths,
+                              const IncludedFile* _predefines, const char* _filename,
+                              const char* _input, size_t _length);
+
+    // On a hit, returns true with the output in _outOutput ('\0' terminated) and the #version it
+    // declared in _outVersion.
+    bool Lookup(const Hash128& _key, std::vector<char>* _outOutput, GLCCint* _outVersion);
+
+    // _length doesn't include the '\0'. Failures are ignored; the cache is only ever a cache.
+    void Store(const Hash128& _key, const std::vector<std::shared_ptr<const IncludedFile> >& _includes,
+               const char* _output, size_t _length, GLCCint _version);
+
+private:
+    DiskCache(const DiskCache&);
+    DiskCache& operator=(const DiskCache&);
+
+    std::string EntryPath(const Hash128& _key) const;
+    void Trim();
+
+    std::string mDirectory;
+    unsigned long long mMaxBytes;
+    std::vector<char> mEntry;           // The one being written, reused.
+};
@@ -0,0 +1,422 @@
+#include "glslppafx.h"
+
+#include "earlyphases.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+// Returned by Next and Peek when the answer depends on input which hasn't been fed yet. Real
+// characters come back as unsigned char, so this can't collide with any of them.
+const int kNeedMore = 0x100;
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// PreprocessEarlyPhases' sink: writes straight into the destination buffer, and keeps the line
+// map if there is one.
+struct DirectSink
+{
+    DirectSink(const char* _src, char* _dst, LineMap* _optLineMap)
+    : mDst(_dst)
+    , mDstBegin(_dst)
+    , mLineMap(_optLineMap)
+    , mMarkSrc(_src)
+    , mMarkLineStart(_src)
+    , mMarkLine(1)
+    { }
+
+    inline void Write(const char* _text, size_t _length)
+    {
+        // Until the first comment or continuation an in-place run is already where it belongs.
+        if (mDst != _text) {
+            memmove(mDst, _text, _length);
+        }
+        mDst += _length;
+    }
+
+    inline void Put(char _char) { (*mDst++) = _char; }
+
+    // The EOL just written, before _src, ends a line that _splicedLines lines (all told) have been
+    // spliced onto. Lines are only counted here, from one mark to the next, so the map costs
+    // nothing where nothing is spliced.
+    inline void Mark(const char* _src, uint32_t _splicedLines)
+    {
+        if (!mLineMap) {
+            return;
+        }
+
+        // The entry goes on the EOL, which puts it on the line it ends (see PhaseFour::NextLine).
+        assert(mDst != mDstBegin && mDst[-1] == '\n' && _src[-1] == '\n');
+        char* dst = mDst - 1;
+        --_src;
+
+        const char* lastNewLine = NULL;
+        size_t newLines = ScanCountNewLines(mMarkSrc, _src, &lastNewLine);
+        if (newLines > 0) {
+            mMarkLine += uint32_t(newLines);
+            mMarkLineStart = lastNewLine + 1;
+        }
+        mMarkSrc = _src;
+
+        // Every EOL makes it to the output, except for the spliced ones.
+        mLineMap->Add(uint64_t(dst - mDstBegin), mMarkLine - _splicedLines, mMarkLine,
+                      uint32_t(_src - mMarkLineStart) + 1);
+    }
+
+    char* mDst;
+    char* mDstBegin;
+    LineMap* mLineMap;
+    const char* mMarkSrc;
+    const char* mMarkLineStart;
+    uint32_t mMarkLine;
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+EarlyPhasesStream::EarlyPhasesStream(bool _maintainLineCount, EarlyPhasesOutputFn _outputFn, void* _userData)
+: mOutputFn(_outputFn)
+, mUserData(_userData)
+, mSrc(NULL)
+, mEnd(NULL)
+, mFinal(false)
+, mMaintainLineCount(_maintainLineCount)
+, mCommentMode(ECM_NoComment)
+, mContiguousLinesContinued(0)
+, mPaddingRemaining(0)
+, mPendingSlash(false)
+, mPendingStar(false)
+, mCarriedBackslash(false)
+, mUsedContinuations(false)
+, mSplicedLineEnded(false)
+, mSplicedLines(0)
+, mDone(false)
+, mOutputUsed(0)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+void EarlyPhasesStream::Feed(const char* _chunk, size_t _chunkLength)
+{
+    if (mDone || _chunkLength == 0) {
+        return;
+    }
+
+    mFinal = false;
+
+    if (mCarriedBackslash) {
+        // The last chunk ended in a '\', and whether that was a continuation depends on the first
+        // character of this one. Run the two of them together; the '\' always gets consumed once
+        // its successor is known, so this picks up in _chunk exactly where that left off.
+        const char stitched[2] = { '\\', _chunk[0] };
+        mSrc = stitched;
+        mEnd = stitched + 2;
+        mCarriedBackslash = false;
+        Run(this);
+
+        size_t stitchedUsed = size_t(mSrc - stitched);
+        assert(stitchedUsed >= 1 || mDone);
+        if (mDone) {
+            return;
+        }
+
+        _chunk += stitchedUsed - 1;
+        _chunkLength -= stitchedUsed - 1;
+    }
+
+    mSrc = _chunk;
+    mEnd = _chunk + _chunkLength;
+    Run(this);
+
+    // Run only stops short of the end for a trailing '\'.
+    if (!mDone && mSrc != mEnd) {
+        assert(mEnd - mSrc == 1 && mSrc[0] == '\\');
+        mCarriedBackslash = true;
+    }
+    mSrc = mEnd = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+void EarlyPhasesStream::Finish()
+{
+    if (!mDone) {
+        const char carried = '\\';
+        mSrc = mEnd = &carried;
+        if (mCarriedBackslash) {
+            ++mEnd;
+            mCarriedBackslash = false;
+        }
+
+        mFinal = true;
+        Run(this);
+        assert(mDone);
+        mSrc = mEnd = NULL;
+    }
+
+    Flush();
+}
+
+// ------------------------------------------------------------------------------------------------
+// Phase two as a stream: hands out the source with line continuations already spliced out (and
+// the line count padding, if requested, already in). Single characters come from Next and Peek;
+// TakeRun hands out whole runs of characters that need no special handling at once.
+// Returns the next character, '\0' at the end (and keeps doing so if called again), or kNeedMore
+// if that depends on the next chunk. Only real characters are consumed.
+inline int EarlyPhasesStream::Next()
+{
+    int retChar = Peek();
+    if (mPaddingRemaining > 0) {
+        --mPaddingRemaining;
+    } else if (retChar != '\0' && retChar != kNeedMore) {
+        ++mSrc;
+        if (retChar == '\n' && mContiguousLinesContinued > 0) {
+            if (mMaintainLineCount) {
+                // Combined with the '\n' we pick up from this line, this winds up with
+                // <SPACE><EOL> on each line. This '\n' is the first of the padding; the real
+                // one comes last.
+                mPaddingRemaining = 2 * mContiguousLinesContinued;
+            }
+            mContiguousLinesContinued = 0;
+            mSplicedLineEnded = true;
+        }
+    }
+    return retChar;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns what Next would, without consuming it.
+inline int EarlyPhasesStream::Peek()
+{
+    if (mPaddingRemaining > 0) {
+        // The padding is "<EOL><SPACE>" per continued line followed by the real EOL, and the
+        // first <EOL> has already been handed out. So odd counts are EOLs.
+        return (mPaddingRemaining & 1) ? '\n' : ' ';
+    }
+
+    // Splicing continuations here is safe, it's what Next would have to do anyway.
+    for (;;) {
+        if (mSrc == mEnd) {
+            return mFinal ? '\0' : kNeedMore;
+        }
+
+        if (mSrc[0] != '\\') {
+            return (unsigned char) mSrc[0];
+        }
+
+        if (mSrc + 1 == mEnd) {
+            // Whether this starts a continuation is up to the next chunk.
+            return mFinal ? '\\' : kNeedMore;
+        }
+
+        if (mSrc[1] != '\n') {
+            return '\\';
+        }
+
+        ++mContiguousLinesContinued;
+        ++mSplicedLines;
+        mUsedContinuations = true;
+        mSrc += 2;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Consumes the longest run of characters in _class, and returns where they start. _class must
+// exclude '\0' and '\\', and also '\n' if HasPendingContinuations; those are the only
+// characters which need phase two's attention. The scan is vectorized, see scan.h.
+inline const char* EarlyPhasesStream::TakeRun(EScanClass _class, size_t* _outLength)
+{
+    const char* runStart = mSrc;
+    if (mPaddingRemaining == 0) {
+        mSrc = ScanSkipClass(_class, mSrc, mEnd);
+    }
+
+    (*_outLength) = size_t(mSrc - runStart);
+    return runStart;
+}
+
+// ------------------------------------------------------------------------------------------------
+template <typename TSink>
+void EarlyPhasesStream::Run(TSink* _sink)
+{
+    // ANNOY: Line continuation isn't supported in all versions of GLSL--added in GLSL420.
+    //     We could detect the #version here and error out if line continuations are used and
+    //     the version is less than 420. Instead, we just record whether line continuation
+    //     occurred and a later phase will croak. That simplifies the processing here.
+    //
+    // Phase three (comments) runs over phase two's output as it's produced. At that point, line
+    // continuations are gone, so any EOLs are "real", and will have effects on non-comment
+    // characters. According to the C Preprocessor documentation:
+    //     - Comments are replaced by one space
+    //     - EOLs are preserved in both single and multi-line comments.
+    // Nothing is ever written ahead of what has been read, so this works in-place, too.
+    //
+    // When a decision needs a character that hasn't been fed yet, Next or Peek say so and this
+    // returns. The only decisions like that are whether a '/' starts a comment and whether a '*'
+    // ends one; those are remembered in mPendingSlash and mPendingStar, so the next chunk can
+    // pick up right there.
+    while (!mDone) {
+        size_t runLength = 0;
+        const char* run = NULL;
+        int thisChar = '\0';
+
+        // The EOL that padding would follow has just been written, in a comment or not (see
+        // LineMap).
+        if (mSplicedLineEnded) {
+            _sink->Mark(mSrc, mSplicedLines);
+            mSplicedLineEnded = false;
+        }
+
+        switch (mCommentMode) {
+            case ECM_NoComment:
+            {
+                if (!mPendingSlash) {
+                    // Plain text is copied straight through.
+                    run = TakeRun(HasPendingContinuations() ? ESC_PlainLineText : ESC_PlainText, &runLength);
+                    _sink->Write(run, runLength);
+
+                    thisChar = Next();
+                    if (thisChar != '/') {
+                        if (thisChar != '\0' && thisChar != kNeedMore) {
+                            _sink->Put(char(thisChar));
+                        }
+                        break;
+                    }
+                    mPendingSlash = true;
+                }
+
+                thisChar = Peek();
+                if (thisChar == kNeedMore) {
+                    break;
+                }
+
+                mPendingSlash = false;
+                if (thisChar == '/' || thisChar == '*') {
+                    // Entering a comment. Write a space. We must consume the next character
+                    // here--otherwise we would recognize /*/ as a begin and end of a comment.
+                    Next();
+                    _sink->Put(' ');
+                    mCommentMode = (thisChar == '/') ? ECM_SingleLine : ECM_MultiLine;
+                } else {
+                    _sink->Put('/');
+                }
+                break;
+            }
+
+            case ECM_SingleLine:
+            {
+                TakeRun(ESC_LineCommentText, &runLength);
+                thisChar = Next();
+                if (thisChar == '\n') {
+                    mCommentMode = ECM_NoComment;
+                    _sink->Put('\n');
+                }
+                break;
+            }
+
+            case ECM_MultiLine:
+            {
+                if (!mPendingStar) {
+                    TakeRun(ESC_BlockCommentText, &runLength);
+                    thisChar = Next();
+                    if (thisChar == '\n') {
+                        // Write out the newline, they are preserved.
+                        _sink->Put('\n');
+                    }
+                    if (thisChar != '*') {
+                        break;
+                    }
+                    mPendingStar = true;
+                }
+
+                thisChar = Peek();
+                if (thisChar == kNeedMore) {
+                    break;
+                }
+
+                mPendingStar = false;
+                if (thisChar == '/') {
+                    // Consume the '/' too, otherwise we'd recognize */* as a finish->start comment.
+                    Next();
+                    mCommentMode = ECM_NoComment;
+                }
+                break;
+            }
+
+            default:
+                assert(!"Error in parser.");
+                break;
+        }
+
+        if (thisChar == kNeedMore) {
+            return;
+        }
+
+        if (thisChar == '\0') {
+            mDone = true;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+inline void EarlyPhasesStream::Write(const char* _text, size_t _length)
+{
+    if (_length >= kOutputBlockSize) {
+        // Big enough to be worth handing over as-is, rather than copying it through the block.
+        Flush();
+        mOutputFn(_text, _length, mUserData);
+        return;
+    }
+
+    if (mOutputUsed + _length > kOutputBlockSize) {
+        Flush();
+    }
+
+    memcpy(mOutput + mOutputUsed, _text, _length);
+    mOutputUsed += _length;
+}
+
+// ------------------------------------------------------------------------------------------------
+inline void EarlyPhasesStream::Put(char _char)
+{
+    if (mOutputUsed == kOutputBlockSize) {
+        Flush();
+    }
+
+    mOutput[mOutputUsed++] = _char;
+}
+
+// ------------------------------------------------------------------------------------------------
+void EarlyPhasesStream::Flush()
+{
+    if (mOutputUsed > 0) {
+        mOutputFn(mOutput, mOutputUsed, mUserData);
+        mOutputUsed = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+size_t PreprocessEarlyPhases(const char* _src, size_t _srcLength, char* _dst,
+                             bool _maintainLineCount, bool* _outUsedContinuations,
+                             LineMap* _optLineMap)
+{
+    assert(!_optLineMap || _src != _dst);
+
+    // The whole input is one final chunk, so Run never has to stop early, and the output can go
+    // straight to _dst.
+    EarlyPhasesStream phases(_maintainLineCount && !_optLineMap, NULL, NULL);
+    phases.mSrc = _src;
+    phases.mEnd = _src + _srcLength;
+    phases.mFinal = true;
+
+    DirectSink sink(_src, _dst, _optLineMap);
+    phases.Run(&sink);
+
+    (*sink.mDst) = '\0';
+    (*_outUsedContinuations) = phases.UsedContinuations();
+    return size_t(sink.mDst - _dst);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "linemap.h"
+#include "scan.h"
+
+#include <stddef.h>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Preprocessor phases two (line continuation) and three (comment removal), fused into a single
+// pass over the source. The result is the same as running phase two over the whole buffer and
+// then phase three over its output:
+//     - Each '\' immediately followed by EOL is removed, joining the two lines.
+//     - Each comment is replaced by one space, but the EOLs inside comments are preserved.
+//     - If _maintainLineCount is set, every line joined by a continuation gets an extra
+//       "<EOL><SPACE>" just before the next real EOL, so later lines keep their line numbers.
+//
+// If _optLineMap is given, it is filled in with where the output's lines came from in the source
+// (see LineMap) and no padding is written, whatever _maintainLineCount says. The map costs an
+// entry per line that had others spliced onto it, rather than bytes in the output.
+//
+// Processing stops at _srcLength or the first '\0', whichever comes first. _dst must have room
+// for _srcLength + 1 characters; the output is never longer than the input, and is always '\0'
+// terminated. _dst may be the same as _src, in which case the work is done in-place (but then
+// there can't be a line map; it's built from the source as it goes).
+// Returns the length of the output, not counting the '\0'. *_outUsedContinuations is set to
+// whether any line continuations were found.
+size_t PreprocessEarlyPhases(const char* _src, size_t _srcLength, char* _dst,
+                             bool _maintainLineCount, bool* _outUsedContinuations,
+                             LineMap* _optLineMap);
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Receives the output of an EarlyPhasesStream. _text is not '\0' terminated, and is only valid
+// for the duration of the call.
+typedef void (*EarlyPhasesOutputFn)(const char* _text, size_t _length, void* _userData);
+
+// The same phases as PreprocessEarlyPhases, over input which arrives in chunks. The chunks can be
+// split anywhere--in the middle of a comment, between a '\' and its EOL, between the '/' and '*'
+// of a comment start--and the output is the same as for the whole input at once.
+// Memory use doesn't depend on the size of the input: nothing from a chunk is kept once Feed
+// returns (except, at most, one trailing '\'), and output is collected in a fixed size block
+// which is handed to the output function whenever it fills up.
+class EarlyPhasesStream
+{
+public:
+    enum { kOutputBlockSize = 16 * 1024 };
+
+    EarlyPhasesStream(bool _maintainLineCount, EarlyPhasesOutputFn _outputFn, void* _userData);
+
+    // A '\0' in a chunk is treated as the end of the input; anything after it, in this chunk or
+    // later ones, is ignored.
+    void Feed(const char* _chunk, size_t _chunkLength);
+
+    // Processes whatever is still pending and flushes all remaining output. Nothing may be fed
+    // after this.
+    void Finish();
+
+    bool UsedContinuations() const { return mUsedContinuations; }
+
+private:
+    EarlyPhasesStream(const EarlyPhasesStream&);
+    EarlyPhasesStream& operator=(const EarlyPhasesStream&);
+
+    enum ECommentMode {
+        ECM_NoComment = 0,
+        ECM_SingleLine,
+        ECM_MultiLine
+    };
+
+    friend size_t PreprocessEarlyPhases(const char*, size_t, char*, bool, bool*, LineMap*);
+
+    template <typename TSink> void Run(TSink* _sink);
+
+    inline int Next();
+    inline int Peek();
+    inline const char* TakeRun(EScanClass _class, size_t* _outLength);
+
+    // While this is true, EOLs may need padding, so runs must stop at them.
+    bool HasPendingContinuations() const { return mContiguousLinesContinued > 0; }
+
+    // The output block, so that Run can use the stream itself as its sink. Streams pad rather
+    // than keep a line map, so Mark has nothing to do: phase four takes streamed text as it
+    // comes, so the padding only ever costs a few bytes of a block that's reused.
+    inline void Write(const char* _text, size_t _length);
+    inline void Put(char _char);
+    inline void Mark(const char* /*_src*/, uint32_t /*_splicedLines*/) { }
+    void Flush();
+
+    EarlyPhasesOutputFn mOutputFn;
+    void* mUserData;
+
+    // The part of the input Run is working on, and whether there is more to come after it.
+    const char* mSrc;
+    const char* mEnd;
+    bool mFinal;
+
+    // Everything that has to survive between chunks.
+    const bool mMaintainLineCount;
+    ECommentMode mCommentMode;
+    int mContiguousLinesContinued;
+    int mPaddingRemaining;
+    bool mPendingSlash;
+    bool mPendingStar;
+    bool mCarriedBackslash;
+    bool mUsedContinuations;
+
+    // Set at the first real EOL after line continuations--where the padding goes--and cleared
+    // once the sink has been told (see LineMap). mSplicedLines counts every spliced line so far.
+    bool mSplicedLineEnded;
+    uint32_t mSplicedLines;
+
+    bool mDone;
+
+    size_t mOutputUsed;
+    char mOutput[kOutputBlockSize];
+};
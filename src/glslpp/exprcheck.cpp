@@ -0,0 +1,228 @@
+#include "glslppafx.h"
+
+#include "exprparser.h"
+#include "tokens.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Checks ExpressionParser, and the SyntaxTree it builds, against a table of expressions and the
+// trees they should give, written out as s-expressions. Run with expressions as arguments to
+// print their trees instead.
+
+extern const LexicalEntry* GetGlslTokens();
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Writes _node as an s-expression: operators as (op operands...), with a postfix operator after
+// its operand, and leaves as their text. A constructor's type is written as its tokens.
+void WriteTree(const SyntaxTree& _tree, const TokenBuffer& _tokens, NodeRef _node, std::string* _out)
+{
+    if (_node == kNoNode) {
+        return;
+    }
+
+    const Node* node = _tree.Get(_node);
+    std::string text(_tokens.GetText(node->mToken), _tokens.GetLength(node->mToken));
+    switch (node->mKind) {
+    case NK_Identifier:
+    case NK_Constant:
+        *_out += text;
+        break;
+    case NK_Unary:
+        *_out += "(";
+        if (node->mOp == NO_PostIncrement || node->mOp == NO_PostDecrement) {
+            WriteTree(_tree, _tokens, _tree.As<UnaryNode>(_node)->mOperand, _out);
+            *_out += " " + text;
+        } else {
+            *_out += text + " ";
+            WriteTree(_tree, _tokens, _tree.As<UnaryNode>(_node)->mOperand, _out);
+        }
+        *_out += ")";
+        break;
+    case NK_Binary:
+    case NK_Assignment:
+    case NK_Index:
+        *_out += (node->mKind == NK_Index) ? "([] " : "(" + text + " ";
+        WriteTree(_tree, _tokens, _tree.As<BinaryNode>(_node)->mLeft, _out);
+        *_out += " ";
+        WriteTree(_tree, _tokens, _tree.As<BinaryNode>(_node)->mRight, _out);
+        *_out += ")";
+        break;
+    case NK_Conditional: {
+        const ConditionalNode* conditional = _tree.As<ConditionalNode>(_node);
+        *_out += "(? ";
+        WriteTree(_tree, _tokens, conditional->mCondition, _out);
+        *_out += " ";
+        WriteTree(_tree, _tokens, conditional->mTrue, _out);
+        *_out += " ";
+        WriteTree(_tree, _tokens, conditional->mFalse, _out);
+        *_out += ")";
+        break;
+    }
+    case NK_FieldSelection: {
+        const FieldSelectionNode* selection = _tree.As<FieldSelectionNode>(_node);
+        *_out += "(. ";
+        WriteTree(_tree, _tokens, selection->mBase, _out);
+        *_out += " " + std::string(_tokens.GetText(selection->mField), _tokens.GetLength(selection->mField));
+        if (node->mFlags & NF_MethodCall) {
+            *_out += "()";
+        }
+        *_out += ")";
+        break;
+    }
+    case NK_Call:
+        *_out += "(call ";
+        WriteTree(_tree, _tokens, _tree.As<CallNode>(_node)->mCallee, _out);
+        if (_tree.As<CallNode>(_node)->mArguments != kNoNode) {
+            *_out += " ";
+            WriteTree(_tree, _tokens, _tree.As<CallNode>(_node)->mArguments, _out);
+        }
+        *_out += ")";
+        break;
+    case NK_List: {
+        const ListNode* list = _tree.As<ListNode>(_node);
+        for (uint32_t i = 0; i < list->mCount; ++i) {
+            if (i > 0) {
+                *_out += " ";
+            }
+            WriteTree(_tree, _tokens, list->Items()[i], _out);
+        }
+        break;
+    }
+    case NK_TypeSpecifier: {
+        NodeRef arraySize = _tree.As<TypeSpecifierNode>(_node)->mArraySize;
+        *_out += text;
+        if (arraySize != kNoNode) {
+            *_out += "[";
+            WriteTree(_tree, _tokens, arraySize, _out);
+            *_out += "]";
+        }
+        break;
+    }
+    default:
+        assert(!"Node kind not expected in an expression");
+        *_out += "?";
+        break;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parses _source as an expression, and returns its tree; or, for a syntax error, "error N: "
+// followed by the message, N being the index of the token it was found at. Tokens left over
+// after the expression are an error too.
+std::string ParseToString(const char* _source)
+{
+    StateObject state;
+    TokenBuffer tokens;
+    Lexer lexer(LexerRuleSet::Get(GetGlslTokens()), _source, strlen(_source), &state);
+    if (!lexer.TokenizeAll(&tokens)) {
+        return "error: couldn't lex";
+    }
+
+    SyntaxTree tree;
+    ExpressionParser parser(&tokens, &tree);
+    size_t pos = 0;
+    NodeRef expression = parser.ParseExpression(&pos);
+
+    std::string result;
+    if (expression == kNoNode) {
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "error %zu: ", parser.GetErrorToken());
+        result = prefix;
+        result += parser.GetError();
+    } else if (pos != tokens.Size()) {
+        char message[64];
+        snprintf(message, sizeof(message), "error %zu: tokens left over", pos);
+        result = message;
+    } else {
+        WriteTree(tree, tokens, expression, &result);
+    }
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+struct ExpressionCase
+{
+    const char* mSource;
+    const char* mExpected;
+};
+
+const ExpressionCase gCases[] = {
+    // Precedence.
+    { "a+b*c"                       , "(+ a (* b c))" },
+    { "a*b+c"                       , "(+ (* a b) c)" },
+    { "a||b&&c|d^e&f==g<h<<i+j*k"   , "(|| a (&& b (| c (^ d (& e (== f (< g (<< h (+ i (* j k))))))))))" },
+    { "a*b<<c>d!=e&f^g|h&&i^^j||k"  , "(|| (^^ (&& (| (^ (& (!= (> (<< (* a b) c) d) e) f) g) h) i) j) k)" },
+    { "(a+b)*c"                     , "(* (+ a b) c)" },
+    { "-a*b"                        , "(* (- a) b)" },
+    { "a=b||c"                      , "(= a (|| b c))" },
+    { "a=1,b=2"                     , "(, (= a 1) (= b 2))" },
+
+    // Associativity.
+    { "a-b-c"                       , "(- (- a b) c)" },
+    { "a/b*c"                       , "(* (/ a b) c)" },
+    { "(a,b),c"                     , "(, (, a b) c)" },
+    { "a=b=c"                       , "(= a (= b c))" },
+    { "a+=b-=c"                     , "(+= a (-= b c))" },
+    { "a?b:c?d:e"                   , "(? a b (? c d e))" },
+    { "a+=b?c:d=e"                  , "(+= a (? b c (= d e)))" },
+    { "a?b,c:d"                     , "(? a (, b c) d)" },
+    // GLSL's last operand of ?: is an assignment_expression, unlike C's.
+    { "a?b:c=d"                     , "(? a b (= c d))" },
+
+    // Unary, postfix, call and constructor chains.
+    { "-a[0].x++"                   , "(- ((. ([] a 0) x) ++))" },
+    { "!~--x"                       , "(! (~ (-- x)))" },
+    { "a[i][j].yz[0]"               , "([] (. ([] ([] a i) j) yz) 0)" },
+    { "s.vec3"                      , "(. s vec3)" },
+    { "a.length()"                  , "(. a length())" },
+    { "f()"                         , "(call f)" },
+    { "f(void)"                     , "(call f)" },
+    { "f(a)[1].x"                   , "(. ([] (call f a) 1) x)" },
+    { "g(f(a,b), h(c), d)"          , "(call g (call f a b) (call h c) d)" },
+    { "vec3(1.0, a, b+c).xy"        , "(. (call vec3 1.0 a (+ b c)) xy)" },
+    { "float[2](1.0,2.0)"           , "(call float[2] 1.0 2.0)" },
+    { "float[](1.0)"                , "(call float[] 1.0)" },
+
+    // Errors.
+    { "a+b=c"                       , "error 3: the left of an assignment must be a unary expression" },
+    { "a||b=c"                      , "error 3: the left of an assignment must be a unary expression" },
+    { "f(a,b"                       , "error 5: expected ')' after a call's arguments" },
+    { "a ? b"                       , "error 3: expected ':' in a conditional expression" },
+    { ")"                           , "error 0: expected an expression" },
+    { ""                            , "error 0: expected an expression" },
+};
+
+} // namespace
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            printf("%s\n", ParseToString(argv[i]).c_str());
+        }
+        return GLCCError_Ok;
+    }
+
+    const size_t caseCount = sizeof(gCases) / sizeof(gCases[0]);
+    size_t failures = 0;
+    for (size_t i = 0; i < caseCount; ++i) {
+        std::string result = ParseToString(gCases[i].mSource);
+        if (result != gCases[i].mExpected) {
+            fprintf(stderr, "\"%s\" parsed as\n    %s\nnot\n    %s\n", gCases[i].mSource, result.c_str(), gCases[i].mExpected);
+            ++failures;
+        }
+    }
+
+    printf("expressions: %zu of %zu parsed differently\n", failures, caseCount);
+    return (failures == 0) ? GLCCError_Ok : GLCCError_InvalidOperation;
+}
@@ -0,0 +1,437 @@
+#include "glslppafx.h"
+
+#include "exprparser.h"
+
+#include "tokens.h"
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// Binding powers, loosest first. The grammar's cascade, one level to a power.
+enum EBindingPower {
+    BP_None = 0,
+    BP_Comma,
+    BP_Assignment,
+    BP_Conditional,
+    BP_LogicalOr,
+    BP_LogicalXor,
+    BP_LogicalAnd,
+    BP_InclusiveOr,
+    BP_ExclusiveOr,
+    BP_And,
+    BP_Equality,
+    BP_Relational,
+    BP_Shift,
+    BP_Additive,
+    BP_Multiplicative
+};
+
+struct InfixOperator
+{
+    int mToken;
+    uint8_t mPower;         // EBindingPower
+    uint8_t mKind;          // ENodeKind
+    uint8_t mOp;            // ENodeOp
+};
+
+const InfixOperator kInfixOperators[] = {
+    { COMMA         , BP_Comma          , NK_Binary     , NO_Comma          },
+    { EQUAL         , BP_Assignment     , NK_Assignment , NO_Assign         },
+    { MUL_ASSIGN    , BP_Assignment     , NK_Assignment , NO_MulAssign      },
+    { DIV_ASSIGN    , BP_Assignment     , NK_Assignment , NO_DivAssign      },
+    { MOD_ASSIGN    , BP_Assignment     , NK_Assignment , NO_ModAssign      },
+    { ADD_ASSIGN    , BP_Assignment     , NK_Assignment , NO_AddAssign      },
+    { SUB_ASSIGN    , BP_Assignment     , NK_Assignment , NO_SubAssign      },
+    { LEFT_ASSIGN   , BP_Assignment     , NK_Assignment , NO_LeftAssign     },
+    { RIGHT_ASSIGN  , BP_Assignment     , NK_Assignment , NO_RightAssign    },
+    { AND_ASSIGN    , BP_Assignment     , NK_Assignment , NO_AndAssign      },
+    { XOR_ASSIGN    , BP_Assignment     , NK_Assignment , NO_XorAssign      },
+    { OR_ASSIGN     , BP_Assignment     , NK_Assignment , NO_OrAssign       },
+    { QUESTION      , BP_Conditional    , NK_Conditional, NO_None           },
+    { OR_OP         , BP_LogicalOr      , NK_Binary     , NO_LogicalOr      },
+    { XOR_OP        , BP_LogicalXor     , NK_Binary     , NO_LogicalXor     },
+    { AND_OP        , BP_LogicalAnd     , NK_Binary     , NO_LogicalAnd     },
+    { VERTICAL_BAR  , BP_InclusiveOr    , NK_Binary     , NO_BitOr          },
+    { CARET         , BP_ExclusiveOr    , NK_Binary     , NO_BitXor         },
+    { AMPERSAND     , BP_And            , NK_Binary     , NO_BitAnd         },
+    { EQ_OP         , BP_Equality       , NK_Binary     , NO_Equal          },
+    { NE_OP         , BP_Equality       , NK_Binary     , NO_NotEqual       },
+    { LEFT_ANGLE    , BP_Relational     , NK_Binary     , NO_Less           },
+    { RIGHT_ANGLE   , BP_Relational     , NK_Binary     , NO_Greater        },
+    { LE_OP         , BP_Relational     , NK_Binary     , NO_LessEqual      },
+    { GE_OP         , BP_Relational     , NK_Binary     , NO_GreaterEqual   },
+    { LEFT_OP       , BP_Shift          , NK_Binary     , NO_ShiftLeft      },
+    { RIGHT_OP      , BP_Shift          , NK_Binary     , NO_ShiftRight     },
+    { PLUS          , BP_Additive       , NK_Binary     , NO_Add            },
+    { DASH          , BP_Additive       , NK_Binary     , NO_Subtract       },
+    { STAR          , BP_Multiplicative , NK_Binary     , NO_Multiply       },
+    { SLASH         , BP_Multiplicative , NK_Binary     , NO_Divide         },
+    { PERCENT       , BP_Multiplicative , NK_Binary     , NO_Remainder      }
+};
+
+// ------------------------------------------------------------------------------------------------
+// kInfixOperators by token, so finding a token's operator is an index. Token ids run from 1 to
+// TYPE_NAME; anything else (EOFTOKEN, say) has none.
+class InfixOperatorTable
+{
+public:
+    static const InfixOperatorTable& Get()
+    {
+        static const InfixOperatorTable sTable;
+        return sTable;
+    }
+
+    const InfixOperator& Find(int _token) const
+    {
+        return (_token > 0 && _token <= TYPE_NAME) ? mByToken[_token] : mByToken[0];
+    }
+
+private:
+    InfixOperatorTable()
+    {
+        for (int i = 0; i <= TYPE_NAME; ++i) {
+            mByToken[i].mToken = i;
+            mByToken[i].mPower = BP_None;
+            mByToken[i].mKind = NK_None;
+            mByToken[i].mOp = NO_None;
+        }
+
+        for (size_t i = 0; i < sizeof(kInfixOperators) / sizeof(kInfixOperators[0]); ++i) {
+            mByToken[kInfixOperators[i].mToken] = kInfixOperators[i];
+        }
+    }
+
+    InfixOperator mByToken[TYPE_NAME + 1];
+};
+
+// ------------------------------------------------------------------------------------------------
+inline ENodeOp PrefixOperator(int _token)
+{
+    switch (_token) {
+        case PLUS:      return NO_Plus;
+        case DASH:      return NO_Negate;
+        case BANG:      return NO_Not;
+        case TILDE:     return NO_Complement;
+        case INC_OP:    return NO_PreIncrement;
+        case DEC_OP:    return NO_PreDecrement;
+        default:        return NO_None;
+    }
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+ExpressionParser::ExpressionParser(const TokenBuffer* _tokens, SyntaxTree* _tree)
+: mTokens(_tokens)
+, mTree(_tree)
+, mTypes(NULL)
+, mTokenCount(0)
+, mPos(0)
+, mError(NULL)
+, mErrorToken(0)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::ParseExpression(size_t* _pos)
+{
+    return Parse(_pos, BP_Comma);
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::ParseAssignmentExpression(size_t* _pos)
+{
+    return Parse(_pos, BP_Assignment);
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::ParseConstantExpression(size_t* _pos)
+{
+    return Parse(_pos, BP_Conditional);
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Parse(size_t* _pos, int _minPower)
+{
+    // The tokens may have been added to, or relexed, since the last expression.
+    mTypes = mTokens->GetTypes();
+    mTokenCount = mTokens->Size();
+    mPos = (*_pos);
+    mError = NULL;
+    mErrorToken = 0;
+    mArguments.clear();
+
+    NodeRef result = Climb(_minPower);
+    (*_pos) = mPos;
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Climb(int _minPower)
+{
+    // An operand, and then as many operators as bind at least as tightly as _minPower, each
+    // taking what follows it up to the next operator that binds no tighter than it does.
+    NodeRef lhs = Unary();
+    if (lhs == kNoNode) {
+        return kNoNode;
+    }
+
+    // Only a unary_expression can be assigned to; a + b = c is a syntax error, as it is in the
+    // grammar.
+    bool lhsIsUnary = true;
+
+    const InfixOperatorTable& table = InfixOperatorTable::Get();
+    for (;;) {
+        const InfixOperator& op = table.Find(Peek());
+        if (op.mPower == BP_None || op.mPower < _minPower) {
+            return lhs;
+        }
+        uint32_t opToken = uint32_t(mPos++);
+
+        if (op.mKind == NK_Conditional) {
+            // logical_or_expression ? expression : assignment_expression
+            NodeRef whenTrue = Climb(BP_Comma);
+            if (whenTrue == kNoNode) {
+                return kNoNode;
+            }
+            if (!Accept(COLON)) {
+                return Fail("expected ':' in a conditional expression");
+            }
+            NodeRef whenFalse = Climb(BP_Assignment);
+            if (whenFalse == kNoNode) {
+                return kNoNode;
+            }
+
+            NodeRef cond = mTree->Make<ConditionalNode>(NK_Conditional, opToken);
+            ConditionalNode* node = mTree->As<ConditionalNode>(cond);
+            node->mCondition = lhs;
+            node->mTrue = whenTrue;
+            node->mFalse = whenFalse;
+            lhs = cond;
+        } else {
+            if (op.mKind == NK_Assignment && !lhsIsUnary) {
+                mPos = opToken;
+                return Fail("the left of an assignment must be a unary expression");
+            }
+
+            // Assignments are right associative, so the right hand side can be another at the same
+            // power. Everything else takes only what binds tighter.
+            NodeRef rhs = Climb((op.mKind == NK_Assignment) ? op.mPower : op.mPower + 1);
+            if (rhs == kNoNode) {
+                return kNoNode;
+            }
+
+            NodeRef binary = mTree->Make<BinaryNode>((ENodeKind) op.mKind, opToken, (ENodeOp) op.mOp);
+            BinaryNode* node = mTree->As<BinaryNode>(binary);
+            node->mLeft = lhs;
+            node->mRight = rhs;
+            lhs = binary;
+        }
+
+        lhsIsUnary = false;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Unary()
+{
+    // Prefix operators apply to a whole unary_expression, postfix ones included: -a[0] is -(a[0]).
+    ENodeOp op = PrefixOperator(Peek());
+    if (op == NO_None) {
+        NodeRef primary = Primary();
+        return (primary != kNoNode) ? Postfix(primary) : kNoNode;
+    }
+
+    uint32_t opToken = uint32_t(mPos++);
+    NodeRef operand = Unary();
+    if (operand == kNoNode) {
+        return kNoNode;
+    }
+
+    NodeRef unary = mTree->Make<UnaryNode>(NK_Unary, opToken, op);
+    mTree->As<UnaryNode>(unary)->mOperand = operand;
+    return unary;
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Postfix(NodeRef _operand)
+{
+    for (;;) {
+        uint32_t opToken = uint32_t(mPos);
+        switch (Peek()) {
+            case LEFT_BRACKET:
+            {
+                ++mPos;
+                NodeRef index = Climb(BP_Comma);
+                if (index == kNoNode) {
+                    return kNoNode;
+                }
+                if (!Accept(RIGHT_BRACKET)) {
+                    return Fail("expected ']'");
+                }
+
+                NodeRef indexed = mTree->Make<BinaryNode>(NK_Index, opToken);
+                BinaryNode* node = mTree->As<BinaryNode>(indexed);
+                node->mLeft = _operand;
+                node->mRight = index;
+                _operand = indexed;
+                break;
+            }
+
+            case DOT:
+            {
+                // Swizzles and members are identifiers, but a member can share its name with a
+                // type.
+                ++mPos;
+                if (Peek() != IDENTIFIER && Peek() != TYPE_NAME) {
+                    return Fail("expected a field name after '.'");
+                }
+
+                NodeRef field = mTree->Make<FieldSelectionNode>(NK_FieldSelection, opToken);
+                FieldSelectionNode* node = mTree->As<FieldSelectionNode>(field);
+                node->mBase = _operand;
+                node->mField = uint32_t(mPos++);
+
+                if (Accept(LEFT_PAREN)) {
+                    Accept(VOID);
+                    if (!Accept(RIGHT_PAREN)) {
+                        return Fail("expected ')': methods take no arguments");
+                    }
+                    node->mFlags |= NF_MethodCall;
+                }
+                _operand = field;
+                break;
+            }
+
+            case INC_OP:
+            case DEC_OP:
+            {
+                ENodeOp op = (Peek() == INC_OP) ? NO_PostIncrement : NO_PostDecrement;
+                ++mPos;
+                NodeRef unary = mTree->Make<UnaryNode>(NK_Unary, opToken, op);
+                mTree->As<UnaryNode>(unary)->mOperand = _operand;
+                _operand = unary;
+                break;
+            }
+
+            default:
+                return _operand;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Primary()
+{
+    uint32_t token = uint32_t(mPos);
+    switch (Peek()) {
+        case IDENTIFIER:
+        {
+            ++mPos;
+            NodeRef identifier = mTree->Make<Node>(NK_Identifier, token);
+            return Accept(LEFT_PAREN) ? Call(identifier, token) : identifier;
+        }
+
+        case TYPE_NAME:
+        {
+            // A constructor: vec3(...), or float[2](...) for an array.
+            ++mPos;
+            NodeRef type = mTree->Make<TypeSpecifierNode>(NK_TypeSpecifier, token);
+            if (Peek() == LEFT_BRACKET) {
+                uint32_t bracket = uint32_t(mPos++);
+                NodeRef size = (Peek() == RIGHT_BRACKET) ? mTree->MakeList(bracket, NULL, 0)
+                                                         : Climb(BP_Conditional);
+                if (size == kNoNode) {
+                    return kNoNode;
+                }
+                if (!Accept(RIGHT_BRACKET)) {
+                    return Fail("expected ']'");
+                }
+                mTree->As<TypeSpecifierNode>(type)->mArraySize = size;
+            }
+
+            if (!Accept(LEFT_PAREN)) {
+                return Fail("expected '(' after a type in an expression");
+            }
+            return Call(type, token);
+        }
+
+        case INTCONSTANT:
+        case UINTCONSTANT:
+        case FLOATCONSTANT:
+        case BOOLCONSTANT:
+            ++mPos;
+            return mTree->Make<Node>(NK_Constant, token);
+
+        case LEFT_PAREN:
+        {
+            ++mPos;
+            NodeRef expression = Climb(BP_Comma);
+            if (expression == kNoNode) {
+                return kNoNode;
+            }
+            if (!Accept(RIGHT_PAREN)) {
+                return Fail("expected ')'");
+            }
+            return expression;
+        }
+
+        default:
+            return Fail("expected an expression");
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Call(NodeRef _callee, uint32_t _token)
+{
+    // After the '('. f() and f(void) both have no arguments. Arguments are collected on the end of
+    // mArguments, above those of any call this one is an argument of.
+    size_t first = mArguments.size();
+    if (Peek() == VOID && mPos + 1 < mTokenCount && mTypes[mPos + 1] == RIGHT_PAREN) {
+        ++mPos;
+    } else if (Peek() != RIGHT_PAREN) {
+        do {
+            NodeRef argument = Climb(BP_Assignment);
+            if (argument == kNoNode) {
+                return kNoNode;
+            }
+            mArguments.push_back(argument);
+        } while (Accept(COMMA));
+    }
+
+    if (!Accept(RIGHT_PAREN)) {
+        return Fail("expected ')' after a call's arguments");
+    }
+
+    NodeRef call = mTree->Make<CallNode>(NK_Call, _token);
+    if (mArguments.size() > first) {
+        NodeRef arguments = mTree->MakeList(_token, mArguments.data() + first, uint32_t(mArguments.size() - first));
+        mTree->As<CallNode>(call)->mArguments = arguments;
+        mArguments.resize(first);
+    }
+    mTree->As<CallNode>(call)->mCallee = _callee;
+    return call;
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef ExpressionParser::Fail(const char* _error)
+{
+    // Only the first error is kept; everything above it just unwinds.
+    if (!mError) {
+        mError = _error;
+        mErrorToken = mPos;
+    }
+    return kNoNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ExpressionParser::Accept(int _type)
+{
+    if (Peek() != _type) {
+        return false;
+    }
+
+    ++mPos;
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common/parserutil.h"
+#include "node.h"
+
+#include <stddef.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Parses the expression productions, postfix_expression up to expression, by precedence climbing.
+// The grammar's cascade--assignment_expression, conditional_expression, logical_or_expression and
+// so on down through multiplicative_expression--takes a call per level for every operand, even
+// a lone identifier. Here each binary operator's token maps to its binding power in a table, and
+// a single loop only goes a level deeper when it finds an operator that binds tighter than the
+// one it's in. The trees are the same as the cascade's: left associative binary operators,
+// right associative assignments and ?:, and parentheses leaving no node of their own.
+// Nodes go into the SyntaxTree given, and name their tokens by index into the TokenBuffer.
+class ExpressionParser
+{
+public:
+    // Both must outlive the parser.
+    ExpressionParser(const TokenBuffer* _tokens, SyntaxTree* _tree);
+
+    // Each parses its production from token *_pos, and moves *_pos past it. On a syntax error
+    // they return kNoNode, and GetError says what was wrong and at which token.
+    NodeRef ParseExpression(size_t* _pos);              // expression: for statements and ()s.
+    NodeRef ParseAssignmentExpression(size_t* _pos);    // Arguments and initializers.
+    NodeRef ParseConstantExpression(size_t* _pos);      // Array sizes and case labels.
+
+    const char* GetError() const { return mError; }
+    size_t GetErrorToken() const { return mErrorToken; }
+
+private:
+    ExpressionParser(const ExpressionParser&);
+    ExpressionParser& operator=(const ExpressionParser&);
+
+    NodeRef Parse(size_t* _pos, int _minPower);
+    NodeRef Climb(int _minPower);
+    NodeRef Unary();
+    NodeRef Postfix(NodeRef _operand);
+    NodeRef Primary();
+    NodeRef Call(NodeRef _callee, uint32_t _token);
+    NodeRef Fail(const char* _error);
+
+    int Peek() const { return (mPos < mTokenCount) ? mTypes[mPos] : EOFTOKEN; }
+    bool Accept(int _type);
+
+    const TokenBuffer* mTokens;
+    SyntaxTree* mTree;
+    const int* mTypes;
+    size_t mTokenCount;
+    size_t mPos;
+
+    const char* mError;
+    size_t mErrorToken;
+
+    // Arguments of the calls being parsed, innermost last.
+    std::vector<NodeRef> mArguments;
+};
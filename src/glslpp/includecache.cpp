@@ -0,0 +1,212 @@
+#include "glslppafx.h"
+
+#include "includecache.h"
+
+#include "earlyphases.h"
+#include "fileutils.h"
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsDirective(const std::vector<PPToken>& _tokens, size_t _pos, uint32_t _name)
+{
+    return _pos + 1 < _tokens.size()
+        && _tokens[_pos].mType == PPT_Punctuator && _tokens[_pos].mId == PPS_Hash
+        && _tokens[_pos + 1].mType == PPT_Identifier && _tokens[_pos + 1].mId == _name;
+}
+
+// ------------------------------------------------------------------------------------------------
+inline size_t SkipEOLs(const std::vector<PPToken>& _tokens, size_t _pos)
+{
+    while (_pos < _tokens.size() && _tokens[_pos].mType == PPT_EOL) {
+        ++_pos;
+    }
+    return _pos;
+}
+
+// ------------------------------------------------------------------------------------------------
+inline size_t NextLine(const std::vector<PPToken>& _tokens, size_t _pos)
+{
+    while (_pos < _tokens.size() && _tokens[_pos].mType != PPT_EOL) {
+        ++_pos;
+    }
+    return _pos + 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the include guard's macro name, or 0 if the file doesn't have the exact shape of one.
+uint32_t FindIncludeGuard(const std::vector<PPToken>& _tokens)
+{
+    // #ifndef X
+    size_t pos = SkipEOLs(_tokens, 0);
+    if (!IsDirective(_tokens, pos, PPS_Ifndef) || pos + 3 >= _tokens.size()
+     || _tokens[pos + 2].mType != PPT_Identifier || _tokens[pos + 3].mType != PPT_EOL) {
+        return 0;
+    }
+    uint32_t guard = _tokens[pos + 2].mId;
+
+    // #define X
+    pos = SkipEOLs(_tokens, pos + 4);
+    if (!IsDirective(_tokens, pos, PPS_Define) || pos + 2 >= _tokens.size() || _tokens[pos + 2].mId != guard) {
+        return 0;
+    }
+
+    // ... up to the #endif that matches the #ifndef, which must be the last thing in the file.
+    int depth = 0;
+    for (pos = NextLine(_tokens, pos); pos < _tokens.size(); pos = NextLine(_tokens, pos)) {
+        if (IsDirective(_tokens, pos, PPS_If) || IsDirective(_tokens, pos, PPS_Ifdef) || IsDirective(_tokens, pos, PPS_Ifndef)) {
+            ++depth;
+        } else if (IsDirective(_tokens, pos, PPS_Endif)) {
+            if (depth-- == 0) {
+                return (SkipEOLs(_tokens, NextLine(_tokens, pos)) == _tokens.size()) ? guard : 0;
+            }
+        } else if (depth == 0 && (IsDirective(_tokens, pos, PPS_Else) || IsDirective(_tokens, pos, PPS_Elif))) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether *_path is a file, and if so, makes it the file's full path: one file is then one path
+// however #includes spell it, for #pragma once, guards and the caches that key on it.
+bool FindFile(std::string* _path)
+{
+    long long size = 0;
+    long long modTime = 0;
+    if (!computeFileStamp(_path->c_str(), &size, &modTime)) {
+        return false;
+    }
+
+    std::string fullPath;
+    if (computeFullPath(_path->c_str(), &fullPath)) {
+        _path->swap(fullPath);
+    }
+    return true;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+std::shared_ptr<const IncludedFile> MakeIncludedFile(const std::string& _name, const char* _text, size_t _length)
+{
+    std::shared_ptr<IncludedFile> file(new IncludedFile);
+    file->mPath = _name;
+    file->mSize = (long long) _length;
+    file->mModTime = 0;
+    file->mContentHash = HashBytes128(_text, _length);
+    file->mUsedLineContinuations = false;
+
+    SeedPPInterner(&file->mInterner);
+    PPTokenize(_text, _length, &file->mInterner, &file->mTokens);
+    file->mGuard = 0;
+    return file;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ResolveIncludePath(const char* _includer, const std::string& _name, bool _system,
+                        const std::vector<std::string>* _optIncludePaths, std::string* _outPath)
+{
+    bool isAbsolute = (_name[0] == '/' || _name[0] == '\\' || (_name.size() > 1 && _name[1] == ':'));
+    if (isAbsolute) {
+        (*_outPath) = _name;
+        return FindFile(_outPath);
+    }
+
+    // "name" looks next to the including file first.
+    if (!_system) {
+        const char* lastSlash = NULL;
+        for (const char* c = _includer; *c; ++c) {
+            if (*c == '/' || *c == '\\') {
+                lastSlash = c;
+            }
+        }
+
+        _outPath->assign(_includer, lastSlash ? size_t(lastSlash + 1 - _includer) : 0);
+        _outPath->append(_name);
+        if (FindFile(_outPath)) {
+            return true;
+        }
+    }
+
+    if (_optIncludePaths) {
+        for (size_t i = 0; i < _optIncludePaths->size(); ++i) {
+            const std::string& dir = (*_optIncludePaths)[i];
+            (*_outPath) = dir;
+            if (!dir.empty() && dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') {
+                (*_outPath) += '/';
+            }
+            _outPath->append(_name);
+            if (FindFile(_outPath)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+IncludeCache& IncludeCache::Get()
+{
+    static IncludeCache sCache;
+    return sCache;
+}
+
+// ------------------------------------------------------------------------------------------------
+std::shared_ptr<const IncludedFile> IncludeCache::Load(const std::string& _path, bool _maintainLineCount)
+{
+    long long size = 0;
+    long long modTime = 0;
+    if (!computeFileStamp(_path.c_str(), &size, &modTime)) {
+        return std::shared_ptr<const IncludedFile>();
+    }
+
+    std::map<std::string, std::shared_ptr<const IncludedFile> >& files = mFiles[_maintainLineCount ? 1 : 0];
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::map<std::string, std::shared_ptr<const IncludedFile> >::iterator it = files.find(_path);
+        if (it != files.end() && it->second->mSize == size && it->second->mModTime == modTime) {
+            return it->second;
+        }
+    }
+
+    // Read it outside the lock, so one thread loading a header doesn't hold up the others. If two
+    // threads both load the same file, the last one in wins; the results are the same.
+    MappedFile mapped;
+    if (!mapped.Open(_path.c_str())) {
+        return std::shared_ptr<const IncludedFile>();
+    }
+
+    std::shared_ptr<IncludedFile> file(new IncludedFile);
+    file->mPath = _path;
+    file->mSize = size;
+    file->mModTime = modTime;
+    file->mContentHash = HashBytes128(mapped.GetData(), mapped.GetSize());
+    file->mUsedLineContinuations = false;
+
+    std::vector<char> text(mapped.GetSize() + 1);
+    size_t textLength = PreprocessEarlyPhases(mapped.GetData(), mapped.GetSize(), text.data(),
+                                              _maintainLineCount, &file->mUsedLineContinuations,
+                                              _maintainLineCount ? &file->mLineMap : NULL);
+    mapped.Close();
+
+    SeedPPInterner(&file->mInterner);
+    PPTokenize(text.data(), textLength, &file->mInterner, &file->mTokens);
+    file->mGuard = FindIncludeGuard(file->mTokens);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    files[_path] = file;
+    return file;
+}
+
+// ------------------------------------------------------------------------------------------------
+void IncludeCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFiles[0].clear();
+    mFiles[1].clear();
+}
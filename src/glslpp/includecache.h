@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common/hashutil.h"
+#include "linemap.h"
+#include "pptokens.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A header that has been through phases two and three and been tokenized, ready for phase four
+// to splice into its input. Immutable once it's in the cache, so any number of preprocessors can
+// share it.
+// The tokens are interned with the file's own interner. It is seeded like every other, so
+// punctuators and directive names already have the right ids; everything else must be mapped
+// into the including preprocessor's interner (see PhaseFour::Include).
+struct IncludedFile
+{
+    std::string mPath;
+    long long mSize;
+    long long mModTime;
+    Hash128 mContentHash;       // Of the bytes on disk, before phases two and three.
+
+    StringInterner mInterner;
+    std::vector<PPToken> mTokens;
+
+    // Where the tokens' lines came from, if the file was loaded with _maintainLineCount (see
+    // IncludeCache::Load). Empty otherwise, and for files that didn't come from disk.
+    LineMap mLineMap;
+
+    // The macro guarding the whole file--#ifndef X / #define X / ... / #endif with nothing but
+    // blank lines outside--or 0 if there isn't one. Once X is defined, including the file again
+    // does nothing, so it doesn't need to be looked at.
+    uint32_t mGuard;
+
+    bool mUsedLineContinuations;
+};
+
+// Tokenizes _text, which has already been through phases two and three, into an IncludedFile
+// that didn't come from disk (and isn't cached). Predefined macros are passed around like this.
+std::shared_ptr<const IncludedFile> MakeIncludedFile(const std::string& _name, const char* _text, size_t _length);
+
+// Finds the file an #include names. An absolute _name is taken as it is. Otherwise a "name"
+// (not _system) is looked for next to _includer first, then both kinds in each of
+// _optIncludePaths, in order. *_outPath is the file's full path (see computeFullPath), so each
+// file has one path however it's named. Returns false if there's no such file.
+bool ResolveIncludePath(const char* _includer, const std::string& _name, bool _system,
+                        const std::vector<std::string>* _optIncludePaths, std::string* _outPath);
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Every included file the process has read, keyed by path. An entry is reused for as long as the
+// file's size and modification time stay the same, and is read again otherwise. Thread safe.
+class IncludeCache
+{
+public:
+    static IncludeCache& Get();
+
+    // Returns NULL if _path can't be read. _maintainLineCount is as for PreprocessEarlyPhases;
+    // files are cached separately for each setting.
+    std::shared_ptr<const IncludedFile> Load(const std::string& _path, bool _maintainLineCount);
+
+    // Drops every entry. Preprocessors still using one keep it alive until they're done.
+    void Clear();
+
+private:
+    IncludeCache() { }
+    IncludeCache(const IncludeCache&);
+    IncludeCache& operator=(const IncludeCache&);
+
+    std::mutex mMutex;
+    std::map<std::string, std::shared_ptr<const IncludedFile> > mFiles[2];
+};
@@ -0,0 +1,159 @@
+#include "glslppafx.h"
+
+#include "common/keywordtable.h"
+#include "common/hashutil.h"
+
+#include <algorithm>
+#include <string.h>
+
+// ------------------------------------------------------------------------------------------------
+// This is "hash and displace": every keyword hashes to a bucket, and each bucket gets a
+// displacement that moves all of its keywords into unused slots. Buckets are placed largest
+// first, which is what makes the search converge quickly.
+namespace {
+
+inline uint32_t BucketOf(uint64_t _hash, uint32_t _bucketCount)
+{
+    return uint32_t(_hash >> 40) % _bucketCount;
+}
+
+inline uint32_t SlotOf(uint64_t _hash, uint32_t _displacement, uint32_t _slotMask)
+{
+    // The step is forced odd, so with a power of two table every displacement visits a
+    // different slot.
+    uint32_t base = uint32_t(_hash);
+    uint32_t step = uint32_t(_hash >> 20) | 1;
+    return (base + _displacement * step) & _slotMask;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+KeywordTable::KeywordTable(const KeywordEntry* _keywords)
+{
+    Build(&_keywords, 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+KeywordTable::KeywordTable(const KeywordEntry* const* _tables, size_t _tableCount)
+{
+    Build(_tables, _tableCount);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool KeywordTable::Find(const char* _str, size_t _length, int* _outToken) const
+{
+    uint64_t hash = HashBytes64(_str, _length, mSeed);
+    uint32_t displacement = mDisplacements[BucketOf(hash, mBucketCount)];
+    const Slot& slot = mSlots[SlotOf(hash, displacement, mSlotMask)];
+
+    if (slot.Length != _length || !slot.Keyword || memcmp(slot.Keyword, _str, _length) != 0) {
+        return false;
+    }
+
+    (*_outToken) = slot.Token;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void KeywordTable::Build(const KeywordEntry* const* _tables, size_t _tableCount)
+{
+    // Gather the unique keywords, first appearance wins.
+    std::vector<const KeywordEntry*> keywords;
+    for (size_t t = 0; t < _tableCount; ++t) {
+        for (const KeywordEntry* entry = _tables[t]; entry->Keyword; ++entry) {
+            bool duplicate = false;
+            for (size_t i = 0; i < keywords.size() && !duplicate; ++i) {
+                duplicate = strcmp(keywords[i]->Keyword, entry->Keyword) == 0;
+            }
+
+            if (!duplicate) {
+                keywords.push_back(entry);
+            }
+        }
+    }
+    mKeywordCount = keywords.size();
+
+    // Keep the table at most half full; that keeps the displacement search short.
+    uint32_t slotCount = 16;
+    while (slotCount < keywords.size() * 2) {
+        slotCount *= 2;
+    }
+    mSlotMask = slotCount - 1;
+    mBucketCount = uint32_t(keywords.size() / 2) + 1;
+
+    for (uint64_t seed = 0; ; ++seed) {
+        if (TryBuild(seed, keywords)) {
+            return;
+        }
+
+        // Essentially never happens, but a pathological key set could force a bigger table.
+        if ((seed & 0xff) == 0xff) {
+            slotCount *= 2;
+            mSlotMask = slotCount - 1;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool KeywordTable::TryBuild(uint64_t _seed, const std::vector<const KeywordEntry*>& _keywords)
+{
+    mSeed = _seed;
+    Slot emptySlot = { nullptr, 0, 0 };
+    mSlots.assign(mSlotMask + 1, emptySlot);
+    mDisplacements.assign(mBucketCount, 0);
+
+    std::vector<uint64_t> hashes(_keywords.size());
+    std::vector<std::vector<uint32_t> > buckets(mBucketCount);
+    for (size_t i = 0; i < _keywords.size(); ++i) {
+        hashes[i] = HashBytes64(_keywords[i]->Keyword, strlen(_keywords[i]->Keyword), _seed);
+        buckets[BucketOf(hashes[i], mBucketCount)].push_back(uint32_t(i));
+    }
+
+    std::vector<uint32_t> order(mBucketCount);
+    for (uint32_t b = 0; b < mBucketCount; ++b) {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t _lhs, uint32_t _rhs) {
+        return buckets[_lhs].size() > buckets[_rhs].size();
+    });
+
+    std::vector<uint32_t> candidateSlots;
+    for (size_t o = 0; o < order.size(); ++o) {
+        const std::vector<uint32_t>& bucket = buckets[order[o]];
+        if (bucket.empty()) {
+            break;
+        }
+
+        bool placed = false;
+        for (uint32_t displacement = 0; displacement <= mSlotMask && !placed; ++displacement) {
+            candidateSlots.clear();
+            placed = true;
+            for (size_t k = 0; k < bucket.size() && placed; ++k) {
+                uint32_t slot = SlotOf(hashes[bucket[k]], displacement, mSlotMask);
+                placed = mSlots[slot].Keyword == nullptr
+                      && std::find(candidateSlots.begin(), candidateSlots.end(), slot) == candidateSlots.end();
+                candidateSlots.push_back(slot);
+            }
+
+            if (placed) {
+                mDisplacements[order[o]] = displacement;
+                for (size_t k = 0; k < bucket.size(); ++k) {
+                    const KeywordEntry* entry = _keywords[bucket[k]];
+                    Slot& slot = mSlots[candidateSlots[k]];
+                    slot.Keyword = entry->Keyword;
+                    slot.Length = uint32_t(strlen(entry->Keyword));
+                    slot.Token = entry->Token;
+                }
+            }
+        }
+
+        if (!placed) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,649 @@
+#include "glslppafx.h"
+
+#include "common/lexerdfa.h"
+#include "common/parserutil.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+
+namespace {
+
+typedef std::bitset<256> CharSet;
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Parsed form of a single pattern. Patterns are tiny, so this is deliberately simple.
+struct ReNode
+{
+    enum EKind {
+        ERK_Set = 0,
+        ERK_Concat,
+        ERK_Alternate,
+        ERK_Repeat
+    };
+
+    EKind Kind;
+    CharSet Set;
+    std::vector<ReNode> Children;
+    int Min;
+    int Max;        // -1 means unbounded.
+
+    explicit ReNode(EKind _kind) : Kind(_kind), Min(0), Max(0) { }
+};
+
+// ------------------------------------------------------------------------------------------------
+class PatternParser
+{
+public:
+    explicit PatternParser(const char* _pattern) : mSrc(_pattern) { }
+
+    ReNode Parse()
+    {
+        ReNode retNode = ParseAlternate();
+        if (*mSrc) {
+            assert(!"Unbalanced ')' in lexical rule pattern.");
+        }
+        return retNode;
+    }
+
+private:
+    // --------------------------------------------------------------------------------------------
+    ReNode ParseAlternate()
+    {
+        ReNode first = ParseConcat();
+        if (*mSrc != '|') {
+            return first;
+        }
+
+        ReNode alt(ReNode::ERK_Alternate);
+        alt.Children.push_back(first);
+        while (*mSrc == '|') {
+            ++mSrc;
+            alt.Children.push_back(ParseConcat());
+        }
+        return alt;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    ReNode ParseConcat()
+    {
+        ReNode concat(ReNode::ERK_Concat);
+        while (*mSrc && *mSrc != '|' && *mSrc != ')') {
+            concat.Children.push_back(ParseRepeat());
+        }
+        return concat;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    ReNode ParseRepeat()
+    {
+        ReNode atom = ParseAtom();
+        for (;;) {
+            int minCount = 0;
+            int maxCount = -1;
+            if (*mSrc == '*') {
+                ++mSrc;
+            } else if (*mSrc == '+') {
+                minCount = 1;
+                ++mSrc;
+            } else if (*mSrc == '?') {
+                maxCount = 1;
+                ++mSrc;
+            } else if (*mSrc == '{') {
+                ++mSrc;
+                minCount = ParseNumber();
+                maxCount = minCount;
+                if (*mSrc == ',') {
+                    ++mSrc;
+                    maxCount = (*mSrc == '}') ? -1 : ParseNumber();
+                }
+                if (*mSrc != '}') {
+                    assert(!"Malformed {m,n} quantifier in lexical rule pattern.");
+                    return atom;
+                }
+                ++mSrc;
+            } else {
+                return atom;
+            }
+
+            ReNode rep(ReNode::ERK_Repeat);
+            rep.Min = minCount;
+            rep.Max = maxCount;
+            rep.Children.push_back(atom);
+            atom = rep;
+        }
+    }
+
+    // --------------------------------------------------------------------------------------------
+    ReNode ParseAtom()
+    {
+        char thisChar = *mSrc++;
+        switch (thisChar) {
+            case '(':
+            {
+                // Non-capturing groups are the same thing to us.
+                if (mSrc[0] == '?' && mSrc[1] == ':') {
+                    mSrc += 2;
+                }
+                ReNode group = ParseAlternate();
+                if (*mSrc != ')') {
+                    assert(!"Unbalanced '(' in lexical rule pattern.");
+                    return group;
+                }
+                ++mSrc;
+                return group;
+            }
+
+            case '[':
+                return MakeSet(ParseClass());
+
+            case '.':
+            {
+                // ECMAScript's '.' matches anything but a line terminator.
+                CharSet anyChar;
+                anyChar.set();
+                anyChar.reset('\n');
+                anyChar.reset('\r');
+                return MakeSet(anyChar);
+            }
+
+            case '\\':
+                return MakeSet(ParseEscape());
+
+            case '^':
+            case '$':
+                assert(!"Anchors are not supported in lexical rule patterns.");
+                return ReNode(ReNode::ERK_Concat);
+
+            default:
+            {
+                CharSet literal;
+                literal.set((unsigned char)thisChar);
+                return MakeSet(literal);
+            }
+        }
+    }
+
+    // --------------------------------------------------------------------------------------------
+    CharSet ParseClass()
+    {
+        CharSet retSet;
+        bool negate = false;
+        if (*mSrc == '^') {
+            negate = true;
+            ++mSrc;
+        }
+
+        // A ']' at the very beginning of the class is a literal.
+        bool first = true;
+        while (*mSrc && (first || *mSrc != ']')) {
+            first = false;
+            CharSet lowSet;
+            int low = ParseClassChar(&lowSet);
+            if (low >= 0 && mSrc[0] == '-' && mSrc[1] && mSrc[1] != ']') {
+                ++mSrc;
+                CharSet highSet;
+                int high = ParseClassChar(&highSet);
+                assert(high >= low);
+                for (int c = low; c <= high; ++c) {
+                    retSet.set(c);
+                }
+            } else {
+                retSet |= lowSet;
+            }
+        }
+
+        if (*mSrc != ']') {
+            assert(!"Unterminated character class in lexical rule pattern.");
+        } else {
+            ++mSrc;
+        }
+
+        if (negate) {
+            retSet.flip();
+        }
+        return retSet;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Returns the single character parsed, or -1 if the element was a class escape like \d.
+    int ParseClassChar(CharSet* _outSet)
+    {
+        if (*mSrc == '\\') {
+            ++mSrc;
+            (*_outSet) = ParseEscape();
+            return (_outSet->count() == 1) ? int(FirstOf(*_outSet)) : -1;
+        }
+
+        unsigned char thisChar = (unsigned char)*mSrc++;
+        _outSet->set(thisChar);
+        return thisChar;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    // Called with mSrc just past the backslash.
+    CharSet ParseEscape()
+    {
+        CharSet retSet;
+        char thisChar = *mSrc++;
+        switch (thisChar) {
+            case 'd': AddRange(&retSet, '0', '9'); break;
+            case 'D': AddRange(&retSet, '0', '9'); retSet.flip(); break;
+            case 'w': AddWordChars(&retSet); break;
+            case 'W': AddWordChars(&retSet); retSet.flip(); break;
+            case 's': AddSpaceChars(&retSet); break;
+            case 'S': AddSpaceChars(&retSet); retSet.flip(); break;
+            case 't': retSet.set('\t'); break;
+            case 'n': retSet.set('\n'); break;
+            case 'r': retSet.set('\r'); break;
+            case 'f': retSet.set('\f'); break;
+            case 'v': retSet.set('\v'); break;
+            case '0': retSet.set(0); break;
+            case 'x':
+            {
+                int value = HexValue(mSrc[0]) * 16 + HexValue(mSrc[1]);
+                assert(value >= 0);
+                mSrc += 2;
+                retSet.set((unsigned char)value);
+                break;
+            }
+            case '\0':
+                assert(!"Trailing backslash in lexical rule pattern.");
+                --mSrc;
+                break;
+            default:
+                retSet.set((unsigned char)thisChar);
+                break;
+        }
+        return retSet;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    int ParseNumber()
+    {
+        int retVal = 0;
+        while (*mSrc >= '0' && *mSrc <= '9') {
+            retVal = retVal * 10 + (*mSrc++ - '0');
+        }
+        return retVal;
+    }
+
+    // --------------------------------------------------------------------------------------------
+    static ReNode MakeSet(const CharSet& _set)
+    {
+        ReNode retNode(ReNode::ERK_Set);
+        retNode.Set = _set;
+        return retNode;
+    }
+
+    static void AddRange(CharSet* _set, int _low, int _high)
+    {
+        for (int c = _low; c <= _high; ++c) {
+            _set->set(c);
+        }
+    }
+
+    static void AddWordChars(CharSet* _set)
+    {
+        AddRange(_set, 'a', 'z');
+        AddRange(_set, 'A', 'Z');
+        AddRange(_set, '0', '9');
+        _set->set('_');
+    }
+
+    static void AddSpaceChars(CharSet* _set)
+    {
+        _set->set(' ');
+        AddRange(_set, '\t', '\r');
+    }
+
+    static int HexValue(char _c)
+    {
+        if (_c >= '0' && _c <= '9') return _c - '0';
+        if (_c >= 'a' && _c <= 'f') return _c - 'a' + 10;
+        if (_c >= 'A' && _c <= 'F') return _c - 'A' + 10;
+        return -1024;
+    }
+
+    static size_t FirstOf(const CharSet& _set)
+    {
+        for (size_t i = 0; i < _set.size(); ++i) {
+            if (_set.test(i)) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+private:
+    const char* mSrc;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Thompson construction over all rules at once. Each state has any number of epsilon edges and at
+// most one character-set edge.
+class Nfa
+{
+public:
+    struct State
+    {
+        std::vector<int> Epsilon;
+        int SetIndex;   // Index into mSets, or -1.
+        int Next;
+        int AcceptRule; // -1 if not accepting.
+    };
+
+    Nfa() : mStart(NewState()) { }
+
+    // --------------------------------------------------------------------------------------------
+    void AddRule(const ReNode& _pattern, int _ruleIndex)
+    {
+        Fragment frag = Build(_pattern);
+        mStates[mStart].Epsilon.push_back(frag.Start);
+        mStates[frag.End].AcceptRule = _ruleIndex;
+    }
+
+    int GetStart() const { return mStart; }
+    const State& GetState(int _index) const { return mStates[_index]; }
+    const std::vector<CharSet>& GetSets() const { return mSets; }
+
+    // --------------------------------------------------------------------------------------------
+    // Expands _states (sorted, unique) to include everything reachable via epsilon edges.
+    void Closure(std::vector<int>* _states) const
+    {
+        std::vector<int> work(*_states);
+        std::vector<bool> seen(mStates.size(), false);
+        for (size_t i = 0; i < _states->size(); ++i) {
+            seen[(*_states)[i]] = true;
+        }
+
+        while (!work.empty()) {
+            int state = work.back();
+            work.pop_back();
+            const std::vector<int>& eps = mStates[state].Epsilon;
+            for (size_t i = 0; i < eps.size(); ++i) {
+                if (!seen[eps[i]]) {
+                    seen[eps[i]] = true;
+                    _states->push_back(eps[i]);
+                    work.push_back(eps[i]);
+                }
+            }
+        }
+
+        std::sort(_states->begin(), _states->end());
+    }
+
+private:
+    struct Fragment
+    {
+        int Start;
+        int End;
+    };
+
+    // --------------------------------------------------------------------------------------------
+    int NewState()
+    {
+        State state;
+        state.SetIndex = -1;
+        state.Next = -1;
+        state.AcceptRule = -1;
+        mStates.push_back(state);
+        return int(mStates.size() - 1);
+    }
+
+    // --------------------------------------------------------------------------------------------
+    Fragment Build(const ReNode& _node)
+    {
+        Fragment retFrag;
+        switch (_node.Kind) {
+            case ReNode::ERK_Set:
+            {
+                retFrag.Start = NewState();
+                retFrag.End = NewState();
+                mStates[retFrag.Start].SetIndex = int(mSets.size());
+                mStates[retFrag.Start].Next = retFrag.End;
+                mSets.push_back(_node.Set);
+                break;
+            }
+
+            case ReNode::ERK_Concat:
+            {
+                retFrag.Start = NewState();
+                retFrag.End = retFrag.Start;
+                for (size_t i = 0; i < _node.Children.size(); ++i) {
+                    Fragment child = Build(_node.Children[i]);
+                    mStates[retFrag.End].Epsilon.push_back(child.Start);
+                    retFrag.End = child.End;
+                }
+                break;
+            }
+
+            case ReNode::ERK_Alternate:
+            {
+                retFrag.Start = NewState();
+                retFrag.End = NewState();
+                for (size_t i = 0; i < _node.Children.size(); ++i) {
+                    Fragment child = Build(_node.Children[i]);
+                    mStates[retFrag.Start].Epsilon.push_back(child.Start);
+                    mStates[child.End].Epsilon.push_back(retFrag.End);
+                }
+                break;
+            }
+
+            case ReNode::ERK_Repeat:
+            {
+                // Unroll the mandatory copies, then either a loop or the optional copies.
+                const ReNode& child = _node.Children[0];
+                retFrag.Start = NewState();
+                retFrag.End = retFrag.Start;
+                for (int i = 0; i < _node.Min; ++i) {
+                    Fragment copy = Build(child);
+                    mStates[retFrag.End].Epsilon.push_back(copy.Start);
+                    retFrag.End = copy.End;
+                }
+
+                if (_node.Max < 0) {
+                    Fragment loop = Build(child);
+                    int exit = NewState();
+                    mStates[retFrag.End].Epsilon.push_back(loop.Start);
+                    mStates[retFrag.End].Epsilon.push_back(exit);
+                    mStates[loop.End].Epsilon.push_back(loop.Start);
+                    mStates[loop.End].Epsilon.push_back(exit);
+                    retFrag.End = exit;
+                } else {
+                    int exit = NewState();
+                    for (int i = _node.Min; i < _node.Max; ++i) {
+                        Fragment copy = Build(child);
+                        mStates[retFrag.End].Epsilon.push_back(copy.Start);
+                        mStates[retFrag.End].Epsilon.push_back(exit);
+                        retFrag.End = copy.End;
+                    }
+                    mStates[retFrag.End].Epsilon.push_back(exit);
+                    retFrag.End = exit;
+                }
+                break;
+            }
+
+            default:
+                assert(!"Unknown pattern node.");
+                retFrag.Start = retFrag.End = NewState();
+                break;
+        }
+
+        return retFrag;
+    }
+
+private:
+    std::vector<State> mStates;
+    std::vector<CharSet> mSets;
+    int mStart;
+};
+
+} // namespace
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+LexerDFA::LexerDFA(const LexicalEntry* _rules)
+: mRuleCount(0)
+, mClassCount(0)
+{
+    Nfa nfa;
+    for (int i = 0; _rules[i].Pattern; ++i) {
+        nfa.AddRule(PatternParser(_rules[i].Pattern).Parse(), i);
+        ++mRuleCount;
+    }
+
+    // Partition the bytes into classes that every character set treats identically. This keeps
+    // the transition table small (a few dozen columns instead of 256).
+    const std::vector<CharSet>& sets = nfa.GetSets();
+    std::map<std::vector<bool>, int> classBySignature;
+    std::vector<int> classRepresentative;
+    for (int b = 0; b < 256; ++b) {
+        std::vector<bool> signature(sets.size());
+        for (size_t s = 0; s < sets.size(); ++s) {
+            signature[s] = sets[s].test(b);
+        }
+
+        std::map<std::vector<bool>, int>::iterator it = classBySignature.find(signature);
+        if (it == classBySignature.end()) {
+            it = classBySignature.insert(std::make_pair(signature, int(classRepresentative.size()))).first;
+            classRepresentative.push_back(b);
+        }
+        mByteClass[b] = (unsigned char)it->second;
+    }
+    mClassCount = classRepresentative.size();
+
+    // Subset construction. DFA states are identified by their (sorted) set of NFA states.
+    std::map<std::vector<int>, int> stateIds;
+    std::vector<std::vector<int> > stateSets;
+
+    std::vector<int> deadSet;
+    stateIds[deadSet] = kDeadState;
+    stateSets.push_back(deadSet);
+
+    std::vector<int> startSet(1, nfa.GetStart());
+    nfa.Closure(&startSet);
+    stateIds[startSet] = kStartState;
+    stateSets.push_back(startSet);
+
+    for (size_t current = 0; current < stateSets.size(); ++current) {
+        // Record which rules accept here.
+        AcceptRange range;
+        range.Begin = int(mAcceptRules.size());
+        for (size_t i = 0; i < stateSets[current].size(); ++i) {
+            int rule = nfa.GetState(stateSets[current][i]).AcceptRule;
+            if (rule >= 0) {
+                mAcceptRules.push_back(rule);
+            }
+        }
+        std::sort(mAcceptRules.begin() + range.Begin, mAcceptRules.end());
+        mAcceptRules.erase(std::unique(mAcceptRules.begin() + range.Begin, mAcceptRules.end()), mAcceptRules.end());
+        range.End = int(mAcceptRules.size());
+        mAccepts.push_back(range);
+
+        mTransitions.resize(stateSets.size() * mClassCount, kDeadState);
+        for (size_t cls = 0; cls < mClassCount; ++cls) {
+            int representative = classRepresentative[cls];
+            std::vector<int> nextSet;
+            for (size_t i = 0; i < stateSets[current].size(); ++i) {
+                const Nfa::State& nfaState = nfa.GetState(stateSets[current][i]);
+                if (nfaState.SetIndex >= 0 && sets[nfaState.SetIndex].test(representative)) {
+                    nextSet.push_back(nfaState.Next);
+                }
+            }
+
+            if (nextSet.empty()) {
+                continue;
+            }
+
+            std::sort(nextSet.begin(), nextSet.end());
+            nextSet.erase(std::unique(nextSet.begin(), nextSet.end()), nextSet.end());
+            nfa.Closure(&nextSet);
+
+            std::map<std::vector<int>, int>::iterator it = stateIds.find(nextSet);
+            if (it == stateIds.end()) {
+                it = stateIds.insert(std::make_pair(nextSet, int(stateSets.size()))).first;
+                stateSets.push_back(nextSet);
+                mTransitions.resize(stateSets.size() * mClassCount, kDeadState);
+            }
+            mTransitions[current * mClassCount + cls] = it->second;
+        }
+    }
+
+    // Find the states which can be accelerated. Prefer the largest scan class whose bytes all
+    // loop; any looping bytes outside of it are still handled by the normal transitions.
+    static const EScanClass candidates[] = { ESC_IdentChars, ESC_Whitespace, ESC_Digits, ESC_Blanks };
+    mAccelerators.assign(stateSets.size(), (unsigned char)ESC_None);
+    for (size_t state = kStartState; state < stateSets.size(); ++state) {
+        for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); ++c) {
+            bool allLoop = true;
+            for (int b = 0; b < 256 && allLoop; ++b) {
+                if (ScanClassContains(candidates[c], (unsigned char)b)) {
+                    allLoop = mTransitions[state * mClassCount + mByteClass[b]] == int(state);
+                }
+            }
+
+            if (allLoop) {
+                mAccelerators[state] = (unsigned char)candidates[c];
+                break;
+            }
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t LexerDFA::Scan(const char* _begin, const char* _end, std::vector<Match>* _outMatches, size_t* _outExamined) const
+{
+    _outMatches->clear();
+
+    const int* transitions = &mTransitions[0];
+    const unsigned char* accelerators = &mAccelerators[0];
+    int state = kStartState;
+    const char* cur = _begin;
+    while (cur != _end) {
+        state = transitions[state * mClassCount + mByteClass[(unsigned char)*cur]];
+        if (state == kDeadState) {
+            break;
+        }
+        ++cur;
+
+        if (accelerators[state] != ESC_None) {
+            cur = ScanSkipClass(EScanClass(accelerators[state]), cur, _end);
+        }
+
+        const AcceptRange& range = mAccepts[state];
+        for (int i = range.Begin; i < range.End; ++i) {
+            // Longer matches always come later, so just overwrite the length. The list of rules
+            // which can match a single token is tiny, so a linear search is fine.
+            int rule = mAcceptRules[i];
+            size_t length = size_t(cur - _begin);
+            size_t m = 0;
+            for (; m < _outMatches->size(); ++m) {
+                if ((*_outMatches)[m].Rule == rule) {
+                    (*_outMatches)[m].Length = length;
+                    break;
+                }
+            }
+
+            if (m == _outMatches->size()) {
+                Match newMatch = { rule, length };
+                _outMatches->push_back(newMatch);
+            }
+        }
+    }
+
+    if (_outExamined) {
+        (*_outExamined) = size_t(cur - _begin) + 1;
+    }
+
+    // Callers try the rules in priority order.
+    std::sort(_outMatches->begin(), _outMatches->end(),
+              [](const Match& _lhs, const Match& _rhs) { return _lhs.Rule < _rhs.Rule; });
+    return _outMatches->size();
+}
@@ -0,0 +1,22 @@
+#include "glslppafx.h"
+
+#include "linemap.h"
+
+// ------------------------------------------------------------------------------------------------
+void LineMap::Add(uint64_t _offset, uint32_t _outputLine, uint32_t _line, uint32_t _column)
+{
+    assert(mEntries.empty() || mEntries.back().mOffset <= _offset);
+
+    // Two things ending at the same place (a comment ending just before a continuation, say):
+    // only the last one matters.
+    if (!mEntries.empty() && mEntries.back().mOffset == _offset) {
+        mEntries.pop_back();
+    }
+
+    LineMapEntry entry;
+    entry.mOffset = _offset;
+    entry.mOutputLine = _outputLine;
+    entry.mLine = _line;
+    entry.mColumn = _column;
+    mEntries.push_back(entry);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// Says that the output of phases two and three at mOffset, an EOL on line mOutputLine of the
+// output, came from the EOL of line mLine of the source (at mColumn).
+struct LineMapEntry
+{
+    uint64_t mOffset;
+    uint32_t mOutputLine;
+    uint32_t mLine;
+    uint32_t mColumn;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Where the output of phases two and three came from in the source, so that splicing lines and
+// removing comments doesn't need padding in the output to keep line numbers right.
+// An entry goes on the EOL that ends each line other lines were spliced onto, which is where
+// streamed output is padded with the EOLs those lines lost (a comment they run into doesn't move
+// it). Phase four adds the same EOLs as it passes the entry's line (see PhaseFour::NextLine), so
+// the output is the same either way, and building and using the map costs nothing per token, and
+// nothing at all for lines without continuations.
+class LineMap
+{
+public:
+    void Clear() { mEntries.clear(); }
+
+    // Entries must be added in order of _offset.
+    void Add(uint64_t _offset, uint32_t _outputLine, uint32_t _line, uint32_t _column);
+
+    size_t Size() const { return mEntries.size(); }
+    bool IsEmpty() const { return mEntries.empty(); }
+    const LineMapEntry& Get(size_t _index) const { return mEntries[_index]; }
+
+private:
+    std::vector<LineMapEntry> mEntries;
+};
@@ -0,0 +1,131 @@
+#include "glslppafx.h"
+
+#include "macros.h"
+
+#include <string.h>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+MacroTable::MacroTable()
+: mCount(0)
+{
+    mSlots.resize(256, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+MacroDef* MacroTable::NewDef(uint32_t _name, EMacroKind _kind, uint16_t _paramCount,
+                             const PPToken* _replacement, uint32_t _replacementLength)
+{
+    PPToken* replacement = NULL;
+    if (_replacementLength > 0) {
+        replacement = mArena.AllocateArray<PPToken>(_replacementLength);
+        memcpy(replacement, _replacement, sizeof(PPToken) * _replacementLength);
+    }
+
+    MacroDef* def = mArena.AllocateArray<MacroDef>(1);
+    def->mName = _name;
+    def->mReplacementLength = _replacementLength;
+    def->mReplacement = replacement;
+    def->mParamCount = _paramCount;
+    def->mKind = uint8_t(_kind);
+    def->mHasPaste = false;
+    def->mDisabled = false;
+    def->mExpandsAlone = false;
+    def->mExpansionInheritsSpace = false;
+    def->mExpansionLength = 0;
+    def->mExpansion = NULL;
+    def->mExpansionGeneration = 0;
+    def->mOperandState = EMO_Unknown;
+    def->mOperandValue = 0;
+
+    for (uint32_t i = 0; i < _replacementLength; ++i) {
+        if (replacement[i].mType == PPT_Punctuator && replacement[i].mId == PPS_HashHash) {
+            def->mHasPaste = true;
+            break;
+        }
+    }
+
+    return def;
+}
+
+// ------------------------------------------------------------------------------------------------
+void MacroTable::Insert(MacroDef* _def)
+{
+    size_t mask = mSlots.size() - 1;
+    size_t slot = Hash(_def->mName) & mask;
+    for (; mSlots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (mSlots[slot]->mName == _def->mName) {
+            mSlots[slot] = _def;
+            return;
+        }
+    }
+
+    mSlots[slot] = _def;
+    ++mCount;
+
+    // Keep the load factor at or below one half, misses stay short.
+    if (mCount * 2 > mSlots.size()) {
+        Grow();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool MacroTable::Remove(uint32_t _name)
+{
+    size_t mask = mSlots.size() - 1;
+    size_t slot = Hash(_name) & mask;
+    for (; mSlots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (mSlots[slot]->mName == _name) {
+            break;
+        }
+    }
+
+    if (mSlots[slot] == NULL) {
+        return false;
+    }
+
+    // Backward shift deletion: pull later members of the probe run back into the hole, so
+    // lookups never need tombstones.
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; mSlots[next] != NULL; next = (next + 1) & mask) {
+        size_t home = Hash(mSlots[next]->mName) & mask;
+        // Move it if its home is not in the (cyclic) range (hole, next].
+        bool homeInRange = (hole <= next) ? (hole < home && home <= next)
+                                          : (hole < home || home <= next);
+        if (!homeInRange) {
+            mSlots[hole] = mSlots[next];
+            hole = next;
+        }
+    }
+
+    mSlots[hole] = NULL;
+    --mCount;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void MacroTable::Clear()
+{
+    mSlots.assign(mSlots.size(), NULL);
+    mCount = 0;
+    mArena.Reset();
+}
+
+// ------------------------------------------------------------------------------------------------
+void MacroTable::Grow()
+{
+    std::vector<MacroDef*> oldSlots(mSlots.size() * 2, NULL);
+    oldSlots.swap(mSlots);
+
+    size_t mask = mSlots.size() - 1;
+    for (size_t i = 0; i < oldSlots.size(); ++i) {
+        if (oldSlots[i] != NULL) {
+            size_t slot = Hash(oldSlots[i]->mName) & mask;
+            while (mSlots[slot] != NULL) {
+                slot = (slot + 1) & mask;
+            }
+            mSlots[slot] = oldSlots[i];
+        }
+    }
+}
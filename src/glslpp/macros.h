@@ -0,0 +1,105 @@
+#pragma once
+
+#include "common/arena.h"
+#include "pptokens.h"
+
+#include <stdint.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+enum EMacroKind {
+    EMK_Object = 0,
+    EMK_Function,
+
+    // Built in, and expanded specially.
+    EMK_Line,
+    EMK_File,
+    EMK_Version
+};
+
+enum EMacroOperand {
+    EMO_Unknown = 0,
+    EMO_Value,
+    EMO_NotOperand
+};
+
+// A macro definition. The replacement list is stored already tokenized, with each use of a
+// parameter replaced by a PPT_Param token, so expansion never looks at text at all.
+struct MacroDef
+{
+    uint32_t mName;
+    uint32_t mReplacementLength;
+    const PPToken* mReplacement;
+    uint16_t mParamCount;
+    uint8_t mKind;          // EMacroKind
+    bool mHasPaste;         // Whether the replacement list uses ##.
+    bool mDisabled;         // While the macro's own expansion is being rescanned.
+
+    // An object-like macro's replacement list fully expanded, as phase four caches it (see
+    // PhaseFour::CacheExpansion). Only meaningful while mExpansionGeneration is current.
+    bool mExpandsAlone;             // The expansion doesn't depend on what's around the macro.
+    bool mExpansionInheritsSpace;   // Its first token takes the macro name's leading space.
+    uint32_t mExpansionLength;
+    const PPToken* mExpansion;
+    uint32_t mExpansionGeneration;  // 0 for never cached.
+
+    // The expansion's value as a #if operand, if it is a lone one (see
+    // PPConditionCompiler::EvaluateOperand). Worked out when first needed, once it's cached.
+    uint8_t mOperandState;          // EMacroOperand
+    long long mOperandValue;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// The defined macros, keyed by the interned id of their name. Open addressed with linear probing,
+// and a lookup for a name which isn't a macro--by far the most common case, since every
+// identifier in the source is looked up--usually stops at the first, empty, slot.
+// Definitions and their replacement lists are allocated from the table's arena, and live until
+// Clear; undefining or redefining a macro doesn't free anything.
+class MacroTable
+{
+public:
+    MacroTable();
+
+    MacroDef* Find(uint32_t _name) const
+    {
+        size_t mask = mSlots.size() - 1;
+        for (size_t slot = Hash(_name) & mask; mSlots[slot] != NULL; slot = (slot + 1) & mask) {
+            if (mSlots[slot]->mName == _name) {
+                return mSlots[slot];
+            }
+        }
+        return NULL;
+    }
+
+    // Allocates a definition (and room for its replacement list) from the table's arena. It
+    // isn't in the table until it's passed to Insert.
+    MacroDef* NewDef(uint32_t _name, EMacroKind _kind, uint16_t _paramCount,
+                     const PPToken* _replacement, uint32_t _replacementLength);
+
+    // Adds _def, replacing any existing definition with the same name.
+    void Insert(MacroDef* _def);
+
+    // Returns false if there was no such macro.
+    bool Remove(uint32_t _name);
+
+    void Clear();
+
+    size_t Size() const { return mCount; }
+
+private:
+    MacroTable(const MacroTable&);
+    MacroTable& operator=(const MacroTable&);
+
+    // Fibonacci hashing. Names are dense small integers, so this mostly just spreads them out.
+    static size_t Hash(uint32_t _name) { return size_t(_name * 2654435761u); }
+
+    void Grow();
+
+    std::vector<MacroDef*> mSlots;
+    size_t mCount;
+    Arena mArena;
+};
@@ -2,8 +2,139 @@
 #include "glslppafx.h"
 
 #include "glslpp/preproc.h"
-#include "common/parserutil.h"
-#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <fcntl.h>
+#   include <io.h>
+#endif
+
+// ------------------------------------------------------------------------------------------------
+static void writeToStdout(const char* _text, size_t _length, void* /*_userData*/)
+{
+    fwrite(_text, 1, _length, stdout);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Streams stdin through the preprocessor, so "-" works at the end of a pipe no matter how much 
+// comes down it.
+static GLCCint preprocessStdin(GLCCPreprocessor* _preproc)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    GLCCint errCode = preprocessBegin(_preproc, "stdin", writeToStdout, NULL);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+
+    char chunk[64 * 1024];
+    size_t chunkLength = 0;
+    while (errCode == GLCCError_Ok && (chunkLength = fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+        errCode = preprocessFeed(_preproc, chunk, chunkLength);
+    }
+
+    GLCCint endErrCode = preprocessEnd(_preproc);
+    return (errCode != GLCCError_Ok) ? errCode : endErrCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+// More than one file goes through a batch, all at once, and their output comes out in order.
+static GLCCint preprocessFiles(const GLPPOptions& _opts, const std::vector<const char*>& _files)
+{
+    GLPPBatch* batch = NULL;
+    GLCCint errCode = genBatch(&batch, &_opts, 0);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+
+    std::vector<GLPPBatchInput> inputs(_files.size());
+    std::vector<GLPPBatchResult> results(_files.size());
+    for (size_t i = 0; i < _files.size(); ++i) {
+        inputs[i].mFilename = _files[i];
+        inputs[i].mMemBuffer = NULL;
+    }
+
+    errCode = preprocessBatch(batch, &inputs[0], inputs.size(), &results[0]);
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].mErrorCode == GLCCError_Ok) {
+            writeToStdout(results[i].mOutput, results[i].mOutputLength, NULL);
+        } else if (results[i].mError) {
+            fprintf(stderr, "Error reported during preprocessing: \"%s\"\n", results[i].mError);
+        }
+    }
+
+    deleteBatch(&batch);
+    return errCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scans each file for what it depends on, without preprocessing it. With _print, what's found is
+// printed; with _optDepfile, written there as one Makefile rule per file, all for _optTarget,
+// which main requires with a depfile.
+static GLCCint scanFiles(const GLPPOptions& _opts, const std::vector<const char*>& _files, bool _print,
+                         const char* _optDepfile, const char* _optTarget)
+{
+    GLCCPreprocessor* preproc = NULL;
+    GLCCint errCode = genPreprocessor(&preproc, &_opts);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+
+    std::string depfile;
+    for (size_t i = 0; i < _files.size() && errCode == GLCCError_Ok; ++i) {
+        GLPPScanResult result;
+        errCode = scanFromFile(preproc, _files[i], &result);
+        if (errCode != GLCCError_Ok) {
+            const char* errText = getLastError(preproc);
+            if (errText) {
+                fprintf(stderr, "Error reported during scanning: \"%s\"\n", errText);
+            }
+            break;
+        }
+
+        if (_print) {
+            printf("%s:\n", _files[i]);
+            if (result.mVersion != 0) {
+                printf("    version %d\n", (int) result.mVersion);
+            }
+            for (size_t j = 0; j < result.mExtensionCount; ++j) {
+                printf("    extension %s\n", result.mExtensions[j]);
+            }
+            for (size_t j = 0; j < result.mIncludeCount; ++j) {
+                printf("    include %s\n", result.mIncludes[j]);
+            }
+        }
+
+        if (_optDepfile) {
+            const char* rule = getDepfile(preproc, _optTarget, NULL);
+            if (!rule) {
+                fprintf(stderr, "The depfile's target can't be its input, \"%s\".\n", _files[i]);
+                errCode = GLCCError_InvalidOperation;
+                break;
+            }
+            depfile += rule;
+        }
+    }
+
+    if (errCode == GLCCError_Ok && _optDepfile) {
+        FILE* file = fopen(_optDepfile, "wb");
+        if (!file || fwrite(depfile.data(), 1, depfile.size(), file) != depfile.size()) {
+            fprintf(stderr, "Could not write \"%s\".\n", _optDepfile);
+            errCode = GLCCError_FileNotFound;
+        }
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    deletePreprocessor(&preproc);
+    return errCode;
+}
 
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
@@ -15,38 +146,98 @@ int main(int argc, char* argv[])
     GLCCint tmpErrCode = GLCCError_Ok;
     
     GLPPOptions opts;
+    std::vector<const char*> includePaths;
+    std::vector<const char*> defines;
+    std::vector<const char*> inputFiles;
+    const char* inputFile = NULL;
+    bool scanOnly = false;
+    const char* depfile = NULL;
+    const char* depfileTarget = NULL;
 
-    extern const LexicalEntry* GetGlslTokens();
-    extern const char** GetGlslReservedTypes();
+    // glslpp [-I<dir>]... [-D<name>[=<value>]]... [--cache-dir=<dir>] [--scan]
+    //        [--depfile=<path> --depfile-target=<name>] <file>..., where a single <file> can be
+    // "-" for stdin. --scan only lists what each file depends on, rather than preprocessing it;
+    // --depfile writes those dependencies out as Makefile rules for the target (what the build
+    // makes from the files; see getDepfile), as well.
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+            includePaths.push_back(argv[i] + 2);
+        } else if (strncmp(argv[i], "-D", 2) == 0 && argv[i][2] != '\0') {
+            defines.push_back(argv[i] + 2);
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0 && argv[i][12] != '\0') {
+            opts.mCacheDirectory = argv[i] + 12;
+        } else if (strcmp(argv[i], "--scan") == 0) {
+            scanOnly = true;
+        } else if (strncmp(argv[i], "--depfile=", 10) == 0 && argv[i][10] != '\0') {
+            depfile = argv[i] + 10;
+        } else if (strncmp(argv[i], "--depfile-target=", 17) == 0 && argv[i][17] != '\0') {
+            depfileTarget = argv[i] + 17;
+        } else {
+            inputFiles.push_back(argv[i]);
+        }
+    }
 
-    StateObject parserState(GetGlslReservedTypes());
-    Lexer myLex(GetGlslTokens(), "struct Foo {\n\tdmat2x2 bar[3];\n\tfloat baz;\n};", &parserState);
-    for (Token tok = myLex.Pop(); !tok.IsEOF(); tok = myLex.Pop()) {
-        std::cout << tok << std::endl;
+    if (inputFiles.empty()) {
+        errCode = GLCCError_MissingRequiredParameter;
+        goto exit;
     }
 
-    if (argc < 2) {
+    opts.mIncludePaths = includePaths.empty() ? NULL : &includePaths[0];
+    opts.mIncludePathCount = includePaths.size();
+    opts.mDefines = defines.empty() ? NULL : &defines[0];
+    opts.mDefineCount = defines.size();
+
+    // The input can't be the target: it would depend on itself, and nothing the build makes
+    // would depend on the includes.
+    if (depfile && !depfileTarget) {
+        fprintf(stderr, "--depfile needs --depfile-target=<name>, the file built from the input.\n");
         errCode = GLCCError_MissingRequiredParameter;
         goto exit;
     }
 
+    // stdin can only be read once, so it can't be scanned (and then preprocessed).
+    if (scanOnly || depfile) {
+        if (strcmp(inputFiles[0], "-") == 0) {
+            errCode = GLCCError_InvalidOperation;
+            goto exit;
+        }
+
+        errCode = scanFiles(opts, inputFiles, scanOnly, depfile, depfileTarget);
+        if (scanOnly || errCode != GLCCError_Ok) {
+            goto exit;
+        }
+    }
+
+    if (inputFiles.size() > 1) {
+        errCode = preprocessFiles(opts, inputFiles);
+        goto exit;
+    }
+    inputFile = inputFiles[0];
+
     if ((errCode = genPreprocessor(&preproc, &opts)) != GLCCError_Ok) 
         goto exit;
 
-    if ((errCode = preprocessFromFile(preproc, argv[1])) != GLCCError_Ok) {
+    errCode = (strcmp(inputFile, "-") == 0) ? preprocessStdin(preproc) 
+                                            : preprocessFromFile(preproc, inputFile);
+    if (errCode != GLCCError_Ok) {
         const char* errText = getLastError(preproc);
         if (errText) {
-            printf("Error reported during preprocessing: \"%s\"\n", errText);
+            fprintf(stderr, "Error reported during preprocessing: \"%s\"\n", errText);
         }
 
         goto cleanup;
     }
 
+    if (strcmp(inputFile, "-") != 0) {
+        size_t outputLength = 0;
+        const char* output = getOutput(preproc, &outputLength);
+        writeToStdout(output, outputLength, NULL);
+    }
 
 cleanup:
     tmpErrCode = deletePreprocessor(&preproc);
     if (tmpErrCode != GLCCError_Ok) {
-        printf("Error while cleaning up: '%d', main still returning preprocess status.", tmpErrCode);
+        fprintf(stderr, "Error while cleaning up: '%d', main still returning preprocess status.", tmpErrCode);
     }
 
 exit:
@@ -0,0 +1,36 @@
+#include "glslppafx.h"
+
+#include "node.h"
+
+#include <string.h>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+SyntaxTree::SyntaxTree()
+: mStorage(1)
+, mRoot(kNoNode)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+void SyntaxTree::Clear()
+{
+    // The nodes don't need destroying, so this is just forgetting them. The capacity stays.
+    mStorage.resize(1);
+    mRoot = kNoNode;
+}
+
+// ------------------------------------------------------------------------------------------------
+NodeRef SyntaxTree::MakeList(uint32_t _token, const NodeRef* _items, uint32_t _count)
+{
+    // The items go straight after the node, in the same allocation.
+    NodeRef ref = Allocate(sizeof(ListNode) + sizeof(NodeRef) * _count);
+    ListNode* list = new (mStorage.data() + ref) ListNode();
+    list->mKind = NK_List;
+    list->mToken = _token;
+    list->mCount = _count;
+    if (_count > 0) {
+        memcpy(list->Items(), _items, sizeof(NodeRef) * _count);
+    }
+    return ref;
+}
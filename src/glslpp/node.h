@@ -0,0 +1,412 @@
+#pragma once
+
+#include "stringutils.h"
+
+#include <assert.h>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// The syntax tree. Every node of a translation unit is bump allocated from the unit's SyntaxTree,
+// and nodes refer to each other by NodeRef--32 bits naming where the node is in the tree's
+// storage--rather than by pointer. A child costs half what a pointer would, and the tree can grow
+// (and be moved, or copied) without fixing anything up.
+// Nothing is freed a node at a time: SyntaxTree::Clear drops the whole tree at once, keeping its
+// memory for the next unit. So, as with Arena, nodes must not need their destructors run; they
+// are plain structs, with no virtual functions.
+//
+// Every node starts with a Node, whose mKind says which of the structs below it is. Expressions
+// share their structs between kinds (all binary operators are a BinaryNode, say) and say which
+// operator they are in mOp.
+typedef uint32_t NodeRef;
+
+// No node: an optional child that isn't there.
+static const NodeRef kNoNode = 0;
+
+// No token, for the optional tokens some nodes keep (a parameter's name, say).
+static const uint32_t kNoToken = UINT32_MAX;
+
+enum ENodeKind {
+    NK_None = 0,
+    NK_List,                // ListNode. A sequence of any other kind.
+
+    // Expressions.
+    NK_Identifier,          // Node: a variable_identifier, at mToken.
+    NK_Constant,            // Node: an INT/UINT/FLOAT/BOOLCONSTANT, at mToken.
+    NK_Unary,               // UnaryNode. mOp is a prefix or postfix operator.
+    NK_Binary,              // BinaryNode. mOp is an arithmetic, logical or comma operator.
+    NK_Assignment,          // BinaryNode. mOp is = or a compound assignment.
+    NK_Conditional,         // ConditionalNode: ?:.
+    NK_Index,               // BinaryNode: mLeft[mRight].
+    NK_FieldSelection,      // FieldSelectionNode: .field, or .method() with NF_MethodCall set.
+    NK_Call,                // CallNode: a function, or a constructor of mCallee's type.
+
+    // Types and declarations.
+    NK_TypeSpecifier,       // TypeSpecifierNode.
+    NK_Struct,              // StructNode.
+    NK_Qualifier,           // QualifierNode.
+    NK_LayoutId,            // LayoutIdNode: one of a layout qualifier's ids.
+    NK_FullySpecifiedType,  // FullySpecifiedTypeNode.
+    NK_Declarator,          // DeclaratorNode: one name in a declaration.
+    NK_Declaration,         // DeclarationNode, also for a struct's members.
+    NK_Precision,           // PrecisionNode: precision highp float;
+    NK_Parameter,           // ParameterNode.
+    NK_FunctionPrototype,   // FunctionPrototypeNode.
+    NK_FunctionDefinition,  // FunctionDefinitionNode.
+
+    // Statements. A declaration statement is just the declaration.
+    NK_Compound,            // CompoundNode.
+    NK_ExpressionStatement, // ExpressionStatementNode. mExpression is kNoNode for a lone ';'.
+    NK_If,                  // IfNode.
+    NK_Switch,              // SwitchNode.
+    NK_Case,                // CaseNode. mValue is kNoNode for default:.
+    NK_While,               // LoopNode.
+    NK_DoWhile,             // LoopNode.
+    NK_For,                 // ForNode.
+    NK_Jump,                // JumpNode. mOp is which.
+
+    NK_TranslationUnit,     // TranslationUnitNode.
+
+    NK_Count
+};
+
+enum ENodeOp {
+    NO_None = 0,
+
+    // Unary.
+    NO_Plus,
+    NO_Negate,
+    NO_Not,
+    NO_Complement,
+    NO_PreIncrement,
+    NO_PreDecrement,
+    NO_PostIncrement,
+    NO_PostDecrement,
+
+    // Binary, tightest binding first.
+    NO_Multiply,
+    NO_Divide,
+    NO_Remainder,
+    NO_Add,
+    NO_Subtract,
+    NO_ShiftLeft,
+    NO_ShiftRight,
+    NO_Less,
+    NO_Greater,
+    NO_LessEqual,
+    NO_GreaterEqual,
+    NO_Equal,
+    NO_NotEqual,
+    NO_BitAnd,
+    NO_BitXor,
+    NO_BitOr,
+    NO_LogicalAnd,
+    NO_LogicalXor,
+    NO_LogicalOr,
+    NO_Comma,
+
+    // Assignment.
+    NO_Assign,
+    NO_MulAssign,
+    NO_DivAssign,
+    NO_ModAssign,
+    NO_AddAssign,
+    NO_SubAssign,
+    NO_LeftAssign,
+    NO_RightAssign,
+    NO_AndAssign,
+    NO_XorAssign,
+    NO_OrAssign,
+
+    // Jumps.
+    NO_Break,
+    NO_Continue,
+    NO_Discard,
+    NO_Return
+};
+
+// ------------------------------------------------------------------------------------------------
+// Where a node came from is the token it was made at (its operator, for an operator; its keyword
+// or name otherwise), as an index into the unit's TokenBuffer. That gives its text and position
+// without the node having to store either.
+struct Node
+{
+    uint8_t mKind;      // ENodeKind
+    uint8_t mOp;        // ENodeOp, for the kinds that have one.
+    uint16_t mFlags;    // Kind specific.
+    uint32_t mToken;
+};
+
+struct ListNode : Node
+{
+    uint32_t mCount;
+
+    // The items follow the node itself.
+    NodeRef* Items() { return (NodeRef*) (this + 1); }
+    const NodeRef* Items() const { return (const NodeRef*) (this + 1); }
+};
+
+// ------------------------------------------------------------------------------------------------
+struct UnaryNode : Node
+{
+    NodeRef mOperand;
+};
+
+struct BinaryNode : Node
+{
+    NodeRef mLeft;
+    NodeRef mRight;
+};
+
+struct ConditionalNode : Node
+{
+    NodeRef mCondition;
+    NodeRef mTrue;
+    NodeRef mFalse;
+};
+
+enum EFieldSelectionFlags {
+    NF_MethodCall = 1 << 0      // array.length(), the only method there is.
+};
+
+struct FieldSelectionNode : Node
+{
+    NodeRef mBase;
+    uint32_t mField;            // The field's token.
+};
+
+struct CallNode : Node
+{
+    NodeRef mCallee;            // An NK_Identifier, or an NK_TypeSpecifier for a constructor.
+    NodeRef mArguments;         // NK_List, or kNoNode for f() and f(void).
+};
+
+// ------------------------------------------------------------------------------------------------
+struct TypeSpecifierNode : Node
+{
+    // mToken is the type's name; for a struct, mStruct is set instead.
+    NodeRef mStruct;
+    NodeRef mArraySize;         // kNoNode if it isn't an array. An empty NK_List for [].
+    uint32_t mPrecision = kNoToken;     // The precision qualifier's token, or kNoToken.
+};
+
+struct StructNode : Node
+{
+    uint32_t mName = kNoToken;  // The name's token, or kNoToken for an anonymous struct.
+    NodeRef mMembers;           // NK_List of NK_Declaration.
+};
+
+enum EQualifierFlags {
+    NF_Const            = 1 << 0,
+    NF_Attribute        = 1 << 1,
+    NF_Varying          = 1 << 2,
+    NF_Centroid         = 1 << 3,
+    NF_In               = 1 << 4,
+    NF_Out              = 1 << 5,
+    NF_Uniform          = 1 << 6,
+    NF_Patch            = 1 << 7,
+    NF_Sample           = 1 << 8,
+    NF_Invariant        = 1 << 9,
+    NF_Smooth           = 1 << 10,
+    NF_Flat             = 1 << 11,
+    NF_NoPerspective    = 1 << 12
+};
+
+// A type qualifier, with every part of it in mFlags (in and out both set for inout).
+struct QualifierNode : Node
+{
+    NodeRef mLayout;            // NK_List of NK_LayoutId, or kNoNode.
+    uint32_t mPrecision = kNoToken;     // The precision qualifier's token, or kNoToken.
+};
+
+struct LayoutIdNode : Node
+{
+    // mToken is the id's name.
+    NodeRef mValue;             // kNoNode for an id without one.
+};
+
+struct FullySpecifiedTypeNode : Node
+{
+    NodeRef mQualifier;         // kNoNode if it's unqualified.
+    NodeRef mType;
+};
+
+struct DeclaratorNode : Node
+{
+    // mToken is the name.
+    NodeRef mArraySize;         // As for TypeSpecifierNode.
+    NodeRef mInitializer;
+};
+
+// A declaration of any number of variables of one type, or of just the type (struct S { ... };).
+struct DeclarationNode : Node
+{
+    NodeRef mType;
+    NodeRef mDeclarators;       // NK_List of NK_Declarator, or kNoNode.
+};
+
+struct PrecisionNode : Node
+{
+    uint32_t mPrecision;        // The precision qualifier's token.
+    NodeRef mType;
+};
+
+struct ParameterNode : Node
+{
+    NodeRef mQualifier;         // kNoNode if it's unqualified.
+    NodeRef mType;
+    uint32_t mName = kNoToken;  // The name's token, or kNoToken for an unnamed parameter.
+    NodeRef mArraySize;
+};
+
+struct FunctionPrototypeNode : Node
+{
+    // mToken is the name.
+    NodeRef mReturnType;
+    NodeRef mParameters;        // NK_List of NK_Parameter, or kNoNode.
+};
+
+struct FunctionDefinitionNode : Node
+{
+    NodeRef mPrototype;
+    NodeRef mBody;              // NK_Compound.
+};
+
+// ------------------------------------------------------------------------------------------------
+enum ECompoundFlags {
+    NF_NoNewScope = 1 << 0      // A function body, or a loop's: the scope is the enclosing one.
+};
+
+struct CompoundNode : Node
+{
+    NodeRef mStatements;        // NK_List, or kNoNode for {}.
+};
+
+struct ExpressionStatementNode : Node
+{
+    NodeRef mExpression;
+};
+
+struct IfNode : Node
+{
+    NodeRef mCondition;
+    NodeRef mThen;
+    NodeRef mElse;              // kNoNode without an else.
+};
+
+struct SwitchNode : Node
+{
+    NodeRef mExpression;
+    NodeRef mStatements;        // NK_List of statements and NK_Case labels, or kNoNode.
+};
+
+struct CaseNode : Node
+{
+    NodeRef mValue;
+};
+
+// while and do-while. mCondition can be an NK_Declaration (while (bool b = ...)).
+struct LoopNode : Node
+{
+    NodeRef mCondition;
+    NodeRef mBody;
+};
+
+struct ForNode : Node
+{
+    NodeRef mInit;              // A statement: NK_ExpressionStatement or NK_Declaration.
+    NodeRef mCondition;         // kNoNode if there's none, and can be an NK_Declaration.
+    NodeRef mIncrement;
+    NodeRef mBody;
+};
+
+struct JumpNode : Node
+{
+    NodeRef mValue;             // What's returned, if anything.
+};
+
+struct TranslationUnitNode : Node
+{
+    NodeRef mDeclarations;      // NK_List of declarations and NK_FunctionDefinition.
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A translation unit's nodes, in one contiguous block which grows geometrically. (Arena can't be
+// used: its blocks are all over the address space, so nothing shorter than a pointer could say
+// where in it a node is.) A NodeRef is an offset into the block, in kNodeAlignment units, so a
+// tree can hold up to 32GB of nodes. Pointers to nodes are only good until the next allocation,
+// which may move the block; hold on to NodeRefs instead.
+// Making a node is a bump of the block's size; Clear frees every node at once, and the block
+// keeps its memory, so a SyntaxTree which is reused for unit after unit stops allocating.
+class SyntaxTree
+{
+public:
+    static const size_t kNodeAlignment = 8;
+
+    SyntaxTree();
+
+    // Frees every node, in O(1).
+    void Clear();
+
+    // A new node of type T and kind _kind, made at _token. Everything else in it is zeroed--
+    // no children--apart from the optional tokens, which are kNoToken.
+    template <typename T>
+    NodeRef Make(ENodeKind _kind, uint32_t _token, ENodeOp _op = NO_None)
+    {
+        NodeRef ref = Allocate(sizeof(T));
+        T* node = new (mStorage.data() + ref) T();
+        node->mKind = (uint8_t) _kind;
+        node->mOp = (uint8_t) _op;
+        node->mToken = _token;
+        return ref;
+    }
+
+    // A new NK_List of _count items, copied from _items.
+    NodeRef MakeList(uint32_t _token, const NodeRef* _items, uint32_t _count);
+
+    Node* Get(NodeRef _ref)
+    {
+        assert(_ref != kNoNode && _ref < mStorage.size());
+        return (Node*) (mStorage.data() + _ref);
+    }
+
+    const Node* Get(NodeRef _ref) const
+    {
+        assert(_ref != kNoNode && _ref < mStorage.size());
+        return (const Node*) (mStorage.data() + _ref);
+    }
+
+    // _ref as the node type for its kind.
+    template <typename T> T* As(NodeRef _ref) { return static_cast<T*>(Get(_ref)); }
+    template <typename T> const T* As(NodeRef _ref) const { return static_cast<const T*>(Get(_ref)); }
+
+    ENodeKind GetKind(NodeRef _ref) const { return (ENodeKind) Get(_ref)->mKind; }
+
+    // The root, once a parse has set it.
+    NodeRef GetRoot() const { return mRoot; }
+    void SetRoot(NodeRef _root) { mRoot = _root; }
+
+    // Bytes used by nodes since construction or the last Clear.
+    size_t GetBytesUsed() const { return (mStorage.size() - 1) * kNodeAlignment; }
+
+private:
+    // --------------------------------------------------------------------------------------------
+    NodeRef Allocate(size_t _size)
+    {
+        size_t ref = mStorage.size();
+        size_t units = (_size + kNodeAlignment - 1) / kNodeAlignment;
+        assert(ref + units <= UINT32_MAX);
+        bufferResize(&mStorage, ref + units);
+        return NodeRef(ref);
+    }
+
+    // In kNodeAlignment sized units. The first is never used, so no node is kNoNode.
+    std::vector<uint64_t> mStorage;
+    NodeRef mRoot;
+};
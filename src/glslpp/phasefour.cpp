@@ -0,0 +1,1843 @@
+#include "glslppafx.h"
+
+#include "phasefour.h"
+#include "errorutils.h"
+#include "fileutils.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsPunctuator(const PPToken& _token, uint32_t _id)
+{
+    return _token.mType == PPT_Punctuator && _token.mId == _id;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+PhaseFour::PhaseFour(const char* _filename, StringInterner* _interner)
+: mFilename(_filename)
+, mInterner(_interner)
+, mPos(NULL)
+, mEnd(NULL)
+, mFinal(false)
+, mInTextLine(false)
+, mMidLine(false)
+, mIncludePaths(NULL)
+, mMaintainLineCount(true)
+, mExpansionGeneration(1)
+, mSkipping(false)
+, mConditionCompiler(_interner)
+, mOutput(NULL)
+, mAtLineStart(true)
+, mAvoidPaste(false)
+, mPendingNewLines(0)
+, mLine(1)
+, mLineDelta(0)
+, mLineMap(NULL)
+, mLineMapNext(0)
+, mOutputLine(1)
+, mLineMapDelta(0)
+, mSourceNumber(0)
+, mVersion(110) // Per the spec, this is the default.
+, mSawTokens(false)
+, mUsedLineContinuations(false)
+, mErrorCode(GLCCError_Ok)
+{
+    mLastEmitted.mId = 0;
+    mLastEmitted.mType = PPT_EOL;
+    mLastEmitted.mFlags = 0;
+
+    // Tokens are read straight out of these, they must never move.
+    mIncludeTokens.reserve(kMaxIncludeDepth);
+
+    DefineBuiltins();
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::~PhaseFour()
+{
+    Unwind();
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::Reset(const char* _filename)
+{
+    Unwind();
+
+    mFilename = _filename;
+    mPos = NULL;
+    mEnd = NULL;
+    mFinal = false;
+    mInTextLine = false;
+    mHeldBack.clear();
+    mMidLine = false;
+
+    // mIncludeTokens is left alone; each depth's tokens are overwritten when it's next entered.
+    mIncludes.clear();
+    mIncludeStates.clear();
+    mIncludedFiles.clear();
+    mPendingInclude.reset();
+
+    mCollected.clear();
+    mDefineTokens.clear();
+    mParamNames.clear();
+    mScratch.Reset();
+
+    mConditionals.clear();
+    mSkipping = false;
+
+    mOutput = NULL;
+    mLastEmitted.mId = 0;
+    mLastEmitted.mType = PPT_EOL;
+    mLastEmitted.mFlags = 0;
+    mAtLineStart = true;
+    mAvoidPaste = false;
+    mPendingNewLines = 0;
+
+    mLine = 1;
+    mLineDelta = 0;
+    mLineMap = NULL;
+    mLineMapNext = 0;
+    mOutputLine = 1;
+    mLineMapDelta = 0;
+    mSourceNumber = 0;
+    mVersion = 110;
+    mSawTokens = false;
+    mUsedLineContinuations = false;
+
+    mErrorCode = GLCCError_Ok;
+    mErrorString.clear();
+
+    FlushExpansions();
+    mMacros.Clear();
+    DefineBuiltins();
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::DefineBuiltins()
+{
+    mMacros.Insert(mMacros.NewDef(PPS_LineMacro, EMK_Line, 0, NULL, 0));
+    mMacros.Insert(mMacros.NewDef(PPS_FileMacro, EMK_File, 0, NULL, 0));
+    mMacros.Insert(mMacros.NewDef(PPS_VersionMacro, EMK_Version, 0, NULL, 0));
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint PhaseFour::Process(const PPToken* _tokens, size_t _count, bool _final, std::vector<char>* _output)
+{
+    if (mErrorCode != GLCCError_Ok) {
+        return mErrorCode;
+    }
+
+    assert(_count == 0 || _tokens[_count - 1].mType == PPT_EOL || mMidLine);
+
+    // Anything held back last time comes first.
+    bool usingHeldBack = !mHeldBack.empty();
+    if (usingHeldBack) {
+        mHeldBack.insert(mHeldBack.end(), _tokens, _tokens + _count);
+        mPos = mHeldBack.data();
+        mEnd = mPos + mHeldBack.size();
+    } else {
+        mPos = _tokens;
+        mEnd = _tokens + _count;
+    }
+
+    mFinal = _final;
+    mOutput = _output;
+
+    EResult result = Run();
+    if (result == ER_NeedMore) {
+        if (usingHeldBack) {
+            mHeldBack.erase(mHeldBack.begin(), mHeldBack.begin() + (mPos - mHeldBack.data()));
+        } else {
+            mHeldBack.assign(mPos, mEnd);
+        }
+    } else {
+        mHeldBack.clear();
+    }
+
+    mPos = mEnd = NULL;
+    mOutput = NULL;
+
+    if (result == ER_Ok && _final) {
+        if (!mConditionals.empty()) {
+            mLine = mConditionals.back().mLine;
+            mLineDelta = 0;
+            Error(GLCCError_InvalidSyntax, "unterminated conditional directive");
+        } else if (mUsedLineContinuations && mVersion < 420) {
+            // ANNOY: Deferred from phase two, because the #version wasn't known yet there.
+            mLine = 1;
+            mLineDelta = 0;
+            Error(GLCCError_InvalidSyntax, "line continuation requires #version 420 or later");
+        }
+    }
+
+    return mErrorCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint PhaseFour::ProcessText(const char* _text, size_t _length, bool _final, std::vector<char>* _output)
+{
+    const char* pos = _text;
+    const char* end = _text + _length;
+    bool endsMidLine = (_length > 0 && end[-1] != '\n' && !_final);
+    bool lineOpen = mMidLine;
+
+    // The rest of a line the last text stopped partway through. A line of text being skipped
+    // mustn't be looked at as if it started here. One that isn't is carried on with by Run.
+    if (mMidLine && mSkipping && pos != end) {
+        const char* eol = (const char*) memchr(pos, '\n', size_t(end - pos));
+        if (eol) {
+            SkipLines(1);
+            pos = eol + 1;
+            lineOpen = false;
+        } else {
+            pos = end;
+        }
+    }
+
+    // A piece at a time, each ending with a conditional directive's line: only those change
+    // whether lines are being skipped. While they are, everything up to the next one is only
+    // counted. (Held back tokens mean a line wasn't skipped, so they're never in the way.)
+    while (pos != end && mErrorCode == GLCCError_Ok) {
+        size_t lines = 0;
+        const char* conditional = PPFindConditional(pos, end, &lines);
+        const char* pieceEnd = end;
+        if (conditional != end) {
+            const char* eol = (const char*) memchr(conditional, '\n', size_t(end - conditional));
+            if (eol) {
+                pieceEnd = eol + 1;
+            }
+        }
+
+        if (mSkipping) {
+            if (lines > 0) {
+                SkipLines(int64_t(lines));
+            }
+            pos = conditional;
+        }
+
+        mTextTokens.clear();
+        PPTokenize(pos, size_t(pieceEnd - pos), mInterner, &mTextTokens);
+
+        // PPTokenize ends an unfinished last line with an EOL, which only comes in a later call.
+        // Cut where PPFindTokenBoundary says, the line ends in a token, so it has one to take off.
+        if (pieceEnd == end && endsMidLine) {
+            if (pos != end) {
+                assert(!mTextTokens.empty() && mTextTokens.back().mType == PPT_EOL);
+                mTextTokens.pop_back();
+            }
+            mMidLine = true;
+        }
+        if (!mTextTokens.empty()) {
+            lineOpen = (mTextTokens.back().mType != PPT_EOL);
+        }
+
+        Process(mTextTokens.data(), mTextTokens.size(), false, _output);
+        pos = pieceEnd;
+    }
+
+    if (_length > 0) {
+        mMidLine = endsMidLine;
+    }
+
+    if (_final) {
+        // A line of text left unfinished by the last text, with no more tokens of it in this one,
+        // still has to end.
+        if (lineOpen && mInTextLine) {
+            PPToken eol = { 0, PPT_EOL, 0 };
+            return Process(&eol, 1, true, _output);
+        }
+        return Process(NULL, 0, true, _output);
+    }
+    return mErrorCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::SetLineMap(const LineMap* _lineMap)
+{
+    assert(mLine == 1 && mOutputLine == 1);
+    mLineMap = _lineMap;
+    mLineMapNext = 0;
+    mLineMapDelta = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint PhaseFour::Predefine(const IncludedFile& _defines)
+{
+    if (mErrorCode != GLCCError_Ok) {
+        return mErrorCode;
+    }
+
+    ImportTokens(_defines, &mPredefineTokens);
+
+    const char* filename = mFilename;
+    mFilename = _defines.mPath.c_str();
+    mPos = mPredefineTokens.data();
+    mEnd = mPos + mPredefineTokens.size();
+    mFinal = true;
+    mOutput = &mDiscardedOutput;
+
+    Run();
+
+    mFilename = filename;
+    mPos = mEnd = NULL;
+    mOutput = NULL;
+    mLine = 1;
+    mOutputLine = 1;
+    mPendingNewLines = 0;
+    mAtLineStart = true;
+    mSawTokens = false;
+    mDiscardedOutput.clear();
+    return mErrorCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Run()
+{
+    // Always at the start of a line here.
+    for (;;) {
+        EResult result = ER_Ok;
+        if (mPos == mEnd) {
+            if (mIncludes.empty()) {
+                return ER_Ok;
+            }
+            result = LeaveInclude();
+        } else if (mInTextLine) {
+            result = TextLine();
+        } else if (IsPunctuator(*mPos, PPS_Hash)) {
+            ++mPos;
+            result = Directive();
+        } else if (mSkipping) {
+            // The line's EOL is owed, like those SkipLines owes, rather than output one at a time.
+            while (mPos->mType != PPT_EOL) {
+                ++mPos;
+            }
+            ++mPos;
+            NextLine();
+            ++mPendingNewLines;
+        } else {
+            result = TextLine();
+        }
+
+        if (result != ER_Ok) {
+            return result;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::TextLine()
+{
+    // Only ProcessText stops partway through a line, to carry on with the rest later.
+    mInTextLine = true;
+    for (;;) {
+        if (mPos == mEnd) {
+            assert(mMidLine);
+            return ER_Ok;
+        }
+        const PPToken& token = *mPos;
+
+        if (token.mType == PPT_EOL) {
+            mInTextLine = false;
+            ++mPos;
+            NextLine();
+            EmitNewLine();
+            return ER_Ok;
+        }
+
+        mSawTokens = true;
+
+        if (token.mType == PPT_Identifier && !(token.mFlags & PPTF_NoExpand)) {
+            MacroDef* def = mMacros.Find(token.mId);
+            if (def) {
+                // If the invocation turns out to continue past the tokens we have, all of this
+                // is undone, and redone once the rest arrives.
+                const PPToken* start = mPos;
+                size_t outputSize = mOutput->size();
+                int64_t line = mLine;
+                int64_t outputLine = mOutputLine;
+                size_t lineMapNext = mLineMapNext;
+                int64_t lineMapDelta = mLineMapDelta;
+                int64_t pendingNewLines = mPendingNewLines;
+                PPToken lastEmitted = mLastEmitted;
+                bool atLineStart = mAtLineStart;
+
+                ++mPos;
+                EResult result = ExpandAndEmit(token, def);
+                mScratch.Reset();
+
+                if (result == ER_NeedMore) {
+                    Unwind();
+                    mPos = start;
+                    mOutput->resize(outputSize);
+                    mLine = line;
+                    mOutputLine = outputLine;
+                    mLineMapNext = lineMapNext;
+                    mLineMapDelta = lineMapDelta;
+                    mPendingNewLines = pendingNewLines;
+                    mLastEmitted = lastEmitted;
+                    mAtLineStart = atLineStart;
+                    return result;
+                }
+
+                if (result != ER_Ok) {
+                    return result;
+                }
+                continue;
+            }
+        }
+
+        Emit(token);
+        ++mPos;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Directive()
+{
+    // The whole line is here, Process is only ever given whole lines.
+    const PPToken* nameTok = mPos;
+    const PPToken* lineEnd = mPos;
+    while (lineEnd->mType != PPT_EOL) {
+        ++lineEnd;
+    }
+    mPos = lineEnd + 1;
+
+    EResult result = ER_Ok;
+
+    if (nameTok == lineEnd) {
+        // The null directive.
+    } else if (nameTok->mType != PPT_Identifier) {
+        if (!mSkipping) {
+            result = Error(GLCCError_InvalidSyntax, "invalid preprocessing directive");
+        }
+    } else {
+        const PPToken* args = nameTok + 1;
+        switch (nameTok->mId) {
+            case PPS_If:
+            case PPS_Ifdef:
+            case PPS_Ifndef:
+            {
+                Conditional cond;
+                cond.mLine = mLine;
+                cond.mParentActive = !mSkipping;
+                cond.mTaken = false;
+                cond.mActive = false;
+                cond.mSeenElse = false;
+
+                if (cond.mParentActive) {
+                    if (nameTok->mId == PPS_If) {
+                        result = If(args, lineEnd, &cond.mActive);
+                    } else if (args == lineEnd || args->mType != PPT_Identifier) {
+                        result = Error(GLCCError_InvalidSyntax, "#%s expects a macro name",
+                                       nameTok->mId == PPS_Ifdef ? "ifdef" : "ifndef");
+                    } else {
+                        bool defined = mMacros.Find(args->mId) != NULL;
+                        cond.mActive = (nameTok->mId == PPS_Ifdef) ? defined : !defined;
+                    }
+                    cond.mTaken = cond.mActive;
+                }
+
+                mConditionals.push_back(cond);
+                mSkipping = !cond.mActive;
+                break;
+            }
+
+            case PPS_Elif:
+            case PPS_Else:
+            {
+                if (mConditionals.empty()) {
+                    result = Error(GLCCError_InvalidSyntax, "#%s without #if", nameTok->mId == PPS_Else ? "else" : "elif");
+                    break;
+                }
+
+                Conditional& cond = mConditionals.back();
+                if (cond.mSeenElse) {
+                    result = Error(GLCCError_InvalidSyntax, "#%s after #else", nameTok->mId == PPS_Else ? "else" : "elif");
+                    break;
+                }
+
+                cond.mActive = false;
+                if (nameTok->mId == PPS_Else) {
+                    cond.mSeenElse = true;
+                    cond.mActive = cond.mParentActive && !cond.mTaken;
+                } else if (cond.mParentActive && !cond.mTaken) {
+                    // Only evaluated if it could be taken.
+                    result = If(args, lineEnd, &cond.mActive);
+                }
+
+                cond.mTaken = cond.mTaken || cond.mActive;
+                mSkipping = !cond.mActive;
+                break;
+            }
+
+            case PPS_Endif:
+            {
+                if (mConditionals.empty()) {
+                    result = Error(GLCCError_InvalidSyntax, "#endif without #if");
+                    break;
+                }
+
+                mConditionals.pop_back();
+                mSkipping = !mConditionals.empty() && !mConditionals.back().mActive;
+                break;
+            }
+
+            default:
+            {
+                if (mSkipping) {
+                    break;
+                }
+
+                bool isVersion = (nameTok->mId == PPS_Version);
+                if (!isVersion) {
+                    mSawTokens = true;
+                }
+
+                switch (nameTok->mId) {
+                    case PPS_Define:
+                        result = Define(args, lineEnd);
+                        break;
+                    case PPS_Undef:
+                        result = Undef(args, lineEnd);
+                        break;
+                    case PPS_Version:
+                        result = Version(args, lineEnd);
+                        break;
+                    case PPS_Line:
+                        result = Line(args, lineEnd);
+                        break;
+                    case PPS_Extension:
+                        EmitLine("#extension", args, lineEnd);
+                        break;
+                    case PPS_Pragma:
+                        if (args + 1 == lineEnd && args->mType == PPT_Identifier && args->mId == PPS_Once) {
+                            // Ours, the compiler never sees it. Included files' names are full
+                            // paths already (see ResolveIncludePath); the input's may not be.
+                            std::string path;
+                            if (!computeFullPath(mFilename, &path)) {
+                                path = mFilename;
+                            }
+                            mIncludeStates[path].mOnce = true;
+                        } else {
+                            EmitLine("#pragma", args, lineEnd);
+                        }
+                        break;
+                    case PPS_Error:
+                    {
+                        std::string message;
+                        for (const PPToken* tok = args; tok != lineEnd; ++tok) {
+                            if (tok != args && (tok->mFlags & PPTF_LeadingSpace)) {
+                                message += ' ';
+                            }
+                            message.append(mInterner->GetString(tok->mId), mInterner->GetLength(tok->mId));
+                        }
+                        result = Error(GLCCError_ErrorDirective, "#error %s", message.c_str());
+                        break;
+                    }
+                    case PPS_Include:
+                        result = Include(args, lineEnd);
+                        break;
+                    default:
+                        result = Error(GLCCError_InvalidSyntax, "invalid preprocessing directive #%.*s",
+                                       int(mInterner->GetLength(nameTok->mId)), mInterner->GetString(nameTok->mId));
+                        break;
+                }
+                break;
+            }
+        }
+    }
+
+    mScratch.Reset();
+    NextLine();
+    EmitNewLine();
+
+    // Only now the #include line is finished with.
+    if (mPendingInclude) {
+        EnterInclude();
+    }
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Define(const PPToken* _args, const PPToken* _argsEnd)
+{
+    if (_args == _argsEnd || _args->mType != PPT_Identifier) {
+        return Error(GLCCError_InvalidSyntax, "macro names must be identifiers");
+    }
+
+    uint32_t name = _args->mId;
+    if (name == PPS_Defined) {
+        return Error(GLCCError_InvalidSyntax, "\"defined\" cannot be used as a macro name");
+    }
+
+    const PPToken* tok = _args + 1;
+    EMacroKind kind = EMK_Object;
+    mParamNames.clear();
+
+    // A function-like macro's '(' must follow its name immediately.
+    if (tok != _argsEnd && IsPunctuator(*tok, PPS_LeftParen) && !(tok->mFlags & PPTF_LeadingSpace)) {
+        kind = EMK_Function;
+        ++tok;
+        if (tok != _argsEnd && IsPunctuator(*tok, PPS_RightParen)) {
+            ++tok;
+        } else {
+            for (;;) {
+                if (tok == _argsEnd || tok->mType != PPT_Identifier) {
+                    return Error(GLCCError_InvalidSyntax, "expected parameter name in macro parameter list");
+                }
+
+                for (size_t i = 0; i < mParamNames.size(); ++i) {
+                    if (mParamNames[i] == tok->mId) {
+                        return Error(GLCCError_InvalidSyntax, "duplicate macro parameter \"%.*s\"",
+                                     int(mInterner->GetLength(tok->mId)), mInterner->GetString(tok->mId));
+                    }
+                }
+                mParamNames.push_back(tok->mId);
+                ++tok;
+
+                if (tok != _argsEnd && IsPunctuator(*tok, PPS_Comma)) {
+                    ++tok;
+                } else if (tok != _argsEnd && IsPunctuator(*tok, PPS_RightParen)) {
+                    ++tok;
+                    break;
+                } else {
+                    return Error(GLCCError_InvalidSyntax, "missing ')' in macro parameter list");
+                }
+            }
+        }
+    }
+
+    // Pre-tokenize the replacement list: parameters become PPT_Param, so substitution never
+    // has to look names up.
+    mDefineTokens.assign(tok, _argsEnd);
+    for (size_t i = 0; i < mDefineTokens.size(); ++i) {
+        PPToken& repl = mDefineTokens[i];
+        if (repl.mType != PPT_Identifier) {
+            continue;
+        }
+
+        for (size_t param = 0; param < mParamNames.size(); ++param) {
+            if (mParamNames[param] == repl.mId) {
+                repl.mType = PPT_Param;
+                repl.mId = uint32_t(param);
+                break;
+            }
+        }
+    }
+
+    if (!mDefineTokens.empty()) {
+        mDefineTokens.front().mFlags &= ~PPTF_LeadingSpace;
+        if (IsPunctuator(mDefineTokens.front(), PPS_HashHash) || IsPunctuator(mDefineTokens.back(), PPS_HashHash)) {
+            return Error(GLCCError_InvalidSyntax, "'##' cannot appear at either end of a macro expansion");
+        }
+    }
+
+    MacroDef* existing = mMacros.Find(name);
+    if (existing) {
+        bool same = existing->mKind == kind
+                 && existing->mParamCount == mParamNames.size()
+                 && existing->mReplacementLength == mDefineTokens.size();
+        for (size_t i = 0; same && i < mDefineTokens.size(); ++i) {
+            const PPToken& a = existing->mReplacement[i];
+            const PPToken& b = mDefineTokens[i];
+            same = a.mType == b.mType && a.mId == b.mId
+                && (a.mFlags & PPTF_LeadingSpace) == (b.mFlags & PPTF_LeadingSpace);
+        }
+
+        if (!same) {
+            return Error(GLCCError_InvalidSyntax, "macro \"%.*s\" redefined",
+                         int(mInterner->GetLength(name)), mInterner->GetString(name));
+        }
+        return ER_Ok;
+    }
+
+    MacroChanging(name);
+    mMacros.Insert(mMacros.NewDef(name, kind, uint16_t(mParamNames.size()),
+                                  mDefineTokens.data(), uint32_t(mDefineTokens.size())));
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Undef(const PPToken* _args, const PPToken* _argsEnd)
+{
+    if (_args == _argsEnd || _args->mType != PPT_Identifier) {
+        return Error(GLCCError_InvalidSyntax, "macro names must be identifiers");
+    }
+
+    MacroDef* def = mMacros.Find(_args->mId);
+    if (def && def->mKind != EMK_Object && def->mKind != EMK_Function) {
+        return Error(GLCCError_InvalidSyntax, "cannot undefine built-in macro \"%.*s\"",
+                     int(mInterner->GetLength(_args->mId)), mInterner->GetString(_args->mId));
+    }
+
+    if (def) {
+        MacroChanging(_args->mId);
+        mMacros.Remove(_args->mId);
+    }
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::If(const PPToken* _args, const PPToken* _argsEnd, bool* _outValue)
+{
+    // Most expressions run as written, compiled the first time they're seen.
+    const PPCondition* condition = NULL;
+    if (!mConditionCache.Find(_args, _argsEnd, &condition)) {
+        PPCondition compiled;
+        const char* error = NULL;
+        bool ok = mConditionCompiler.Compile(_args, _argsEnd, true, &compiled, &error);
+        condition = mConditionCache.Add(_args, _argsEnd, ok ? &compiled : NULL);
+    }
+
+    long long value = 0;
+    const char* error = NULL;
+    EPPConditionResult result = condition ? RunCondition(*condition, &value, &error) : PPCR_NeedsExpansion;
+    if (result != PPCR_NeedsExpansion) {
+        if (result == PPCR_Error) {
+            return Error(GLCCError_InvalidSyntax, "%s", error);
+        }
+        (*_outValue) = (value != 0);
+        return ER_Ok;
+    }
+
+    // The rest are macro expanded first, like any other line. defined must be resolved before
+    // expansion, or the macros it names would be expanded away.
+    mCollected.clear();
+    for (const PPToken* tok = _args; tok != _argsEnd; ++tok) {
+        if (tok->mType != PPT_Identifier || tok->mId != PPS_Defined) {
+            mCollected.push_back(*tok);
+            continue;
+        }
+
+        ++tok;
+        bool paren = (tok != _argsEnd && IsPunctuator(*tok, PPS_LeftParen));
+        if (paren) {
+            ++tok;
+        }
+
+        if (tok == _argsEnd || tok->mType != PPT_Identifier) {
+            return Error(GLCCError_InvalidSyntax, "operator \"defined\" requires an identifier");
+        }
+
+        PPToken defined = *tok;
+        defined.mType = PPT_Number;
+        defined.mId = mMacros.Find(tok->mId) ? PPS_One : PPS_Zero;
+
+        if (paren) {
+            ++tok;
+            if (tok == _argsEnd || !IsPunctuator(*tok, PPS_RightParen)) {
+                return Error(GLCCError_InvalidSyntax, "missing ')' after \"defined\"");
+            }
+        }
+
+        mCollected.push_back(defined);
+    }
+
+    // The expansion reads from a copy, mCollected is needed again for argument collection.
+    PPToken* tokens = mScratch.AllocateArray<PPToken>(mCollected.size() + 1);
+    std::copy(mCollected.begin(), mCollected.end(), tokens);
+
+    size_t start = mExpanded.size();
+    EResult expandResult = ExpandRange(tokens, tokens + mCollected.size());
+    if (expandResult != ER_Ok) {
+        mExpanded.resize(start);
+        return expandResult;
+    }
+
+    PPCondition expanded;
+    bool ok = mConditionCompiler.Compile(mExpanded.data() + start, mExpanded.data() + mExpanded.size(), false,
+                                         &expanded, &error);
+    mExpanded.resize(start);
+    if (ok) {
+        result = RunCondition(expanded, &value, &error);
+        assert(result != PPCR_NeedsExpansion);
+    }
+
+    if (!ok || result == PPCR_Error) {
+        return Error(GLCCError_InvalidSyntax, "%s", error);
+    }
+
+    (*_outValue) = (value != 0);
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+EPPConditionResult PhaseFour::RunCondition(const PPCondition& _condition, long long* _outValue, const char** _outError)
+{
+    if (mConditionStack.size() < _condition.mMaxDepth) {
+        mConditionStack.resize(_condition.mMaxDepth);
+    }
+
+    ConditionValues values = { this };
+    return PPRunCondition(_condition, values, mConditionStack.data(), _outValue, _outError);
+}
+
+// ------------------------------------------------------------------------------------------------
+// A name's value in a compiled expression, if it can have one without the expression being
+// expanded. A name which isn't a macro, or is a function-like one without an argument list
+// (which a compiled expression can't have), is 0. An object-like macro needs an expansion that
+// is a lone operand.
+bool PhaseFour::GetConditionValue(uint32_t _name, long long* _outValue)
+{
+    MacroDef* def = mMacros.Find(_name);
+    if (!def) {
+        (*_outValue) = 0;
+        return true;
+    }
+
+    switch (def->mKind) {
+        case EMK_Line:      (*_outValue) = CurrentLine(); return true;
+        case EMK_File:      (*_outValue) = mSourceNumber; return true;
+        case EMK_Version:   (*_outValue) = mVersion; return true;
+        case EMK_Function:  (*_outValue) = 0; return true;
+
+        case EMK_Object:
+            if (def->mHasPaste) {
+                return false;
+            }
+
+            if (def->mExpansionGeneration != mExpansionGeneration) {
+                CacheExpansion(def);
+            }
+            if (!def->mExpandsAlone) {
+                return false;
+            }
+
+            if (def->mOperandState == EMO_Unknown) {
+                long long value = 0;
+                bool ok = mConditionCompiler.EvaluateOperand(def->mExpansion, def->mExpansion + def->mExpansionLength, &value);
+                def->mOperandState = uint8_t(ok ? EMO_Value : EMO_NotOperand);
+                def->mOperandValue = value;
+            }
+
+            (*_outValue) = def->mOperandValue;
+            return def->mOperandState == EMO_Value;
+
+        default:
+            assert(!"Unknown macro kind");
+            return false;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Version(const PPToken* _args, const PPToken* _argsEnd)
+{
+    if (mSawTokens) {
+        return Error(GLCCError_InvalidSyntax, "#version must occur before anything else");
+    }
+    mSawTokens = true;
+
+    if (_args == _argsEnd || _args->mType != PPT_Number) {
+        return Error(GLCCError_InvalidSyntax, "#version expects a version number");
+    }
+
+    const char* text = mInterner->GetString(_args->mId);
+    uint32_t length = mInterner->GetLength(_args->mId);
+    GLCCint version = 0;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return Error(GLCCError_InvalidSyntax, "#version expects a version number");
+        }
+        version = version * 10 + (text[i] - '0');
+    }
+    mVersion = version;
+
+    uint32_t profile = (_args + 1 != _argsEnd) ? _args[1].mId : uint32_t(PPS_None);
+    if (profile != PPS_None && profile != PPS_Es && profile != PPS_Core && profile != PPS_Compatibility) {
+        return Error(GLCCError_InvalidSyntax, "unknown profile in #version");
+    }
+
+    // The profile macros. GLSL ES 1.00 has no profile, but is ES all the same.
+    PPToken one = { PPS_One, PPT_Number, 0 };
+    if (profile == PPS_Es || version == 100) {
+        MacroChanging(PPS_GL_ES);
+        mMacros.Insert(mMacros.NewDef(PPS_GL_ES, EMK_Object, 0, &one, 1));
+    } else if (version >= 150) {
+        uint32_t name = (profile == PPS_Compatibility) ? PPS_GL_compatibility_profile : PPS_GL_core_profile;
+        MacroChanging(name);
+        mMacros.Insert(mMacros.NewDef(name, EMK_Object, 0, &one, 1));
+    }
+
+    EmitLine("#version", _args, _argsEnd);
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Line(const PPToken* _args, const PPToken* _argsEnd)
+{
+    size_t start = mExpanded.size();
+    EResult result = ExpandRange(_args, _argsEnd);
+    if (result != ER_Ok) {
+        mExpanded.resize(start);
+        return result;
+    }
+
+    const PPToken* tok = mExpanded.data() + start;
+    const PPToken* end = mExpanded.data() + mExpanded.size();
+    long long values[2] = { 0, 0 };
+    size_t valueCount = 0;
+    for (; tok != end && valueCount < 2; ++tok, ++valueCount) {
+        if (tok->mType != PPT_Number || !mConditionCompiler.EvaluateOperand(tok, tok + 1, &values[valueCount])) {
+            break;
+        }
+    }
+
+    if (valueCount == 0 || tok != end) {
+        mExpanded.resize(start);
+        return Error(GLCCError_InvalidSyntax, "#line expects a line number and an optional source string number");
+    }
+
+    // The line after the directive is the given one.
+    mLineDelta = values[0] - (mLine + 1);
+    if (valueCount == 2) {
+        mSourceNumber = values[1];
+    }
+
+    // The compiler needs to see it too.
+    EmitLine("#line", mExpanded.data() + start, end);
+    mExpanded.resize(start);
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Include(const PPToken* _args, const PPToken* _argsEnd)
+{
+    if (mIncludes.size() >= kMaxIncludeDepth) {
+        return Error(GLCCError_InvalidSyntax, "#include nested too deeply");
+    }
+
+    // "name" or <name>. Anything else gets macro expanded first, and must give one of those.
+    size_t start = mExpanded.size();
+    const PPToken* tok = _args;
+    const PPToken* end = _argsEnd;
+    bool isQuote = (tok != end && tok->mType == PPT_Other && mInterner->GetString(tok->mId)[0] == '"');
+    bool isSystem = (tok != end && IsPunctuator(*tok, PPS_LeftAngle));
+    if (!isQuote && !isSystem) {
+        EResult result = ExpandRange(_args, _argsEnd);
+        if (result != ER_Ok) {
+            mExpanded.resize(start);
+            return result;
+        }
+
+        tok = mExpanded.data() + start;
+        end = mExpanded.data() + mExpanded.size();
+        isQuote = (tok != end && tok->mType == PPT_Other && mInterner->GetString(tok->mId)[0] == '"');
+        isSystem = (tok != end && IsPunctuator(*tok, PPS_LeftAngle));
+    }
+
+    // The name is put back together from its tokens. Runs of whitespace in it become one space,
+    // which no sane include path will notice.
+    mIncludeName.clear();
+    bool closed = false;
+    if (isQuote || isSystem) {
+        for (++tok; tok != end; ++tok) {
+            closed = isQuote ? (tok->mType == PPT_Other && mInterner->GetString(tok->mId)[0] == '"')
+                             : IsPunctuator(*tok, PPS_RightAngle);
+            if (closed) {
+                ++tok;
+                break;
+            }
+
+            if (tok->mFlags & PPTF_LeadingSpace) {
+                mIncludeName += ' ';
+            }
+            mIncludeName.append(mInterner->GetString(tok->mId), mInterner->GetLength(tok->mId));
+        }
+    }
+    mExpanded.resize(start);
+
+    if (!closed || tok != end || mIncludeName.empty()) {
+        return Error(GLCCError_InvalidSyntax, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    std::string path;
+    if (!ResolveIncludePath(mFilename, mIncludeName, isSystem, mIncludePaths, &path)) {
+        return Error(GLCCError_FileNotFound, "cannot find include file \"%s\"", mIncludeName.c_str());
+    }
+
+    // Already seen, and known to do nothing the second time?
+    bool firstTime = (mIncludeStates.find(path) == mIncludeStates.end());
+    IncludeState& state = mIncludeStates[path];
+    if (state.mOnce || (state.mGuard != 0 && mMacros.Find(state.mGuard))) {
+        return ER_Ok;
+    }
+
+    std::shared_ptr<const IncludedFile> file = IncludeCache::Get().Load(path, mMaintainLineCount);
+    if (!file) {
+        return Error(GLCCError_FileNotFound, "cannot open include file \"%s\"", path.c_str());
+    }
+    if (firstTime) {
+        mIncludedFiles.push_back(file);
+    }
+
+    if (mIncludeTokens.size() <= mIncludes.size()) {
+        mIncludeTokens.resize(mIncludes.size() + 1);
+    }
+    ImportTokens(*file, &mIncludeTokens[mIncludes.size()]);
+
+    if (file->mGuard != 0) {
+        state.mGuard = mInterner->Intern(file->mInterner.GetString(file->mGuard), file->mInterner.GetLength(file->mGuard));
+    }
+
+    // Line numbers restart for the included file, and are put back after (see LeaveInclude).
+    EmitText("#line 1");
+    mPendingInclude = file;
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::ImportTokens(const IncludedFile& _file, std::vector<PPToken>* _outTokens)
+{
+    // Brings the file's tokens over to this preprocessor's ids. The seeded ones are the same
+    // everywhere; the rest are interned the first time they turn up.
+    _outTokens->assign(_file.mTokens.begin(), _file.mTokens.end());
+
+    mIncludeIds.assign(_file.mInterner.Size() + 1, 0);
+    for (size_t i = 0; i < _outTokens->size(); ++i) {
+        PPToken& token = (*_outTokens)[i];
+        if (token.mId < PPS_Count) {
+            continue;
+        }
+
+        if (mIncludeIds[token.mId] == 0) {
+            mIncludeIds[token.mId] = mInterner->Intern(_file.mInterner.GetString(token.mId), _file.mInterner.GetLength(token.mId));
+        }
+        token.mId = mIncludeIds[token.mId];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::EnterInclude()
+{
+    IncludeFrame frame;
+    frame.mPos = mPos;
+    frame.mEnd = mEnd;
+    frame.mLine = mLine;
+    frame.mLineDelta = mLineDelta;
+    frame.mSourceNumber = mSourceNumber;
+    frame.mLineMap = mLineMap;
+    frame.mLineMapNext = mLineMapNext;
+    frame.mOutputLine = mOutputLine;
+    frame.mLineMapDelta = mLineMapDelta;
+    frame.mFilename = mFilename;
+    frame.mConditionalDepth = mConditionals.size();
+    frame.mFile.swap(mPendingInclude);
+
+    const std::vector<PPToken>& tokens = mIncludeTokens[mIncludes.size()];
+    mPos = tokens.data();
+    mEnd = mPos + tokens.size();
+    mLine = 1;
+    mLineDelta = 0;
+    mLineMap = &frame.mFile->mLineMap;
+    mLineMapNext = 0;
+    mOutputLine = 1;
+    mLineMapDelta = 0;
+    mFilename = frame.mFile->mPath.c_str();
+    mUsedLineContinuations = mUsedLineContinuations || frame.mFile->mUsedLineContinuations;
+
+    mIncludes.push_back(frame);
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::LeaveInclude()
+{
+    const IncludeFrame& frame = mIncludes.back();
+    if (mConditionals.size() > frame.mConditionalDepth) {
+        mLine = mConditionals.back().mLine;
+        mLineDelta = 0;
+        return Error(GLCCError_InvalidSyntax, "unterminated conditional directive");
+    }
+
+    mPos = frame.mPos;
+    mEnd = frame.mEnd;
+    mLine = frame.mLine;
+    mLineDelta = frame.mLineDelta;
+    mSourceNumber = frame.mSourceNumber;
+    mLineMap = frame.mLineMap;
+    mLineMapNext = frame.mLineMapNext;
+    mOutputLine = frame.mOutputLine;
+    mLineMapDelta = frame.mLineMapDelta;
+    mFilename = frame.mFilename;
+    mIncludes.pop_back();
+
+    char text[32];
+    snprintf(text, sizeof(text), "#line %lld", (long long) CurrentLine());
+    EmitText(text);
+    EmitNewLine();
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::ExpandAndEmit(const PPToken& _name, MacroDef* _def)
+{
+    EResult result = BeginExpansion(_name, _def);
+    if (result == ER_NotInvoked) {
+        Emit(_name);
+        return ER_Ok;
+    }
+
+    // Rescan until every context is used up. Contexts only ever hold tokens from a single line's
+    // worth of macro, so there's no EOL to watch for.
+    while (result == ER_Ok) {
+        PPToken token;
+        if (ReadToken(&token, false) != ERD_Token) {
+            break;
+        }
+
+        if (token.mType == PPT_Identifier && !(token.mFlags & PPTF_NoExpand)) {
+            MacroDef* def = mMacros.Find(token.mId);
+            if (def && def->mDisabled) {
+                // Painted: never expanded again, even once the macro is enabled.
+                token.mFlags |= PPTF_NoExpand;
+            } else if (def) {
+                result = BeginExpansion(token, def);
+                if (result == ER_NotInvoked) {
+                    result = ER_Ok;
+                    Emit(token);
+                }
+                continue;
+            }
+        }
+
+        Emit(token);
+    }
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::BeginExpansion(const PPToken& _name, MacroDef* _def)
+{
+    bool leadingSpace = (_name.mFlags & PPTF_LeadingSpace) != 0;
+
+    switch (_def->mKind) {
+        case EMK_Line:
+        case EMK_File:
+        case EMK_Version:
+        {
+            long long value = (_def->mKind == EMK_Line) ? CurrentLine()
+                            : (_def->mKind == EMK_File) ? mSourceNumber
+                            : mVersion;
+            PPToken* number = mScratch.AllocateArray<PPToken>(1);
+            (*number) = MakeNumber(value);
+            PushContext(number, 1, NULL, leadingSpace);
+            return ER_Ok;
+        }
+
+        case EMK_Object:
+            if (!_def->mHasPaste && mContexts.empty()) {
+                // Nothing is disabled and nothing else is being expanded, so the expansion is
+                // the same every time and can come from the cache.
+                if (_def->mExpansionGeneration != mExpansionGeneration) {
+                    CacheExpansion(_def);
+                }
+
+                if (_def->mExpandsAlone) {
+                    if (!_def->mExpansionInheritsSpace) {
+                        leadingSpace = (_def->mExpansion[0].mFlags & PPTF_LeadingSpace) != 0;
+                    }
+                    PushContext(_def->mExpansion, _def->mExpansionLength, NULL, leadingSpace);
+                    return ER_Ok;
+                }
+            }
+
+            if (!_def->mHasPaste) {
+                // The replacement list is exactly what gets rescanned, no copy needed.
+                PushContext(_def->mReplacement, _def->mReplacementLength, _def, leadingSpace);
+                return ER_Ok;
+            }
+            return Substitute(_name, _def, NULL);
+
+        case EMK_Function:
+        {
+            PPToken next;
+            ERead read = PeekNonEOL(&next);
+            if (read == ERD_EndOfInput && MoreInputMayFollow()) {
+                return ER_NeedMore;
+            }
+
+            if (read != ERD_Token || !IsPunctuator(next, PPS_LeftParen)) {
+                return ER_NotInvoked;
+            }
+
+            ArgSpan* args = NULL;
+            EResult result = CollectArgs(_name, _def, &args);
+            if (result != ER_Ok) {
+                return result;
+            }
+            return Substitute(_name, _def, args);
+        }
+
+        default:
+            assert(!"Unknown macro kind");
+            return ER_NotInvoked;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::ExpandRange(const PPToken* _begin, const PPToken* _end)
+{
+    // Fully macro expands [_begin, _end) onto the end of mExpanded. Invocations inside can't
+    // reach past _end, the barrier sees to that.
+    Context barrier;
+    barrier.mCursor = _begin;
+    barrier.mEnd = _end;
+    barrier.mMacro = NULL;
+    barrier.mBarrier = true;
+    barrier.mAtStart = false;
+    barrier.mLeadingSpace = false;
+    mContexts.push_back(barrier);
+    size_t barrierIndex = mContexts.size() - 1;
+
+    EResult result = ER_Ok;
+    for (;;) {
+        PPToken token;
+        if (ReadToken(&token, false) != ERD_Token) {
+            break;
+        }
+
+        if (token.mType == PPT_Identifier && !(token.mFlags & PPTF_NoExpand)) {
+            MacroDef* def = mMacros.Find(token.mId);
+            if (def && def->mDisabled) {
+                token.mFlags |= PPTF_NoExpand;
+            } else if (def) {
+                result = BeginExpansion(token, def);
+                if (result == ER_NotInvoked) {
+                    result = ER_Ok;
+                    mExpanded.push_back(token);
+                } else if (result != ER_Ok) {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        mExpanded.push_back(token);
+    }
+
+    // On an error there may be contexts above the barrier still.
+    while (mContexts.size() > barrierIndex + 1) {
+        PopContext();
+    }
+    assert(mContexts.back().mBarrier);
+    mContexts.pop_back();
+    return result;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::CollectArgs(const PPToken& _name, MacroDef* _def, ArgSpan** _outArgs)
+{
+    // The '(' was only peeked at.
+    PPToken token;
+    ERead read = ReadToken(&token, true);
+    while (read == ERD_Token && token.mType == PPT_EOL) {
+        read = ReadToken(&token, true);
+    }
+    assert(read == ERD_Token && IsPunctuator(token, PPS_LeftParen));
+
+    mCollected.clear();
+    std::vector<uint32_t> argEnds;
+    int depth = 0;
+    bool space = false;
+
+    for (;;) {
+        read = ReadToken(&token, true);
+        if (read == ERD_EndOfInput && MoreInputMayFollow()) {
+            return ER_NeedMore;
+        } else if (read != ERD_Token) {
+            return Error(GLCCError_InvalidSyntax, "unterminated argument list invoking macro \"%.*s\"",
+                         int(mInterner->GetLength(_name.mId)), mInterner->GetString(_name.mId));
+        }
+
+        if (token.mType == PPT_EOL) {
+            // Arguments can span lines; an EOL in one is just whitespace.
+            space = true;
+            continue;
+        }
+
+        // Only input has EOLs, so this token came from the start of an input line. Directives
+        // there are undefined behavior in C; here they're an error.
+        if (space && IsPunctuator(token, PPS_Hash)) {
+            return Error(GLCCError_InvalidSyntax, "directive inside the arguments of macro \"%.*s\"",
+                         int(mInterner->GetLength(_name.mId)), mInterner->GetString(_name.mId));
+        }
+
+        if (space) {
+            token.mFlags |= PPTF_LeadingSpace;
+            space = false;
+        }
+
+        if (token.mType == PPT_Punctuator) {
+            if (token.mId == PPS_LeftParen) {
+                ++depth;
+            } else if (token.mId == PPS_RightParen) {
+                if (depth-- == 0) {
+                    break;
+                }
+            } else if (token.mId == PPS_Comma && depth == 0) {
+                argEnds.push_back(uint32_t(mCollected.size()));
+                continue;
+            }
+        } else if (token.mType == PPT_Identifier && !(token.mFlags & PPTF_NoExpand)) {
+            MacroDef* def = mMacros.Find(token.mId);
+            if (def && def->mDisabled) {
+                token.mFlags |= PPTF_NoExpand;
+            }
+        }
+
+        mCollected.push_back(token);
+    }
+    argEnds.push_back(uint32_t(mCollected.size()));
+
+    // f() passes one empty argument, which is fine for a macro with no parameters.
+    size_t argCount = argEnds.size();
+    if (argCount == 1 && _def->mParamCount == 0 && mCollected.empty()) {
+        argCount = 0;
+    }
+
+    if (argCount != _def->mParamCount) {
+        return Error(GLCCError_InvalidSyntax, "macro \"%.*s\" passed %u arguments, but takes %u",
+                     int(mInterner->GetLength(_name.mId)), mInterner->GetString(_name.mId),
+                     unsigned(argCount), unsigned(_def->mParamCount));
+    }
+
+    // mCollected gets reused by nested invocations, so the arguments move to the scratch arena.
+    PPToken* raw = mScratch.AllocateArray<PPToken>(mCollected.size() + 1);
+    std::copy(mCollected.begin(), mCollected.end(), raw);
+
+    ArgSpan* args = mScratch.AllocateArray<ArgSpan>(argCount + 1);
+    uint32_t argStart = 0;
+    for (size_t i = 0; i < argCount; ++i) {
+        args[i].mRaw = raw + argStart;
+        args[i].mRawCount = argEnds[i] - argStart;
+        args[i].mExpanded = NULL;
+        args[i].mExpandedCount = 0;
+        args[i].mExpandedValid = false;
+
+        // Whitespace around an argument doesn't carry into the expansion.
+        if (args[i].mRawCount > 0) {
+            raw[argStart].mFlags &= ~PPTF_LeadingSpace;
+        }
+        argStart = argEnds[i];
+    }
+
+    (*_outArgs) = args;
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Substitute(const PPToken& _name, MacroDef* _def, ArgSpan* _args)
+{
+    const PPToken* repl = _def->mReplacement;
+    uint32_t replLength = _def->mReplacementLength;
+
+    // First, find out how big the result can be, expanding the arguments that need it. An
+    // argument next to ## is used as written; anywhere else it's fully expanded first.
+    size_t maxLength = 0;
+    for (uint32_t i = 0; i < replLength; ++i) {
+        if (repl[i].mType != PPT_Param) {
+            ++maxLength;
+            continue;
+        }
+
+        ArgSpan& arg = _args[repl[i].mId];
+        bool pasted = (i > 0 && IsPunctuator(repl[i - 1], PPS_HashHash))
+                   || (i + 1 < replLength && IsPunctuator(repl[i + 1], PPS_HashHash));
+        if (pasted) {
+            maxLength += arg.mRawCount;
+            continue;
+        }
+
+        if (!arg.mExpandedValid) {
+            size_t start = mExpanded.size();
+            EResult result = ExpandRange(arg.mRaw, arg.mRaw + arg.mRawCount);
+            if (result != ER_Ok) {
+                mExpanded.resize(start);
+                return result;
+            }
+
+            size_t count = mExpanded.size() - start;
+            PPToken* expanded = mScratch.AllocateArray<PPToken>(count + 1);
+            std::copy(mExpanded.begin() + start, mExpanded.end(), expanded);
+            mExpanded.resize(start);
+
+            arg.mExpanded = expanded;
+            arg.mExpandedCount = uint32_t(count);
+            arg.mExpandedValid = true;
+        }
+        maxLength += arg.mExpandedCount;
+    }
+
+    PPToken* result = mScratch.AllocateArray<PPToken>(maxLength + 1);
+    size_t length = 0;
+    bool pasteNext = false;
+    bool lastWasEmpty = true;
+
+    for (uint32_t i = 0; i < replLength; ++i) {
+        const PPToken& tok = repl[i];
+        if (IsPunctuator(tok, PPS_HashHash)) {
+            pasteNext = true;
+            continue;
+        }
+
+        const PPToken* operand = &tok;
+        size_t operandLength = 1;
+        if (tok.mType == PPT_Param) {
+            const ArgSpan& arg = _args[tok.mId];
+            bool pasted = pasteNext || (i + 1 < replLength && IsPunctuator(repl[i + 1], PPS_HashHash));
+            operand = pasted ? arg.mRaw : arg.mExpanded;
+            operandLength = pasted ? arg.mRawCount : arg.mExpandedCount;
+        }
+
+        size_t first = length;
+        if (operandLength > 0) {
+            if (pasteNext && !lastWasEmpty) {
+                // A ## B: the last token so far and the operand's first become one token. If
+                // either side is empty there's nothing to paste.
+                EResult pasteResult = Paste(result[length - 1], operand[0], &result[length - 1]);
+                if (pasteResult != ER_Ok) {
+                    return pasteResult;
+                }
+                ++operand;
+                --operandLength;
+                first = length + 1;     // Keeps the pasted token's spacing.
+            }
+
+            memcpy(result + length, operand, sizeof(PPToken) * operandLength);
+            if (first == length && tok.mType == PPT_Param) {
+                result[length].mFlags = (result[length].mFlags & ~PPTF_LeadingSpace) | (tok.mFlags & PPTF_LeadingSpace);
+            }
+            length += operandLength;
+            lastWasEmpty = false;
+        } else if (!pasteNext) {
+            lastWasEmpty = true;
+        }
+
+        pasteNext = false;
+    }
+
+    assert(length <= maxLength);
+    PushContext(result, length, _def, (_name.mFlags & PPTF_LeadingSpace) != 0);
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Paste(const PPToken& _left, const PPToken& _right, PPToken* _outToken)
+{
+    // The only place tokens go back to text. Copy both out first: interning the result may
+    // move the interner's storage.
+    mPasteText.assign(mInterner->GetString(_left.mId), mInterner->GetLength(_left.mId));
+    mPasteText.append(mInterner->GetString(_right.mId), mInterner->GetLength(_right.mId));
+
+    uint8_t flags = _left.mFlags;
+    if (!PPTokenizeOne(mPasteText.data(), mPasteText.size(), mInterner, _outToken)) {
+        return Error(GLCCError_InvalidSyntax, "pasting \"%.*s\" and \"%.*s\" does not give a valid preprocessing token",
+                     int(mInterner->GetLength(_left.mId)), mInterner->GetString(_left.mId),
+                     int(mInterner->GetLength(_right.mId)), mInterner->GetString(_right.mId));
+    }
+
+    _outToken->mFlags = flags & PPTF_LeadingSpace;
+    return ER_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+PPToken PhaseFour::MakeNumber(long long _value)
+{
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%lld", _value);
+
+    PPToken token;
+    token.mId = mInterner->Intern(text, size_t(length));
+    token.mType = PPT_Number;
+    token.mFlags = 0;
+    return token;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Fully expands _def as ExpandAndEmit would with nothing else in progress, and keeps the result
+// in _def. Only chains of object-like macros are cached: a function-like macro could take its
+// arguments from past the end, and the built in ones change from use to use. The tokens come out
+// ready to emit: every identifier is marked not to be expanded again, and any space that Emit
+// would put between tokens from different macros so they don't paste is already there.
+void PhaseFour::CacheExpansion(MacroDef* _def)
+{
+    assert(_def->mKind == EMK_Object && !_def->mHasPaste && mContexts.empty());
+
+    _def->mExpansionGeneration = mExpansionGeneration;
+    _def->mExpandsAlone = true;
+    _def->mExpansionInheritsSpace = false;
+    _def->mOperandState = EMO_Unknown;
+    NoteExpansionDependency(_def->mName);
+
+    mExpansionTokens.clear();
+    mExpansionFrames.clear();
+    ExpansionFrame root = { _def, 0, false, true };
+    mExpansionFrames.push_back(root);
+    _def->mDisabled = true;
+
+    bool avoidPaste = true;
+    bool expanded = false;
+    while (!mExpansionFrames.empty()) {
+        ExpansionFrame& frame = mExpansionFrames.back();
+        if (frame.mNext == frame.mMacro->mReplacementLength) {
+            frame.mMacro->mDisabled = false;
+            mExpansionFrames.pop_back();
+            avoidPaste = true;
+            continue;
+        }
+
+        bool first = (frame.mNext == 0);
+        PPToken token = frame.mMacro->mReplacement[frame.mNext++];
+        if (first) {
+            token.mFlags = (token.mFlags & ~PPTF_LeadingSpace) | (frame.mLeadingSpace ? PPTF_LeadingSpace : 0);
+        }
+
+        if (token.mType == PPT_Identifier && !(token.mFlags & PPTF_NoExpand)) {
+            NoteExpansionDependency(token.mId);
+            MacroDef* def = mMacros.Find(token.mId);
+            expanded = expanded || def;
+            if (def && !def->mDisabled) {
+                if (def->mKind != EMK_Object || def->mHasPaste) {
+                    _def->mExpandsAlone = false;
+                    break;
+                }
+
+                ExpansionFrame inner = { def, 0, (token.mFlags & PPTF_LeadingSpace) != 0, first && frame.mFromStart };
+                mExpansionFrames.push_back(inner);
+                def->mDisabled = true;
+                avoidPaste = true;
+                continue;
+            }
+
+            // Painted if it's disabled, and otherwise left alone for as long as it isn't a macro,
+            // which is as long as the cache lasts.
+            token.mFlags |= PPTF_NoExpand;
+        }
+
+        if (mExpansionTokens.empty()) {
+            _def->mExpansionInheritsSpace = first && frame.mFromStart;
+        } else if (avoidPaste && WouldPaste(mExpansionTokens.back(), token)) {
+            token.mFlags |= PPTF_LeadingSpace;
+        }
+        avoidPaste = false;
+        mExpansionTokens.push_back(token);
+    }
+
+    for (size_t i = 0; i < mExpansionFrames.size(); ++i) {
+        mExpansionFrames[i].mMacro->mDisabled = false;
+    }
+
+    if (!_def->mExpandsAlone) {
+        return;
+    }
+
+    if (mExpansionTokens.empty()) {
+        _def->mExpansion = NULL;
+        _def->mExpansionLength = 0;
+        _def->mExpansionInheritsSpace = true;
+        return;
+    }
+
+    if (!expanded) {
+        // Nothing to expand (or paint): the replacement list is already the expansion.
+        _def->mExpansion = _def->mReplacement;
+        _def->mExpansionLength = _def->mReplacementLength;
+        _def->mExpansionInheritsSpace = true;
+        return;
+    }
+
+    PPToken* expansion = mExpansionArena.AllocateArray<PPToken>(mExpansionTokens.size());
+    memcpy(expansion, mExpansionTokens.data(), sizeof(PPToken) * mExpansionTokens.size());
+    _def->mExpansion = expansion;
+    _def->mExpansionLength = uint32_t(mExpansionTokens.size());
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::NoteExpansionDependency(uint32_t _name)
+{
+    if (_name >= mExpansionDependencies.size()) {
+        mExpansionDependencies.resize(std::max<size_t>(_name + 1, mExpansionDependencies.size() * 2), 0);
+    }
+
+    if (!mExpansionDependencies[_name]) {
+        mExpansionDependencies[_name] = 1;
+        mExpansionDependencyNames.push_back(_name);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Before _name is defined or undefined. Most #defines are of names nothing cached has looked at,
+// and those leave the cache alone.
+void PhaseFour::MacroChanging(uint32_t _name)
+{
+    if (_name < mExpansionDependencies.size() && mExpansionDependencies[_name]) {
+        FlushExpansions();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::FlushExpansions()
+{
+    ++mExpansionGeneration;
+    mExpansionArena.Reset();
+
+    for (size_t i = 0; i < mExpansionDependencyNames.size(); ++i) {
+        mExpansionDependencies[mExpansionDependencyNames[i]] = 0;
+    }
+    mExpansionDependencyNames.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::ERead PhaseFour::ReadToken(PPToken* _outToken, bool _allowInput)
+{
+    // Innermost context first, popping the ones that are used up (which re-enables their
+    // macros). Then, if allowed, the input itself.
+    while (!mContexts.empty()) {
+        Context& context = mContexts.back();
+        if (context.mCursor != context.mEnd) {
+            (*_outToken) = *context.mCursor++;
+            if (context.mAtStart) {
+                context.mAtStart = false;
+                _outToken->mFlags = (_outToken->mFlags & ~PPTF_LeadingSpace) | (context.mLeadingSpace ? PPTF_LeadingSpace : 0);
+            }
+            return ERD_Token;
+        }
+
+        if (context.mBarrier) {
+            return ERD_EndOfRange;
+        }
+        PopContext();
+    }
+
+    if (!_allowInput || mPos == mEnd) {
+        return ERD_EndOfInput;
+    }
+
+    (*_outToken) = *mPos++;
+    if (_outToken->mType == PPT_EOL) {
+        // Swallowed by an invocation spanning lines. The EOLs are made up at the end of the
+        // line, so later lines keep their line numbers.
+        NextLine();
+        ++mPendingNewLines;
+    }
+    return ERD_Token;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::ERead PhaseFour::PeekNonEOL(PPToken* _outToken)
+{
+    for (size_t i = mContexts.size(); i-- > 0; ) {
+        const Context& context = mContexts[i];
+        if (context.mCursor != context.mEnd) {
+            (*_outToken) = *context.mCursor;
+            return ERD_Token;
+        }
+        if (context.mBarrier) {
+            return ERD_EndOfRange;
+        }
+    }
+
+    for (const PPToken* tok = mPos; tok != mEnd; ++tok) {
+        if (tok->mType != PPT_EOL) {
+            (*_outToken) = *tok;
+            return ERD_Token;
+        }
+    }
+    return ERD_EndOfInput;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::PushContext(const PPToken* _tokens, size_t _count, MacroDef* _macro, bool _leadingSpace)
+{
+    Context context;
+    context.mCursor = _tokens;
+    context.mEnd = _tokens + _count;
+    context.mMacro = _macro;
+    context.mBarrier = false;
+    context.mAtStart = true;
+    context.mLeadingSpace = _leadingSpace;
+    mContexts.push_back(context);
+
+    if (_macro) {
+        _macro->mDisabled = true;
+    }
+    mAvoidPaste = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::PopContext()
+{
+    assert(!mContexts.empty() && !mContexts.back().mBarrier);
+    if (mContexts.back().mMacro) {
+        mContexts.back().mMacro->mDisabled = false;
+    }
+    mContexts.pop_back();
+    mAvoidPaste = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::Unwind()
+{
+    for (size_t i = 0; i < mContexts.size(); ++i) {
+        if (mContexts[i].mMacro) {
+            mContexts[i].mMacro->mDisabled = false;
+        }
+    }
+    mContexts.clear();
+    mExpanded.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::Emit(const PPToken& _token)
+{
+    if (!mAtLineStart) {
+        if ((_token.mFlags & PPTF_LeadingSpace) || (mAvoidPaste && WouldPaste(mLastEmitted, _token))) {
+            mOutput->push_back(' ');
+        }
+    }
+
+    const char* text = mInterner->GetString(_token.mId);
+    mOutput->insert(mOutput->end(), text, text + mInterner->GetLength(_token.mId));
+
+    mLastEmitted = _token;
+    mAtLineStart = false;
+    mAvoidPaste = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Past an EOL token. Lines spliced by continuations before the new line are skipped over, and
+// owed to the output like the EOLs an invocation swallows, so it keeps the source's line count.
+inline void PhaseFour::NextLine()
+{
+    ++mLine;
+    ++mOutputLine;
+
+    if (!mLineMap) {
+        return;
+    }
+
+    while (mLineMapNext < mLineMap->Size() && mLineMap->Get(mLineMapNext).mOutputLine < mOutputLine) {
+        const LineMapEntry& entry = mLineMap->Get(mLineMapNext);
+        int64_t delta = int64_t(entry.mLine) - int64_t(entry.mOutputLine);
+        mLine += delta - mLineMapDelta;
+        mPendingNewLines += delta - mLineMapDelta;
+        mLineMapDelta = delta;
+        ++mLineMapNext;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Past _count lines which were skipped without being tokenized. They still each get an EOL in
+// the output, as Run gives the lines it skips; those are owed until the next one is emitted.
+void PhaseFour::SkipLines(int64_t _count)
+{
+    assert(_count > 0);
+    mLine += _count - 1;
+    mOutputLine += _count - 1;
+    NextLine();
+    mPendingNewLines += _count;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::EmitNewLine()
+{
+    mOutput->insert(mOutput->end(), size_t(mPendingNewLines + 1), '\n');
+    mPendingNewLines = 0;
+    mAtLineStart = true;
+    mAvoidPaste = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::EmitText(const char* _text)
+{
+    mOutput->insert(mOutput->end(), _text, _text + strlen(_text));
+    mAtLineStart = false;
+    mAvoidPaste = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PhaseFour::EmitLine(const char* _directive, const PPToken* _begin, const PPToken* _end)
+{
+    EmitText(_directive);
+
+    for (const PPToken* tok = _begin; tok != _end; ++tok) {
+        PPToken token = *tok;
+        if (tok == _begin) {
+            token.mFlags |= PPTF_LeadingSpace;
+        }
+        Emit(token);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PhaseFour::WouldPaste(const PPToken& _left, const PPToken& _right) const
+{
+    // Only asked where a macro expansion starts or ends. Tokens that came from different places
+    // must not run together into something the compiler would lex differently.
+    if (_left.mType == PPT_EOL) {
+        return false;
+    }
+
+    bool leftWord = (_left.mType == PPT_Identifier || _left.mType == PPT_Number);
+    bool rightWord = (_right.mType == PPT_Identifier || _right.mType == PPT_Number);
+    if (leftWord && rightWord) {
+        return true;
+    }
+
+    char rightFirst = mInterner->GetString(_right.mId)[0];
+    if (_left.mType == PPT_Number) {
+        return rightFirst == '.' || rightFirst == '+' || rightFirst == '-';
+    }
+
+    if (_left.mType == PPT_Punctuator) {
+        if (_left.mId == PPS_Dot) {
+            return _right.mType == PPT_Number || rightFirst == '.';
+        }
+
+        switch (_left.mId) {
+            case PPS_LeftParen:
+            case PPS_RightParen:
+            case PPS_LeftBracket:
+            case PPS_RightBracket:
+            case PPS_LeftBrace:
+            case PPS_RightBrace:
+            case PPS_Comma:
+            case PPS_Semicolon:
+            case PPS_Colon:
+            case PPS_Question:
+            case PPS_Tilde:
+                return false;
+            default:
+                // Any other punctuator might combine with a following one.
+                return _right.mType == PPT_Punctuator;
+        }
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+PhaseFour::EResult PhaseFour::Error(GLCCint _errCode, const char* _fmt, ...)
+{
+    char message[512];
+    va_list args;
+    va_start(args, _fmt);
+    vsnprintf(message, sizeof(message), _fmt, args);
+    va_end(args);
+
+    mErrorCode = ReportError(_errCode, this, "%s(%lld): error: %s\n", mFilename, (long long) CurrentLine(), message);
+    return ER_Error;
+}
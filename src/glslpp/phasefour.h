@@ -0,0 +1,323 @@
+#pragma once
+
+#include "common/arena.h"
+#include "common/common.h"
+#include "common/hashutil.h"
+#include "includecache.h"
+#include "linemap.h"
+#include "macros.h"
+#include "ppcondition.h"
+#include "pptokens.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Preprocessor phase four: directives, conditionals and macro expansion, over the tokens of
+// phase three's output (see PPTokenize).
+//
+// Expansion works on tokens throughout and never goes back to text, except to paste with ##.
+// Each expansion in progress is a context on a stack: a span of tokens being rescanned plus the
+// macro it came from, which stays disabled until the span is used up. An object-like macro's
+// context is its replacement list itself; function-like macros are substituted into an array in
+// a scratch arena, which is thrown away whenever the stack is empty again.
+//
+// An object-like macro expanded straight from the input, with nothing else in progress, is
+// expanded once and the result kept (CacheExpansion); later uses push the cached span. The cache
+// remembers every name it looked at, and #define or #undef of any of them throws it all away.
+//
+// #include switches the input over to the included file's tokens (from the IncludeCache) until
+// they run out. A file guarded by #pragma once, or by an include guard whose macro is defined,
+// isn't included again, and isn't even loaded.
+//
+// Given text (ProcessText), only what could be output or could end a conditional is tokenized.
+// The lines a conditional leaves out are passed over by PPFindConditional, a line at a time.
+//
+// #if and #elif expressions are compiled as written (see PPConditionCompiler) and cached, and
+// macros are looked up as they run. Only an expression using a macro that doesn't expand to a
+// lone operand is expanded first, and compiled afresh each time.
+class PhaseFour
+{
+public:
+    // _filename is used for diagnostics, and must outlive this. _interner must be seeded with
+    // SeedPPInterner, and is what the tokens passed to Process were interned with.
+    PhaseFour(const char* _filename, StringInterner* _interner);
+    ~PhaseFour();
+
+    // Forgets everything about the last input--macros, conditionals, includes, errors--to start
+    // over on another, as if newly constructed. The include options are kept, and so is the
+    // memory: the macro table, its arena and the various stacks keep their capacity. Compiled
+    // #if expressions are kept too; they only depend on the interner's ids.
+    void Reset(const char* _filename);
+
+    // Drops the compiled #if expressions, which must be done whenever the interner is cleared.
+    void ClearConditionCache() { mConditionCache.Clear(); }
+
+    // Runs over _tokens, which must end in a PPT_EOL, appending the output text to _output.
+    // Unless _final, more tokens will follow in later calls: a macro invocation that might
+    // continue into them is held back (along with everything after it) and finished then.
+    // Errors are sticky, once one is returned every later call returns it too.
+    GLCCint Process(const PPToken* _tokens, size_t _count, bool _final, std::vector<char>* _output);
+
+    // As Process, but given phase three's output rather than its tokens. Unless _final, _text
+    // must end in a '\n', or partway through a line of text (never a directive) at a point
+    // PPFindTokenBoundary gives; the next call's text carries on with the rest of that line. So
+    // a stream need not hold on to a long line until it ends. Tokenizes up to each conditional
+    // directive in turn, and not at all in the blocks they leave out.
+    GLCCint ProcessText(const char* _text, size_t _length, bool _final, std::vector<char>* _output);
+
+    // Runs _defines, which must be nothing but #define lines, before any input. Nothing is
+    // output, and the input still starts at line 1 with nothing seen yet. Can be called more than
+    // once, each set on top of the last.
+    GLCCint Predefine(const IncludedFile& _defines);
+
+    // Copies _file's tokens into _outTokens, with their ids mapped to the interner this was
+    // given, ready to pass to Process. The ids stay valid until that interner is cleared.
+    void ImportTokens(const IncludedFile& _file, std::vector<PPToken>* _outTokens);
+
+    // Whether phases two and three found line continuations, which are only allowed from GLSL
+    // 420 on. Checked once the final tokens have been processed.
+    void SetUsedLineContinuations(bool _used) { mUsedLineContinuations = _used; }
+
+    // Where the input's lines came from, if phases two and three built a map rather than padding
+    // (see LineMap), or NULL. Lines spliced away are put back as empty lines in the output, and
+    // errors report the source's line numbers. _lineMap must outlive the run.
+    void SetLineMap(const LineMap* _lineMap);
+
+    // Where #include looks, after the including file's directory. _includePaths must outlive
+    // this. _maintainLineCount is the setting included files go through phases two and three
+    // with.
+    void SetIncludeOptions(const std::vector<std::string>* _includePaths, bool _maintainLineCount)
+    {
+        mIncludePaths = _includePaths;
+        mMaintainLineCount = _maintainLineCount;
+    }
+
+    // Every file #included so far, once each, in the order they were first read.
+    const std::vector<std::shared_ptr<const IncludedFile> >& GetIncludedFiles() const { return mIncludedFiles; }
+
+    GLCCint GetVersion() const { return mVersion; }
+    GLCCint GetErrorCode() const { return mErrorCode; }
+    const char* GetErrorString() const { return mErrorString.empty() ? NULL : mErrorString.data(); }
+
+private:
+    PhaseFour(const PhaseFour&);
+    PhaseFour& operator=(const PhaseFour&);
+
+    template<typename T>
+    friend GLCCint ReportError(GLCCint _errCode, T *_where, const char* _fmt, ...);
+
+    enum EResult {
+        ER_Ok = 0,
+        ER_Error,
+        ER_NeedMore,        // The rest of a macro invocation hasn't been fed yet.
+        ER_NotInvoked       // A function-like macro's name without an argument list.
+    };
+
+    enum ERead {
+        ERD_Token = 0,
+        ERD_EndOfRange,     // The span being expanded by ExpandRange ran out.
+        ERD_EndOfInput      // The tokens passed to Process ran out.
+    };
+
+    struct Context
+    {
+        const PPToken* mCursor;
+        const PPToken* mEnd;
+        MacroDef* mMacro;       // Re-enabled when the context is popped. NULL for none.
+        bool mBarrier;          // ExpandRange's span; reading stops here rather than popping.
+        bool mAtStart;
+        bool mLeadingSpace;     // Replaces the first token's, it takes the macro name's place.
+    };
+
+    struct Conditional
+    {
+        int64_t mLine;
+        bool mParentActive;
+        bool mTaken;            // Some branch has been taken already.
+        bool mActive;           // The current branch is being taken.
+        bool mSeenElse;
+    };
+
+    // The includer's input, saved while an included file is being read.
+    struct IncludeFrame
+    {
+        const PPToken* mPos;
+        const PPToken* mEnd;
+        int64_t mLine;
+        int64_t mLineDelta;
+        int64_t mSourceNumber;
+        const LineMap* mLineMap;
+        size_t mLineMapNext;
+        int64_t mOutputLine;
+        int64_t mLineMapDelta;
+        const char* mFilename;
+        size_t mConditionalDepth;       // Conditionals must balance within a file.
+        std::shared_ptr<const IncludedFile> mFile;  // The included one, kept alive while in use.
+    };
+
+    // What's known about a file that's been included, by path.
+    struct IncludeState
+    {
+        uint32_t mGuard;                // The include guard's macro, 0 for none.
+        bool mOnce;                     // It had #pragma once.
+    };
+
+    static const size_t kMaxIncludeDepth = 64;
+
+    // A macro being expanded by CacheExpansion.
+    struct ExpansionFrame
+    {
+        MacroDef* mMacro;
+        uint32_t mNext;         // Index into its replacement list.
+        bool mLeadingSpace;     // The name's, given to the first token.
+        bool mFromStart;        // The name was the first token of the expansion being cached.
+    };
+
+    // Looks names up for compiled #if expressions (see PPRunCondition).
+    struct ConditionValues
+    {
+        PhaseFour* mPhaseFour;
+
+        bool IsDefined(uint32_t _name) { return mPhaseFour->mMacros.Find(_name) != NULL; }
+        bool GetValue(uint32_t _name, long long* _outValue) { return mPhaseFour->GetConditionValue(_name, _outValue); }
+    };
+
+    struct ArgSpan
+    {
+        const PPToken* mRaw;
+        uint32_t mRawCount;
+        const PPToken* mExpanded;
+        uint32_t mExpandedCount;
+        bool mExpandedValid;
+    };
+
+    void DefineBuiltins();
+
+    EResult Run();
+    EResult TextLine();
+    EResult Directive();
+
+    EResult Define(const PPToken* _args, const PPToken* _argsEnd);
+    EResult Undef(const PPToken* _args, const PPToken* _argsEnd);
+    EResult If(const PPToken* _args, const PPToken* _argsEnd, bool* _outValue);
+    EPPConditionResult RunCondition(const PPCondition& _condition, long long* _outValue, const char** _outError);
+    bool GetConditionValue(uint32_t _name, long long* _outValue);
+    EResult Version(const PPToken* _args, const PPToken* _argsEnd);
+    EResult Line(const PPToken* _args, const PPToken* _argsEnd);
+    EResult Include(const PPToken* _args, const PPToken* _argsEnd);
+
+    // Includes.
+    void EnterInclude();
+    EResult LeaveInclude();
+
+    // Function-like macro invocations can't span files, so only the base input can be continued
+    // by a later call to Process.
+    bool MoreInputMayFollow() const { return !mFinal && mIncludes.empty(); }
+
+    // Expansion.
+    EResult ExpandAndEmit(const PPToken& _name, MacroDef* _def);
+    EResult BeginExpansion(const PPToken& _name, MacroDef* _def);
+    EResult ExpandRange(const PPToken* _begin, const PPToken* _end);
+    EResult CollectArgs(const PPToken& _name, MacroDef* _def, ArgSpan** _outArgs);
+    EResult Substitute(const PPToken& _name, MacroDef* _def, ArgSpan* _args);
+    EResult Paste(const PPToken& _left, const PPToken& _right, PPToken* _outToken);
+    PPToken MakeNumber(long long _value);
+
+    // Expansion cache.
+    void CacheExpansion(MacroDef* _def);
+    void NoteExpansionDependency(uint32_t _name);
+    void MacroChanging(uint32_t _name);
+    void FlushExpansions();
+
+    ERead ReadToken(PPToken* _outToken, bool _allowInput);
+    ERead PeekNonEOL(PPToken* _outToken);
+    void PushContext(const PPToken* _tokens, size_t _count, MacroDef* _macro, bool _leadingSpace);
+    void PopContext();
+    void Unwind();
+
+    // Output.
+    void Emit(const PPToken& _token);
+    void EmitNewLine();
+    void EmitText(const char* _text);
+    void EmitLine(const char* _directive, const PPToken* _begin, const PPToken* _end);
+    bool WouldPaste(const PPToken& _left, const PPToken& _right) const;
+
+    inline void NextLine();
+    void SkipLines(int64_t _count);
+    int64_t CurrentLine() const { return mLine + mLineDelta; }
+    EResult Error(GLCCint _errCode, const char* _fmt, ...);
+
+    const char* mFilename;
+    StringInterner* mInterner;
+    MacroTable mMacros;
+
+    // The tokens being processed, and any held back from the last call.
+    const PPToken* mPos;
+    const PPToken* mEnd;
+    bool mFinal;
+    bool mInTextLine;                   // The tokens ran out partway through a line of text.
+    std::vector<PPToken> mHeldBack;
+    std::vector<PPToken> mTextTokens;   // ProcessText's, reused.
+    bool mMidLine;                      // ProcessText's last text ended partway through a line.
+
+    const std::vector<std::string>* mIncludePaths;
+    bool mMaintainLineCount;
+    std::vector<IncludeFrame> mIncludes;
+    std::vector<std::vector<PPToken> > mIncludeTokens;  // By depth, in this preprocessor's ids.
+    std::vector<uint32_t> mIncludeIds;                  // Included file's ids to this one's.
+    std::map<std::string, IncludeState> mIncludeStates;
+    std::vector<std::shared_ptr<const IncludedFile> > mIncludedFiles;
+    std::shared_ptr<const IncludedFile> mPendingInclude;
+    std::string mIncludeName;
+    std::vector<PPToken> mPredefineTokens;
+    std::vector<char> mDiscardedOutput;
+
+    std::vector<Context> mContexts;
+    std::vector<PPToken> mCollected;
+    std::vector<PPToken> mExpanded;     // A stack; each ExpandRange appends, then pops its part.
+    std::vector<PPToken> mDefineTokens;
+    std::vector<uint32_t> mParamNames;
+    std::string mPasteText;
+    Arena mScratch;
+
+    uint32_t mExpansionGeneration;      // MacroDef::mExpansionGeneration, when current.
+    Arena mExpansionArena;              // The cached expansions, until the next flush.
+    std::vector<uint8_t> mExpansionDependencies;    // By name, whether any expansion looked.
+    std::vector<uint32_t> mExpansionDependencyNames;
+    std::vector<ExpansionFrame> mExpansionFrames;
+    std::vector<PPToken> mExpansionTokens;
+
+    std::vector<Conditional> mConditionals;
+    bool mSkipping;
+    PPConditionCompiler mConditionCompiler;
+    PPConditionCache mConditionCache;
+    std::vector<long long> mConditionStack;
+
+    std::vector<char>* mOutput;
+    PPToken mLastEmitted;
+    bool mAtLineStart;
+    bool mAvoidPaste;
+    int64_t mPendingNewLines;
+
+    int64_t mLine;
+    int64_t mLineDelta;                 // From #line.
+
+    // mLine is the source's line. Where lines were spliced, the tokens' lines (mOutputLine) are
+    // behind it by mLineMapDelta, which mLineMap's entries from mLineMapNext on will add to.
+    const LineMap* mLineMap;
+    size_t mLineMapNext;
+    int64_t mOutputLine;
+    int64_t mLineMapDelta;
+    int64_t mSourceNumber;              // __FILE__, also from #line.
+    GLCCint mVersion;
+    bool mSawTokens;
+    bool mUsedLineContinuations;
+
+    GLCCint mErrorCode;
+    std::vector<char> mErrorString;
+};
@@ -0,0 +1,550 @@
+#include "glslppafx.h"
+
+#include "glslpp/preproc.h"
+#include "fileutils.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <dirent.h>
+#endif
+
+// Checks the preprocessor against the fixtures in tests/glslpp, and its entry points against each
+// other. Every x.glsl there is preprocessed in one go and streamed in chunks of several sizes,
+// which must agree; if there's an x.out beside it, that's what preprocessing must give. An
+// x.variants beside it gives define sets to preprocess it under as variants (see CheckVariants),
+// and each is scanned for its dependencies, from the file and from memory, which must agree and
+// match any x.scan.out. Random inputs are streamed against one-shot runs too, with --random. Run
+// with --help for the options.
+//
+// Fixtures include from the test directory's include/, as well as beside themselves. In expected
+// output, a failure is written "error N: message", and paths in the test directory are written
+// relative to it.
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+struct RunResult
+{
+    GLCCint mErrorCode;
+    std::string mOutput;
+    std::string mError;
+};
+
+// ------------------------------------------------------------------------------------------------
+struct CheckState
+{
+    std::string mTestDir;
+    std::string mFullTestDir;
+    bool mUpdate;
+    size_t mCheckCount;
+    size_t mFailureCount;
+};
+
+// ------------------------------------------------------------------------------------------------
+std::vector<std::string> ListFixtures(const std::string& _dir)
+{
+    std::vector<std::string> retFiles;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    HANDLE findHandle = FindFirstFileA((_dir + "\\*.glsl").c_str(), &findData);
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        do {
+            retFiles.push_back(_dir + "/" + findData.cFileName);
+        } while (FindNextFileA(findHandle, &findData));
+        FindClose(findHandle);
+    }
+#else
+    DIR* dir = opendir(_dir.c_str());
+    if (dir) {
+        while (struct dirent* entry = readdir(dir)) {
+            size_t nameLength = strlen(entry->d_name);
+            if (nameLength > 5 && strcmp(entry->d_name + nameLength - 5, ".glsl") == 0) {
+                retFiles.push_back(_dir + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    std::sort(retFiles.begin(), retFiles.end());
+    return retFiles;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ReadWholeFile(const std::string& _path, std::string* _outContents)
+{
+    std::vector<char> buffer;
+    size_t length = 0;
+    if (!fileContentsToBuffer(_path.c_str(), &buffer, &length)) {
+        return false;
+    }
+
+    _outContents->assign(buffer.data(), length);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void ReplaceAll(std::string* _text, const std::string& _from, const std::string& _to)
+{
+    if (_from.empty()) {
+        return;
+    }
+
+    for (size_t pos = _text->find(_from); pos != std::string::npos; pos = _text->find(_from, pos + _to.size())) {
+        _text->replace(pos, _from.size(), _to);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// _text with the paths in it that are in the test directory made relative to it.
+std::string Relative(const CheckState& _state, const std::string& _text)
+{
+    std::string retText = _text;
+    ReplaceAll(&retText, _state.mFullTestDir + "/", "");
+    ReplaceAll(&retText, _state.mTestDir + "/", "");
+    return retText;
+}
+
+// ------------------------------------------------------------------------------------------------
+// What a run gave, as an expected file holds it.
+std::string Describe(const CheckState& _state, const RunResult& _result)
+{
+    std::string retText;
+    if (_result.mErrorCode == GLCCError_Ok) {
+        retText = _result.mOutput;
+    } else {
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "error %d: ", (int) _result.mErrorCode);
+        retText = prefix + _result.mError;
+    }
+
+    return Relative(_state, retText);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Counts a check, and reports it if _actual isn't _expected: what it was, and the first line that
+// differs.
+bool Compare(CheckState* _state, const std::string& _what, const std::string& _expected, const std::string& _actual)
+{
+    ++_state->mCheckCount;
+    if (_expected == _actual) {
+        return true;
+    }
+
+    ++_state->mFailureCount;
+    size_t lineStart = 0;
+    size_t line = 1;
+    for (size_t i = 0; i < _expected.size() && i < _actual.size() && _expected[i] == _actual[i]; ++i) {
+        if (_expected[i] == '\n') {
+            lineStart = i + 1;
+            ++line;
+        }
+    }
+
+    std::string expectedLine = _expected.substr(lineStart, _expected.find('\n', lineStart) - lineStart);
+    std::string actualLine = _actual.substr(lineStart, _actual.find('\n', lineStart) - lineStart);
+    fprintf(stderr, "%s: differs from line %zu\n    expected: \"%s\"%s\n    got:      \"%s\"%s\n", _what.c_str(),
+            line, expectedLine.c_str(), (lineStart >= _expected.size()) ? " (the end)" : "",
+            actualLine.c_str(), (lineStart >= _actual.size()) ? " (the end)" : "");
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+void CollectOutput(const char* _text, size_t _length, void* _userData)
+{
+    ((std::string*) _userData)->append(_text, _length);
+}
+
+// ------------------------------------------------------------------------------------------------
+RunResult FinishRun(GLCCPreprocessor* _preproc, GLCCint _errCode)
+{
+    RunResult retResult;
+    retResult.mErrorCode = _errCode;
+    if (_errCode == GLCCError_Ok) {
+        size_t length = 0;
+        const char* output = getOutput(_preproc, &length);
+        retResult.mOutput.assign(output ? output : "", output ? length : 0);
+    } else {
+        const char* error = getLastError(_preproc);
+        retResult.mError = error ? error : "";
+    }
+    return retResult;
+}
+
+// ------------------------------------------------------------------------------------------------
+RunResult RunFromFile(GLCCPreprocessor* _preproc, const std::string& _path)
+{
+    return FinishRun(_preproc, preprocessFromFile(_preproc, _path.c_str()));
+}
+
+// ------------------------------------------------------------------------------------------------
+RunResult RunFromMemory(GLCCPreprocessor* _preproc, const std::string& _name, const std::string& _source)
+{
+    return FinishRun(_preproc, preprocessFromMemory(_preproc, _source.c_str(), _name.c_str()));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Streams _source in chunks of _chunkSize, or if that's 0, of random sizes up to 16 from _seed.
+RunResult RunStreamed(GLCCPreprocessor* _preproc, const std::string& _name, const std::string& _source,
+                      size_t _chunkSize, uint32_t _seed)
+{
+    std::string output;
+    GLCCint errCode = preprocessBegin(_preproc, _name.c_str(), CollectOutput, &output);
+
+    uint32_t seed = _seed;
+    for (size_t pos = 0; errCode == GLCCError_Ok && pos < _source.size(); ) {
+        size_t chunkSize = _chunkSize;
+        if (chunkSize == 0) {
+            seed = seed * 1664525u + 1013904223u;
+            chunkSize = 1 + (seed >> 8) % 16;
+        }
+
+        chunkSize = std::min(chunkSize, _source.size() - pos);
+        errCode = preprocessFeed(_preproc, _source.data() + pos, chunkSize);
+        pos += chunkSize;
+    }
+
+    GLCCint endErrCode = preprocessEnd(_preproc);
+    RunResult retResult = FinishRun(_preproc, (errCode != GLCCError_Ok) ? errCode : endErrCode);
+    retResult.mOutput = output;
+    return retResult;
+}
+
+// ------------------------------------------------------------------------------------------------
+// A failed stream has handed out some of its output already, which a failed one-shot run doesn't
+// give at all; only the errors are compared then.
+bool CompareStreamed(CheckState* _state, const std::string& _what, const RunResult& _oneShot, const RunResult& _streamed)
+{
+    if (_oneShot.mErrorCode != GLCCError_Ok && _streamed.mErrorCode != GLCCError_Ok) {
+        RunResult streamed = _streamed;
+        streamed.mOutput.clear();
+        return Compare(_state, _what, Describe(*_state, _oneShot), Describe(*_state, streamed));
+    }
+    return Compare(_state, _what, Describe(*_state, _oneShot), Describe(*_state, _streamed));
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Compares _actual with the expected file _expectedPath, if there is one; or with --update,
+// writes it.
+void CheckExpected(CheckState* _state, const std::string& _expectedPath, const std::string& _actual)
+{
+    std::string expected;
+    if (!ReadWholeFile(_expectedPath, &expected)) {
+        return;
+    }
+
+    if (_state->mUpdate) {
+        FILE* file = fopen(_expectedPath.c_str(), "wb");
+        if (!file || fwrite(_actual.data(), 1, _actual.size(), file) != _actual.size()) {
+            fprintf(stderr, "Could not write \"%s\".\n", _expectedPath.c_str());
+        }
+        if (file) {
+            fclose(file);
+        }
+        return;
+    }
+
+    Compare(_state, _expectedPath, expected, _actual);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Preprocesses _path in one go, and compares that with streaming it and with x.out, if there is
+// one (or with --update, writes x.out).
+void CheckFixture(CheckState* _state, GLCCPreprocessor* _preproc, const std::string& _path)
+{
+    static const size_t chunkSizes[] = { 1, 2, 3, 7, 64, 0 };
+
+    std::string source;
+    if (!ReadWholeFile(_path, &source)) {
+        Compare(_state, _path, "(the file)", "(nothing: it couldn't be read)");
+        return;
+    }
+
+    RunResult oneShot = RunFromFile(_preproc, _path);
+    for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); ++i) {
+        size_t chunkSize = (chunkSizes[i] != 0) ? chunkSizes[i] : std::max(source.size(), size_t(1));
+        RunResult streamed = RunStreamed(_preproc, _path, source, chunkSize, 0);
+
+        char what[64];
+        snprintf(what, sizeof(what), " streamed in chunks of %zu", chunkSize);
+        CompareStreamed(_state, _path + what, oneShot, streamed);
+    }
+
+    CheckExpected(_state, _path.substr(0, _path.size() - 5) + ".out", Describe(*_state, oneShot));
+}
+
+// ------------------------------------------------------------------------------------------------
+// If there's an x.variants beside _path, preprocesses _path under each of its define sets, one per
+// line (names separated by spaces, as GLPPOptions::mDefines has them), with preprocessVariants.
+// Each variant must come out as preprocessing with its defines alone does, and be the same as
+// the first that comes out identically. What each gave, or which it was the same as, is compared
+// with x.variants.out.
+void CheckVariants(CheckState* _state, const GLPPOptions& _options, const std::string& _path)
+{
+    std::string base = _path.substr(0, _path.size() - 5);
+    std::string variantsText;
+    if (!ReadWholeFile(base + ".variants", &variantsText)) {
+        return;
+    }
+
+    // Every line, blank ones too: a variant with no defines is a variant.
+    std::vector<std::string> lines;
+    for (size_t pos = 0; pos < variantsText.size(); ) {
+        size_t end = std::min(variantsText.find('\n', pos), variantsText.size());
+        lines.push_back(variantsText.substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    std::vector<std::vector<std::string> > defines(lines.size());
+    std::vector<std::vector<const char*> > definePointers(lines.size());
+    std::vector<GLPPDefineSet> defineSets(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        for (size_t pos = lines[i].find_first_not_of(' '); pos != std::string::npos; ) {
+            size_t end = lines[i].find(' ', pos);
+            defines[i].push_back(lines[i].substr(pos, end - pos));
+            pos = lines[i].find_first_not_of(' ', end);
+        }
+        for (size_t j = 0; j < defines[i].size(); ++j) {
+            definePointers[i].push_back(defines[i][j].c_str());
+        }
+        defineSets[i].mDefines = definePointers[i].empty() ? NULL : &definePointers[i][0];
+        defineSets[i].mDefineCount = definePointers[i].size();
+    }
+
+    GLPPBatch* batch = NULL;
+    genBatch(&batch, &_options, 0);
+    GLPPBatchInput input = { _path.c_str(), NULL };
+    std::vector<GLPPVariantResult> results(lines.size());
+    preprocessVariants(batch, &input, defineSets.empty() ? NULL : &defineSets[0], defineSets.size(),
+                       results.empty() ? NULL : &results[0]);
+
+    std::string listing;
+    std::vector<std::string> alone(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        char what[64];
+        snprintf(what, sizeof(what), "%s variant %zu", base.c_str(), i);
+
+        RunResult variant;
+        variant.mErrorCode = results[i].mErrorCode;
+        variant.mOutput.assign(results[i].mOutput ? results[i].mOutput : "", results[i].mOutput ? results[i].mOutputLength : 0);
+        variant.mError = results[i].mError ? results[i].mError : "";
+
+        GLPPOptions options = _options;
+        options.mDefines = defineSets[i].mDefines;
+        options.mDefineCount = defineSets[i].mDefineCount;
+        GLCCPreprocessor* preproc = NULL;
+        genPreprocessor(&preproc, &options);
+        alone[i] = Describe(*_state, RunFromFile(preproc, _path));
+        deletePreprocessor(&preproc);
+        Compare(_state, what, alone[i], Describe(*_state, variant));
+
+        size_t sameAs = i;
+        for (size_t j = 0; j < i && variant.mErrorCode == GLCCError_Ok; ++j) {
+            if (results[j].mErrorCode == GLCCError_Ok && alone[j] == alone[i]) {
+                sameAs = j;
+                break;
+            }
+        }
+
+        char expectedSameAs[32], actualSameAs[32];
+        snprintf(expectedSameAs, sizeof(expectedSameAs), "same as %zu", sameAs);
+        snprintf(actualSameAs, sizeof(actualSameAs), "same as %zu", results[i].mSameAs);
+        Compare(_state, what, expectedSameAs, actualSameAs);
+
+        char heading[32];
+        snprintf(heading, sizeof(heading), "variant %zu:", i);
+        listing += heading + (lines[i].empty() ? "" : " " + lines[i]) + "\n";
+        if (results[i].mSameAs != i) {
+            snprintf(heading, sizeof(heading), "same as variant %zu\n", results[i].mSameAs);
+            listing += heading;
+        } else {
+            listing += Describe(*_state, variant) + "\n";
+        }
+    }
+    deleteBatch(&batch);
+
+    CheckExpected(_state, base + ".variants.out", listing);
+}
+
+// ------------------------------------------------------------------------------------------------
+// What a scan found, as glslpp --scan lists it, followed by its depfile for x.spv; or the error.
+std::string ScanToString(const CheckState& _state, GLCCPreprocessor* _preproc, GLCCint _errCode,
+                         const GLPPScanResult& _result, const std::string& _path)
+{
+    if (_errCode != GLCCError_Ok) {
+        RunResult failed = { _errCode, "", getLastError(_preproc) ? getLastError(_preproc) : "" };
+        return Describe(_state, failed);
+    }
+
+    std::string retText;
+    char line[32];
+    if (_result.mVersion != 0) {
+        snprintf(line, sizeof(line), "version %d\n", (int) _result.mVersion);
+        retText += line;
+    }
+    for (size_t i = 0; i < _result.mExtensionCount; ++i) {
+        retText += std::string("extension ") + _result.mExtensions[i] + "\n";
+    }
+    for (size_t i = 0; i < _result.mIncludeCount; ++i) {
+        retText += std::string("include ") + _result.mIncludes[i] + "\n";
+    }
+
+    std::string target = _path.substr(0, _path.size() - 5) + ".spv";
+    const char* depfile = getDepfile(_preproc, target.c_str(), NULL);
+    retText += depfile ? depfile : "(no depfile)\n";
+    return Relative(_state, retText);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scans _path from the file and from memory, which must agree, and compares what they found with
+// x.scan.out, if there is one.
+void CheckScan(CheckState* _state, GLCCPreprocessor* _preproc, const std::string& _path)
+{
+    std::string source;
+    if (!ReadWholeFile(_path, &source)) {
+        return;
+    }
+
+    GLPPScanResult result;
+    GLCCint errCode = scanFromFile(_preproc, _path.c_str(), &result);
+    std::string fromFile = ScanToString(*_state, _preproc, errCode, result, _path);
+
+    errCode = scanFromMemory(_preproc, source.c_str(), _path.c_str(), &result);
+    Compare(_state, _path + " scanned from memory", fromFile, ScanToString(*_state, _preproc, errCode, result, _path));
+
+    CheckExpected(_state, _path.substr(0, _path.size() - 5) + ".scan.out", fromFile);
+}
+
+// ------------------------------------------------------------------------------------------------
+// _count random inputs, each preprocessed in one go and streamed, with and without line count
+// maintenance. They are made of pieces that give phases two and three the most trouble: line
+// continuations and comments, split and unfinished, and lines ending right at the end of input.
+void CheckRandom(CheckState* _state, size_t _count)
+{
+    static const char* const pieces[] = {
+        "a", "b1", "int", "x", "1", "2.5", "+", "(", ")", ";", ",", " ", "  ", "\t", "\n", "\n",
+        "\\\n", "\\\n", "\\\n\\\n", "\\", "/", "*", "/*", "*/", "//", "\"", "#", "#\\\n", "/*\\\n",
+        "*\\\n/", "/\\\n*", "#define A 1\n", "#define F(x) x+\\\n1\n", "A", "F(2)", "F(\n2)",
+        "#if A\n", "#else\n", "#endif\n", "#ifdef B\n", "#line 7\n", "__LINE__"
+    };
+    const size_t pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+
+    GLPPOptions options[2];
+    options[1].mMaintainLineCount = false;
+    GLCCPreprocessor* preprocs[2] = { NULL, NULL };
+    genPreprocessor(&preprocs[0], &options[0]);
+    genPreprocessor(&preprocs[1], &options[1]);
+
+    uint32_t seed = 1;
+    for (size_t i = 0; i < _count; ++i) {
+        // Mostly with line continuations allowed.
+        seed = seed * 1664525u + 1013904223u;
+        std::string source = ((seed >> 8) % 8 != 0) ? "#version 450\n" : "";
+        seed = seed * 1664525u + 1013904223u;
+        for (size_t pieceIndex = (seed >> 8) % 40; pieceIndex < 40; ++pieceIndex) {
+            seed = seed * 1664525u + 1013904223u;
+            source += pieces[(seed >> 8) % pieceCount];
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "random-%zu", i);
+        for (size_t j = 0; j < 2; ++j) {
+            RunResult oneShot = RunFromMemory(preprocs[j], name, source);
+            RunResult streamed = RunStreamed(preprocs[j], name, source, 0, seed);
+            RunResult streamedBytes = RunStreamed(preprocs[j], name, source, 1, 0);
+
+            std::string what = std::string(name) + (j == 0 ? "" : " without line counts") + " streamed";
+            bool same = CompareStreamed(_state, what, oneShot, streamed)
+                     && CompareStreamed(_state, what + " a byte at a time", oneShot, streamedBytes);
+            if (!same) {
+                std::string escaped = source;
+                ReplaceAll(&escaped, "\\", "\\\\");
+                ReplaceAll(&escaped, "\n", "\\n");
+                fprintf(stderr, "    from \"%s\"\n", escaped.c_str());
+            }
+        }
+    }
+
+    deletePreprocessor(&preprocs[0]);
+    deletePreprocessor(&preprocs[1]);
+}
+
+// ------------------------------------------------------------------------------------------------
+void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: glslpp_ppcheck [options]\n"
+        "  --tests=DIR      Directory of fixtures (default: the repo's tests/glslpp).\n"
+        "  --random=COUNT   Also stream COUNT random inputs against one-shot runs (default 0).\n"
+        "  --update         Write each existing x.out from what preprocessing gives now, rather\n"
+        "                   than checking it.\n");
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    CheckState state;
+    state.mTestDir = GLSLPP_PPCHECK_TEST_DIR;
+    state.mUpdate = false;
+    state.mCheckCount = 0;
+    state.mFailureCount = 0;
+    size_t randomCount = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--tests=") == 0) {
+            state.mTestDir = arg.substr(8);
+        } else if (arg.compare(0, 9, "--random=") == 0) {
+            randomCount = size_t(strtoull(arg.c_str() + 9, NULL, 10));
+        } else if (arg == "--update") {
+            state.mUpdate = true;
+        } else {
+            PrintUsage();
+            return (arg == "--help") ? GLCCError_Ok : GLCCError_MissingRequiredParameter;
+        }
+    }
+
+    // Included files come back as full paths, so those are made relative too.
+    if (!computeFullPath(state.mTestDir.c_str(), &state.mFullTestDir)) {
+        state.mFullTestDir = state.mTestDir;
+    }
+
+    std::string includePath = state.mTestDir + "/include";
+    const char* includePaths[] = { includePath.c_str() };
+
+    GLCCPreprocessor* preproc = NULL;
+    GLPPOptions options;
+    options.mIncludePaths = includePaths;
+    options.mIncludePathCount = 1;
+    genPreprocessor(&preproc, &options);
+
+    std::vector<std::string> fixtures = ListFixtures(state.mTestDir);
+    for (size_t i = 0; i < fixtures.size(); ++i) {
+        CheckFixture(&state, preproc, fixtures[i]);
+        CheckVariants(&state, options, fixtures[i]);
+        CheckScan(&state, preproc, fixtures[i]);
+    }
+    deletePreprocessor(&preproc);
+
+    CheckRandom(&state, randomCount);
+
+    printf("ppcheck: %zu of %zu checks failed\n", state.mFailureCount, state.mCheckCount);
+    return (state.mFailureCount == 0) ? GLCCError_Ok : GLCCError_InvalidOperation;
+}
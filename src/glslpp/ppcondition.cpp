@@ -0,0 +1,592 @@
+#include "glslppafx.h"
+
+#include "ppcondition.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsPunctuator(const PPToken& _token, uint32_t _id)
+{
+    return _token.mType == PPT_Punctuator && _token.mId == _id;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+PPConditionCompiler::PPConditionCompiler(const StringInterner* _interner)
+: mInterner(_interner)
+, mPos(NULL)
+, mEnd(NULL)
+, mResolveNames(false)
+, mError(NULL)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+bool PPConditionCompiler::Compile(const PPToken* _begin, const PPToken* _end, bool _resolveNames,
+                                  PPCondition* _outCondition, const char** _outError)
+{
+    if (_begin == _end) {
+        (*_outError) = "#if with no expression";
+        return false;
+    }
+
+    Start(_begin, _end, _resolveNames);
+    LogicalOr();
+    if (!mError && mPos != mEnd) {
+        mError = "missing binary operator in #if expression";
+    }
+
+    if (mError) {
+        (*_outError) = mError;
+        return false;
+    }
+
+    // Every op pushes, pops or leaves the stack alone, and a jump lands where the ops it skips
+    // would have left the stack anyway, so going through them in order finds the deepest point.
+    uint32_t depth = 0;
+    uint32_t maxDepth = 0;
+    for (size_t i = 0; i < mOps.size(); ++i) {
+        uint32_t op = mOps[i].mOp;
+        if (op == PPCO_Constant || op == PPCO_Defined || op == PPCO_Value) {
+            maxDepth = std::max(maxDepth, ++depth);
+        } else if (op >= PPCO_Multiply) {
+            --depth;
+        }
+    }
+    assert(depth == 1);
+
+    _outCondition->mOps = mOps.data();
+    _outCondition->mConstants = mConstants.data();
+    _outCondition->mOpCount = uint32_t(mOps.size());
+    _outCondition->mMaxDepth = maxDepth;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PPConditionCompiler::EvaluateOperand(const PPToken* _begin, const PPToken* _end, long long* _outValue)
+{
+    Start(_begin, _end, false);
+    Unary();
+    return !mError && mPos == mEnd && IsConstant(0, _outValue);
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPConditionCompiler::Start(const PPToken* _begin, const PPToken* _end, bool _resolveNames)
+{
+    mPos = _begin;
+    mEnd = _end;
+    mResolveNames = _resolveNames;
+    mError = NULL;
+    mOps.clear();
+    mConstants.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PPConditionCompiler::Accept(uint32_t _punctuator)
+{
+    if (mPos != mEnd && IsPunctuator(*mPos, _punctuator)) {
+        ++mPos;
+        return true;
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPConditionCompiler::LogicalOr()
+{
+    size_t start = mOps.size();
+    LogicalAnd();
+    while (!mError && Accept(PPS_OrOp)) {
+        size_t jump = mOps.size();
+        PPConditionOp op = { PPCO_OrJump, 0 };
+        mOps.push_back(op);
+        LogicalAnd();
+        EmitShortCircuit(PPCO_OrJump, start, jump);
+    }
+}
+
+void PPConditionCompiler::LogicalAnd()
+{
+    size_t start = mOps.size();
+    BitOr();
+    while (!mError && Accept(PPS_AndOp)) {
+        size_t jump = mOps.size();
+        PPConditionOp op = { PPCO_AndJump, 0 };
+        mOps.push_back(op);
+        BitOr();
+        EmitShortCircuit(PPCO_AndJump, start, jump);
+    }
+}
+
+void PPConditionCompiler::BitOr()
+{
+    size_t start = mOps.size();
+    BitXor();
+    while (!mError && Accept(PPS_VerticalBar)) {
+        size_t rhs = mOps.size();
+        BitXor();
+        EmitBinary(PPCO_BitOr, start, rhs);
+    }
+}
+
+void PPConditionCompiler::BitXor()
+{
+    size_t start = mOps.size();
+    BitAnd();
+    while (!mError && Accept(PPS_Caret)) {
+        size_t rhs = mOps.size();
+        BitAnd();
+        EmitBinary(PPCO_BitXor, start, rhs);
+    }
+}
+
+void PPConditionCompiler::BitAnd()
+{
+    size_t start = mOps.size();
+    Equality();
+    while (!mError && Accept(PPS_Ampersand)) {
+        size_t rhs = mOps.size();
+        Equality();
+        EmitBinary(PPCO_BitAnd, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Equality()
+{
+    size_t start = mOps.size();
+    Relational();
+    for (;;) {
+        EPPConditionOp op;
+        if (!mError && Accept(PPS_EqOp)) {
+            op = PPCO_Equal;
+        } else if (!mError && Accept(PPS_NeOp)) {
+            op = PPCO_NotEqual;
+        } else {
+            return;
+        }
+
+        size_t rhs = mOps.size();
+        Relational();
+        EmitBinary(op, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Relational()
+{
+    size_t start = mOps.size();
+    Shift();
+    for (;;) {
+        EPPConditionOp op;
+        if (!mError && Accept(PPS_LeftAngle)) {
+            op = PPCO_Less;
+        } else if (!mError && Accept(PPS_RightAngle)) {
+            op = PPCO_Greater;
+        } else if (!mError && Accept(PPS_LeOp)) {
+            op = PPCO_LessEqual;
+        } else if (!mError && Accept(PPS_GeOp)) {
+            op = PPCO_GreaterEqual;
+        } else {
+            return;
+        }
+
+        size_t rhs = mOps.size();
+        Shift();
+        EmitBinary(op, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Shift()
+{
+    size_t start = mOps.size();
+    Additive();
+    for (;;) {
+        EPPConditionOp op;
+        if (!mError && Accept(PPS_LeftOp)) {
+            op = PPCO_ShiftLeft;
+        } else if (!mError && Accept(PPS_RightOp)) {
+            op = PPCO_ShiftRight;
+        } else {
+            return;
+        }
+
+        size_t rhs = mOps.size();
+        Additive();
+        EmitBinary(op, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Additive()
+{
+    size_t start = mOps.size();
+    Multiplicative();
+    for (;;) {
+        EPPConditionOp op;
+        if (!mError && Accept(PPS_Plus)) {
+            op = PPCO_Add;
+        } else if (!mError && Accept(PPS_Dash)) {
+            op = PPCO_Subtract;
+        } else {
+            return;
+        }
+
+        size_t rhs = mOps.size();
+        Multiplicative();
+        EmitBinary(op, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Multiplicative()
+{
+    size_t start = mOps.size();
+    Unary();
+    for (;;) {
+        EPPConditionOp op;
+        if (!mError && Accept(PPS_Star)) {
+            op = PPCO_Multiply;
+        } else if (!mError && Accept(PPS_Slash)) {
+            op = PPCO_Divide;
+        } else if (!mError && Accept(PPS_Percent)) {
+            op = PPCO_Remainder;
+        } else {
+            return;
+        }
+
+        size_t rhs = mOps.size();
+        Unary();
+        EmitBinary(op, start, rhs);
+    }
+}
+
+void PPConditionCompiler::Unary()
+{
+    if (mError) {
+        return;
+    }
+
+    size_t start = mOps.size();
+    if (Accept(PPS_Plus)) {
+        Unary();
+    } else if (Accept(PPS_Dash)) {
+        Unary();
+        EmitUnary(PPCO_Negate, start);
+    } else if (Accept(PPS_Tilde)) {
+        Unary();
+        EmitUnary(PPCO_Complement, start);
+    } else if (Accept(PPS_Bang)) {
+        Unary();
+        EmitUnary(PPCO_Not, start);
+    } else {
+        Primary();
+    }
+}
+
+void PPConditionCompiler::Primary()
+{
+    if (mPos == mEnd) {
+        mError = "#if expression ends unexpectedly";
+        return;
+    }
+
+    if (Accept(PPS_LeftParen)) {
+        LogicalOr();
+        if (!mError && !Accept(PPS_RightParen)) {
+            mError = "missing ')' in #if expression";
+        }
+        return;
+    }
+
+    const PPToken& token = *mPos++;
+    if (token.mType == PPT_Identifier) {
+        if (!mResolveNames) {
+            // Whatever is left after expansion wasn't a macro. As in C (and as most GLSL
+            // compilers do outside of ES), it's 0.
+            EmitConstant(0);
+        } else if (token.mId == PPS_Defined) {
+            Defined();
+        } else {
+            PPConditionOp op = { PPCO_Value, token.mId };
+            mOps.push_back(op);
+        }
+        return;
+    }
+
+    if (token.mType == PPT_Number) {
+        Number(mInterner->GetString(token.mId), mInterner->GetLength(token.mId));
+        return;
+    }
+
+    mError = "invalid token in #if expression";
+}
+
+// ------------------------------------------------------------------------------------------------
+// defined X or defined(X), past the defined.
+void PPConditionCompiler::Defined()
+{
+    bool paren = Accept(PPS_LeftParen);
+    if (mPos == mEnd || mPos->mType != PPT_Identifier) {
+        mError = "operator \"defined\" requires an identifier";
+        return;
+    }
+
+    PPConditionOp op = { PPCO_Defined, mPos->mId };
+    mOps.push_back(op);
+    ++mPos;
+
+    if (paren && !Accept(PPS_RightParen)) {
+        mError = "missing ')' after \"defined\"";
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPConditionCompiler::Number(const char* _text, size_t _length)
+{
+    // Decimal, octal (leading 0) or hex, with an optional unsigned suffix.
+    if (_length > 0 && (_text[_length - 1] == 'u' || _text[_length - 1] == 'U')) {
+        --_length;
+    }
+
+    unsigned long long value = 0;
+    size_t i = 0;
+    unsigned base = 10;
+    if (_length > 1 && _text[0] == '0' && (_text[1] == 'x' || _text[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if (_length > 1 && _text[0] == '0') {
+        base = 8;
+        i = 1;
+    }
+
+    if (i == _length) {
+        mError = "invalid integer constant in #if expression";
+        return;
+    }
+
+    for (; i < _length; ++i) {
+        char c = _text[i];
+        unsigned digit = 0;
+        if (c >= '0' && c <= '9') {
+            digit = unsigned(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = unsigned(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = unsigned(c - 'A' + 10);
+        } else {
+            digit = base;
+        }
+
+        if (digit >= base) {
+            mError = "invalid integer constant in #if expression";
+            return;
+        }
+        value = value * base + digit;
+    }
+
+    EmitConstant((long long) value);
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+void PPConditionCompiler::EmitConstant(long long _value)
+{
+    PPConditionOp op = { PPCO_Constant, uint32_t(mConstants.size()) };
+    mOps.push_back(op);
+    mConstants.push_back(_value);
+}
+
+// ------------------------------------------------------------------------------------------------
+// _operand is where the operand's ops start; they run to the end.
+void PPConditionCompiler::EmitUnary(EPPConditionOp _op, size_t _operand)
+{
+    if (mError) {
+        return;
+    }
+
+    long long value;
+    if (!IsConstant(_operand, &value)) {
+        PPConditionOp op = { uint32_t(_op), 0 };
+        mOps.push_back(op);
+        return;
+    }
+
+    switch (_op) {
+        case PPCO_Negate:       value = (long long) (0 - (unsigned long long) value); break;
+        case PPCO_Complement:   value = ~value; break;
+        case PPCO_Not:          value = (value == 0) ? 1 : 0; break;
+        case PPCO_Bool:         value = (value != 0) ? 1 : 0; break;
+        default:                assert(!"Not a unary op"); break;
+    }
+    mConstants[mOps[_operand].mArg] = value;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPConditionCompiler::EmitBinary(EPPConditionOp _op, size_t _lhs, size_t _rhs)
+{
+    if (mError) {
+        return;
+    }
+
+    // Dividing by a constant zero isn't folded: it's only an error if it's evaluated.
+    long long rhs, value;
+    if (_rhs == _lhs + 1 && mOps[_lhs].mOp == PPCO_Constant && IsConstant(_rhs, &rhs)
+     && PPApplyConditionOp(_op, mConstants[mOps[_lhs].mArg], rhs, &value)) {
+        mConstants[mOps[_lhs].mArg] = value;
+        mOps.resize(_lhs + 1);
+        return;
+    }
+
+    PPConditionOp op = { uint32_t(_op), 0 };
+    mOps.push_back(op);
+}
+
+// ------------------------------------------------------------------------------------------------
+// After the right hand side of && or ||: _lhs is where the left hand side starts, _jump the jump
+// past the right hand side that follows it.
+void PPConditionCompiler::EmitShortCircuit(EPPConditionOp _op, size_t _lhs, size_t _jump)
+{
+    if (mError) {
+        return;
+    }
+
+    size_t rhs = _jump + 1;
+    EmitUnary(PPCO_Bool, rhs);
+    mOps[_jump].mArg = uint32_t(mOps.size() - _jump);
+
+    if (_jump != _lhs + 1 || mOps[_lhs].mOp != PPCO_Constant) {
+        return;
+    }
+
+    long long lhs = mConstants[mOps[_lhs].mArg];
+    bool decided = (_op == PPCO_AndJump) ? (lhs == 0) : (lhs != 0);
+    if (!decided) {
+        // The left hand side makes no difference, the result is the right's.
+        mOps.erase(mOps.begin() + _lhs, mOps.begin() + rhs);
+        return;
+    }
+
+    // The right hand side is never evaluated. Its names are still looked up, though (see
+    // PPRunCondition), so it can only go if it has none.
+    if (!HasValues(rhs)) {
+        mOps.resize(_lhs + 1);
+        mConstants[mOps[_lhs].mArg] = (_op == PPCO_AndJump) ? 0 : 1;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether the ops from _start to the end are just a constant.
+bool PPConditionCompiler::IsConstant(size_t _start, long long* _outValue) const
+{
+    if (mOps.size() != _start + 1 || mOps[_start].mOp != PPCO_Constant) {
+        return false;
+    }
+
+    (*_outValue) = mConstants[mOps[_start].mArg];
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PPConditionCompiler::HasValues(size_t _start) const
+{
+    for (size_t i = _start; i < mOps.size(); ++i) {
+        if (mOps[i].mOp == PPCO_Value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+bool PPConditionCache::Find(const PPToken* _begin, const PPToken* _end, const PPCondition** _outCondition) const
+{
+    std::map<uint64_t, Entry*>::const_iterator it = mEntries.find(Hash(_begin, _end));
+    if (it == mEntries.end()) {
+        return false;
+    }
+
+    size_t count = size_t(_end - _begin);
+    for (const Entry* entry = it->second; entry != NULL; entry = entry->mNext) {
+        if (entry->mTokenCount != count) {
+            continue;
+        }
+
+        bool same = true;
+        for (size_t i = 0; same && i < count; ++i) {
+            same = entry->mTokens[i].mType == _begin[i].mType && entry->mTokens[i].mId == _begin[i].mId;
+        }
+
+        if (same) {
+            (*_outCondition) = entry->mCondition;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+const PPCondition* PPConditionCache::Add(const PPToken* _begin, const PPToken* _end, const PPCondition* _optCondition)
+{
+    size_t count = size_t(_end - _begin);
+    PPToken* tokens = mArena.AllocateArray<PPToken>(count);
+    std::copy(_begin, _end, tokens);
+
+    PPCondition* condition = NULL;
+    if (_optCondition) {
+        PPConditionOp* ops = mArena.AllocateArray<PPConditionOp>(_optCondition->mOpCount);
+        memcpy(ops, _optCondition->mOps, sizeof(PPConditionOp) * _optCondition->mOpCount);
+
+        // Up to the last constant an op uses. Folding leaves some behind that none do.
+        uint32_t constantCount = 0;
+        for (uint32_t i = 0; i < _optCondition->mOpCount; ++i) {
+            if (ops[i].mOp == PPCO_Constant) {
+                constantCount = std::max(constantCount, ops[i].mArg + 1);
+            }
+        }
+
+        long long* constants = NULL;
+        if (constantCount > 0) {
+            constants = mArena.AllocateArray<long long>(constantCount);
+            memcpy(constants, _optCondition->mConstants, sizeof(long long) * constantCount);
+        }
+
+        condition = mArena.AllocateArray<PPCondition>(1);
+        condition->mOps = ops;
+        condition->mConstants = constants;
+        condition->mOpCount = _optCondition->mOpCount;
+        condition->mMaxDepth = _optCondition->mMaxDepth;
+    }
+
+    Entry* entry = mArena.AllocateArray<Entry>(1);
+    entry->mTokens = tokens;
+    entry->mTokenCount = uint32_t(count);
+    entry->mCondition = condition;
+
+    Entry*& head = mEntries[Hash(_begin, _end)];
+    entry->mNext = head;
+    head = entry;
+    return condition;
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPConditionCache::Clear()
+{
+    mEntries.clear();
+    mArena.Reset();
+}
+
+// ------------------------------------------------------------------------------------------------
+uint64_t PPConditionCache::Hash(const PPToken* _begin, const PPToken* _end)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const PPToken* tok = _begin; tok != _end; ++tok) {
+        hash ^= (uint64_t(tok->mId) << 8) | tok->mType;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
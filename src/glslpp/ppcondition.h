@@ -0,0 +1,291 @@
+#pragma once
+
+#include "common/arena.h"
+#include "common/hashutil.h"
+#include "pptokens.h"
+
+#include <assert.h>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// #if and #elif expressions, compiled for a little stack machine. An expression is compiled once
+// and can then be run any number of times, under whatever macros are defined by then: names are
+// looked up as it runs, not when it's compiled. Anything made only of numbers is folded as it
+// compiles.
+enum EPPConditionOp {
+    PPCO_Constant = 0,  // Pushes mConstants[mArg].
+    PPCO_Defined,       // Pushes whether the name mArg is a macro.
+    PPCO_Value,         // Pushes the name mArg's value: its macro's expansion, or 0 if it isn't one.
+
+    // Unary, on the top of the stack.
+    PPCO_Negate,
+    PPCO_Complement,
+    PPCO_Not,
+    PPCO_Bool,
+
+    // Binary, popping the right hand side.
+    PPCO_Multiply,
+    PPCO_Divide,
+    PPCO_Remainder,
+    PPCO_Add,
+    PPCO_Subtract,
+    PPCO_ShiftLeft,
+    PPCO_ShiftRight,
+    PPCO_Less,
+    PPCO_Greater,
+    PPCO_LessEqual,
+    PPCO_GreaterEqual,
+    PPCO_Equal,
+    PPCO_NotEqual,
+    PPCO_BitAnd,
+    PPCO_BitXor,
+    PPCO_BitOr,
+
+    // Short circuits. mArg is how many ops forward to jump.
+    PPCO_AndJump,       // If the top is 0, leaves it and jumps; otherwise pops it.
+    PPCO_OrJump         // If the top isn't 0, makes it 1 and jumps; otherwise pops it.
+};
+
+struct PPConditionOp
+{
+    uint32_t mOp;       // EPPConditionOp
+    uint32_t mArg;
+};
+
+// A compiled expression. The ops and constants belong to whatever compiled or cached it.
+struct PPCondition
+{
+    const PPConditionOp* mOps;
+    const long long* mConstants;
+    uint32_t mOpCount;
+    uint32_t mMaxDepth;     // The most values the stack ever holds.
+};
+
+enum EPPConditionResult {
+    PPCR_Ok = 0,
+    PPCR_Error,
+    PPCR_NeedsExpansion     // A name's value isn't a lone operand; expand the expression instead.
+};
+
+// Applies the binary op _op. Returns false for a division by zero, which is only an error where
+// it's evaluated.
+inline bool PPApplyConditionOp(uint32_t _op, long long _lhs, long long _rhs, long long* _outValue)
+{
+    // Wrapping rather than overflowing.
+    unsigned long long lhs = (unsigned long long) _lhs;
+    unsigned long long rhs = (unsigned long long) _rhs;
+
+    switch (_op) {
+        case PPCO_Multiply:     (*_outValue) = (long long) (lhs * rhs); return true;
+        case PPCO_Add:          (*_outValue) = (long long) (lhs + rhs); return true;
+        case PPCO_Subtract:     (*_outValue) = (long long) (lhs - rhs); return true;
+        case PPCO_ShiftLeft:    (*_outValue) = (long long) (lhs << (_rhs & 63)); return true;
+        case PPCO_ShiftRight:   (*_outValue) = _lhs >> (_rhs & 63); return true;
+        case PPCO_Less:         (*_outValue) = (_lhs < _rhs) ? 1 : 0; return true;
+        case PPCO_Greater:      (*_outValue) = (_lhs > _rhs) ? 1 : 0; return true;
+        case PPCO_LessEqual:    (*_outValue) = (_lhs <= _rhs) ? 1 : 0; return true;
+        case PPCO_GreaterEqual: (*_outValue) = (_lhs >= _rhs) ? 1 : 0; return true;
+        case PPCO_Equal:        (*_outValue) = (_lhs == _rhs) ? 1 : 0; return true;
+        case PPCO_NotEqual:     (*_outValue) = (_lhs != _rhs) ? 1 : 0; return true;
+        case PPCO_BitAnd:       (*_outValue) = _lhs & _rhs; return true;
+        case PPCO_BitXor:       (*_outValue) = _lhs ^ _rhs; return true;
+        case PPCO_BitOr:        (*_outValue) = _lhs | _rhs; return true;
+
+        case PPCO_Divide:
+        case PPCO_Remainder:
+            if (_rhs == 0) {
+                (*_outValue) = 0;
+                return false;
+            }
+            if (_rhs == -1) {
+                // Avoid the one overflowing case, LLONG_MIN / -1.
+                (*_outValue) = (_op == PPCO_Divide) ? (long long) (0 - lhs) : 0;
+                return true;
+            }
+            (*_outValue) = (_op == PPCO_Divide) ? (_lhs / _rhs) : (_lhs % _rhs);
+            return true;
+
+        default:
+            assert(!"Not a binary op");
+            return false;
+    }
+}
+
+// Runs _condition. _values looks names up, with
+//     bool IsDefined(uint32_t _name);
+//     bool GetValue(uint32_t _name, long long* _outValue);
+// where GetValue returns false if the name's macro doesn't expand to a single operand. _stack
+// must have room for _condition.mMaxDepth values; nothing else is needed, and nothing allocated.
+template <typename T>
+EPPConditionResult PPRunCondition(const PPCondition& _condition, T& _values, long long* _stack,
+                                  long long* _outValue, const char** _outError)
+{
+    const PPConditionOp* ops = _condition.mOps;
+    long long* top = _stack - 1;
+
+    for (uint32_t pc = 0; pc < _condition.mOpCount; ++pc) {
+        const PPConditionOp& op = ops[pc];
+        switch (op.mOp) {
+            case PPCO_Constant:
+                *++top = _condition.mConstants[op.mArg];
+                break;
+
+            case PPCO_Defined:
+                *++top = _values.IsDefined(op.mArg) ? 1 : 0;
+                break;
+
+            case PPCO_Value:
+                if (!_values.GetValue(op.mArg, ++top)) {
+                    return PPCR_NeedsExpansion;
+                }
+                break;
+
+            case PPCO_Negate:       (*top) = (long long) (0 - (unsigned long long) *top); break;
+            case PPCO_Complement:   (*top) = ~(*top); break;
+            case PPCO_Not:          (*top) = (*top == 0) ? 1 : 0; break;
+            case PPCO_Bool:         (*top) = (*top != 0) ? 1 : 0; break;
+
+            case PPCO_AndJump:
+            case PPCO_OrJump:
+            {
+                bool jump = (op.mOp == PPCO_AndJump) ? (*top == 0) : (*top != 0);
+                if (!jump) {
+                    --top;
+                    break;
+                }
+
+                // What's jumped over isn't evaluated, but its names must still be ones that
+                // could be: expanding them is what would have found anything wrong with them.
+                for (uint32_t skipped = pc + 1; skipped < pc + op.mArg; ++skipped) {
+                    long long unused;
+                    if (ops[skipped].mOp == PPCO_Value && !_values.GetValue(ops[skipped].mArg, &unused)) {
+                        return PPCR_NeedsExpansion;
+                    }
+                }
+
+                (*top) = (*top != 0) ? 1 : 0;
+                pc += op.mArg - 1;
+                break;
+            }
+
+            default:
+            {
+                long long rhs = *top--;
+                if (!PPApplyConditionOp(op.mOp, *top, rhs, top)) {
+                    (*_outError) = "division by zero in #if expression";
+                    return PPCR_Error;
+                }
+                break;
+            }
+        }
+    }
+
+    assert(top == _stack);
+    (*_outValue) = *top;
+    return PPCR_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Compiles expressions by recursive descent over the GLSL preprocessor's operators, lowest
+// precedence first. The buffers are kept from one expression to the next.
+class PPConditionCompiler
+{
+public:
+    explicit PPConditionCompiler(const StringInterner* _interner);
+
+    // Compiles [_begin, _end). With _resolveNames the tokens are as written: defined is an
+    // operator, and other identifiers are looked up as the expression runs. Otherwise they've
+    // been macro expanded already, defined() included, and any identifier left is 0.
+    // Returns false, with *_outError set, if the expression is malformed. *_outCondition is
+    // valid until the next call.
+    bool Compile(const PPToken* _begin, const PPToken* _end, bool _resolveNames,
+                 PPCondition* _outCondition, const char** _outError);
+
+    // Whether [_begin, _end), a macro's (expanded) replacement list, is a single operand with a
+    // value of its own: unary operators on a number, an identifier or a parenthesized
+    // expression, with no division by zero. Nothing binds tighter than a unary operator, so
+    // such an expansion can stand in for the macro's name as a value.
+    bool EvaluateOperand(const PPToken* _begin, const PPToken* _end, long long* _outValue);
+
+private:
+    PPConditionCompiler(const PPConditionCompiler&);
+    PPConditionCompiler& operator=(const PPConditionCompiler&);
+
+    void Start(const PPToken* _begin, const PPToken* _end, bool _resolveNames);
+    bool Accept(uint32_t _punctuator);
+
+    void LogicalOr();
+    void LogicalAnd();
+    void BitOr();
+    void BitXor();
+    void BitAnd();
+    void Equality();
+    void Relational();
+    void Shift();
+    void Additive();
+    void Multiplicative();
+    void Unary();
+    void Primary();
+    void Defined();
+    void Number(const char* _text, size_t _length);
+
+    void EmitConstant(long long _value);
+    void EmitUnary(EPPConditionOp _op, size_t _operand);
+    void EmitBinary(EPPConditionOp _op, size_t _lhs, size_t _rhs);
+    void EmitShortCircuit(EPPConditionOp _op, size_t _lhs, size_t _jump);
+    bool IsConstant(size_t _start, long long* _outValue) const;
+    bool HasValues(size_t _start) const;
+
+    const StringInterner* mInterner;
+    const PPToken* mPos;
+    const PPToken* mEnd;
+    bool mResolveNames;
+    const char* mError;
+
+    std::vector<PPConditionOp> mOps;
+    std::vector<long long> mConstants;
+};
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Compiled expressions (with names resolved) by their tokens, so an expression seen again--in a
+// header included more than once, or the next variant of a shader--isn't compiled again. Tokens
+// are compared by id, so the cache is only good for as long as the interner they came from.
+class PPConditionCache
+{
+public:
+    PPConditionCache() { }
+
+    // Returns false if [_begin, _end) has never been added. Otherwise *_outCondition is what it
+    // compiled to, or NULL if it didn't compile as written (and must be expanded first).
+    bool Find(const PPToken* _begin, const PPToken* _end, const PPCondition** _outCondition) const;
+
+    // Copies the tokens and _optCondition, if any, and returns the copy of _optCondition.
+    const PPCondition* Add(const PPToken* _begin, const PPToken* _end, const PPCondition* _optCondition);
+
+    void Clear();
+
+private:
+    PPConditionCache(const PPConditionCache&);
+    PPConditionCache& operator=(const PPConditionCache&);
+
+    struct Entry
+    {
+        const PPToken* mTokens;
+        uint32_t mTokenCount;
+        const PPCondition* mCondition;
+        Entry* mNext;           // Another with the same hash.
+    };
+
+    static uint64_t Hash(const PPToken* _begin, const PPToken* _end);
+
+    std::map<uint64_t, Entry*> mEntries;
+    Arena mArena;
+};
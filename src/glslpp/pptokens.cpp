@@ -0,0 +1,341 @@
+#include "glslppafx.h"
+
+#include "pptokens.h"
+#include "scan.h"
+
+#include <string.h>
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// In EPPSpelling order.
+const char* const kPPSpellings[PPS_Count] = {
+    "",
+    "(", ")", "[", "]", "{", "}", ".", ",", ":", ";", "?",
+    "+", "-", "*", "/", "%", "!", "~", "=", "<", ">", "&", "|", "^",
+    "#", "##",
+    "<<", ">>", "++", "--", "<=", ">=", "==", "!=", "&&", "||", "^^",
+    "*=", "/=", "+=", "-=", "%=", "<<=", ">>=", "&=", "^=", "|=",
+
+    "defined", "define", "undef", "if", "ifdef", "ifndef", "else", "elif", "endif",
+    "error", "pragma", "extension", "version", "line", "include",
+    "__LINE__", "__FILE__", "__VERSION__",
+    "GL_ES", "GL_core_profile", "GL_compatibility_profile",
+    "es", "core", "compatibility",
+    "once",
+    "0", "1",
+};
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsIdentStart(char _c)
+{
+    return (_c >= 'a' && _c <= 'z') || (_c >= 'A' && _c <= 'Z') || _c == '_';
+}
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsDigit(char _c)
+{
+    return _c >= '0' && _c <= '9';
+}
+
+// ------------------------------------------------------------------------------------------------
+inline bool IsBlank(char _c)
+{
+    return _c == ' ' || _c == '\t' || _c == '\r' || _c == '\v' || _c == '\f';
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether _name is that of a directive which opens, continues or closes a conditional.
+inline bool IsConditionalName(const char* _name, size_t _length)
+{
+    switch (_length) {
+        case 2: return memcmp(_name, "if", 2) == 0;
+        case 4: return memcmp(_name, "elif", 4) == 0 || memcmp(_name, "else", 4) == 0;
+        case 5: return memcmp(_name, "ifdef", 5) == 0 || memcmp(_name, "endif", 5) == 0;
+        case 6: return memcmp(_name, "ifndef", 6) == 0;
+        default: return false;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Whether _name is that of a directive which can change what a shader depends on: a conditional,
+// #include, #version or #extension.
+inline bool IsDependencyName(const char* _name, size_t _length)
+{
+    switch (_length) {
+        case 7: return memcmp(_name, "include", 7) == 0 || memcmp(_name, "version", 7) == 0;
+        case 9: return memcmp(_name, "extension", 9) == 0;
+        default: return IsConditionalName(_name, _length);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the start of the first line in [_src, _end) that is a directive TIsName accepts the
+// name of, or _end, and counts the lines passed over.
+template <bool (*TIsName)(const char*, size_t)>
+const char* FindDirective(const char* _src, const char* _end, size_t* _outLines)
+{
+    size_t lines = 0;
+    const char* line = _src;
+    while (line != _end) {
+        // Blanks are skipped exactly as PPTokenize does, so this agrees with phase four on what
+        // is a directive.
+        const char* c = line;
+        while (c != _end && IsBlank(*c)) {
+            ++c;
+        }
+
+        if (c != _end && *c == '#') {
+            do {
+                ++c;
+            } while (c != _end && IsBlank(*c));
+
+            const char* name = c;
+            c = ScanSkipClass(ESC_IdentChars, c, _end);
+            if (TIsName(name, size_t(c - name))) {
+                break;
+            }
+        }
+
+        const char* eol = (const char*) memchr(c, '\n', size_t(_end - c));
+        if (!eol) {
+            line = _end;
+            break;
+        }
+
+        ++lines;
+        line = eol + 1;
+    }
+
+    (*_outLines) = lines;
+    return line;
+}
+
+// ------------------------------------------------------------------------------------------------
+// A pp-number: a digit (or '.' and a digit) followed by any run of letters, digits, '.', '_'
+// and exponent signs. This is deliberately looser than the numbers the compiler accepts, the
+// same as in C--the compiler gets to complain about malformed ones, not the preprocessor.
+inline const char* SkipNumber(const char* _src, const char* _end)
+{
+    ++_src;
+    while (_src != _end) {
+        char c = *_src;
+        if ((c == '+' || c == '-') && (_src[-1] == 'e' || _src[-1] == 'E')) {
+            ++_src;
+        } else if (IsIdentStart(c) || IsDigit(c) || c == '.') {
+            ++_src;
+        } else {
+            break;
+        }
+    }
+    return _src;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the length of the punctuator at _src (longest match), or 0 if there isn't one.
+inline size_t MatchPunctuator(const char* _src, const char* _end, uint32_t* _outId)
+{
+    char c1 = (_src + 1 != _end) ? _src[1] : '\0';
+    char c2 = (c1 != '\0' && _src + 2 != _end) ? _src[2] : '\0';
+
+    switch (_src[0]) {
+        case '(': (*_outId) = PPS_LeftParen; return 1;
+        case ')': (*_outId) = PPS_RightParen; return 1;
+        case '[': (*_outId) = PPS_LeftBracket; return 1;
+        case ']': (*_outId) = PPS_RightBracket; return 1;
+        case '{': (*_outId) = PPS_LeftBrace; return 1;
+        case '}': (*_outId) = PPS_RightBrace; return 1;
+        case '.': (*_outId) = PPS_Dot; return 1;
+        case ',': (*_outId) = PPS_Comma; return 1;
+        case ':': (*_outId) = PPS_Colon; return 1;
+        case ';': (*_outId) = PPS_Semicolon; return 1;
+        case '?': (*_outId) = PPS_Question; return 1;
+        case '~': (*_outId) = PPS_Tilde; return 1;
+        case '#':
+            if (c1 == '#') { (*_outId) = PPS_HashHash; return 2; }
+            (*_outId) = PPS_Hash; return 1;
+        case '+':
+            if (c1 == '+') { (*_outId) = PPS_IncOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_AddAssign; return 2; }
+            (*_outId) = PPS_Plus; return 1;
+        case '-':
+            if (c1 == '-') { (*_outId) = PPS_DecOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_SubAssign; return 2; }
+            (*_outId) = PPS_Dash; return 1;
+        case '*':
+            if (c1 == '=') { (*_outId) = PPS_MulAssign; return 2; }
+            (*_outId) = PPS_Star; return 1;
+        case '/':
+            if (c1 == '=') { (*_outId) = PPS_DivAssign; return 2; }
+            (*_outId) = PPS_Slash; return 1;
+        case '%':
+            if (c1 == '=') { (*_outId) = PPS_ModAssign; return 2; }
+            (*_outId) = PPS_Percent; return 1;
+        case '!':
+            if (c1 == '=') { (*_outId) = PPS_NeOp; return 2; }
+            (*_outId) = PPS_Bang; return 1;
+        case '=':
+            if (c1 == '=') { (*_outId) = PPS_EqOp; return 2; }
+            (*_outId) = PPS_Equal; return 1;
+        case '<':
+            if (c1 == '<' && c2 == '=') { (*_outId) = PPS_LeftAssign; return 3; }
+            if (c1 == '<') { (*_outId) = PPS_LeftOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_LeOp; return 2; }
+            (*_outId) = PPS_LeftAngle; return 1;
+        case '>':
+            if (c1 == '>' && c2 == '=') { (*_outId) = PPS_RightAssign; return 3; }
+            if (c1 == '>') { (*_outId) = PPS_RightOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_GeOp; return 2; }
+            (*_outId) = PPS_RightAngle; return 1;
+        case '&':
+            if (c1 == '&') { (*_outId) = PPS_AndOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_AndAssign; return 2; }
+            (*_outId) = PPS_Ampersand; return 1;
+        case '|':
+            if (c1 == '|') { (*_outId) = PPS_OrOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_OrAssign; return 2; }
+            (*_outId) = PPS_VerticalBar; return 1;
+        case '^':
+            if (c1 == '^') { (*_outId) = PPS_XorOp; return 2; }
+            if (c1 == '=') { (*_outId) = PPS_XorAssign; return 2; }
+            (*_outId) = PPS_Caret; return 1;
+        default:
+            return 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Lexes the token at _src, which must not be whitespace or an EOL. Returns where it ends.
+inline const char* LexToken(const char* _src, const char* _end, StringInterner* _interner, PPToken* _outToken)
+{
+    const char* tokEnd = NULL;
+    char c = _src[0];
+
+    if (IsIdentStart(c)) {
+        tokEnd = ScanSkipClass(ESC_IdentChars, _src + 1, _end);
+        _outToken->mType = PPT_Identifier;
+        _outToken->mId = _interner->Intern(_src, size_t(tokEnd - _src));
+    } else if (IsDigit(c) || (c == '.' && _src + 1 != _end && IsDigit(_src[1]))) {
+        tokEnd = SkipNumber(_src, _end);
+        _outToken->mType = PPT_Number;
+        _outToken->mId = _interner->Intern(_src, size_t(tokEnd - _src));
+    } else {
+        uint32_t id = 0;
+        size_t length = MatchPunctuator(_src, _end, &id);
+        if (length > 0) {
+            _outToken->mType = PPT_Punctuator;
+            _outToken->mId = id;
+            tokEnd = _src + length;
+        } else {
+            _outToken->mType = PPT_Other;
+            _outToken->mId = _interner->Intern(_src, 1);
+            tokEnd = _src + 1;
+        }
+    }
+
+    return tokEnd;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+void SeedPPInterner(StringInterner* _interner)
+{
+    assert(_interner->Size() == 0);
+    for (int i = 1; i < PPS_Count; ++i) {
+        uint32_t id = _interner->Intern(kPPSpellings[i], strlen(kPPSpellings[i]));
+        assert(id == uint32_t(i));
+        (void) id;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void PPTokenize(const char* _src, size_t _srcLength, StringInterner* _interner,
+                std::vector<PPToken>* _outTokens)
+{
+    const char* src = _src;
+    const char* end = _src + _srcLength;
+    bool lineHasTokens = false;
+    uint8_t flags = 0;
+
+    // Most shader lines are a handful of tokens per ~30 bytes.
+    _outTokens->reserve(_outTokens->size() + _srcLength / 4);
+
+    while (src != end) {
+        char c = *src;
+        if (IsBlank(c)) {
+            src = ScanSkipClass(ESC_Blanks, src + 1, end);
+            flags = PPTF_LeadingSpace;
+            continue;
+        }
+
+        PPToken token;
+        token.mFlags = flags;
+        flags = 0;
+
+        if (c == '\n') {
+            token.mType = PPT_EOL;
+            token.mId = 0;
+            ++src;
+            lineHasTokens = false;
+        } else {
+            src = LexToken(src, end, _interner, &token);
+            lineHasTokens = true;
+        }
+
+        _outTokens->push_back(token);
+    }
+
+    if (lineHasTokens) {
+        PPToken eol = { 0, PPT_EOL, 0 };
+        _outTokens->push_back(eol);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* PPFindConditional(const char* _src, const char* _end, size_t* _outLines)
+{
+    return FindDirective<IsConditionalName>(_src, _end, _outLines);
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* PPFindDependencyDirective(const char* _src, const char* _end, size_t* _outLines)
+{
+    return FindDirective<IsDependencyName>(_src, _end, _outLines);
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* PPFindTokenBoundary(const char* _src, const char* _end)
+{
+    // Cutting before the blanks, rather than after, keeps the PPTF_LeadingSpace of the token
+    // after them when the rest of the line is tokenized on its own.
+    for (const char* c = _end; c != _src; --c) {
+        switch (c[-1]) {
+            case ' ': case '\t': case '\r': case '\v': case '\f':
+                while (c - 1 != _src && IsBlank(c[-2])) {
+                    --c;
+                }
+                return c - 1;
+
+            case '(': case ')': case '[': case ']': case '{': case '}':
+            case ',': case ':': case ';': case '?': case '~':
+                return c;
+
+            default:
+                break;
+        }
+    }
+
+    return _src;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PPTokenizeOne(const char* _src, size_t _srcLength, StringInterner* _interner, PPToken* _outToken)
+{
+    if (_srcLength == 0 || IsBlank(_src[0]) || _src[0] == '\n') {
+        return false;
+    }
+
+    _outToken->mFlags = 0;
+    return LexToken(_src, _src + _srcLength, _interner, _outToken) == _src + _srcLength;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "common/hashutil.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Preprocessing tokens, as phase four sees them. The text of every token is interned, so a token
+// is just its kind and an id: comparing two tokens is an integer compare, and tokens don't refer
+// back into the buffer they came from (which phase four is free to throw away).
+enum EPPTokenType {
+    PPT_EOL = 0,
+    PPT_Identifier,
+    PPT_Number,
+    PPT_Punctuator,
+    PPT_Other,          // Any other character. Passed through untouched.
+    PPT_Param           // Only in macro replacement lists, where mId is the parameter's index.
+};
+
+enum EPPTokenFlags {
+    PPTF_LeadingSpace = 1 << 0, // Whitespace came before this token, on the same line.
+    PPTF_NoExpand     = 1 << 1  // An identifier which must never be macro expanded.
+};
+
+struct PPToken
+{
+    uint32_t mId;       // Interned text; 0 for PPT_EOL.
+    uint8_t mType;
+    uint8_t mFlags;
+};
+
+// ------------------------------------------------------------------------------------------------
+// The text phase four needs to recognize. SeedPPInterner interns them first, and in this order,
+// so these are their ids in any interner it has seeded.
+enum EPPSpelling {
+    PPS_None = 0,
+
+    // Punctuators.
+    PPS_LeftParen,
+    PPS_RightParen,
+    PPS_LeftBracket,
+    PPS_RightBracket,
+    PPS_LeftBrace,
+    PPS_RightBrace,
+    PPS_Dot,
+    PPS_Comma,
+    PPS_Colon,
+    PPS_Semicolon,
+    PPS_Question,
+    PPS_Plus,
+    PPS_Dash,
+    PPS_Star,
+    PPS_Slash,
+    PPS_Percent,
+    PPS_Bang,
+    PPS_Tilde,
+    PPS_Equal,
+    PPS_LeftAngle,
+    PPS_RightAngle,
+    PPS_Ampersand,
+    PPS_VerticalBar,
+    PPS_Caret,
+    PPS_Hash,
+    PPS_HashHash,
+    PPS_LeftOp,
+    PPS_RightOp,
+    PPS_IncOp,
+    PPS_DecOp,
+    PPS_LeOp,
+    PPS_GeOp,
+    PPS_EqOp,
+    PPS_NeOp,
+    PPS_AndOp,
+    PPS_OrOp,
+    PPS_XorOp,
+    PPS_MulAssign,
+    PPS_DivAssign,
+    PPS_AddAssign,
+    PPS_SubAssign,
+    PPS_ModAssign,
+    PPS_LeftAssign,
+    PPS_RightAssign,
+    PPS_AndAssign,
+    PPS_XorAssign,
+    PPS_OrAssign,
+
+    // Directive names and other identifiers with a meaning to the preprocessor.
+    PPS_Defined,
+    PPS_Define,
+    PPS_Undef,
+    PPS_If,
+    PPS_Ifdef,
+    PPS_Ifndef,
+    PPS_Else,
+    PPS_Elif,
+    PPS_Endif,
+    PPS_Error,
+    PPS_Pragma,
+    PPS_Extension,
+    PPS_Version,
+    PPS_Line,
+    PPS_Include,
+    PPS_LineMacro,      // __LINE__
+    PPS_FileMacro,      // __FILE__
+    PPS_VersionMacro,   // __VERSION__
+    PPS_GL_ES,
+    PPS_GL_core_profile,
+    PPS_GL_compatibility_profile,
+    PPS_Es,
+    PPS_Core,
+    PPS_Compatibility,
+    PPS_Once,           // #pragma once
+    PPS_Zero,
+    PPS_One,
+
+    PPS_Count
+};
+
+// Interns every EPPSpelling, in order. _interner must be empty.
+void SeedPPInterner(StringInterner* _interner);
+
+// ------------------------------------------------------------------------------------------------
+// Splits _src (the output of phases two and three) into preprocessing tokens, appending them to
+// _outTokens. Each '\n' becomes a PPT_EOL token; if the last line has tokens but no '\n', a
+// PPT_EOL is added for it, so every line phase four sees is terminated.
+// _interner must have been seeded with SeedPPInterner.
+void PPTokenize(const char* _src, size_t _srcLength, StringInterner* _interner,
+                std::vector<PPToken>* _outTokens);
+
+// Returns the start of the first line in [_src, _end) that is a conditional directive--#if,
+// #ifdef, #ifndef, #elif, #else or #endif--or _end if there is none. _src must be the start of a
+// line. *_outLines is set to the number of lines before it. Nothing is tokenized; each line is
+// only looked at as far as a directive's name. This is how phase four gets past the lines a
+// conditional leaves out.
+const char* PPFindConditional(const char* _src, const char* _end, size_t* _outLines);
+
+// The same, for the directives a dependency scan looks at: the conditionals, #include, #version
+// and #extension (see DependencyScanner).
+const char* PPFindDependencyDirective(const char* _src, const char* _end, size_t* _outLines);
+
+// Returns a point in [_src, _end), which must have no '\n', that no token spans: before a run of
+// blanks, or after a punctuator that nothing can be added to (';', ')' and the like). Text after
+// _end can't change the tokens before it, so they can be tokenized before the line is finished.
+// The last such point is returned, or _src if there is none.
+const char* PPFindTokenBoundary(const char* _src, const char* _end);
+
+// Tokenizes _src, which must be exactly one token (no whitespace). Returns false if it isn't.
+// This is what ## pasting uses to check its result.
+bool PPTokenizeOne(const char* _src, size_t _srcLength, StringInterner* _interner, PPToken* _outToken);
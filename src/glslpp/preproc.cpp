@@ -3,77 +3,132 @@
 
 #include "glslpp/preproc.h"
 
+#include "depscan.h"
+#include "diskcache.h"
+#include "earlyphases.h"
+#include "errorutils.h"
 #include "fileutils.h"
+#include "includecache.h"
+#include "phasefour.h"
+#include "pptokens.h"
 #include "stringutils.h"
+#include "threadpool.h"
+
+#include <map>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <vector>
 
 GLCCint _preprocess(GLCCPreprocessor* _preproc);
-GLCCint _preprocessPhaseTwo(GLCCPreprocessor* _preproc);
-GLCCint _preprocessPhaseThree(GLCCPreprocessor* _preproc);
+GLCCint _preprocessReadFile(GLCCPreprocessor* _preproc, const char* _filename);
+GLCCint _preprocessPhasesTwoAndThree(GLCCPreprocessor* _preproc);
 GLCCint _preprocessPhaseFour(GLCCPreprocessor* _preproc);
+GLCCint _preprocessStartPhaseFour(GLCCPreprocessor* _preproc);
+GLCCint _scan(GLCCPreprocessor* _preproc, GLPPScanResult* _outResult);
+void _appendDepfilePath(std::vector<char>* _depfile, const char* _path);
+void _preprocessStartRun(GLCCPreprocessor* _preproc, const char* _filename);
+void _preprocessPhaseFourStreamed(const char* _text, size_t _length, void* _userData);
+void _preprocessPhaseFourStreamLongLine(GLCCPreprocessor* _preproc);
+GLCCint _preprocessPhaseFourStreamEnd(GLCCPreprocessor* _preproc);
+GLCCint _preprocessPhaseFourStreamProcess(GLCCPreprocessor* _preproc, const char* _text, size_t _length, bool _final);
+std::shared_ptr<const IncludedFile> _makePredefinedMacros(const char* const* _defines, size_t _defineCount);
+void _preprocessBatchJob(size_t _job, size_t _worker, void* _userData);
+void _preprocessVariantJob(size_t _job, size_t _worker, void* _userData);
+
+// How much of a line a stream holds on to before passing what it can of it on to phase four.
+const size_t kMaxStreamLine = 64 * 1024;
 
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
-// TODO: Relocate this into a common header. This will work for any stateful object that has an 
-// char* mErrorString. 
-template<typename T>
-GLCCint ReportError(GLCCint _errCode, T *_where, const char* _fmt, ...)
+struct GLCCPreprocessor 
 {
-    // Cleanup if anythign is there already.
-    if (_where->mErrorString) {
-        delete [] _where->mErrorString;
-        _where->mErrorString = NULL;
-    }
+    const GLPPOptions mOptions;
+    std::vector<std::string> mIncludePaths;     // mOptions' copied, its pointers may not last.
+    std::shared_ptr<const IncludedFile> mPredefines;    // mOptions.mDefines, run before any input.
+    DiskCache* mDiskCache;                      // NULL unless mOptions.mCacheDirectory is set.
 
-    // determine required size.
-    va_list args;
-    va_start( args, _fmt);
-    int reqSize = vsnprintf(NULL, 0, _fmt, args);
-    assert(reqSize >= 0);
-    va_end(args);
+    // Every buffer is kept from one run to the next, and only ever grows (geometrically, see
+    // bufferResize), so a preprocessor that's reused stops allocating once it has seen its
+    // largest input.
+    std::vector<char> mFilename;        // '\0' terminated.
+    MappedFile mInputFile;
+    std::vector<char> mInputBuffer;     // Input read from a file that couldn't be mapped.
+    const char* mInput;
+    size_t mInputLength;
+    std::vector<char> mOutputBuffer;    // Phases two and three's output.
+    size_t mOutputLength;
+    LineMap mLineMap;                   // mOutputBuffer's, if mOptions.mMaintainLineCount.
+    std::vector<char> mErrorString;     // '\0' terminated, or empty for no error.
 
-    // Create new place.
-    va_start( args, _fmt);
-    _where->mErrorString = new char[reqSize + 1];
-    vsnprintf(_where->mErrorString, reqSize + 1, _fmt, args);
-    va_end(args);
+    // Phase four. Identifiers are interned once per preprocessor, and the ids stay valid across
+    // runs. mOutput is the final output (NULL terminated once complete).
+    StringInterner mInterner;
+    std::vector<char> mOutput;
+    PhaseFour* mPhaseFour;
 
-    return _errCode;
-}
+    // preprocessVariants' shared tokens, brought over to mInterner's ids the first time this
+    // preprocessor runs one of its variants. mVariantTokensFrom is NULL for none.
+    std::vector<PPToken> mVariantTokens;
+    const IncludedFile* mVariantTokensFrom;
 
-// ------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------
-struct GLCCPreprocessor 
-{
-    const GLPPOptions mOptions;
+    // Only while a stream is in progress, between preprocessBegin and preprocessEnd.
+    EarlyPhasesStream* mStream;
+    GLPPOutputFn mStreamOutputFn;
+    void* mStreamUserData;
+    std::vector<char> mStreamText;      // Phase three output that doesn't end a line yet.
+    size_t mStreamTextSearched;         // How much of it PPFindTokenBoundary has looked at.
+    bool mStreamMidLine;                // Whether it starts partway through its line.
 
-    char* mFilename;
-    char* mInputBuffer;
-    char* mOutputBuffer;
-    char* mErrorString;
+    // Dependency scanning (scanFromFile and friends). The scanner is made the first time it's
+    // needed. The last scan's results are only good while mScanned is set.
+    DependencyScanner* mScanner;
+    std::vector<const char*> mScanIncludes;
+    std::vector<const char*> mScanExtensions;
+    std::vector<char> mDepfile;
+    bool mScanned;
 
     GLCCint mVersionGLSL;
     bool mUsedLineContinuations;
 
     // --------------------------------------------------------------------------------------------
-    GLCCPreprocessor(const GLPPOptions& _options)
+    GLCCPreprocessor(const GLPPOptions& _options, const std::shared_ptr<const IncludedFile>& _predefines)
     : mOptions(_options)
-    , mFilename(NULL)
-    , mInputBuffer(NULL)
-    , mOutputBuffer(NULL)
-    , mErrorString(NULL)
+    , mPredefines(_predefines)
+    , mDiskCache(NULL)
+    , mInput(NULL)
+    , mInputLength(0)
+    , mOutputLength(0)
+    , mPhaseFour(NULL)
+    , mVariantTokensFrom(NULL)
+    , mStream(NULL)
+    , mStreamOutputFn(NULL)
+    , mStreamUserData(NULL)
+    , mStreamTextSearched(0)
+    , mStreamMidLine(false)
+    , mScanner(NULL)
+    , mScanned(false)
     , mVersionGLSL(110) // Per the spec, this is the default.
     , mUsedLineContinuations(false)
-    { }
+    { 
+        for (size_t i = 0; i < mOptions.mIncludePathCount; ++i) {
+            mIncludePaths.push_back(mOptions.mIncludePaths[i]);
+        }
+        SeedPPInterner(&mInterner);
+
+        if (mOptions.mCacheDirectory) {
+            mDiskCache = new DiskCache(mOptions.mCacheDirectory, mOptions.mCacheMaxBytes);
+        }
+    }
 
     // --------------------------------------------------------------------------------------------
     ~GLCCPreprocessor()
     {
-        delete [] mFilename;
-        delete [] mInputBuffer;
-        delete [] mOutputBuffer;
-        delete [] mErrorString;
+        delete mPhaseFour;
+        delete mStream;
+        delete mScanner;
+        delete mDiskCache;
     }
 };
 
@@ -92,7 +147,7 @@ GLCCint genPreprocessor(GLCCPreprocessor** _newPreproc, const GLPPOptions* _optO
         myOpts = (*_optOptions);
     }
 
-    (*_newPreproc) = new GLCCPreprocessor(myOpts);
+    (*_newPreproc) = new GLCCPreprocessor(myOpts, _makePredefinedMacros(myOpts.mDefines, myOpts.mDefineCount));
     return GLCCError_Ok;
 }
 
@@ -118,10 +173,11 @@ GLCCint preprocessFromFile(GLCCPreprocessor* _preproc, const char* _filename)
         return GLCCError_MissingRequiredParameter;
     }
 
-    _preproc->mFilename = stringDuplicate(_filename);
-    _preproc->mInputBuffer = fileContentsToString(_filename);
-    if (_preproc->mInputBuffer == NULL) {
-        return GLCCError_FileNotFound;
+    _preprocessStartRun(_preproc, _filename);
+
+    GLCCint errCode = _preprocessReadFile(_preproc, _filename);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
     }
 
     return _preprocess(_preproc);
@@ -134,12 +190,94 @@ GLCCint preprocessFromMemory(GLCCPreprocessor* _preproc, const char* _memBuffer,
         return GLCCError_MissingRequiredParameter;
     }
 
-    _preproc->mFilename = stringDuplicate((_optFilename != NULL) ? _optFilename : "MemoryBuffer");
-    _preproc->mInputBuffer = stringDuplicate(_memBuffer);
+    _preprocessStartRun(_preproc, (_optFilename != NULL) ? _optFilename : "MemoryBuffer");
+
+    // The caller's buffer outlives the call, and nothing writes to the input, so it's used as is.
+    _preproc->mInput = _memBuffer;
+    _preproc->mInputLength = strlen(_memBuffer);
 
     return _preprocess(_preproc);
 }
 
+// ------------------------------------------------------------------------------------------------
+GLCCint preprocessBegin(GLCCPreprocessor* _preproc, const char* _optFilename, 
+                        GLPPOutputFn _outputFn, void* _optUserData)
+{
+    if (!_preproc || !_outputFn) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    if (_preproc->mStream) {
+        return ReportError(GLCCError_InvalidOperation, _preproc, "A stream is already in progress, call preprocessEnd first.\n");
+    }
+
+    _preprocessStartRun(_preproc, (_optFilename != NULL) ? _optFilename : "Stream");
+    _preproc->mStreamOutputFn = _outputFn;
+    _preproc->mStreamUserData = _optUserData;
+    _preproc->mStreamText.clear();
+    _preproc->mStreamTextSearched = 0;
+    _preproc->mStreamMidLine = false;
+
+    GLCCint errCode = _preprocessStartPhaseFour(_preproc);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+
+    // Phase one is up to the caller. Phases two and three run on each chunk as it arrives, and 
+    // hand their output on to phase four.
+    _preproc->mStream = new EarlyPhasesStream(_preproc->mOptions.mMaintainLineCount, 
+                                              _preprocessPhaseFourStreamed, _preproc);
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint preprocessFeed(GLCCPreprocessor* _preproc, const char* _chunk, size_t _chunkLength)
+{
+    if (!_preproc || (!_chunk && _chunkLength > 0)) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    if (!_preproc->mStream) {
+        return ReportError(GLCCError_InvalidOperation, _preproc, "No stream in progress, call preprocessBegin first.\n");
+    }
+
+    // Phase four runs from inside Feed, on each line as it's completed.
+    _preproc->mStream->Feed(_chunk, _chunkLength);
+    return _preproc->mPhaseFour->GetErrorCode();
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint preprocessEnd(GLCCPreprocessor* _preproc)
+{
+    if (!_preproc) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    if (!_preproc->mStream) {
+        return ReportError(GLCCError_InvalidOperation, _preproc, "No stream in progress, call preprocessBegin first.\n");
+    }
+
+    _preproc->mStream->Finish();
+    _preproc->mUsedLineContinuations = _preproc->mStream->UsedContinuations();
+    delete _preproc->mStream;
+    _preproc->mStream = NULL;
+
+    return _preprocessPhaseFourStreamEnd(_preproc);
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* getOutput(GLCCPreprocessor* _preproc, size_t* _optLength)
+{
+    if (!_preproc || _preproc->mOutput.empty()) {
+        return NULL;
+    }
+
+    if (_optLength) {
+        (*_optLength) = _preproc->mOutput.size() - 1;
+    }
+    return _preproc->mOutput.data();
+}
+
 // ------------------------------------------------------------------------------------------------
 const char* getLastError(GLCCPreprocessor* _preproc)
 {
@@ -147,7 +285,105 @@ const char* getLastError(GLCCPreprocessor* _preproc)
         return NULL;
     }
 
-    return _preproc->mErrorString;
+    return _preproc->mErrorString.empty() ? NULL : _preproc->mErrorString.data();
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint resetPreprocessor(GLCCPreprocessor* _preproc)
+{
+    if (!_preproc) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    // Abandon any stream in progress.
+    delete _preproc->mStream;
+    _preproc->mStream = NULL;
+    _preproc->mStreamOutputFn = NULL;
+    _preproc->mStreamUserData = NULL;
+    _preproc->mStreamText.clear();
+    _preproc->mStreamTextSearched = 0;
+    _preproc->mStreamMidLine = false;
+
+    _preproc->mInputFile.Close();
+    _preproc->mInput = NULL;
+    _preproc->mInputLength = 0;
+    _preproc->mOutputLength = 0;
+    _preproc->mOutput.clear();
+    _preproc->mErrorString.clear();
+    _preproc->mVersionGLSL = 110;
+    _preproc->mUsedLineContinuations = false;
+    _preproc->mVariantTokensFrom = NULL;
+    _preproc->mScanned = false;
+
+    // Identifiers otherwise pile up in the interner for the life of the preprocessor. The phase
+    // four left over refers to them, but it is reset before it runs again.
+    _preproc->mInterner.Clear();
+    SeedPPInterner(&_preproc->mInterner);
+    if (_preproc->mPhaseFour) {
+        _preproc->mPhaseFour->ClearConditionCache();
+    }
+
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint scanFromFile(GLCCPreprocessor* _preproc, const char* _filename, GLPPScanResult* _outResult)
+{
+    if (!_preproc || !_filename || !_outResult) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    _preprocessStartRun(_preproc, _filename);
+
+    GLCCint errCode = _preprocessReadFile(_preproc, _filename);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+
+    return _scan(_preproc, _outResult);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint scanFromMemory(GLCCPreprocessor* _preproc, const char* _memBuffer, const char* _optFilename,
+                       GLPPScanResult* _outResult)
+{
+    if (!_preproc || !_memBuffer || !_outResult) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    _preprocessStartRun(_preproc, (_optFilename != NULL) ? _optFilename : "MemoryBuffer");
+    _preproc->mInput = _memBuffer;
+    _preproc->mInputLength = strlen(_memBuffer);
+
+    return _scan(_preproc, _outResult);
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* getDepfile(GLCCPreprocessor* _preproc, const char* _target, size_t* _optLength)
+{
+    if (!_preproc || !_target || !_preproc->mScanned || strcmp(_target, _preproc->mFilename.data()) == 0) {
+        return NULL;
+    }
+
+    // "target: input include...", with each include on a line of its own.
+    std::vector<char>& depfile = _preproc->mDepfile;
+    depfile.clear();
+    _appendDepfilePath(&depfile, _target);
+    depfile.push_back(':');
+    depfile.push_back(' ');
+    _appendDepfilePath(&depfile, _preproc->mFilename.data());
+    for (size_t i = 0; i < _preproc->mScanIncludes.size(); ++i) {
+        static const char kContinue[] = " \\\n  ";
+        depfile.insert(depfile.end(), kContinue, kContinue + sizeof(kContinue) - 1);
+        _appendDepfilePath(&depfile, _preproc->mScanIncludes[i]);
+    }
+    depfile.push_back('\n');
+    depfile.push_back('\0');
+
+    if (_optLength) {
+        (*_optLength) = depfile.size() - 1;
+    }
+    return depfile.data();
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -157,195 +393,655 @@ GLCCint _preprocess(GLCCPreprocessor* _preproc)
     // In the C preprocessor, phase 1 is reading into memory. If we're here, we've already 
     // done that.
 
-    if ((errCode = _preprocessPhaseTwo(_preproc)) != GLCCError_Ok)
+    // Seen before? Then the output is already on disk, and none of the phases need to run.
+    Hash128 cacheKey = { 0, 0 };
+    if (_preproc->mDiskCache) {
+        cacheKey = DiskCache::ComputeKey(_preproc->mOptions.mMaintainLineCount, _preproc->mIncludePaths,
+                                         _preproc->mPredefines.get(), _preproc->mFilename.data(),
+                                         _preproc->mInput, _preproc->mInputLength);
+        if (_preproc->mDiskCache->Lookup(cacheKey, &_preproc->mOutput, &_preproc->mVersionGLSL)) {
+            _preproc->mInputFile.Close();
+            _preproc->mInput = NULL;
+            _preproc->mInputLength = 0;
+            return GLCCError_Ok;
+        }
+    }
+
+    // Phases two (line continuation) and three (comments) are done together, in one pass.
+    if ((errCode = _preprocessPhasesTwoAndThree(_preproc)) != GLCCError_Ok)
         return errCode;
 
-    if ((errCode = _preprocessPhaseThree(_preproc)) != GLCCError_Ok)
+    if ((errCode = _preprocessPhaseFour(_preproc)) != GLCCError_Ok)
         return errCode;
 
-    return _preprocessPhaseFour(_preproc);
+    // Only successes are cached. Failures are rare, and should be reported properly every time.
+    if (_preproc->mDiskCache) {
+        _preproc->mDiskCache->Store(cacheKey, _preproc->mPhaseFour->GetIncludedFiles(),
+                                    _preproc->mOutput.data(), _preproc->mOutput.size() - 1,
+                                    _preproc->mVersionGLSL);
+    }
+    return GLCCError_Ok;
 }
 
 // ------------------------------------------------------------------------------------------------
-GLCCint _preprocessPhaseTwo(GLCCPreprocessor* _preproc)
+GLCCint _preprocessReadFile(GLCCPreprocessor* _preproc, const char* _filename)
 {
-    // Phase Two is line continuation. We do this in-place in _preproc->mInputBuffer. 
+    // Phase one is just mapping the file. Nothing ever writes to the input, so a read-only
+    // mapping is all that's needed and the contents are never copied. Anything that can't be
+    // mapped (pipes and the like) is read into memory instead.
+    if (_preproc->mInputFile.Open(_filename)) {
+        _preproc->mInput = _preproc->mInputFile.GetData();
+        _preproc->mInputLength = _preproc->mInputFile.GetSize();
+    } else {
+        if (!fileContentsToBuffer(_filename, &_preproc->mInputBuffer, &_preproc->mInputLength)) {
+            return ReportError(GLCCError_FileNotFound, _preproc, "Could not read \"%s\".\n", _filename);
+        }
+        _preproc->mInput = _preproc->mInputBuffer.data();
+    }
 
-    // ANNOY: Line continuation isn't supported in all versions of GLSL--added in GLSL420. 
-    //     We could detect the #version here and error out if line continuations are used and
-    //     the version is less than 420. Instead, we just record whether line continuation 
-    //     occurred and a later phase will croak. That simplifies the processing here.
-    // 
-    // TODO: We should support a non-conformant behavior (which should probably be the default)
-    //     that if you use line continuation, we insert an equivalent number of \ns after the next 
-    //     non-escaped EOL character. This would keep line numbers in sync for error purposes.
+    return GLCCError_Ok;
+}
 
-    size_t srcFp = 0;
-    size_t dstFp = 0;
-    size_t lineNum = 1;
-    size_t charNum = 1;
-    int contiguousLinesContinued = 0;
-    bool anyContinuations = false;
+// ------------------------------------------------------------------------------------------------
+GLCCint _preprocessPhasesTwoAndThree(GLCCPreprocessor* _preproc)
+{
+    // Both phases are done in a single pass, from the (possibly mapped, so read-only) input into
+    // mOutputBuffer. See earlyphases.h for the details. The output is never longer than the input,
+    // and gets the same double-NULL fileContentsToString would have given it. Line numbers are
+    // kept with a line map rather than padding; phase four puts the lines back.
+    bufferResize(&_preproc->mOutputBuffer, _preproc->mInputLength + 2);
+    _preproc->mLineMap.Clear();
+    _preproc->mOutputLength = PreprocessEarlyPhases(_preproc->mInput, _preproc->mInputLength,
+                                                    _preproc->mOutputBuffer.data(),
+                                                    _preproc->mOptions.mMaintainLineCount,
+                                                    &_preproc->mUsedLineContinuations,
+                                                    _preproc->mOptions.mMaintainLineCount ? &_preproc->mLineMap : NULL);
+    _preproc->mOutputBuffer[_preproc->mOutputLength + 1] = '\0';
 
-    bool advanceDst = false;
-    for (srcFp = 0; _preproc->mInputBuffer[srcFp]; ++srcFp) {
-        char thisChar = _preproc->mInputBuffer[srcFp + 0]; 
-        char nextChar = _preproc->mInputBuffer[srcFp + 1];
-        int advanceSrc = 0;
+    // Everything after this works from the output, so the input can go. (mInputBuffer's memory
+    // stays, for the next input that needs it.)
+    _preproc->mInputFile.Close();
+    _preproc->mInput = NULL;
+    _preproc->mInputLength = 0;
 
-        if (thisChar == '\\' && nextChar == '\n') {
-            ++contiguousLinesContinued;
-            anyContinuations = true;
-            advanceDst = false;
-            advanceSrc = 1;
-        } else {
-            if (_preproc->mOptions.mMaintainLineCount && thisChar == '\n') {
-                while (contiguousLinesContinued-- > 0) {
-                    // Combined with the '\n' we're going to pick up from this line, this will
-                    // wind up with <SPACE><EOL> on each line.
-                    _preproc->mInputBuffer[dstFp++] = '\n';
-                    _preproc->mInputBuffer[dstFp++] = ' ';
-                }
-            }
-            advanceDst = true;
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint _preprocessPhaseFour(GLCCPreprocessor* _preproc)
+{
+    // Phase four is what people think of when they think of the preprocessor. This does 
+    // processing on preprocessor directives, macro substitution, etc. Phase three's output is
+    // split into tokens, with every spelling interned, and PhaseFour does the rest on those. See
+    // phasefour.h. It does the splitting itself, so that blocks left out by conditionals are
+    // never tokenized at all.
+
+    // ANNOY: The preprocessor has to be both a line parser and a line-independent parser. This
+    //     is the result of a particular intersection of rules. Preprocessor directives that
+    //     begin with # are processed in a line manner--they take over the complete line they
+    //     appear on. However, macro substitution has a particular corner case that's a bit 
+    //     dumb. If you have a function-like macro, it doesn't perform macro substitution unless
+    //     the call-site looks like a function call. But that site could be split over multiple
+    //     lines, meaning that we have to actually do light parsing on that portion of the file.
+    //     For this reason, the tokens keep their EOLs, and PhaseFour decides when it does and 
+    //     does not care about them.
+    _preproc->mOutput.clear();
+    GLCCint errCode = _preprocessStartPhaseFour(_preproc);
+    if (errCode != GLCCError_Ok) {
+        return errCode;
+    }
+    _preproc->mPhaseFour->SetLineMap(_preproc->mOptions.mMaintainLineCount ? &_preproc->mLineMap : NULL);
+
+    // I deferred complaining about the #version directive--in case the author used line 
+    // coninuations here, too. PhaseFour checks once it has seen the whole file.
+    _preproc->mPhaseFour->SetUsedLineContinuations(_preproc->mUsedLineContinuations);
+
+    errCode = _preproc->mPhaseFour->ProcessText(_preproc->mOutputBuffer.data(), _preproc->mOutputLength,
+                                                true, &_preproc->mOutput);
+    _preproc->mOutputLength = 0;
+    _preproc->mVersionGLSL = _preproc->mPhaseFour->GetVersion();
+    if (errCode != GLCCError_Ok) {
+        _preproc->mOutput.clear();
+        return ReportError(errCode, _preproc, "%s", _preproc->mPhaseFour->GetErrorString());
+    }
+
+    _preproc->mOutput.push_back('\0');
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+void _preprocessPhaseFourStreamed(const char* _text, size_t _length, void* _userData)
+{
+    // Phase three's output while streaming, a piece at a time. Phase four works on whole lines,
+    // so anything after the last newline waits for the next piece. Errors are sticky in 
+    // PhaseFour, and reported by preprocessEnd.
+    GLCCPreprocessor* preproc = (GLCCPreprocessor*) _userData;
+    std::vector<char>& pending = preproc->mStreamText;
+
+    const char* lastNewLine = NULL;
+    for (const char* c = _text + _length; c != _text; --c) {
+        if (c[-1] == '\n') {
+            lastNewLine = c - 1;
+            break;
         }
+    }
 
-        // PERFORMANCE: Profile whether an extra branch here matters. We do this a lot. It could
-        // be that the branch here costs more than it saves and it could be factored out.
-        if (dstFp != srcFp && advanceDst) {
-            _preproc->mInputBuffer[dstFp] = thisChar;
+    if (lastNewLine == NULL) {
+        pending.insert(pending.end(), _text, _text + _length);
+    } else {
+        // Complete lines go straight from phase three's buffer when nothing is waiting in front
+        // of them.
+        const char* lineEnd = lastNewLine + 1;
+        if (pending.empty()) {
+            _preprocessPhaseFourStreamProcess(preproc, _text, size_t(lineEnd - _text), false);
+        } else {
+            pending.insert(pending.end(), _text, lineEnd);
+            _preprocessPhaseFourStreamProcess(preproc, pending.data(), pending.size(), false);
+            pending.clear();
         }
+        pending.insert(pending.end(), lineEnd, _text + _length);
+        preproc->mStreamTextSearched = 0;
+        preproc->mStreamMidLine = false;
+    }
+
+    if (pending.size() >= kMaxStreamLine) {
+        _preprocessPhaseFourStreamLongLine(preproc);
+    }
+}
 
-        if (thisChar == '\n') {
-            ++lineNum;
-            charNum = 1;
+// ------------------------------------------------------------------------------------------------
+void _preprocessPhaseFourStreamLongLine(GLCCPreprocessor* _preproc)
+{
+    // A line too long to wait for the end of (a minified shader can be all one line) goes on to
+    // phase four up to its last complete token, and only the rest is kept. Directives have to be
+    // whole, so their lines are kept however long they get.
+    std::vector<char>& pending = _preproc->mStreamText;
+    const char* begin = pending.data();
+    const char* end = begin + pending.size();
+    if (!_preproc->mStreamMidLine) {
+        const char* c = begin;
+        while (c != end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\v' || *c == '\f')) {
+            ++c;
+        }
+        if (c == end || *c == '#') {
+            return;
         }
+    }
+
+    // What was looked at before had nowhere to cut, or it would have been cut then.
+    const char* searchFrom = begin + _preproc->mStreamTextSearched;
+    const char* cut = PPFindTokenBoundary(searchFrom, end);
+    _preproc->mStreamTextSearched = pending.size();
+    if (cut == searchFrom) {
+        return;
+    }
+
+    _preprocessPhaseFourStreamProcess(_preproc, begin, size_t(cut - begin), false);
+    pending.erase(pending.begin(), pending.begin() + (cut - begin));
+    _preproc->mStreamTextSearched = pending.size();
+    _preproc->mStreamMidLine = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint _preprocessPhaseFourStreamEnd(GLCCPreprocessor* _preproc)
+{
+    // Whatever is left is the last line, without its newline.
+    std::vector<char>& pending = _preproc->mStreamText;
+    _preproc->mPhaseFour->SetUsedLineContinuations(_preproc->mUsedLineContinuations);
+    GLCCint errCode = _preprocessPhaseFourStreamProcess(_preproc, pending.data(), pending.size(), true);
+    pending.clear();
+    _preproc->mVersionGLSL = _preproc->mPhaseFour->GetVersion();
+
+    // The PhaseFour stays, to be Reset by the next run rather than built again.
+    return errCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint _preprocessPhaseFourStreamProcess(GLCCPreprocessor* _preproc, const char* _text, size_t _length, bool _final)
+{
+    // Runs phase four over _text, and passes on whatever output that gives.
+    GLCCint errCode = _preproc->mPhaseFour->ProcessText(_text, _length, _final, &_preproc->mOutput);
+    if (errCode != GLCCError_Ok) {
+        _preproc->mOutput.clear();
+        return ReportError(errCode, _preproc, "%s", _preproc->mPhaseFour->GetErrorString());
+    }
+
+    if (!_preproc->mOutput.empty()) {
+        _preproc->mStreamOutputFn(_preproc->mOutput.data(), _preproc->mOutput.size(), _preproc->mStreamUserData);
+        _preproc->mOutput.clear();
+    }
+    return GLCCError_Ok;
+}
 
-        // Move the srcFp forward (skipping characters) as necessary.
-        srcFp += advanceSrc;
+// ------------------------------------------------------------------------------------------------
+GLCCint _preprocessStartPhaseFour(GLCCPreprocessor* _preproc)
+{
+    // The same PhaseFour is reused, so its macro table and the rest keep their memory.
+    if (_preproc->mPhaseFour) {
+        _preproc->mPhaseFour->Reset(_preproc->mFilename.data());
+    } else {
+        _preproc->mPhaseFour = new PhaseFour(_preproc->mFilename.data(), &_preproc->mInterner);
+    }
+    _preproc->mPhaseFour->SetIncludeOptions(&_preproc->mIncludePaths, _preproc->mOptions.mMaintainLineCount);
 
-        if (advanceDst) {
-            ++dstFp;
+    if (_preproc->mPredefines) {
+        GLCCint errCode = _preproc->mPhaseFour->Predefine(*_preproc->mPredefines);
+        if (errCode != GLCCError_Ok) {
+            return ReportError(errCode, _preproc, "%s", _preproc->mPhaseFour->GetErrorString());
         }
     }
 
-    // Write out the new '\0', then record whether we did any line continuations.
-    _preproc->mInputBuffer[dstFp] = '\0';
-    _preproc->mUsedLineContinuations = anyContinuations;
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint _scan(GLCCPreprocessor* _preproc, GLPPScanResult* _outResult)
+{
+    // Phases two and three as for preprocessing, but always padding continued lines: the scanner
+    // has no line map to put its errors' line numbers right.
+    bufferResize(&_preproc->mOutputBuffer, _preproc->mInputLength + 1);
+    size_t textLength = PreprocessEarlyPhases(_preproc->mInput, _preproc->mInputLength,
+                                              _preproc->mOutputBuffer.data(), true,
+                                              &_preproc->mUsedLineContinuations, NULL);
+    _preproc->mInputFile.Close();
+    _preproc->mInput = NULL;
+    _preproc->mInputLength = 0;
+
+    if (!_preproc->mScanner) {
+        _preproc->mScanner = new DependencyScanner;
+    }
+    DependencyScanner* scanner = _preproc->mScanner;
+
+    GLCCint errCode = scanner->Scan(_preproc->mFilename.data(), _preproc->mOutputBuffer.data(), textLength,
+                                    &_preproc->mIncludePaths);
+    if (errCode != GLCCError_Ok) {
+        return ReportError(errCode, _preproc, "%s", scanner->GetErrorString());
+    }
+
+    _preproc->mScanIncludes.clear();
+    for (size_t i = 0; i < scanner->GetIncludes().size(); ++i) {
+        _preproc->mScanIncludes.push_back(scanner->GetIncludes()[i].c_str());
+    }
+    _preproc->mScanExtensions.clear();
+    for (size_t i = 0; i < scanner->GetExtensions().size(); ++i) {
+        _preproc->mScanExtensions.push_back(scanner->GetExtensions()[i].c_str());
+    }
+    _preproc->mScanned = true;
 
+    _outResult->mVersion = scanner->GetVersion();
+    _outResult->mIncludes = _preproc->mScanIncludes.empty() ? NULL : _preproc->mScanIncludes.data();
+    _outResult->mIncludeCount = _preproc->mScanIncludes.size();
+    _outResult->mExtensions = _preproc->mScanExtensions.empty() ? NULL : _preproc->mScanExtensions.data();
+    _outResult->mExtensionCount = _preproc->mScanExtensions.size();
     return GLCCError_Ok;
 }
 
 // ------------------------------------------------------------------------------------------------
-GLCCint _preprocessPhaseThree(GLCCPreprocessor* _preproc)
+void _appendDepfilePath(std::vector<char>* _depfile, const char* _path)
+{
+    // Make splits prerequisites at spaces, starts a comment at '#' and expands '$'. Ninja reads
+    // the same escapes.
+    for (const char* c = _path; *c; ++c) {
+        if (*c == ' ' || *c == '#') {
+            _depfile->push_back('\\');
+        } else if (*c == '$') {
+            _depfile->push_back('$');
+        }
+        _depfile->push_back(*c);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void _preprocessStartRun(GLCCPreprocessor* _preproc, const char* _filename)
+{
+    // Whatever the last run left behind is dropped, but the memory it used is not.
+    bufferAssignString(&_preproc->mFilename, _filename);
+    _preproc->mOutput.clear();
+    _preproc->mErrorString.clear();
+    _preproc->mScanned = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+std::shared_ptr<const IncludedFile> _makePredefinedMacros(const char* const* _defines, size_t _defineCount)
+{
+    // The defines become the #define lines they stand for, tokenized once here. Every run (and
+    // every preprocessor in a batch) shares the result.
+    if (_defineCount == 0) {
+        return std::shared_ptr<const IncludedFile>();
+    }
+
+    std::string text;
+    for (size_t i = 0; i < _defineCount; ++i) {
+        const char* define = _defines[i];
+        const char* equals = strchr(define, '=');
+
+        text += "#define ";
+        if (equals) {
+            text.append(define, equals);
+            text += ' ';
+            text += (equals + 1);
+        } else {
+            text += define;
+            text += " 1";
+        }
+        text += '\n';
+    }
+
+    return MakeIncludedFile("<predefined>", text.data(), text.size());
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+struct GLPPBatch
 {
-    // Phase three is comment processing. At this point, line continuations are gone, so any EOLs
-    // that remain are "real", and will have effects on non-comment characters.
-    // According to the C Preprocessor documentation:
-    //     - Comments are replaced by one space
-    //     - EOLs are preserved in both single and multi-line comments.
-    // As with line continuations, we do this in-place in _preproc->mInputBuffer.
+    // What each input's preprocessor gets, in a form that lasts as long as the batch.
+    std::vector<std::string> mIncludePaths;
+    std::vector<const char*> mIncludePathPtrs;
+    GLPPOptions mOptions;
+    std::shared_ptr<const IncludedFile> mPredefines;
 
-    enum ECommentMode {
-        ECM_NoComment = 0,
-        ECM_SingleLine,
-        ECM_MultiLine
+    ThreadPool mPool;
+    std::vector<GLCCPreprocessor*> mWorkers;     // One per pool worker, reused for every input.
+
+    // The inputs and results of the preprocessBatch call in progress (or the last one).
+    struct Result
+    {
+        GLCCint mErrorCode;
+        std::vector<char> mOutput;
+        std::string mError;
+        Hash128 mOutputHash;            // Variants only.
     };
 
-    ECommentMode commentMode = ECM_NoComment;
-    size_t srcFp = 0;
-    size_t dstFp = 0;
-
-    for (srcFp = 0; _preproc->mInputBuffer[srcFp]; ++srcFp) {
-        char thisChar = _preproc->mInputBuffer[srcFp + 0]; 
-        char nextChar = _preproc->mInputBuffer[srcFp + 1];
-
-        switch(commentMode) {
-            case ECM_NoComment: 
-            {
-                if (thisChar == '/') {
-                    if (nextChar == '/') {
-                        // Entering a single line comment. Write a space.
-                        _preproc->mInputBuffer[dstFp++] = ' ';
-                        commentMode = ECM_SingleLine;
-                        // Move the source location. This is for consistency--but not needed for single line
-                        // comments. It *is* required for multi-line comments.
-                        ++srcFp;
-                        break;
-                    } else if (nextChar == '*') {
-                        // Entering multi-line comment. Write a space.
-                        _preproc->mInputBuffer[dstFp++] = ' ';
-                        commentMode = ECM_MultiLine;
-                        // We must move the src pointer here--otherwise we would recognize /*/ 
-                        // as a begin and end of a comment string.
-                        ++srcFp;
-                        break;
-                    } 
-                }
-
-                _preproc->mInputBuffer[dstFp++] = thisChar;
-                break;
-            }
+    const GLPPBatchInput* mInputs;
+    std::vector<Result> mResults;
 
-            case ECM_SingleLine:
-            {
-                if (thisChar == '\n') {
-                    commentMode = ECM_NoComment;
-                    _preproc->mInputBuffer[dstFp++] = thisChar;
-                }
-                break;
-            }
+    // The preprocessVariants call in progress: its input after phases two and three, tokenized
+    // once for every variant.
+    const GLPPDefineSet* mDefineSets;
+    std::shared_ptr<const IncludedFile> mVariantSource;
+    LineMap mVariantLineMap;
+    bool mVariantUsedLineContinuations;
 
-            case ECM_MultiLine:
-            {
-                if (thisChar == '\n') {
-                    // Write out the newline, they are preserved.
-                    _preproc->mInputBuffer[dstFp++] = thisChar;                    
-                }
+    // --------------------------------------------------------------------------------------------
+    GLPPBatch(const GLPPOptions& _options, size_t _threadCount)
+    : mOptions(_options)
+    , mPredefines(_makePredefinedMacros(_options.mDefines, _options.mDefineCount))
+    , mPool(_threadCount)
+    , mInputs(NULL)
+    , mDefineSets(NULL)
+    , mVariantUsedLineContinuations(false)
+    {
+        for (size_t i = 0; i < _options.mIncludePathCount; ++i) {
+            mIncludePaths.push_back(_options.mIncludePaths[i]);
+        }
+        for (size_t i = 0; i < mIncludePaths.size(); ++i) {
+            mIncludePathPtrs.push_back(mIncludePaths[i].c_str());
+        }
 
-                if (thisChar == '*' && nextChar == '/') {
-                    commentMode = ECM_NoComment;
-                    // Advance the src pointer, otherwise we'd recognize */* as a finish->start comment.
-                    ++srcFp;
-                }
+        mOptions.mIncludePaths = mIncludePathPtrs.empty() ? NULL : mIncludePathPtrs.data();
+        mOptions.mIncludePathCount = mIncludePathPtrs.size();
 
-                break;
-            }
+        // Already taken care of by mPredefines.
+        mOptions.mDefines = NULL;
+        mOptions.mDefineCount = 0;
 
-            default:
-                assert(!"Error in parser.");
-                break;
-        };
+        for (size_t i = 0; i < mPool.GetWorkerCount(); ++i) {
+            mWorkers.push_back(new GLCCPreprocessor(mOptions, mPredefines));
+        }
+    }
+
+    // --------------------------------------------------------------------------------------------
+    ~GLPPBatch()
+    {
+        for (size_t i = 0; i < mWorkers.size(); ++i) {
+            delete mWorkers[i];
+        }
     }
+};
 
-    _preproc->mInputBuffer[dstFp] = '\0';
+// ------------------------------------------------------------------------------------------------
+GLCCint genBatch(GLPPBatch** _newBatch, const GLPPOptions* _optOptions, size_t _optThreadCount)
+{
+    if (!_newBatch) {
+        return GLCCError_MissingRequiredParameter;
+    }
 
+    GLPPOptions myOpts;
+    if (_optOptions) {
+        myOpts = (*_optOptions);
+    }
 
+    (*_newBatch) = new GLPPBatch(myOpts, _optThreadCount);
     return GLCCError_Ok;
 }
 
 // ------------------------------------------------------------------------------------------------
-GLCCint _preprocessPhaseFour(GLCCPreprocessor* _preproc)
+GLCCint deleteBatch(GLPPBatch** _batch)
 {
-    // Phase four is what people think of when they think of the preprocessor. This does 
-    // processing on preprocessor directives, macro substitution, etc.
-    // Because of the complexity of this phase, we use a real parser here rather than a hand-
-    // rolled parser like the ones used for phase two and phase three.
+    if (!_batch) {
+        return GLCCError_MissingRequiredParameter;
+    }
 
-    // I deferred complaining about the #version directive--in case the author used line 
-    // coninuations here, too.
+    if (*_batch) {
+        delete (*_batch);
+        (*_batch) = NULL;
+    }
 
-    // ANNOY: The preprocessor has to be both a line parser and a line-independent parser. This
-    //     is the result of a particular intersection of rules. Preprocessor directives that
-    //     begin with # are processed in a line manner--they take over the complete line they
-    //     appear on. However, macro substitution has a particular corner case that's a bit 
-    //     dumb. If you have a function-like macro, it doesn't perform macro substitution unless
-    //     the call-site looks like a function call. But that site could be split over multiple
-    //     lines, meaning that we have to actually do light parsing on that portion of the file.
-    //     For this reason, you'll find that the lexxer/parser for this have rules to basically
-    //     determine when they do and do not care about EOLs. 
+    return GLCCError_Ok;
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint preprocessBatch(GLPPBatch* _batch, const GLPPBatchInput* _inputs, size_t _inputCount,
+                        GLPPBatchResult* _outResults)
+{
+    if (!_batch || (_inputCount > 0 && (!_inputs || !_outResults))) {
+        return GLCCError_MissingRequiredParameter;
+    }
+
+    // The results aren't cleared, their buffers are swapped with the workers' as they go and so
+    // get reused too. The workers start each batch with nothing interned.
+    _batch->mInputs = _inputs;
+    _batch->mResults.resize(_inputCount);
+    for (size_t i = 0; i < _batch->mWorkers.size(); ++i) {
+        resetPreprocessor(_batch->mWorkers[i]);
+    }
+
+    _batch->mPool.Run(_inputCount, _preprocessBatchJob, _batch);
+
+    // Results go back in input order, whatever order they finished in.
+    GLCCint errCode = GLCCError_Ok;
+    for (size_t i = 0; i < _inputCount; ++i) {
+        const GLPPBatch::Result& result = _batch->mResults[i];
+        GLPPBatchResult& outResult = _outResults[i];
 
-    printf("%s", _preproc->mInputBuffer);
+        outResult.mErrorCode = result.mErrorCode;
+        if (result.mErrorCode == GLCCError_Ok) {
+            outResult.mOutput = result.mOutput.data();
+            outResult.mOutputLength = result.mOutput.size() - 1;
+            outResult.mError = NULL;
+        } else {
+            outResult.mOutput = NULL;
+            outResult.mOutputLength = 0;
+            outResult.mError = result.mError.c_str();
+
+            if (errCode == GLCCError_Ok) {
+                errCode = result.mErrorCode;
+            }
+        }
+    }
+
+    _batch->mInputs = NULL;
+    return errCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+void _preprocessBatchJob(size_t _job, size_t _worker, void* _userData)
+{
+    GLPPBatch* batch = (GLPPBatch*) _userData;
+    const GLPPBatchInput& input = batch->mInputs[_job];
+    GLPPBatch::Result& result = batch->mResults[_job];
+
+    // Each worker has a preprocessor of its own, only the immutable parts are shared.
+    GLCCPreprocessor* preproc = batch->mWorkers[_worker];
+    if (input.mMemBuffer) {
+        result.mErrorCode = preprocessFromMemory(preproc, input.mMemBuffer, input.mFilename);
+    } else if (input.mFilename) {
+        result.mErrorCode = preprocessFromFile(preproc, input.mFilename);
+    } else {
+        result.mErrorCode = ReportError(GLCCError_MissingRequiredParameter, preproc, 
+                                        "Batch input %u has no file name or buffer.\n", unsigned(_job));
+    }
+
+    result.mError.clear();
+    if (result.mErrorCode == GLCCError_Ok) {
+        result.mOutput.swap(preproc->mOutput);
+    } else if (!preproc->mErrorString.empty()) {
+        result.mError = preproc->mErrorString.data();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+GLCCint preprocessVariants(GLPPBatch* _batch, const GLPPBatchInput* _input,
+                           const GLPPDefineSet* _defineSets, size_t _variantCount,
+                           GLPPVariantResult* _outResults)
+{
+    if (!_batch || !_input || (_variantCount > 0 && (!_defineSets || !_outResults))) {
+        return GLCCError_MissingRequiredParameter;
+    }
 
-    return ReportError(GLCCError_NotImplemented, _preproc, "Phase %d has not yet been implemented.\n", 4);
+    for (size_t i = 0; i < _batch->mWorkers.size(); ++i) {
+        resetPreprocessor(_batch->mWorkers[i]);
+    }
+
+    // Phases two and three run once, on the first worker while the pool isn't using it. Their
+    // output is tokenized once too, into a file of its own that every variant can share.
+    GLCCPreprocessor* first = _batch->mWorkers[0];
+    const char* filename = _input->mFilename ? _input->mFilename : "MemoryBuffer";
+    _preprocessStartRun(first, filename);
+
+    GLCCint errCode = GLCCError_Ok;
+    if (_input->mMemBuffer) {
+        first->mInput = _input->mMemBuffer;
+        first->mInputLength = strlen(_input->mMemBuffer);
+    } else if (_input->mFilename) {
+        errCode = _preprocessReadFile(first, filename);
+    } else {
+        errCode = ReportError(GLCCError_MissingRequiredParameter, first, "Variant input has no file name or buffer.\n");
+    }
+
+    if (errCode == GLCCError_Ok) {
+        errCode = _preprocessPhasesTwoAndThree(first);
+    }
+
+    if (errCode != GLCCError_Ok) {
+        // Every variant fails the same way.
+        for (size_t i = 0; i < _variantCount; ++i) {
+            GLPPVariantResult& outResult = _outResults[i];
+            outResult.mErrorCode = errCode;
+            outResult.mOutput = NULL;
+            outResult.mOutputLength = 0;
+            outResult.mError = getLastError(first);
+            outResult.mSameAs = i;
+        }
+        return errCode;
+    }
+
+    _batch->mVariantSource = MakeIncludedFile(filename, first->mOutputBuffer.data(), first->mOutputLength);
+    _batch->mVariantLineMap = first->mLineMap;
+    _batch->mVariantUsedLineContinuations = first->mUsedLineContinuations;
+    first->mOutputLength = 0;
+
+    _batch->mDefineSets = _defineSets;
+    _batch->mResults.resize(_variantCount);
+    _batch->mPool.Run(_variantCount, _preprocessVariantJob, _batch);
+
+    // Results go back in order. Identical outputs are found by their hashes, and confirmed byte
+    // for byte; every one after the first points at the first's.
+    std::map<std::pair<uint64_t, uint64_t>, size_t> firstWithHash;
+    for (size_t i = 0; i < _variantCount; ++i) {
+        const GLPPBatch::Result& result = _batch->mResults[i];
+        GLPPVariantResult& outResult = _outResults[i];
+
+        outResult.mErrorCode = result.mErrorCode;
+        outResult.mSameAs = i;
+        if (result.mErrorCode != GLCCError_Ok) {
+            outResult.mOutput = NULL;
+            outResult.mOutputLength = 0;
+            outResult.mError = result.mError.c_str();
+
+            if (errCode == GLCCError_Ok) {
+                errCode = result.mErrorCode;
+            }
+            continue;
+        }
+
+        outResult.mOutput = result.mOutput.data();
+        outResult.mOutputLength = result.mOutput.size() - 1;
+        outResult.mError = NULL;
+
+        std::pair<uint64_t, uint64_t> hash(result.mOutputHash.mLow, result.mOutputHash.mHigh);
+        std::map<std::pair<uint64_t, uint64_t>, size_t>::iterator it = firstWithHash.find(hash);
+        if (it == firstWithHash.end()) {
+            firstWithHash[hash] = i;
+        } else if (_batch->mResults[it->second].mOutput == result.mOutput) {
+            outResult.mOutput = _outResults[it->second].mOutput;
+            outResult.mSameAs = it->second;
+        }
+    }
+
+    _batch->mDefineSets = NULL;
+    return errCode;
+}
+
+// ------------------------------------------------------------------------------------------------
+void _preprocessVariantJob(size_t _job, size_t _worker, void* _userData)
+{
+    GLPPBatch* batch = (GLPPBatch*) _userData;
+    const GLPPDefineSet& defineSet = batch->mDefineSets[_job];
+    const IncludedFile& source = *batch->mVariantSource;
+    GLPPBatch::Result& result = batch->mResults[_job];
+
+    // Only phase four runs here: the batch's predefined macros, then the variant's, then the
+    // shared tokens.
+    GLCCPreprocessor* preproc = batch->mWorkers[_worker];
+    _preprocessStartRun(preproc, source.mPath.c_str());
+    GLCCint errCode = _preprocessStartPhaseFour(preproc);
+    PhaseFour* phaseFour = preproc->mPhaseFour;
+
+    if (errCode == GLCCError_Ok && defineSet.mDefineCount > 0) {
+        std::shared_ptr<const IncludedFile> defines = _makePredefinedMacros(defineSet.mDefines, defineSet.mDefineCount);
+        errCode = phaseFour->Predefine(*defines);
+        if (errCode != GLCCError_Ok) {
+            errCode = ReportError(errCode, preproc, "%s", phaseFour->GetErrorString());
+        }
+    }
+
+    if (errCode == GLCCError_Ok) {
+        // The first variant a worker runs brings the tokens over to its ids; the rest reuse them.
+        if (preproc->mVariantTokensFrom != &source) {
+            phaseFour->ImportTokens(source, &preproc->mVariantTokens);
+            preproc->mVariantTokensFrom = &source;
+        }
+
+        phaseFour->SetLineMap(batch->mOptions.mMaintainLineCount ? &batch->mVariantLineMap : NULL);
+        phaseFour->SetUsedLineContinuations(batch->mVariantUsedLineContinuations);
+        errCode = phaseFour->Process(preproc->mVariantTokens.data(), preproc->mVariantTokens.size(),
+                                     true, &preproc->mOutput);
+        if (errCode != GLCCError_Ok) {
+            preproc->mOutput.clear();
+            errCode = ReportError(errCode, preproc, "%s", phaseFour->GetErrorString());
+        } else {
+            preproc->mOutput.push_back('\0');
+        }
+    }
+
+    result.mErrorCode = errCode;
+    result.mError.clear();
+    if (errCode == GLCCError_Ok) {
+        result.mOutput.swap(preproc->mOutput);
+        result.mOutputHash = HashBytes128(result.mOutput.data(), result.mOutput.size());
+    } else if (!preproc->mErrorString.empty()) {
+        result.mError = preproc->mErrorString.data();
+    }
 }
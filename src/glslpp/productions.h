@@ -1,16 +1,20 @@
 #pragma once
 
+#include "node.h"
+
+// Productions give the node they parsed as a NodeRef into the unit's SyntaxTree (see node.h), not
+// a Node*: a pointer would be left dangling by the next node made.
 #define DeclareProduction(_name) \
-    class _name : public ProductionBase { public: virtual Node* operator(); }
+    class _name : public ProductionBase { public: virtual NodeRef operator(); }
 
 #define DefineProduction(_name) \
-    Node* _name::operator()
+    NodeRef _name::operator()
 
 // ------------------------------------------------------------------------------------------------
 class ProductionBase
 {
 public:
-    virtual Node* operator() = 0;
+    virtual NodeRef operator() = 0;
 };
 
 DeclareProduction(variable_identifier);
@@ -27,6 +31,8 @@ DeclareProduction(function_call_header);
 DeclareProduction(function_identifier);
 DeclareProduction(unary_expression);
 DeclareProduction(unary_operator);
+// The cascade from multiplicative_expression up to expression is parsed in one loop by
+// ExpressionParser (see exprparser.h), not a production per level.
 DeclareProduction(multiplicative_expression);
 DeclareProduction(additive_expression);
 DeclareProduction(shift_expression);
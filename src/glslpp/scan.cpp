@@ -0,0 +1,377 @@
+#include "glslppafx.h"
+
+#include "scan.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define GLSLPP_SCAN_X86 1
+#   include <emmintrin.h>
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#       define GLSLPP_TARGET_AVX2
+#   else
+#       define GLSLPP_TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#else
+#   define GLSLPP_SCAN_X86 0
+#endif
+
+namespace {
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Scalar versions. These also finish off the tails of the vector versions.
+struct ClassTables
+{
+    bool Member[ESC_Count][256];
+
+    ClassTables()
+    {
+        for (int c = 0; c < 256; ++c) {
+            bool isDigit = (c >= '0' && c <= '9');
+            bool isAlpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            Member[ESC_None][c] = false;
+            Member[ESC_Blanks][c] = (c == ' ' || c == '\t');
+            Member[ESC_Whitespace][c] = (c == ' ' || c == '\t' || c == '\n');
+            Member[ESC_Digits][c] = isDigit;
+            Member[ESC_IdentChars][c] = isDigit || isAlpha || c == '_';
+
+            bool isLineCommentText = (c != '\0' && c != '\\' && c != '\n');
+            Member[ESC_PlainText][c] = (c != '\0' && c != '\\' && c != '/');
+            Member[ESC_PlainLineText][c] = isLineCommentText && c != '/';
+            Member[ESC_LineCommentText][c] = isLineCommentText;
+            Member[ESC_BlockCommentText][c] = isLineCommentText && c != '*';
+        }
+    }
+};
+
+// ------------------------------------------------------------------------------------------------
+// Function-local statics, so other static initializers may safely use the scanners.
+const ClassTables& GetClassTables()
+{
+    static const ClassTables classTables;
+    return classTables;
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* SkipClassScalar(EScanClass _class, const char* _begin, const char* _end)
+{
+    const bool* member = GetClassTables().Member[_class];
+    while (_begin != _end && member[(unsigned char)*_begin]) {
+        ++_begin;
+    }
+    return _begin;
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t CountNewLinesScalar(const char* _begin, const char* _end, const char** _outLastNewLine)
+{
+    size_t count = 0;
+    for (const char* cur = _begin; cur != _end; ++cur) {
+        if (*cur == '\n') {
+            ++count;
+            (*_outLastNewLine) = cur;
+        }
+    }
+    return count;
+}
+
+#if GLSLPP_SCAN_X86
+
+// ------------------------------------------------------------------------------------------------
+inline unsigned CountTrailingZeros(unsigned _value)
+{
+#   ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, _value);
+    return unsigned(index);
+#   else
+    return unsigned(__builtin_ctz(_value));
+#   endif
+}
+
+// ------------------------------------------------------------------------------------------------
+inline unsigned HighestBit(unsigned _value)
+{
+#   ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, _value);
+    return unsigned(index);
+#   else
+    return 31u - unsigned(__builtin_clz(_value));
+#   endif
+}
+
+// ------------------------------------------------------------------------------------------------
+inline unsigned PopCount(unsigned _value)
+{
+    // Portable bit trick; hardware popcnt isn't guaranteed with SSE2.
+    _value = _value - ((_value >> 1) & 0x55555555u);
+    _value = (_value & 0x33333333u) + ((_value >> 2) & 0x33333333u);
+    return (((_value + (_value >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// SSE2. Class membership is computed with compares; unsigned range checks use max_epu8.
+inline __m128i InRange128(__m128i _v, char _low, char _high)
+{
+    __m128i offset = _mm_sub_epi8(_v, _mm_set1_epi8(_low));
+    __m128i limit = _mm_set1_epi8(char(_high - _low));
+    return _mm_cmpeq_epi8(_mm_max_epu8(offset, limit), limit);
+}
+
+// ------------------------------------------------------------------------------------------------
+// The bytes which end a run of text in every preprocessor mode: '\0', '\\' and '\n'.
+inline __m128i LineCommentStops128(__m128i _v)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_v, _mm_setzero_si128()), _mm_cmpeq_epi8(_v, _mm_set1_epi8('\\'))),
+                        _mm_cmpeq_epi8(_v, _mm_set1_epi8('\n')));
+}
+
+// ------------------------------------------------------------------------------------------------
+inline __m128i ClassMask128(EScanClass _class, __m128i _v)
+{
+    switch (_class) {
+        case ESC_Blanks:
+            return _mm_or_si128(_mm_cmpeq_epi8(_v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(_v, _mm_set1_epi8('\t')));
+        case ESC_Whitespace:
+            return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(_v, _mm_set1_epi8('\t'))),
+                                _mm_cmpeq_epi8(_v, _mm_set1_epi8('\n')));
+        case ESC_Digits:
+            return InRange128(_v, '0', '9');
+        case ESC_IdentChars:
+        {
+            // Folding to lower case with |0x20 only matters for letters; the range check rejects
+            // everything else that lands in [a-z].
+            __m128i lower = _mm_or_si128(_v, _mm_set1_epi8(0x20));
+            return _mm_or_si128(_mm_or_si128(InRange128(lower, 'a', 'z'), InRange128(_v, '0', '9')),
+                                _mm_cmpeq_epi8(_v, _mm_set1_epi8('_')));
+        }
+        case ESC_PlainText:
+            return _mm_andnot_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_v, _mm_setzero_si128()), _mm_cmpeq_epi8(_v, _mm_set1_epi8('\\'))),
+                                                 _mm_cmpeq_epi8(_v, _mm_set1_epi8('/'))),
+                                    _mm_set1_epi8(-1));
+        case ESC_PlainLineText:
+            return _mm_andnot_si128(_mm_or_si128(LineCommentStops128(_v), _mm_cmpeq_epi8(_v, _mm_set1_epi8('/'))),
+                                    _mm_set1_epi8(-1));
+        case ESC_LineCommentText:
+            return _mm_andnot_si128(LineCommentStops128(_v), _mm_set1_epi8(-1));
+        case ESC_BlockCommentText:
+            return _mm_andnot_si128(_mm_or_si128(LineCommentStops128(_v), _mm_cmpeq_epi8(_v, _mm_set1_epi8('*'))),
+                                    _mm_set1_epi8(-1));
+        default:
+            return _mm_setzero_si128();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* SkipClassSSE2(EScanClass _class, const char* _begin, const char* _end)
+{
+    while (_end - _begin >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)_begin);
+        unsigned outside = ~unsigned(_mm_movemask_epi8(ClassMask128(_class, v))) & 0xffffu;
+        if (outside) {
+            return _begin + CountTrailingZeros(outside);
+        }
+        _begin += 16;
+    }
+    return SkipClassScalar(_class, _begin, _end);
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t CountNewLinesSSE2(const char* _begin, const char* _end, const char** _outLastNewLine)
+{
+    size_t count = 0;
+    const __m128i newLine = _mm_set1_epi8('\n');
+    while (_end - _begin >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)_begin);
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newLine)));
+        if (mask) {
+            count += PopCount(mask);
+            (*_outLastNewLine) = _begin + HighestBit(mask);
+        }
+        _begin += 16;
+    }
+    return count + CountNewLinesScalar(_begin, _end, _outLastNewLine);
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// AVX2. Same thing, 32 bytes at a time.
+GLSLPP_TARGET_AVX2
+inline __m256i InRange256(__m256i _v, char _low, char _high)
+{
+    __m256i offset = _mm256_sub_epi8(_v, _mm256_set1_epi8(_low));
+    __m256i limit = _mm256_set1_epi8(char(_high - _low));
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(offset, limit), limit);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLSLPP_TARGET_AVX2
+inline __m256i LineCommentStops256(__m256i _v)
+{
+    return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_v, _mm256_setzero_si256()), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\\'))),
+                           _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\n')));
+}
+
+// ------------------------------------------------------------------------------------------------
+GLSLPP_TARGET_AVX2
+inline __m256i ClassMask256(EScanClass _class, __m256i _v)
+{
+    switch (_class) {
+        case ESC_Blanks:
+            return _mm256_or_si256(_mm256_cmpeq_epi8(_v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\t')));
+        case ESC_Whitespace:
+            return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\t'))),
+                                   _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\n')));
+        case ESC_Digits:
+            return InRange256(_v, '0', '9');
+        case ESC_IdentChars:
+        {
+            __m256i lower = _mm256_or_si256(_v, _mm256_set1_epi8(0x20));
+            return _mm256_or_si256(_mm256_or_si256(InRange256(lower, 'a', 'z'), InRange256(_v, '0', '9')),
+                                   _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('_')));
+        }
+        case ESC_PlainText:
+            return _mm256_andnot_si256(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_v, _mm256_setzero_si256()), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('\\'))),
+                                                       _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('/'))),
+                                       _mm256_set1_epi8(-1));
+        case ESC_PlainLineText:
+            return _mm256_andnot_si256(_mm256_or_si256(LineCommentStops256(_v), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('/'))),
+                                       _mm256_set1_epi8(-1));
+        case ESC_LineCommentText:
+            return _mm256_andnot_si256(LineCommentStops256(_v), _mm256_set1_epi8(-1));
+        case ESC_BlockCommentText:
+            return _mm256_andnot_si256(_mm256_or_si256(LineCommentStops256(_v), _mm256_cmpeq_epi8(_v, _mm256_set1_epi8('*'))),
+                                       _mm256_set1_epi8(-1));
+        default:
+            return _mm256_setzero_si256();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+GLSLPP_TARGET_AVX2
+const char* SkipClassAVX2(EScanClass _class, const char* _begin, const char* _end)
+{
+    while (_end - _begin >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)_begin);
+        unsigned outside = ~unsigned(_mm256_movemask_epi8(ClassMask256(_class, v)));
+        if (outside) {
+            return _begin + CountTrailingZeros(outside);
+        }
+        _begin += 32;
+    }
+    return SkipClassSSE2(_class, _begin, _end);
+}
+
+// ------------------------------------------------------------------------------------------------
+GLSLPP_TARGET_AVX2
+size_t CountNewLinesAVX2(const char* _begin, const char* _end, const char** _outLastNewLine)
+{
+    size_t count = 0;
+    const __m256i newLine = _mm256_set1_epi8('\n');
+    while (_end - _begin >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)_begin);
+        unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newLine)));
+        if (mask) {
+            count += PopCount(mask);
+            (*_outLastNewLine) = _begin + HighestBit(mask);
+        }
+        _begin += 32;
+    }
+    return count + CountNewLinesSSE2(_begin, _end, _outLastNewLine);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CpuHasAVX2()
+{
+#   ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // The OS must also save the YMM registers for us (OSXSAVE + XCR0 bits 1 and 2).
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#   else
+    // This checks OS support as well.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#   endif
+}
+
+#endif // GLSLPP_SCAN_X86
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+struct ScanDispatch
+{
+    const char* (*SkipClass)(EScanClass, const char*, const char*);
+    size_t (*CountNewLines)(const char*, const char*, const char**);
+    const char* Name;
+
+    ScanDispatch()
+    : SkipClass(SkipClassScalar)
+    , CountNewLines(CountNewLinesScalar)
+    , Name("scalar")
+    {
+#if GLSLPP_SCAN_X86
+        // SSE2 is part of the x64 baseline (and we build x86 with /arch:SSE2).
+        SkipClass = SkipClassSSE2;
+        CountNewLines = CountNewLinesSSE2;
+        Name = "sse2";
+
+        if (CpuHasAVX2()) {
+            SkipClass = SkipClassAVX2;
+            CountNewLines = CountNewLinesAVX2;
+            Name = "avx2";
+        }
+#endif
+    }
+};
+
+// ------------------------------------------------------------------------------------------------
+const ScanDispatch& GetScanDispatch()
+{
+    static const ScanDispatch scanDispatch;
+    return scanDispatch;
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ScanClassContains(EScanClass _class, unsigned char _char)
+{
+    return GetClassTables().Member[_class][_char];
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* ScanSkipClass(EScanClass _class, const char* _begin, const char* _end)
+{
+    return GetScanDispatch().SkipClass(_class, _begin, _end);
+}
+
+// ------------------------------------------------------------------------------------------------
+size_t ScanCountNewLines(const char* _begin, const char* _end, const char** _outLastNewLine)
+{
+    return GetScanDispatch().CountNewLines(_begin, _end, _outLastNewLine);
+}
+
+// ------------------------------------------------------------------------------------------------
+const char* GetScanImplementationName()
+{
+    return GetScanDispatch().Name;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// Bulk byte scanning used by the lexer's and preprocessor's hot loops. Each routine has an AVX2,
+// an SSE2 and a scalar implementation; the best one the CPU supports is picked once at startup.
+
+// Character classes which can be skipped over in bulk.
+enum EScanClass {
+    ESC_None = 0,
+    ESC_Blanks,             // [ \t]
+    ESC_Whitespace,         // [ \t\n]
+    ESC_Digits,             // [0-9]
+    ESC_IdentChars,         // [_a-zA-Z0-9]
+
+    // Text the preprocessor's comment and line continuation phases pass over untouched, in each
+    // of their modes. See earlyphases.cpp.
+    ESC_PlainText,          // [^\0\\/]
+    ESC_PlainLineText,      // [^\0\\\n/]
+    ESC_LineCommentText,    // [^\0\\\n]
+    ESC_BlockCommentText,   // [^\0\\\n*]
+
+    ESC_Count
+};
+
+// Whether _char is a member of _class.
+bool ScanClassContains(EScanClass _class, unsigned char _char);
+
+// Returns the first byte in [_begin, _end) which is not in _class, or _end.
+const char* ScanSkipClass(EScanClass _class, const char* _begin, const char* _end);
+
+// Returns the number of '\n' in [_begin, _end). If there are any, *_outLastNewLine is set to
+// the last one; otherwise it is left alone.
+size_t ScanCountNewLines(const char* _begin, const char* _end, const char** _outLastNewLine);
+
+// "avx2", "sse2" or "scalar". Useful when reporting benchmark numbers.
+const char* GetScanImplementationName();
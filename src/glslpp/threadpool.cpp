@@ -0,0 +1,162 @@
+#include "glslppafx.h"
+
+#include "threadpool.h"
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+ThreadPool::ThreadPool(size_t _threadCount)
+: mWorkerCount(_threadCount)
+, mGeneration(0)
+, mBusy(0)
+, mShutdown(false)
+, mFn(NULL)
+, mUserData(NULL)
+{
+    if (mWorkerCount == 0) {
+        // hardware_concurrency is allowed to not know.
+        mWorkerCount = std::thread::hardware_concurrency();
+        if (mWorkerCount == 0) {
+            mWorkerCount = 1;
+        }
+    }
+
+    mQueues.reset(new WorkQueue[mWorkerCount]);
+    for (size_t i = 0; i < mWorkerCount; ++i) {
+        mQueues[i].mBegin = 0;
+        mQueues[i].mEnd = 0;
+    }
+
+    // Worker 0 is whoever calls Run.
+    for (size_t i = 1; i < mWorkerCount; ++i) {
+        mThreads.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWake.notify_all();
+
+    for (size_t i = 0; i < mThreads.size(); ++i) {
+        mThreads[i].join();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void ThreadPool::Run(size_t _jobCount, JobFn _fn, void* _userData)
+{
+    if (_jobCount == 0) {
+        return;
+    }
+
+    // Hand out contiguous, even shares. Nothing is running, so no locks are needed for this.
+    for (size_t i = 0; i < mWorkerCount; ++i) {
+        mQueues[i].mBegin = _jobCount * i / mWorkerCount;
+        mQueues[i].mEnd = _jobCount * (i + 1) / mWorkerCount;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFn = _fn;
+        mUserData = _userData;
+        mBusy = mThreads.size();
+        ++mGeneration;
+    }
+    mWake.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mBusy > 0) {
+        mDone.wait(lock);
+    }
+    mFn = NULL;
+    mUserData = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+void ThreadPool::WorkerMain(size_t _worker)
+{
+    uint64_t seenGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (!mShutdown && mGeneration == seenGeneration) {
+                mWake.wait(lock);
+            }
+
+            if (mShutdown) {
+                return;
+            }
+            seenGeneration = mGeneration;
+        }
+
+        Work(_worker);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mBusy == 0) {
+            mDone.notify_one();
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void ThreadPool::Work(size_t _worker)
+{
+    // No job creates more jobs, so once every queue has been seen empty this worker is done.
+    size_t job = 0;
+    while (Pop(_worker, &job) || Steal(_worker, &job)) {
+        mFn(job, _worker, mUserData);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ThreadPool::Pop(size_t _worker, size_t* _outJob)
+{
+    WorkQueue& queue = mQueues[_worker];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    if (queue.mBegin == queue.mEnd) {
+        return false;
+    }
+
+    (*_outJob) = --queue.mEnd;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool ThreadPool::Steal(size_t _worker, size_t* _outJob)
+{
+    for (size_t i = 1; i < mWorkerCount; ++i) {
+        WorkQueue& victim = mQueues[(_worker + i) % mWorkerCount];
+
+        size_t begin = 0;
+        size_t end = 0;
+        {
+            std::lock_guard<std::mutex> lock(victim.mMutex);
+            size_t remaining = victim.mEnd - victim.mBegin;
+            if (remaining == 0) {
+                continue;
+            }
+
+            // Half, rounded up, from the end the victim isn't working from.
+            begin = victim.mBegin;
+            end = begin + (remaining + 1) / 2;
+            victim.mBegin = end;
+        }
+
+        // Run the first, and queue the rest where other thieves can find them.
+        (*_outJob) = begin;
+        WorkQueue& queue = mQueues[_worker];
+        std::lock_guard<std::mutex> lock(queue.mMutex);
+        queue.mBegin = begin + 1;
+        queue.mEnd = end;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// A fixed set of worker threads, for running batches of independent jobs. Each worker starts a
+// batch with an even share of the jobs in its own queue, and takes them from the back. A worker
+// that runs out steals half of what's left at the front of another's queue. So a few huge jobs
+// among thousands of small ones--one giant shader in an asset build--don't leave the rest of the
+// threads idle at the end.
+class ThreadPool
+{
+public:
+    typedef void (*JobFn)(size_t _job, size_t _worker, void* _userData);
+
+    // _threadCount of 0 means one per hardware thread. The thread calling Run is one of the
+    // workers, so one fewer thread than that is started.
+    explicit ThreadPool(size_t _threadCount = 0);
+    ~ThreadPool();
+
+    size_t GetWorkerCount() const { return mWorkerCount; }
+
+    // Calls _fn for every job in [0, _jobCount), spread over the workers, and returns once every
+    // job has finished. _worker is in [0, GetWorkerCount()), and no two jobs with the same _worker
+    // run at the same time, so it can index per-worker state without locking. Only one thread
+    // may call Run at a time.
+    void Run(size_t _jobCount, JobFn _fn, void* _userData);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    // The jobs [mBegin, mEnd). Jobs are just indices, so a range is all a queue needs.
+    struct WorkQueue
+    {
+        std::mutex mMutex;
+        size_t mBegin;
+        size_t mEnd;
+    };
+
+    void WorkerMain(size_t _worker);
+    void Work(size_t _worker);
+    bool Pop(size_t _worker, size_t* _outJob);
+    bool Steal(size_t _worker, size_t* _outJob);
+
+    size_t mWorkerCount;
+    std::unique_ptr<WorkQueue[]> mQueues;
+    std::vector<std::thread> mThreads;
+
+    // Guards everything below.
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    uint64_t mGeneration;       // Bumped for each Run, which is how workers know there's work.
+    size_t mBusy;               // Started threads still working on this Run.
+    bool mShutdown;
+    JobFn mFn;
+    void* mUserData;
+};
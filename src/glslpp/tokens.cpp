@@ -1,9 +1,15 @@
 #include "glslppafx.h"
 
 #include "common/parserutil.h"
+#include "common/keywordtable.h"
+#include "scan.h"
+#include "tokens.h"
 
 #include <algorithm>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string.h>
 
 const LexicalEntry SentinelRule = { nullptr, 0 };
 const int IGNORETOKEN = -1;
@@ -11,192 +17,157 @@ const int REJECTTOKEN = -2;
 const int EOFTOKEN = -3;
 
 // ------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------
-// ------------------------------------------------------------------------------------------------
-enum GLSLTokenIDs {
-    ATTRIBUTE = 1,
-    CONST,
-    BREAK,
-    CONTINUE,
-    DO,
-    ELSE,
-    FOR,
-    IF,
-    DISCARD,
-    RETURN,
-    SWITCH,
-    CASE,
-    DEFAULT,
-    SUBROUTINE,
-    CENTROID,
-    IN,
-    OUT,
-    INOUT,
-    UNIFORM,
-    VARYING,
-    PATCH,
-    SAMPLE,
-    NOPERSPECTIVE,
-    FLAT,
-    SMOOTH,
-    LAYOUT,
-    STRUCT,
-    VOID,
-    WHILE,
-    LEFT_OP,
-    RIGHT_OP,
-    INC_OP,
-    DEC_OP,
-    LE_OP,
-    GE_OP,
-    EQ_OP,
-    NE_OP,
-    AND_OP,
-    OR_OP,
-    XOR_OP,
-    MUL_ASSIGN,
-    DIV_ASSIGN,
-    ADD_ASSIGN,
-    MOD_ASSIGN,
-    LEFT_ASSIGN,
-    RIGHT_ASSIGN,
-    AND_ASSIGN,
-    XOR_ASSIGN,
-    OR_ASSIGN,
-    SUB_ASSIGN,
-    LEFT_PAREN,
-    RIGHT_PAREN,
-    LEFT_BRACKET,
-    RIGHT_BRACKET,
-    LEFT_BRACE,
-    RIGHT_BRACE,
-    DOT,
-    COMMA,
-    COLON,
-    EQUAL,
-    SEMICOLON,
-    BANG,
-    DASH,
-    TILDE,
-    PLUS,
-    STAR,
-    SLASH,
-    PERCENT,
-    LEFT_ANGLE,
-    RIGHT_ANGLE,
-    VERTICAL_BAR,
-    CARET,
-    AMPERSAND,
-    QUESTION,
-    INVARIANT,
-    HIGH_PRECISION,
-    MEDIUM_PRECISION,
-    LOW_PRECISION,
-    PRECISION,
-    BOOLCONSTANT,
-    IDENTIFIER,
-    FLOATCONSTANT,
-    UINTCONSTANT,
-    INTCONSTANT,
-
-    TYPE_NAME
+const KeywordEntry glslReservedTypes[] = {
+    { "bool"                   , TYPE_NAME },
+    { "float"                  , TYPE_NAME },
+    { "double"                 , TYPE_NAME },
+    { "int"                    , TYPE_NAME },
+    { "uint"                   , TYPE_NAME },
+    { "bvec2"                  , TYPE_NAME },
+    { "bvec3"                  , TYPE_NAME },
+    { "bvec4"                  , TYPE_NAME },
+    { "ivec2"                  , TYPE_NAME },
+    { "ivec3"                  , TYPE_NAME },
+    { "ivec4"                  , TYPE_NAME },
+    { "uvec2"                  , TYPE_NAME },
+    { "uvec3"                  , TYPE_NAME },
+    { "uvec4"                  , TYPE_NAME },
+    { "vec2"                   , TYPE_NAME },
+    { "vec3"                   , TYPE_NAME },
+    { "vec4"                   , TYPE_NAME },
+    { "mat2"                   , TYPE_NAME },
+    { "mat3"                   , TYPE_NAME },
+    { "mat4"                   , TYPE_NAME },
+    { "dvec2"                  , TYPE_NAME },
+    { "dvec3"                  , TYPE_NAME },
+    { "dvec4"                  , TYPE_NAME },
+    { "dmat2"                  , TYPE_NAME },
+    { "dmat3"                  , TYPE_NAME },
+    { "dmat4"                  , TYPE_NAME },
+    { "mat2x2"                 , TYPE_NAME },
+    { "mat2x3"                 , TYPE_NAME },
+    { "mat2x4"                 , TYPE_NAME },
+    { "mat3x2"                 , TYPE_NAME },
+    { "mat3x3"                 , TYPE_NAME },
+    { "mat3x4"                 , TYPE_NAME },
+    { "mat4x2"                 , TYPE_NAME },
+    { "mat4x3"                 , TYPE_NAME },
+    { "mat4x4"                 , TYPE_NAME },
+    { "dmat2x2"                , TYPE_NAME },
+    { "dmat2x3"                , TYPE_NAME },
+    { "dmat2x4"                , TYPE_NAME },
+    { "dmat3x2"                , TYPE_NAME },
+    { "dmat3x3"                , TYPE_NAME },
+    { "dmat3x4"                , TYPE_NAME },
+    { "dmat4x2"                , TYPE_NAME },
+    { "dmat4x3"                , TYPE_NAME },
+    { "dmat4x4"                , TYPE_NAME },
+    { "sampler1D"              , TYPE_NAME },
+    { "sampler2D"              , TYPE_NAME },
+    { "sampler3D"              , TYPE_NAME },
+    { "samplerCube"            , TYPE_NAME },
+    { "sampler1DShadow"        , TYPE_NAME },
+    { "sampler2DShadow"        , TYPE_NAME },
+    { "samplerCubeShadow"      , TYPE_NAME },
+    { "sampler1DArray"         , TYPE_NAME },
+    { "sampler2DArray"         , TYPE_NAME },
+    { "sampler1DArrayShadow"   , TYPE_NAME },
+    { "sampler2DArrayShadow"   , TYPE_NAME },
+    { "isampler1D"             , TYPE_NAME },
+    { "isampler2D"             , TYPE_NAME },
+    { "isampler3D"             , TYPE_NAME },
+    { "isamplerCube"           , TYPE_NAME },
+    { "isampler1DArray"        , TYPE_NAME },
+    { "isampler2DArray"        , TYPE_NAME },
+    { "usampler1D"             , TYPE_NAME },
+    { "usampler2D"             , TYPE_NAME },
+    { "usampler3D"             , TYPE_NAME },
+    { "usamplerCube"           , TYPE_NAME },
+    { "usampler1DArray"        , TYPE_NAME },
+    { "usampler2DArray"        , TYPE_NAME },
+    { "sampler2DRect"          , TYPE_NAME },
+    { "sampler2DRectShadow"    , TYPE_NAME },
+    { "isampler2DRect"         , TYPE_NAME },
+    { "usampler2DRect"         , TYPE_NAME },
+    { "samplerBuffer"          , TYPE_NAME },
+    { "isamplerBuffer"         , TYPE_NAME },
+    { "usamplerBuffer"         , TYPE_NAME },
+    { "samplerCubeArray"       , TYPE_NAME },
+    { "samplerCubeArrayShadow" , TYPE_NAME },
+    { "isamplerCubeArray"      , TYPE_NAME },
+    { "usamplerCubeArray"      , TYPE_NAME },
+    { "sampler2DMS"            , TYPE_NAME },
+    { "isampler2DMS"           , TYPE_NAME },
+    { "usampler2DMS"           , TYPE_NAME },
+    { "sampler2DMSArray"       , TYPE_NAME },
+    { "isampler2DMSArray"      , TYPE_NAME },
+    { "usampler2DMSArray"      , TYPE_NAME },
+
+    { nullptr, 0 }
 };
 
 // ------------------------------------------------------------------------------------------------
-const char* glslReservedTypes[] = {
-    "bool",
-    "float", 
-    "double", 
-    "int", 
-    "uint", 
-    "bvec2", 
-    "bvec3", 
-    "bvec4", 
-    "ivec2", 
-    "ivec3", 
-    "ivec4", 
-    "uvec2", 
-    "uvec3", 
-    "uvec4", 
-    "vec2", 
-    "vec3", 
-    "vec4", 
-    "mat2", 
-    "mat3", 
-    "mat4", 
-    "dvec2", 
-    "dvec3", 
-    "dvec4", 
-    "dmat2", 
-    "dmat3", 
-    "dmat4", 
-    "mat2x2", 
-    "mat2x3", 
-    "mat2x4", 
-    "mat3x2", 
-    "mat3x3", 
-    "mat3x4", 
-    "mat4x2", 
-    "mat4x3", 
-    "mat4x4", 
-    "dmat2x2", 
-    "dmat2x3", 
-    "dmat2x4", 
-    "dmat3x2", 
-    "dmat3x3", 
-    "dmat3x4", 
-    "dmat4x2", 
-    "dmat4x3", 
-    "dmat4x4", 
-    "sampler1D", 
-    "sampler2D", 
-    "sampler3D", 
-    "samplerCube", 
-    "sampler1DShadow", 
-    "sampler2DShadow", 
-    "samplerCubeShadow", 
-    "sampler1DArray", 
-    "sampler2DArray", 
-    "sampler1DArrayShadow", 
-    "sampler2DArrayShadow", 
-    "isampler1D", 
-    "isampler2D", 
-    "isampler3D", 
-    "isamplerCube", 
-    "isampler1DArray", 
-    "isampler2DArray", 
-    "usampler1D", 
-    "usampler2D", 
-    "usampler3D", 
-    "usamplerCube", 
-    "usampler1DArray", 
-    "usampler2DArray", 
-    "sampler2DRect", 
-    "sampler2DRectShadow", 
-    "isampler2DRect", 
-    "usampler2DRect", 
-    "samplerBuffer", 
-    "isamplerBuffer", 
-    "usamplerBuffer", 
-    "samplerCubeArray", 
-    "samplerCubeArrayShadow", 
-    "isamplerCubeArray", 
-    "usamplerCubeArray", 
-    "sampler2DMS", 
-    "isampler2DMS", 
-    "usampler2DMS", 
-    "sampler2DMSArray", 
-    "isampler2DMSArray", 
-    "usampler2DMSArray", 
-
-    nullptr
+// Keywords are not lexical rules of their own. The identifier rule classifies them (and the
+// reserved type names) with a single perfect hash lookup.
+const KeywordEntry glslKeywords[] = {
+    { "attribute"     , ATTRIBUTE        },
+    { "const"         , CONST            },
+    { "break"         , BREAK            },
+    { "continue"      , CONTINUE         },
+    { "do"            , DO               },
+    { "else"          , ELSE             },
+    { "for"           , FOR              },
+    { "if"            , IF               },
+    { "discard"       , DISCARD          },
+    { "return"        , RETURN           },
+    { "switch"        , SWITCH           },
+    { "case"          , CASE             },
+    { "default"       , DEFAULT          },
+    { "subroutine"    , SUBROUTINE       },
+    { "centroid"      , CENTROID         },
+    { "in"            , IN               },
+    { "out"           , OUT              },
+    { "inout"         , INOUT            },
+    { "uniform"       , UNIFORM          },
+    { "varying"       , VARYING          },
+    { "patch"         , PATCH            },
+    { "sample"        , SAMPLE           },
+    { "noperspective" , NOPERSPECTIVE    },
+    { "flat"          , FLAT             },
+    { "smooth"        , SMOOTH           },
+    { "layout"        , LAYOUT           },
+    { "struct"        , STRUCT           },
+    { "void"          , VOID             },
+    { "while"         , WHILE            },
+    { "invariant"     , INVARIANT        },
+    { "highp"         , HIGH_PRECISION   },
+    { "mediump"       , MEDIUM_PRECISION },
+    { "lowp"          , LOW_PRECISION    },
+    { "precision"     , PRECISION        },
+    { "true"          , BOOLCONSTANT     },
+    { "false"         , BOOLCONSTANT     },
+
+    { nullptr, 0 }
 };
 
 // ------------------------------------------------------------------------------------------------
-int DetermineIdentifierSubtype(const std::string& _match, const int _initialToken, StateObject* _state)
+const KeywordTable& GetGlslKeywordTable()
+{
+    static const KeywordEntry* const tables[] = { glslKeywords, glslReservedTypes };
+    static const KeywordTable keywordTable(tables, sizeof(tables) / sizeof(tables[0]));
+    return keywordTable;
+}
+
+// ------------------------------------------------------------------------------------------------
+int DetermineIdentifierSubtype(const char* _match, size_t _matchLength, const int _initialToken, StateObject* _state)
 {
+    int keywordToken = _initialToken;
+    if (GetGlslKeywordTable().Find(_match, _matchLength, &keywordToken)) {
+        return keywordToken;
+    }
+
     if (_state) {
-        if (_state->IsValidType(_match)) {
+        if (_state->IsUserType(_match, _matchLength)) {
             return TYPE_NAME;
         }
     }
@@ -207,35 +178,6 @@ int DetermineIdentifierSubtype(const std::string& _match, const int _initialToke
 // ------------------------------------------------------------------------------------------------
 const LexicalEntry glslTokens[] = {
     { "[ \t\n]+"                                , IGNORETOKEN      , nullptr },
-	{ "attribute"				                , ATTRIBUTE        , nullptr },
-	{ "const"					                , CONST            , nullptr },
-	{ "break"                                   , BREAK            , nullptr },
-	{ "continue"                                , CONTINUE         , nullptr },
-	{ "do"                                      , DO               , nullptr },
-	{ "else"                                    , ELSE             , nullptr },
-	{ "for"                                     , FOR              , nullptr },
-	{ "if"                                      , IF               , nullptr },
-	{ "discard"                                 , DISCARD          , nullptr },
-	{ "return"                                  , RETURN           , nullptr },
-	{ "switch"                                  , SWITCH           , nullptr },
-	{ "case"                                    , CASE             , nullptr },
-	{ "default"                                 , DEFAULT          , nullptr },
-	{ "subroutine"                              , SUBROUTINE       , nullptr },
-	{ "centroid"                                , CENTROID         , nullptr },
-	{ "in"                                      , IN               , nullptr },
-	{ "out"                                     , OUT              , nullptr },
-	{ "inout"                                   , INOUT            , nullptr },
-	{ "uniform"                                 , UNIFORM          , nullptr },
-	{ "varying"                                 , VARYING          , nullptr },
-	{ "patch"                                   , PATCH            , nullptr },
-	{ "sample"                                  , SAMPLE           , nullptr },
-	{ "noperspective"                           , NOPERSPECTIVE    , nullptr },
-	{ "flat"                                    , FLAT             , nullptr },
-	{ "smooth"                                  , SMOOTH           , nullptr },
-	{ "layout"                                  , LAYOUT           , nullptr },
-    { "struct"                                  , STRUCT           , nullptr },
-    { "void"                                    , VOID             , nullptr },
-    { "while"                                   , WHILE            , nullptr },
     { "<<"                                      , LEFT_OP          , nullptr },
     { ">>"                                      , RIGHT_OP         , nullptr },
     { "\\+\\+"                                  , INC_OP           , nullptr },
@@ -281,12 +223,6 @@ const LexicalEntry glslTokens[] = {
     { "\\^"                                     , CARET            , nullptr },
     { "&"                                       , AMPERSAND        , nullptr },
     { "\\?"                                     , QUESTION         , nullptr },
-    { "invariant"                               , INVARIANT        , nullptr },
-    { "highp"                                   , HIGH_PRECISION   , nullptr },
-    { "mediump"                                 , MEDIUM_PRECISION , nullptr },
-    { "lowp"                                    , LOW_PRECISION    , nullptr },
-    { "precision"                               , PRECISION        , nullptr },
-    { "false|true"                              , BOOLCONSTANT     , nullptr },
     { "[_a-zA-Z][_a-zA-Z0-9]*"                  , IDENTIFIER       , DetermineIdentifierSubtype },
     { "[0-9]+\\.[0-9]*([eE][-+]?[0-9]+)?[fF]?"  , FLOATCONSTANT    , nullptr },
     { "[0-9]*\\.[0-9]+([eE][-+]?[0-9]+)?[fF]?"  , FLOATCONSTANT    , nullptr },
@@ -304,7 +240,8 @@ const LexicalEntry glslTokens[] = {
 
 // ------------------------------------------------------------------------------------------------
 const LexicalEntry* GetGlslTokens() { return glslTokens; }
-const char** GetGlslReservedTypes() { return glslReservedTypes; }
+const KeywordEntry* GetGlslKeywords() { return glslKeywords; }
+const KeywordEntry* GetGlslReservedTypes() { return glslReservedTypes; }
 
 // ------------------------------------------------------------------------------------------------
 StreamPosition::StreamPosition(StreamOffset _lineNum, StreamOffset _colNum)
@@ -323,19 +260,59 @@ std::ostream& operator<<(std::ostream& _os, const StreamPosition& _streamPos)
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
-StateObject::StateObject(const char** _reservedTypes)
+StateObject::StateObject()
+{ }
+
+// ------------------------------------------------------------------------------------------------
+void StateObject::AddUserType(const char* _identifier, size_t _length)
+{
+    mUserTypes.Insert(_identifier, _length);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool StateObject::IsUserType(const char* _identifier, size_t _length) const
 {
-    for (int i = 0; _reservedTypes[i]; ++i) {
-        mTypes.insert(_reservedTypes[i]);
-    }
+    return mUserTypes.Contains(_identifier, _length);
 }
 
 // ------------------------------------------------------------------------------------------------
-bool StateObject::IsValidType(const std::string& _identifier) const
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+TokenRef::TokenRef()
+: mType(REJECTTOKEN)
+, mOffset(0)
+, mLength(0)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+TokenRef::TokenRef(int _streamTok, StreamOffset _offset, StreamOffset _length)
+: mType(_streamTok)
+, mOffset(_offset)
+, mLength(_length)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+bool TokenRef::IsEOF() const
 {
-    return mTypes.find(_identifier) != mTypes.end();
+    return mType == EOFTOKEN;
 }
 
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+TextEdit::TextEdit(StreamOffset _offset, StreamOffset _removedLength, StreamOffset _insertedLength)
+: mOffset(_offset)
+, mRemovedLength(_removedLength)
+, mInsertedLength(_insertedLength)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+TokenSplice::TokenSplice()
+: mFirst(0)
+, mOldCount(0)
+, mNewCount(0)
+{ }
+
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
@@ -368,13 +345,77 @@ std::ostream& operator<<(std::ostream& _os, const Token& _token)
                << ")";
 }
 
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+LexerRuleSet::LexerRuleSet(const LexicalEntry* _rules)
+: mRules(_rules)
+, mDFA(_rules)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+const LexerRuleSet& LexerRuleSet::Get(const LexicalEntry* _rules)
+{
+    // Compilation happens under the lock. It only happens once per table, and it avoids two
+    // threads both compiling the same table.
+    static std::mutex registryMutex;
+    static std::map<const LexicalEntry*, LexerRuleSet*> registry;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    LexerRuleSet*& ruleSet = registry[_rules];
+    if (!ruleSet) {
+        ruleSet = new LexerRuleSet(_rules);
+    }
+    return *ruleSet;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 Lexer::Lexer(const LexicalEntry* _rules, const char* _stringToLex, StateObject* _state)
-: mStringToLex(_stringToLex)
-, mSrcPos(mStringToLex.cbegin())
+: mOwnedRuleSet(new LexerRuleSet(_rules))
+, mRuleSet(mOwnedRuleSet.get())
+, mStringToLex(_stringToLex)
+, mSrcBegin(mStringToLex.data())
+, mSrcEnd(mSrcBegin + mStringToLex.size())
+, mSrcPos(mSrcBegin)
+, mState(_state)
+{
+    mLookaheadToken = FindNextToken();
+}
+
+// ------------------------------------------------------------------------------------------------
+Lexer::Lexer(const LexicalEntry* _rules, const char* _buffer, size_t _length, StateObject* _state)
+: mOwnedRuleSet(new LexerRuleSet(_rules))
+, mRuleSet(mOwnedRuleSet.get())
+, mSrcBegin(_buffer)
+, mSrcEnd(_buffer + _length)
+, mSrcPos(_buffer)
+, mState(_state)
+{
+    mLookaheadToken = FindNextToken();
+}
+
+// ------------------------------------------------------------------------------------------------
+Lexer::Lexer(const LexerRuleSet& _ruleSet, const char* _stringToLex, StateObject* _state)
+: mRuleSet(&_ruleSet)
+, mStringToLex(_stringToLex)
+, mSrcBegin(mStringToLex.data())
+, mSrcEnd(mSrcBegin + mStringToLex.size())
+, mSrcPos(mSrcBegin)
+, mState(_state)
+{
+    mLookaheadToken = FindNextToken();
+}
+
+// ------------------------------------------------------------------------------------------------
+Lexer::Lexer(const LexerRuleSet& _ruleSet, const char* _buffer, size_t _length, StateObject* _state)
+: mRuleSet(&_ruleSet)
+, mSrcBegin(_buffer)
+, mSrcEnd(_buffer + _length)
+, mSrcPos(_buffer)
 , mState(_state)
 {
-    ConstructRules(_rules);
     mLookaheadToken = FindNextToken();
 }
 
@@ -387,92 +428,328 @@ Lexer::~Lexer()
 // ------------------------------------------------------------------------------------------------
 Token Lexer::Peek() const 
 { 
-    return mLookaheadToken; 
+    return Token(mLookaheadToken.mType, 
+                 std::string(GetTokenText(mLookaheadToken), size_t(mLookaheadToken.mLength)), 
+                 mLookaheadPosition);
 }
 
 // ------------------------------------------------------------------------------------------------
 Token Lexer::Pop() 
 { 
-    Token retToken = mLookaheadToken;
-    mLookaheadToken = FindNextToken();
+    Token retToken = Peek();
+    PopRef();
     return retToken; 
 }
 
 // ------------------------------------------------------------------------------------------------
-void Lexer::ConstructRules(const LexicalEntry* _rules)
+TokenRef Lexer::PeekRef() const
+{
+    return mLookaheadToken;
+}
+
+// ------------------------------------------------------------------------------------------------
+TokenRef Lexer::PopRef()
 {
-    for (int i = 0; _rules[i].Pattern; ++i) {
-        std::regex re = std::regex(_rules[i].Pattern, std::regex::optimize | std::regex::ECMAScript);
-        mRules.push_back({ re, _rules[i].Token, _rules[i].TokenCallback });
+    TokenRef retToken = mLookaheadToken;
+    mLookaheadToken = FindNextToken();
+    return retToken;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool Lexer::TokenizeAll(TokenBuffer* _outTokens)
+{
+    _outTokens->Clear();
+    _outTokens->mBuffer = mSrcBegin;
+    _outTokens->mBufferLength = size_t(mSrcEnd - mSrcBegin);
+
+    if (mLookaheadToken.mType == REJECTTOKEN) {
+        return false;
+    }
+
+    // The lookahead token has already been matched; everything after it is matched here with no
+    // per-token position work.
+    if (!mLookaheadToken.IsEOF()) {
+        _outTokens->Push(mLookaheadToken.mType, mLookaheadToken.mOffset, mLookaheadToken.mLength);
     }
+
+    const char* positionFrom = mSrcPos;
+    bool retVal = true;
+    while (mSrcPos != mSrcEnd) {
+        size_t length = 0;
+        int tokenFound = MatchToken(&length);
+        if (tokenFound == REJECTTOKEN) {
+            fprintf(stderr, "Error! Couldn't match token!\n");
+            retVal = false;
+            break;
+        }
+
+        if (tokenFound != IGNORETOKEN) {
+            _outTokens->Push(tokenFound, mSrcPos - mSrcBegin, StreamOffset(length));
+        }
+        mSrcPos += length;
+    }
+
+    // Leave the lexer sitting at the end (or at the error), with its position up to date.
+    AdvancePosition(positionFrom, mSrcPos);
+    mLookaheadPosition = mStreamPosition;
+    mLookaheadToken = retVal ? TokenRef(EOFTOKEN, mSrcPos - mSrcBegin, 0) : TokenRef();
+    return retVal;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool Lexer::Relex(const TextEdit& _edit, TokenBuffer* _tokens, TokenSplice* _outSplice)
+{
+    const StreamOffset delta = _edit.mInsertedLength - _edit.mRemovedLength;
+    const StreamOffset oldEditEnd = _edit.mOffset + _edit.mRemovedLength;
+    const StreamOffset newEditEnd = _edit.mOffset + _edit.mInsertedLength;
+    assert(oldEditEnd <= StreamOffset(_tokens->mBufferLength));
+    assert(StreamOffset(_tokens->mBufferLength) + delta == mSrcEnd - mSrcBegin);
+
+    const std::vector<StreamOffset>& offsets = _tokens->mOffsets;
+    const std::vector<uint32_t>& lengths = _tokens->mLengths;
+    const size_t oldCount = offsets.size();
+
+    // The first token which can't be kept is the one overlapping the edit, or the one after it.
+    size_t first = size_t(std::upper_bound(offsets.begin(), offsets.end(), _edit.mOffset) - offsets.begin());
+    if (first > 0 && offsets[first - 1] + lengths[first - 1] > _edit.mOffset) {
+        --first;
+    }
+
+    // Tokens ending before the edit may still depend on it, because the automaton looks past the
+    // end of the token it matches: "7e+" is three tokens until a digit after it makes it one
+    // float. The text before the edit is unchanged, so re-running the automaton over a token
+    // tells us whether its original match looked as far as the edit. One that didn't doesn't
+    // end the search--"7" looked further than "+" did--but text the rules ignore does, as no
+    // rule matches across it.
+    for (size_t candidate = first; candidate > 0; --candidate) {
+        size_t examined = 0;
+        const char* tokenBegin = mSrcBegin + offsets[candidate - 1];
+        mRuleSet->GetDFA().Scan(tokenBegin, mSrcEnd, &mMatches, &examined);
+        if (offsets[candidate - 1] + StreamOffset(examined) > _edit.mOffset) {
+            first = candidate - 1;
+        }
+
+        if (candidate == 1 || offsets[candidate - 2] + lengths[candidate - 2] != offsets[candidate - 1]) {
+            break;
+        }
+    }
+
+    // Lex from the end of the last token we kept until we reach a token boundary which was also a
+    // boundary in the old stream, past the edit. From there on the text is the same, so the 
+    // tokens are too.
+    const StreamOffset restart = first > 0 ? offsets[first - 1] + lengths[first - 1] : 0;
+    const char* savedPos = mSrcPos;
+    mSrcPos = mSrcBegin + restart;
+
+    TokenBuffer fresh;
+    size_t resync = oldCount;
+    size_t next = first;
+    bool retVal = true;
+    while (mSrcPos != mSrcEnd) {
+        StreamOffset position = mSrcPos - mSrcBegin;
+        if (position >= newEditEnd) {
+            StreamOffset oldPosition = position - delta;
+            while (next < oldCount && offsets[next] < oldPosition) {
+                ++next;
+            }
+
+            if (next < oldCount && offsets[next] == oldPosition) {
+                resync = next;
+                break;
+            }
+        }
+
+        size_t length = 0;
+        int tokenFound = MatchToken(&length);
+        if (tokenFound == REJECTTOKEN) {
+            fprintf(stderr, "Error! Couldn't match token!\n");
+            retVal = false;
+            break;
+        }
+
+        if (tokenFound != IGNORETOKEN) {
+            fresh.Push(tokenFound, position, StreamOffset(length));
+        }
+        mSrcPos += length;
+    }
+    mSrcPos = savedPos;
+
+    if (_outSplice) {
+        _outSplice->mFirst = first;
+        _outSplice->mOldCount = resync - first;
+        _outSplice->mNewCount = fresh.Size();
+    }
+
+    _tokens->Splice(first, resync - first, fresh, delta);
+    _tokens->ApplyEdit(_edit, mSrcBegin, size_t(mSrcEnd - mSrcBegin));
+    return retVal;
+}
+
+// ------------------------------------------------------------------------------------------------
+int Lexer::MatchToken(size_t* _outLength)
+{
+    // One pass of the automaton tells us every rule that matches here, so rejections from
+    // a callback just fall through to the next rule in priority order.
+    mRuleSet->GetDFA().Scan(mSrcPos, mSrcEnd, &mMatches);
+
+    for (auto it = mMatches.begin(); it != mMatches.end(); ++it) {
+        const LexicalEntry& rule = mRuleSet->GetRules()[it->Rule];
+        int localTok = rule.Token;
+
+        // If there's a token callback function, call it and allow it to replace our 
+        // default value.
+        if (rule.TokenCallback) {
+            localTok = rule.TokenCallback(mSrcPos, it->Length, localTok, mState);
+        }
+
+        if (localTok != REJECTTOKEN) {
+            (*_outLength) = it->Length;
+            return localTok;
+        }
+    }
+
+    return REJECTTOKEN;
 }
 
 // ------------------------------------------------------------------------------------------------
-Token Lexer::FindNextToken()
+void Lexer::AdvancePosition(const char* _from, const char* _to)
 {
-    Token retToken;
+    const char* lastNewLine = NULL;
+    StreamOffset newLines = StreamOffset(ScanCountNewLines(_from, _to, &lastNewLine));
+
+    if (newLines > 0) {
+        mStreamPosition.mLineNum += newLines;
+        mStreamPosition.mColNum = _to - lastNewLine;
+    } else {
+        mStreamPosition.mColNum += _to - _from;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+TokenRef Lexer::FindNextToken()
+{
+    for (;;) {
+        mLookaheadPosition = mStreamPosition;
 
-    int tokenFound = IGNORETOKEN;
-    while (tokenFound == IGNORETOKEN)
-    {
         // Check if we're at the EOF. If so, bail.
-        if (mSrcPos == mStringToLex.cend()) {
-            retToken = Token(EOFTOKEN, "\0", mStreamPosition);
-            break;    
+        if (mSrcPos == mSrcEnd) {
+            return TokenRef(EOFTOKEN, mSrcPos - mSrcBegin, 0);
         }
 
         // If not, then we need to find out what token we're at, and either use it or
         // continue. We may continue if the token is something we're supposed to ignore.
-        std::smatch res;
-        bool found = false;
-        for (auto it = mRules.begin(); it != mRules.end(); ++it) {
-            if (std::regex_search(mSrcPos, mStringToLex.cend(), res, it->Regex, std::regex_constants::match_continuous)) {
-                // Definitely needs to not be 0, but also needs to not be >1--if so indicates 
-                // something wonky has happened.
-                std::string matchStr = res.str();
-                size_t resultLength = res.length();
-                int localTok = it->Token;
-
-                // If there's a token callback function, call it and allow it to replace our 
-                // default value.
-                if (it->TokenCallback) {
-                    localTok = it->TokenCallback(matchStr, localTok, mState);
-                }
-
-                if (localTok == REJECTTOKEN) {
-                    continue;
-                }
-
-                // Mark this as the found token.
-                tokenFound = localTok;
-
-                // Record the token for further processing.
-                retToken = Token(tokenFound, matchStr, mStreamPosition);
-
-                // Update position variables.
-                int newLines = std::count(matchStr.begin(), matchStr.end(), '\n');
-                if (newLines > 0) {
-                    mStreamPosition.mLineNum += newLines;
-                    mStreamPosition.mColNum = resultLength - matchStr.find_last_of('\n');
-                } else {
-                    mStreamPosition.mColNum += resultLength;
-                }
-
-                // Advance our search position, and mark that we have a hit.
-                std::advance(mSrcPos, resultLength);
-                found = true;
-
-                // Then go around again.
+        size_t resultLength = 0;
+        int tokenFound = MatchToken(&resultLength);
+        if (tokenFound == REJECTTOKEN) {
+            fprintf(stderr, "Error! Couldn't match token!\n");
+            return TokenRef();
+        }
+
+        TokenRef retToken(tokenFound, mSrcPos - mSrcBegin, StreamOffset(resultLength));
+
+        // Update position variables, advance our search position, then either hand back the
+        // token or go around again.
+        const char* matchEnd = mSrcPos + resultLength;
+        AdvancePosition(mSrcPos, matchEnd);
+        mSrcPos = matchEnd;
+        if (tokenFound != IGNORETOKEN) {
+            return retToken;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+TokenBuffer::TokenBuffer()
+: mBuffer(NULL)
+, mBufferLength(0)
+, mLineStartsValid(false)
+{ }
+
+// ------------------------------------------------------------------------------------------------
+void TokenBuffer::Clear()
+{
+    mTypes.clear();
+    mOffsets.clear();
+    mLengths.clear();
+    mBuffer = NULL;
+    mBufferLength = 0;
+    mLineStarts.clear();
+    mLineStartsValid = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+StreamPosition TokenBuffer::PositionOfOffset(StreamOffset _offset) const
+{
+    if (!mLineStartsValid) {
+        // Built on first use; most consumers never ask for a position at all.
+        mLineStarts.clear();
+        mLineStarts.push_back(0);
+        const char* end = mBuffer + mBufferLength;
+        for (const char* cur = mBuffer; cur != end; ++cur) {
+            cur = (const char*)memchr(cur, '\n', size_t(end - cur));
+            if (!cur) {
                 break;
             }
+            mLineStarts.push_back(StreamOffset(cur - mBuffer) + 1);
         }
+        mLineStartsValid = true;
+    }
+
+    // The line is the last line start at or before _offset.
+    std::vector<StreamOffset>::const_iterator it = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), _offset);
+    StreamOffset lineIndex = StreamOffset(it - mLineStarts.begin()) - 1;
+    return StreamPosition(lineIndex + 1, _offset - mLineStarts[size_t(lineIndex)] + 1);
+}
 
-        if (!found) {
-            printf("Error! Couldn't match token!\n");
-            return Token();
+// ------------------------------------------------------------------------------------------------
+void TokenBuffer::Splice(size_t _first, size_t _oldCount, const TokenBuffer& _fresh, StreamOffset _shift)
+{
+    size_t last = _first + _oldCount;
+    mTypes.erase(mTypes.begin() + _first, mTypes.begin() + last);
+    mOffsets.erase(mOffsets.begin() + _first, mOffsets.begin() + last);
+    mLengths.erase(mLengths.begin() + _first, mLengths.begin() + last);
+
+    mTypes.insert(mTypes.begin() + _first, _fresh.mTypes.begin(), _fresh.mTypes.end());
+    mOffsets.insert(mOffsets.begin() + _first, _fresh.mOffsets.begin(), _fresh.mOffsets.end());
+    mLengths.insert(mLengths.begin() + _first, _fresh.mLengths.begin(), _fresh.mLengths.end());
+
+    if (_shift != 0) {
+        for (size_t i = _first + _fresh.Size(); i < mOffsets.size(); ++i) {
+            mOffsets[i] += _shift;
         }
     }
-
-    return retToken;
 }
 
+// ------------------------------------------------------------------------------------------------
+void TokenBuffer::ApplyEdit(const TextEdit& _edit, const char* _newBuffer, size_t _newBufferLength)
+{
+    mBuffer = _newBuffer;
+    mBufferLength = _newBufferLength;
+    if (!mLineStartsValid) {
+        return;
+    }
+
+    // Patch the line index rather than throwing it away. Line starts are one past each '\n', so
+    // the ones for newlines inside the removed text are in (mOffset, mOffset + mRemovedLength].
+    const StreamOffset oldEditEnd = _edit.mOffset + _edit.mRemovedLength;
+    const StreamOffset delta = _edit.mInsertedLength - _edit.mRemovedLength;
+    std::vector<StreamOffset>::iterator removeBegin = std::upper_bound(mLineStarts.begin(), mLineStarts.end(), _edit.mOffset);
+    std::vector<StreamOffset>::iterator removeEnd = std::upper_bound(removeBegin, mLineStarts.end(), oldEditEnd);
+    size_t insertAt = size_t(mLineStarts.erase(removeBegin, removeEnd) - mLineStarts.begin());
+    for (size_t i = insertAt; i < mLineStarts.size(); ++i) {
+        mLineStarts[i] += delta;
+    }
+
+    std::vector<StreamOffset> inserted;
+    const char* end = mBuffer + _edit.mOffset + _edit.mInsertedLength;
+    for (const char* cur = mBuffer + _edit.mOffset; cur != end; ++cur) {
+        cur = (const char*)memchr(cur, '\n', size_t(end - cur));
+        if (!cur) {
+            break;
+        }
+        inserted.push_back(StreamOffset(cur - mBuffer) + 1);
+    }
+    mLineStarts.insert(mLineStarts.begin() + insertAt, inserted.begin(), inserted.end());
+}
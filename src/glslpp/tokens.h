@@ -0,0 +1,94 @@
+#pragma once
+
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// ------------------------------------------------------------------------------------------------
+// The token ids of the GLSL lexer (see GetGlslTokens), for the parser to switch on.
+enum GLSLTokenIDs {
+    ATTRIBUTE = 1,
+    CONST,
+    BREAK,
+    CONTINUE,
+    DO,
+    ELSE,
+    FOR,
+    IF,
+    DISCARD,
+    RETURN,
+    SWITCH,
+    CASE,
+    DEFAULT,
+    SUBROUTINE,
+    CENTROID,
+    IN,
+    OUT,
+    INOUT,
+    UNIFORM,
+    VARYING,
+    PATCH,
+    SAMPLE,
+    NOPERSPECTIVE,
+    FLAT,
+    SMOOTH,
+    LAYOUT,
+    STRUCT,
+    VOID,
+    WHILE,
+    LEFT_OP,
+    RIGHT_OP,
+    INC_OP,
+    DEC_OP,
+    LE_OP,
+    GE_OP,
+    EQ_OP,
+    NE_OP,
+    AND_OP,
+    OR_OP,
+    XOR_OP,
+    MUL_ASSIGN,
+    DIV_ASSIGN,
+    ADD_ASSIGN,
+    MOD_ASSIGN,
+    LEFT_ASSIGN,
+    RIGHT_ASSIGN,
+    AND_ASSIGN,
+    XOR_ASSIGN,
+    OR_ASSIGN,
+    SUB_ASSIGN,
+    LEFT_PAREN,
+    RIGHT_PAREN,
+    LEFT_BRACKET,
+    RIGHT_BRACKET,
+    LEFT_BRACE,
+    RIGHT_BRACE,
+    DOT,
+    COMMA,
+    COLON,
+    EQUAL,
+    SEMICOLON,
+    BANG,
+    DASH,
+    TILDE,
+    PLUS,
+    STAR,
+    SLASH,
+    PERCENT,
+    LEFT_ANGLE,
+    RIGHT_ANGLE,
+    VERTICAL_BAR,
+    CARET,
+    AMPERSAND,
+    QUESTION,
+    INVARIANT,
+    HIGH_PRECISION,
+    MEDIUM_PRECISION,
+    LOW_PRECISION,
+    PRECISION,
+    BOOLCONSTANT,
+    IDENTIFIER,
+    FLOATCONSTANT,
+    UINTCONSTANT,
+    INTCONSTANT,
+
+    TYPE_NAME
+};
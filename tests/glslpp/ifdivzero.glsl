@@ -0,0 +1,5 @@
+#version 450
+#define ZERO (1 - 1)
+#if 0 || 1 / ZERO
+int divided;
+#endif
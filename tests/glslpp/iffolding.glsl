@@ -0,0 +1,58 @@
+#version 450
+// Each line left in the output is one whose #if was meant to be true.
+#define ONE 1
+#define TWO (ONE + ONE)
+#define NEG -TWO
+#define F(x) ((x) * 3)
+#define OBJ_ALIAS TWO
+#if ONE
+int ifMacro;
+#endif
+#if TWO * 3 == 6 && -NEG == 2 && ~0 == -1 && !0 && (7 % 4) == 3 && (1 << 4) == 16 && (-16 >> 2) == -4
+int ifArithmetic;
+#endif
+#if 2 - 2
+int ifConditionalFalse;
+#elif (1 | 2) == 3 && (6 & 3) == 2 && (6 ^ 3) == 5 && 2 > 1 && 1 >= 1 && 1 < 2 && 2 <= 2 && 1 != 2
+int ifBitwise;
+#endif
+#if F(2) == 6 && OBJ_ALIAS == 2
+int ifFunctionMacro;
+#endif
+#if defined ONE && defined(TWO) && !defined(THREE)
+int ifDefined;
+#endif
+#if UNDEFINED_NAME == 0
+int ifUndefinedIsZero;
+#endif
+// Dividing by zero is only an error where it's evaluated.
+#if 1 || 1 / 0
+int ifOrShortCircuits;
+#endif
+#if 0 && 1 % 0
+int ifAndShortCircuitsFalse;
+#else
+int ifAndShortCircuits;
+#endif
+#if ONE || 1 / UNDEFINED_NAME
+int ifOrShortCircuitsNames;
+#endif
+// The same expression, met again under different macros, is worked out again.
+#define VALUE 1
+#if VALUE == 1
+int ifValueOne;
+#endif
+#undef VALUE
+#define VALUE 2
+#if VALUE == 1
+int ifValueOneAgain;
+#elif VALUE == 2
+int ifValueTwo;
+#endif
+#undef VALUE
+#if VALUE == 1
+int ifValueUndefined;
+#else
+int ifValueUndefinedIsZero;
+#endif
+int line = __LINE__;
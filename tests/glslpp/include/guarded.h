@@ -0,0 +1,7 @@
+// Comments and blank lines around a guard don't stop it being one.
+
+#ifndef GUARDED_H
+#define GUARDED_H
+int guardedCount;
+#endif // GUARDED_H
+
@@ -0,0 +1,4 @@
+// "name" includes look beside the including file first, so this is sub/../once.h.
+#include "../once.h"
+#include "../guarded.h"
+int relativeCount;
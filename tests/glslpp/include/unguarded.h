@@ -0,0 +1,7 @@
+#ifndef UNGUARDED_H
+#define UNGUARDED_H
+int unguardedGuarded;
+#endif
+// Something after the #endif means this isn't a guard, so each include reads the file again;
+// the #ifndef still keeps its body out.
+int unguardedCount = __LINE__;
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+// Every spelling of a #pragma once or guarded header is the same file: each is pasted once.
+#include "include/once.h"
+#include <once.h>
+#include "include/../include/once.h"
+#include "./include/./once.h"
+#include "include/guarded.h"
+#include <guarded.h>
+#include <sub/../guarded.h>
+#include "include/sub/relative.h"
+#include <sub/relative.h>
+#include "include/unguarded.h"
+#include <unguarded.h>
+#undef GUARDED_H
+// The guard's macro has gone, so this one is pasted again.
+#include <guarded.h>
+int line = __LINE__;
@@ -0,0 +1,24 @@
+#version 450 core
+#extension GL_GOOGLE_include_directive : require
+#extension GL_ARB_shader_draw_parameters : enable
+#extension GL_GOOGLE_include_directive : require
+// Conditionals that need macros to decide are taken both ways; ones that don't, aren't.
+#include "include/guarded.h"
+#ifdef USE_ONCE
+#include <once.h>
+#else
+#include <sub/relative.h>
+#endif
+#if 0
+#include <missing.h>
+#endif
+#if 1
+#include "include/./guarded.h"
+#elif 1
+#include <missing.h>
+#endif
+#define HEADER <missing.h>
+#if 0
+#include HEADER
+#endif
+int line = __LINE__;
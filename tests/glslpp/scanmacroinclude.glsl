@@ -0,0 +1,6 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#define HEADER <once.h>
+#ifdef SOMETHING
+#include HEADER
+#endif
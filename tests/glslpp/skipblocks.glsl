@@ -0,0 +1,52 @@
+#version 450
+// Nothing in a skipped block is looked at but its conditional directives, which still nest.
+#if 0
+#error not reached
+#bogus directive
+#include <missing.h>
+#define SKIPPED 1
+int a = 1 +* ;
+'quotes" and other things that aren't GLSL @ $
+#if 1
+#else
+#endif
+  #  ifdef NESTED
+#elif 1 / 0
+#endif
+#ifndef NESTED
+#endif
+/*
+#endif
+*/
+// #endif
+x #endif
+#else
+int skippedElse;
+// A directive joined by line continuations is still one.
+#end\
+if
+#ifdef SKIPPED
+int skippedWasDefined;
+#endif
+// A taken branch's #elif isn't evaluated, nor are those after it.
+#if 1
+int firstBranch;
+#elif 1 / 0
+int secondBranch;
+#elif )
+#else
+int elseBranch;
+#endif
+#ifdef UNDEFINED
+#if 1
+int nestedInSkipped;
+#endif
+#elif 1
+int elifAfterSkipped;
+#endif
+	#	if 0
+int tabs;
+	#	else
+int tabsElse;
+	#	endif
+int line = __LINE__;
@@ -0,0 +1,5 @@
+#version 450
+#if 0
+#if 1
+#endif
+int unterminated;
@@ -0,0 +1,18 @@
+#version 450
+// Lines spliced by continuations keep the lines after them where they were, whether
+// the spliced line ends in a comment or not; __LINE__ counts source lines.
+int a;\
+int b;
+int c = __LINE__;
+float x/*\
+
+*/ = 1.0;
+int d = __LINE__;
+#define F(x) x + \
+    1 + \
+    2
+int e = F(__LINE__);
+vec2 v = vec2(1.0, \
+    2.0); // a comment\
+still a comment
+int f = __LINE__;
@@ -0,0 +1,14 @@
+#version 450
+// Variants that differ only in macros the source never looks at come out the same.
+#ifdef USE_FOG
+float fog = FOG_DENSITY;
+#endif
+#if QUALITY > 1
+#define SAMPLES (QUALITY * 4)
+#else
+#define SAMPLES 1
+#endif
+int samples = SAMPLES;
+#ifdef BROKEN
+#error BROKEN is set
+#endif